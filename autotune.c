@@ -0,0 +1,260 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+
+#include "soi.h"
+#include "isa.h"
+
+/*
+ * Plan-time autotuning of the filter stage convolution.
+ * The register blocking (theta and j unroll factors) is fixed at compile
+ * time, so each ISA has a handful of variants compiled in
+ * (conv_variants in parallel_filter_subsampling.cpp). The cache tiling
+ * (i_tile, j_block) is a runtime parameter. We first time all register
+ * blocking variants with the default tiling, then the tilings with the
+ * best variant, then software prefetching. The prefetch distance is the
+ * measured memory latency divided by the time spent per row of alpha_dt,
+ * and we also try half and twice that. Each rank times on its own, and the
+ * maximum over ranks decides so that all ranks end up with the same config.
+ *
+ * Results are appended to d->wisdom_file as lines of
+ *   conv <isa> <layout> n_mu=.. d_mu=.. B=.. S=.. P=.. threads=..[ tile_rows=..][ float][ compensated] : theta j i_tile j_block prefetch_rows prefetch_window
+ * and the last matching line is used next time instead of timing. Lines
+ * without the prefetch fields, from before they were tuned, are read with
+ * prefetching off.
+ */
+
+#define MAX_CONV_CONFIGS 32
+#define TUNE_REPS 3
+#define TUNE_MAX_ROWS 256 // block rows convolved per timing
+#define MAX_PREFETCH_ROWS 256
+
+static const int i_tiles[] = { 1, 2, 4 };
+static const int j_blocks[] = { 0, 16, 64 };
+
+static void conv_wisdom_key(soi_desc_t *d, char *key, size_t len)
+{
+  int n = snprintf(
+    key, len, "conv %s %s n_mu=%d d_mu=%d B=%ld S=%ld P=%d threads=%d",
+    soi_isa_name(d->isa),
+    SOI_WINDOW_OTF == d->window_mode ? "otf" :
+    d->use_split_complex ? "split" : "interleaved",
+    d->n_mu, d->d_mu, (long)d->B, (long)(d->k*d->P), d->P,
+    omp_get_max_threads());
+  if (SOI_INPUT_TILED == d->input_layout && n < len) {
+    n += snprintf(key + n, len - n, " tile_rows=%d", d->input_tile_rows);
+  }
+  if (SOI_WINDOW_PRECISION_FLOAT == d->window_precision && n < len) {
+    n += snprintf(key + n, len - n, " float");
+  }
+  if (d->use_compensated_sum && n < len) {
+    snprintf(key + n, len - n, " compensated");
+  }
+}
+
+/**
+ * @return 1 if wisdom_file has a config for d, 0 otherwise
+ */
+static int read_conv_wisdom(soi_desc_t *d, soi_conv_config_t *config)
+{
+  FILE *fp = fopen(d->wisdom_file, "r");
+  if (NULL == fp) return 0;
+
+  char key[256], line[512];
+  conv_wisdom_key(d, key, sizeof(key));
+  size_t key_len = strlen(key);
+
+  int found = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    if (strncmp(line, key, key_len)) continue;
+    // lines written before prefetching was tuned have 4 fields, and were
+    // tuned without it
+    soi_conv_config_t c;
+    c.prefetch_rows = c.prefetch_window = 0;
+    int n = sscanf(
+      line + key_len, " : %d %d %d %d %d %d",
+      &c.theta_unroll, &c.j_unroll, &c.i_tile, &c.j_block,
+      &c.prefetch_rows, &c.prefetch_window);
+    if (4 == n || 6 == n) {
+      *config = c;
+      found = 1;
+    }
+  }
+  fclose(fp);
+  return found;
+}
+
+static void write_conv_wisdom(soi_desc_t *d, const soi_conv_config_t *config)
+{
+  FILE *fp = fopen(d->wisdom_file, "a");
+  if (NULL == fp) {
+    fprintf(stderr, "Failed to open wisdom file %s\n", d->wisdom_file);
+    return;
+  }
+  char key[256];
+  conv_wisdom_key(d, key, sizeof(key));
+  fprintf(
+    fp, "%s : %d %d %d %d %d %d\n",
+    key, config->theta_unroll, config->j_unroll, config->i_tile, config->j_block,
+    config->prefetch_rows, config->prefetch_window);
+  fclose(fp);
+}
+
+/**
+ * Time each config and set times[i] to the maximum over ranks of the
+ * minimum over TUNE_REPS runs.
+ */
+static void time_conv_configs(
+  soi_desc_t *d, const cfft_complex_t *alpha, cfft_size_t K,
+  const soi_conv_config_t *configs, int n, double *times)
+{
+  const soi_kernels_t *kernels = soi_get_kernels(d->isa);
+  for (int i = 0; i < n; ++i) {
+    kernels->time_conv(d, alpha, K, configs + i); // warm up
+    times[i] = DBL_MAX;
+    for (int r = 0; r < TUNE_REPS; ++r) {
+      times[i] = MIN(times[i], kernels->time_conv(d, alpha, K, configs + i));
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, times, n, MPI_DOUBLE, MPI_MAX, d->comm);
+}
+
+/**
+ * @return rows of alpha_dt to prefetch ahead so that a prefetch issued now
+ *         completes when conv with config reaches the row
+ */
+static int model_prefetch_rows(
+  soi_desc_t *d, const cfft_complex_t *alpha, cfft_size_t K,
+  const soi_conv_config_t *config)
+{
+  double t;
+  time_conv_configs(d, alpha, K, config, 1, &t);
+  // each thread loads its share of K*d_mu rows times S/(CACHE_LINE_LEN/2) lines
+  cfft_size_t S = d->k*d->P;
+  double lines_per_thread = (double)K*d->d_mu*(S/(CACHE_LINE_LEN/2))/omp_get_max_threads();
+  double latency = get_memory_latency();
+  MPI_Allreduce(MPI_IN_PLACE, &latency, 1, MPI_DOUBLE, MPI_MAX, d->comm);
+  int rows = ceil(latency/(t/lines_per_thread));
+  return MIN(MAX(rows, 1), MAX_PREFETCH_ROWS);
+}
+
+/**
+ * Zero the input used for timing
+ * @return the number of block rows to time, 0 if the filter stage can't
+ *         run with d (it reports why)
+ */
+static cfft_size_t prepare_tuning(soi_desc_t *d)
+{
+  cfft_size_t S = d->k*d->P;
+  cfft_size_t M = d->N/S;
+  int nthreads = omp_get_max_threads();
+  int num_thread_groups = MIN(S/(CACHE_LINE_LEN/2), 8);
+  if (M/d->P < d->B || nthreads < num_thread_groups || nthreads%num_thread_groups) {
+    return 0;
+  }
+  cfft_size_t K = MIN((M/d->P - d->B)/d->d_mu, TUNE_MAX_ROWS);
+
+  // alpha_tilde is at least N/P long and not used until the filter stage.
+  // With SOI_INPUT_TILED, the rows are spread over whole tiles.
+  cfft_size_t R = SOI_INPUT_TILED == d->input_layout ? d->input_tile_rows : 1;
+  cfft_size_t rows = (K*d->d_mu + d->B + R - 1)/R*R;
+  memset(d->alpha_tilde, 0, sizeof(cfft_complex_t)*MIN(rows*S, d->N/d->P));
+  return K;
+}
+
+static int argmin(const double *times, int n)
+{
+  int best = 0;
+  for (int i = 1; i < n; ++i) {
+    if (times[i] < times[best]) best = i;
+  }
+  return best;
+}
+
+void soi_tune_conv(soi_desc_t *d)
+{
+  const soi_kernels_t *kernels = soi_get_kernels(d->isa);
+  soi_conv_config_t configs[MAX_CONV_CONFIGS];
+  int n = kernels->conv_variants(d, configs, MAX_CONV_CONFIGS);
+  if (0 == n) return; // unsupported n_mu and d_mu, reported by the filter stage
+
+  cfft_complex_t *alpha = d->alpha_tilde;
+
+  if (d->conv_config.theta_unroll > 0) {
+    for (int i = 0; i < n; ++i) {
+      if (configs[i].theta_unroll == d->conv_config.theta_unroll &&
+          configs[i].j_unroll == d->conv_config.j_unroll) {
+        if (d->conv_config.prefetch_rows < 0) {
+          cfft_size_t K = prepare_tuning(d);
+          d->conv_config.prefetch_rows =
+            K > 0 ? model_prefetch_rows(d, alpha, K, &d->conv_config) : 0;
+        }
+        return;
+      }
+    }
+    if (0 == d->rank) {
+      fprintf(
+        stderr, "theta_unroll=%d j_unroll=%d is not compiled in for n_mu=%d. Try",
+        d->conv_config.theta_unroll, d->conv_config.j_unroll, d->n_mu);
+      for (int i = 0; i < n; ++i) {
+        fprintf(stderr, " %d,%d", configs[i].theta_unroll, configs[i].j_unroll);
+      }
+      fprintf(stderr, "\n");
+    }
+    exit(-1);
+  }
+
+  if (d->wisdom_file) {
+    int found = 0;
+    if (0 == d->rank) found = read_conv_wisdom(d, &d->conv_config);
+    MPI_Bcast(&found, 1, MPI_INT, 0, d->comm);
+    if (found) {
+      MPI_Bcast(&d->conv_config, sizeof(d->conv_config), MPI_BYTE, 0, d->comm);
+      return;
+    }
+  }
+
+  d->conv_config = configs[0];
+  cfft_size_t K = prepare_tuning(d);
+  if (0 == K) return;
+
+  double times[MAX_CONV_CONFIGS];
+
+  // register blocking with the default tiling
+  time_conv_configs(d, alpha, K, configs, n, times);
+  soi_conv_config_t best = configs[argmin(times, n)];
+
+  // tiling with the best register blocking
+  n = 0;
+  for (int i = 0; i < sizeof(i_tiles)/sizeof(i_tiles[0]); ++i) {
+    for (int j = 0; j < sizeof(j_blocks)/sizeof(j_blocks[0]); ++j) {
+      configs[n] = best;
+      configs[n].i_tile = i_tiles[i];
+      configs[n].j_block = j_blocks[j];
+      ++n;
+    }
+  }
+  time_conv_configs(d, alpha, K, configs, n, times);
+  best = configs[argmin(times, n)];
+
+  // prefetching with the best blocking and tiling
+  int rows = model_prefetch_rows(d, alpha, K, &best);
+  int prefetch_rows[] = { 0, MAX(rows/2, 1), rows, MIN(2*rows, MAX_PREFETCH_ROWS) };
+  n = 0;
+  for (int i = 0; i < sizeof(prefetch_rows)/sizeof(prefetch_rows[0]); ++i) {
+    for (int w = 0; w < 2; ++w) {
+      configs[n] = best;
+      configs[n].prefetch_rows = prefetch_rows[i];
+      configs[n].prefetch_window = w;
+      ++n;
+    }
+  }
+  time_conv_configs(d, alpha, K, configs, n, times);
+  d->conv_config = configs[argmin(times, n)];
+
+  if (d->wisdom_file && 0 == d->rank) write_conv_wisdom(d, &d->conv_config);
+}
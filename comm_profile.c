@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "soi.h"
+
+/*
+ * Per message profile of the all-to-all of compute_soi.
+ *
+ * compute_soi reports each send and receive it posts with
+ * soi_comm_profile_post, by its slot in d->sendRequests or d->recvRequests
+ * (the receive from src of the ik-th segment is slot ik*P + src), and
+ * waits for them with soi_comm_waitall or soi_comm_wait_shared. With a
+ * profile, soi_comm_waitall completes the requests one at a time with
+ * MPI_Waitany so that each message gets its own completion time. With the
+ * MPI_Ialltoallv of SOI_USE_I_ALL_TO_ALL, all receives of a segment
+ * complete together.
+ *
+ * The receives are also accumulated across transforms per source rank, so
+ * that soi_comm_profile_write_matrix can show the P x P bytes, time from
+ * post to completion, and bandwidth of each link.
+ */
+
+#define SLOW_LINK_FACTOR 2 // slower than this times the median is reported
+
+typedef struct
+{
+  int peer, segment;
+  long bytes; // -1 if not posted
+  double post, complete, wait; // seconds since soi_comm_profile_begin
+} comm_record_t;
+
+typedef struct
+{
+  double bytes, time, messages;
+} link_stats_t;
+
+struct soi_comm_profile
+{
+  int P, rank;
+  double origin;
+  comm_record_t *records[2]; // [SOI_COMM_SEND], [SOI_COMM_RECV]
+  size_t num_slots[2];
+  link_stats_t *links; // receives from each source rank, across transforms
+  double wait_time; // seconds blocked in waits, across transforms
+};
+
+soi_comm_profile_t *soi_comm_profile_create(MPI_Comm comm)
+{
+  soi_comm_profile_t *p = (soi_comm_profile_t *)malloc(sizeof(soi_comm_profile_t));
+  if (NULL == p) {
+    fprintf(stderr, "Failed to allocate the communication profile\n");
+    exit(1);
+  }
+  memset(p, 0, sizeof(*p));
+  MPI_Comm_size(comm, &p->P);
+  MPI_Comm_rank(comm, &p->rank);
+  p->links = (link_stats_t *)calloc(p->P, sizeof(link_stats_t));
+  return p;
+}
+
+void soi_comm_profile_begin(soi_comm_profile_t *p, cfft_size_t k)
+{
+  if (NULL == p) return;
+  size_t S = k*p->P;
+  size_t num_slots[2] = { S, p->P*S }; // as d->sendRequests and d->recvRequests
+  for (int kind = 0; kind < 2; ++kind) {
+    if (p->num_slots[kind] != num_slots[kind]) {
+      free(p->records[kind]);
+      p->records[kind] = (comm_record_t *)malloc(sizeof(comm_record_t)*num_slots[kind]);
+      p->num_slots[kind] = num_slots[kind];
+    }
+    for (size_t i = 0; i < num_slots[kind]; ++i) p->records[kind][i].bytes = -1;
+  }
+  p->origin = MPI_Wtime();
+}
+
+void soi_comm_profile_record(
+  soi_comm_profile_t *p, soi_comm_kind_t kind, size_t slot, int peer, int segment, long bytes)
+{
+  comm_record_t *r = p->records[kind] + slot;
+  r->peer = peer;
+  r->segment = segment;
+  r->bytes = bytes;
+  r->post = MPI_Wtime() - p->origin;
+  r->complete = r->wait = 0;
+}
+
+static void complete(soi_comm_profile_t *p, soi_comm_kind_t kind, size_t slot, double wait_begin)
+{
+  comm_record_t *r = p->records[kind] + slot;
+  if (r->bytes < 0) return;
+  r->complete = MPI_Wtime() - p->origin;
+  r->wait = MAX(r->complete - wait_begin, 0);
+  if (SOI_COMM_RECV == kind) {
+    link_stats_t *link = p->links + r->peer;
+    link->bytes += r->bytes;
+    link->time += r->complete - r->post;
+    link->messages += 1;
+  }
+}
+
+int soi_comm_waitall(
+  soi_comm_profile_t *p, soi_comm_kind_t kind, size_t first_slot, int count,
+  MPI_Request *requests)
+{
+  if (NULL == p) return MPI_Waitall(count, requests, MPI_STATUSES_IGNORE);
+
+  double wait_begin = MPI_Wtime() - p->origin;
+  for (int i = 0; i < count; ++i) {
+    int index, ret = MPI_Waitany(count, requests, &index, MPI_STATUS_IGNORE);
+    if (MPI_SUCCESS != ret) return ret;
+    if (MPI_UNDEFINED == index) break; // the rest weren't posted
+    complete(p, kind, first_slot + index, wait_begin);
+  }
+  p->wait_time += MPI_Wtime() - p->origin - wait_begin;
+  return MPI_SUCCESS;
+}
+
+int soi_comm_wait_shared(
+  soi_comm_profile_t *p, soi_comm_kind_t kind, size_t first_slot, int count,
+  MPI_Request *request)
+{
+  if (NULL == p) return MPI_Wait(request, MPI_STATUS_IGNORE);
+
+  double wait_begin = MPI_Wtime() - p->origin;
+  int ret = MPI_Wait(request, MPI_STATUS_IGNORE);
+  for (int i = 0; i < count; ++i) complete(p, kind, first_slot + i, wait_begin);
+  p->wait_time += MPI_Wtime() - p->origin - wait_begin;
+  return ret;
+}
+
+void soi_comm_profile_write_records(soi_comm_profile_t *p, MPI_Comm comm, const char *file_name)
+{
+  // each rank in turn appends its records of the last transform
+  for (int r = 0; r < p->P; ++r) {
+    MPI_Barrier(comm);
+    if (r != p->rank) continue;
+    FILE *fp = fopen(file_name, 0 == r ? "w" : "a");
+    if (NULL == fp) {
+      fprintf(stderr, "Failed to open communication profile file %s\n", file_name);
+      continue;
+    }
+    if (0 == r) fprintf(fp, "rank,kind,peer,segment,bytes,post,complete,wait\n");
+    for (int kind = 0; kind < 2; ++kind) {
+      for (size_t i = 0; i < p->num_slots[kind]; ++i) {
+        const comm_record_t *rec = p->records[kind] + i;
+        if (rec->bytes < 0) continue;
+        fprintf(
+          fp, "%d,%s,%d,%d,%ld,%.9f,%.9f,%.9f\n",
+          r, SOI_COMM_SEND == kind ? "send" : "recv", rec->peer, rec->segment,
+          rec->bytes, rec->post, rec->complete, rec->wait);
+      }
+    }
+    fclose(fp);
+  }
+  MPI_Barrier(comm);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+void soi_comm_profile_write_matrix(soi_comm_profile_t *p, MPI_Comm comm, FILE *fp)
+{
+  int P = p->P;
+  // row dst: the links from each src to dst
+  link_stats_t *matrix = NULL;
+  double *wait_times = NULL;
+  if (0 == p->rank) {
+    matrix = (link_stats_t *)malloc(sizeof(link_stats_t)*P*P);
+    wait_times = (double *)malloc(sizeof(double)*P);
+  }
+  MPI_Gather(
+    p->links, 3*P, MPI_DOUBLE, matrix, 3*P, MPI_DOUBLE, 0, comm);
+  MPI_Gather(&p->wait_time, 1, MPI_DOUBLE, wait_times, 1, MPI_DOUBLE, 0, comm);
+  if (0 != p->rank) return;
+
+  const char *names[3] = { "comm_bytes", "comm_time", "comm_bandwidth" };
+  double *bandwidths = (double *)malloc(sizeof(double)*P*P);
+  int num_links = 0;
+  for (int m = 0; m < 3; ++m) {
+    // row src, column dst
+    fprintf(fp, "%s", names[m]);
+    for (int src = 0; src < P; ++src) {
+      fprintf(fp, "\t");
+      for (int dst = 0; dst < P; ++dst) {
+        const link_stats_t *link = matrix + dst*P + src;
+        double v =
+          0 == m ? link->bytes :
+          link->messages ? (1 == m ? link->time/link->messages : link->bytes/link->time) : 0;
+        fprintf(fp, "%s%g", dst ? "," : "", v);
+        if (2 == m && src != dst && link->messages) bandwidths[num_links++] = v;
+      }
+    }
+    fprintf(fp, "\n");
+  }
+
+  // links and ranks slower than SLOW_LINK_FACTOR times the median
+  if (num_links > 0) {
+    qsort(bandwidths, num_links, sizeof(double), compare_doubles);
+    double median = bandwidths[num_links/2];
+    for (int src = 0; src < P; ++src) {
+      for (int dst = 0; dst < P; ++dst) {
+        const link_stats_t *link = matrix + dst*P + src;
+        if (src == dst || !link->messages) continue;
+        double bw = link->bytes/link->time;
+        if (bw*SLOW_LINK_FACTOR < median) {
+          fprintf(fp, "comm_slow_link\t%d->%d,bandwidth=%g,median=%g\n", src, dst, bw, median);
+        }
+      }
+    }
+  }
+  double *sorted = (double *)malloc(sizeof(double)*P);
+  memcpy(sorted, wait_times, sizeof(double)*P);
+  qsort(sorted, P, sizeof(double), compare_doubles);
+  fprintf(fp, "comm_wait_time");
+  for (int r = 0; r < P; ++r) fprintf(fp, "%s%f", r ? "," : "\t", wait_times[r]);
+  fprintf(fp, "\n");
+  // a straggler's peers wait for it while it waits little itself
+  for (int r = 0; r < P; ++r) {
+    if (wait_times[r]*SLOW_LINK_FACTOR < sorted[P/2]) {
+      fprintf(fp, "comm_straggler\t%d,wait_time=%f,median=%f\n", r, wait_times[r], sorted[P/2]);
+    }
+  }
+  free(sorted);
+  free(bandwidths);
+  free(matrix);
+  free(wait_times);
+}
+
+void soi_comm_profile_free(soi_comm_profile_t *p)
+{
+  if (NULL == p) return;
+  free(p->records[0]);
+  free(p->records[1]);
+  free(p->links);
+  free(p);
+}
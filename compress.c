@@ -425,7 +425,9 @@ void extract8(
   }
 }
 
-void decompress(double *out, const int *in, int len, int e_max, int e_max_i, const double *refIn)
+void decompress(
+  double *out, const int *in, int len, int e_max, int e_max_i, const double *refIn,
+  int stream)
 {
   double e1 = pow(2, e_max - (NBITS - 31));
   double e2 = pow(2, e_max - NBITS);
@@ -482,10 +484,18 @@ void decompress(double *out, const int *in, int len, int e_max, int e_max_i, con
       d14, _mm256_set1_pd(e1),
       _mm256_mul_pd(d24, _mm256_set1_pd(e2)));
 
-    _mm256_stream_pd(out + i, x1);
-    _mm256_stream_pd(out + i + VLEN/4, x2);
-    _mm256_stream_pd(out + i + VLEN/4*2, x3);
-    _mm256_stream_pd(out + i + VLEN/4*3, x4);
+    if (stream) {
+      _mm256_stream_pd(out + i, x1);
+      _mm256_stream_pd(out + i + VLEN/4, x2);
+      _mm256_stream_pd(out + i + VLEN/4*2, x3);
+      _mm256_stream_pd(out + i + VLEN/4*3, x4);
+    }
+    else {
+      _mm256_store_pd(out + i, x1);
+      _mm256_store_pd(out + i + VLEN/4, x2);
+      _mm256_store_pd(out + i + VLEN/4*2, x3);
+      _mm256_store_pd(out + i + VLEN/4*3, x4);
+    }
   }
 
   if (curWordOccupancy < 32) {
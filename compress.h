@@ -7,4 +7,9 @@ int max_exponent(const double *x, int len);
  */
 int compress(int *out, const double *in, int len, int e_max, int e_max_i, int print);
 
-void decompress(double *out, const int *in, int len, int e_max, int e_max_i, const double *refIn);
+/**
+ * @param stream use non-temporal stores for out
+ */
+void decompress(
+  double *out, const int *in, int len, int e_max, int e_max_i, const double *refIn,
+  int stream);
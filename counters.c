@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <cpuid.h>
+
+#include <omp.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "soi.h"
+
+/*
+ * Hardware performance counters of the stages of compute_soi with Linux
+ * perf_event_open.
+ *
+ * Each OpenMP thread opens its own core counters, so a stage run inside a
+ * parallel region is counted by each thread around its own part, and a
+ * stage run by the master thread outside (the M_hat-point FFTs, whose
+ * backend runs its own threads) by reading the counters of all threads.
+ * Flops are FP_ARITH_INST_RETIRED of Intel cores weighted by the vector
+ * width (an FMA counts twice). Memory bytes are the CAS counts of the
+ * uncore memory controllers times 64. They are system wide and read with
+ * the counters of thread 0, so a parallel stage gets the traffic of the
+ * interval thread 0 runs it, which approximates the traffic of all its
+ * threads. Counters that can't be opened (no PMU, perf_event_paranoid, not
+ * Intel, or not Linux) are reported as unavailable, and multiplexed ones
+ * are scaled by their time enabled over running.
+ */
+
+#define MAX_FP_EVENTS 4
+#define MAX_IMC_UNITS 16
+#define IMC_EVENTS 2 // reads and writes
+
+typedef enum
+{
+  EVENT_CYCLES,
+  EVENT_INSTRUCTIONS,
+  EVENT_LLC_MISSES,
+  EVENT_DTLB_MISSES,
+  EVENT_FP, // MAX_FP_EVENTS of them
+  NUM_CORE_EVENTS = EVENT_FP + MAX_FP_EVENTS,
+} core_event_t;
+
+typedef struct
+{
+  int fds[NUM_CORE_EVENTS]; // -1 if not available
+  soi_counter_snapshot_t sums[SOI_NUM_COUNTED_STAGES];
+  char pad[64];
+} thread_counters_t;
+
+struct soi_counters
+{
+  int nthreads;
+  double fp_weights[MAX_FP_EVENTS];
+  int imc_fds[MAX_IMC_UNITS*IMC_EVENTS];
+  int num_imc_fds;
+  int available[SOI_NUM_COUNTERS];
+  thread_counters_t threads[MAX_THREADS];
+};
+
+static const char *counter_names[SOI_NUM_COUNTERS] = {
+  "cycles", "instructions", "llc_misses", "dtlb_misses", "flops", "mem_bytes",
+};
+
+static const char *stage_names[SOI_NUM_COUNTED_STAGES] = {
+  "conv", "fft_s", "transpose", "fft_m_hat", "demodulate",
+};
+
+#ifdef __linux__
+static int open_event(__u32 type, __u64 config, pid_t pid, int cpu)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  if (-1 != pid) {
+    // uncore PMUs reject the exclude bits
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+  }
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(__NR_perf_event_open, &attr, pid, cpu, -1, 0);
+}
+
+/**
+ * @return the value of fd scaled for multiplexing, 0 if fd is -1
+ */
+static double read_event(int fd)
+{
+  if (fd < 0) return 0;
+  unsigned long long v[3]; // value, time enabled, time running
+  if (sizeof(v) != read(fd, v, sizeof(v)) || 0 == v[2]) return 0;
+  return (double)v[0]*v[1]/v[2];
+}
+
+static int is_intel()
+{
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) return 0;
+  return 0x756e6547 == ebx && 0x49656e69 == edx && 0x6c65746e == ecx; // GenuineIntel
+}
+
+/**
+ * @return the perf type of PMU name, -1 if it doesn't exist
+ */
+static int pmu_type(const char *name)
+{
+  char path[256];
+  snprintf(path, sizeof(path), "/sys/bus/event_source/devices/%s/type", name);
+  FILE *fp = fopen(path, "r");
+  if (NULL == fp) return -1;
+  int type = -1;
+  if (1 != fscanf(fp, "%d", &type)) type = -1;
+  fclose(fp);
+  return type;
+}
+#else
+static double read_event(int fd)
+{
+  return 0;
+}
+#endif
+
+soi_counters_t *soi_counters_create()
+{
+  soi_counters_t *c = (soi_counters_t *)malloc(sizeof(soi_counters_t));
+  if (NULL == c) {
+    fprintf(stderr, "Failed to allocate the counters\n");
+    exit(1);
+  }
+  memset(c, 0, sizeof(*c));
+  c->nthreads = omp_get_max_threads();
+  for (int t = 0; t < MAX_THREADS; ++t) {
+    for (int e = 0; e < NUM_CORE_EVENTS; ++e) c->threads[t].fds[e] = -1;
+  }
+
+#ifdef __linux__
+  // FP_ARITH_INST_RETIRED: scalar, 128, 256, and 512 bit packed
+  __u64 fp_umasks[MAX_FP_EVENTS];
+  int intel = is_intel();
+  for (int i = 0; i < MAX_FP_EVENTS; ++i) {
+#if PRECISION == 2
+    fp_umasks[i] = 0x01 << 2*i;
+    c->fp_weights[i] = 1 << i;
+#else
+    fp_umasks[i] = 0x02 << 2*i;
+    c->fp_weights[i] = i ? 2 << i : 1;
+#endif
+  }
+
+  // each thread counts itself
+#pragma omp parallel
+  {
+    thread_counters_t *t = c->threads + omp_get_thread_num();
+    t->fds[EVENT_CYCLES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0, -1);
+    t->fds[EVENT_INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0, -1);
+    t->fds[EVENT_LLC_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 0, -1);
+    t->fds[EVENT_DTLB_MISSES] = open_event(
+      PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_DTLB |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      0, -1);
+    for (int i = 0; i < MAX_FP_EVENTS && intel; ++i) {
+      t->fds[EVENT_FP + i] = open_event(PERF_TYPE_RAW, 0xc7 | fp_umasks[i] << 8, 0, -1);
+    }
+  }
+
+  // CAS_COUNT.RD and CAS_COUNT.WR of each memory controller
+  for (int u = 0; u < MAX_IMC_UNITS; ++u) {
+    char name[64];
+    snprintf(name, sizeof(name), "uncore_imc_%d", u);
+    int type = pmu_type(name);
+    if (type < 0) break;
+    int rd = open_event(type, 0x04 | 0x03 << 8, -1, 0);
+    int wr = open_event(type, 0x04 | 0x0c << 8, -1, 0);
+    if (rd >= 0) c->imc_fds[c->num_imc_fds++] = rd;
+    if (wr >= 0) c->imc_fds[c->num_imc_fds++] = wr;
+  }
+#endif
+
+  // available if every thread could open it
+  for (int i = 0; i < SOI_NUM_COUNTERS; ++i) c->available[i] = 1;
+  for (int t = 0; t < c->nthreads; ++t) {
+    const int *fds = c->threads[t].fds;
+    if (fds[EVENT_CYCLES] < 0) c->available[SOI_COUNTER_CYCLES] = 0;
+    if (fds[EVENT_INSTRUCTIONS] < 0) c->available[SOI_COUNTER_INSTRUCTIONS] = 0;
+    if (fds[EVENT_LLC_MISSES] < 0) c->available[SOI_COUNTER_LLC_MISSES] = 0;
+    if (fds[EVENT_DTLB_MISSES] < 0) c->available[SOI_COUNTER_DTLB_MISSES] = 0;
+    for (int i = 0; i < MAX_FP_EVENTS; ++i) {
+      if (fds[EVENT_FP + i] < 0) c->available[SOI_COUNTER_FLOPS] = 0;
+    }
+  }
+  c->available[SOI_COUNTER_MEM_BYTES] = c->num_imc_fds > 0;
+  return c;
+}
+
+int soi_counters_available(const soi_counters_t *c, soi_counter_t counter)
+{
+  return c->available[counter];
+}
+
+static void add_thread(const soi_counters_t *c, int thread, soi_counter_snapshot_t *s)
+{
+  const int *fds = c->threads[thread].fds;
+  s->v[SOI_COUNTER_CYCLES] += read_event(fds[EVENT_CYCLES]);
+  s->v[SOI_COUNTER_INSTRUCTIONS] += read_event(fds[EVENT_INSTRUCTIONS]);
+  s->v[SOI_COUNTER_LLC_MISSES] += read_event(fds[EVENT_LLC_MISSES]);
+  s->v[SOI_COUNTER_DTLB_MISSES] += read_event(fds[EVENT_DTLB_MISSES]);
+  for (int i = 0; i < MAX_FP_EVENTS; ++i) {
+    s->v[SOI_COUNTER_FLOPS] += c->fp_weights[i]*read_event(fds[EVENT_FP + i]);
+  }
+}
+
+void soi_counters_read(soi_counters_t *c, soi_counter_snapshot_t *s)
+{
+  memset(s, 0, sizeof(*s));
+  s->time = MPI_Wtime();
+  if (omp_in_parallel()) {
+    add_thread(c, omp_get_thread_num(), s);
+  }
+  else {
+    for (int t = 0; t < c->nthreads; ++t) add_thread(c, t, s);
+  }
+  if (0 == omp_get_thread_num()) {
+    for (int i = 0; i < c->num_imc_fds; ++i) {
+      s->v[SOI_COUNTER_MEM_BYTES] += 64*read_event(c->imc_fds[i]);
+    }
+  }
+}
+
+void soi_counters_add(
+  soi_counters_t *c, soi_counted_stage_t stage, const soi_counter_snapshot_t *begin)
+{
+  soi_counter_snapshot_t end;
+  soi_counters_read(c, &end);
+  soi_counter_snapshot_t *sum = c->threads[omp_get_thread_num()].sums + stage;
+  for (int i = 0; i < SOI_NUM_COUNTERS; ++i) sum->v[i] += end.v[i] - begin->v[i];
+  sum->time += end.time - begin->time;
+}
+
+void soi_counters_reset(soi_counters_t *c)
+{
+  for (int t = 0; t < MAX_THREADS; ++t) {
+    memset(c->threads[t].sums, 0, sizeof(c->threads[t].sums));
+  }
+}
+
+void soi_write_counters(const soi_counters_t *c, MPI_Comm comm, FILE *fp)
+{
+  // counts summed over threads and ranks, time of the slowest thread and rank
+  double counts[SOI_NUM_COUNTED_STAGES][SOI_NUM_COUNTERS], times[SOI_NUM_COUNTED_STAGES];
+  int available[SOI_NUM_COUNTERS];
+  for (int s = 0; s < SOI_NUM_COUNTED_STAGES; ++s) {
+    times[s] = 0;
+    for (int i = 0; i < SOI_NUM_COUNTERS; ++i) counts[s][i] = 0;
+    for (int t = 0; t < MAX_THREADS; ++t) {
+      const soi_counter_snapshot_t *sum = c->threads[t].sums + s;
+      for (int i = 0; i < SOI_NUM_COUNTERS; ++i) counts[s][i] += sum->v[i];
+      times[s] = MAX(times[s], sum->time);
+    }
+  }
+  memcpy(available, c->available, sizeof(available));
+  MPI_Allreduce(MPI_IN_PLACE, counts, sizeof(counts)/sizeof(double), MPI_DOUBLE, MPI_SUM, comm);
+  MPI_Allreduce(MPI_IN_PLACE, times, SOI_NUM_COUNTED_STAGES, MPI_DOUBLE, MPI_MAX, comm);
+  MPI_Allreduce(MPI_IN_PLACE, available, SOI_NUM_COUNTERS, MPI_INT, MPI_LAND, comm);
+
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  if (0 != rank) return;
+
+  for (int s = 0; s < SOI_NUM_COUNTED_STAGES; ++s) {
+    fprintf(fp, "counters_%s\ttime=%f", stage_names[s], times[s]);
+    for (int i = 0; i < SOI_NUM_COUNTERS; ++i) {
+      if (available[i]) fprintf(fp, ",%s=%g", counter_names[i], counts[s][i]);
+      else fprintf(fp, ",%s=n/a", counter_names[i]);
+    }
+    // derived metrics
+    const double *n = counts[s];
+    if (available[SOI_COUNTER_CYCLES] && available[SOI_COUNTER_INSTRUCTIONS]) {
+      fprintf(fp, ",ipc=%f", n[SOI_COUNTER_INSTRUCTIONS]/n[SOI_COUNTER_CYCLES]);
+    }
+    if (available[SOI_COUNTER_FLOPS] && times[s] > 0) {
+      fprintf(fp, ",gflops=%f", n[SOI_COUNTER_FLOPS]/times[s]/1e9);
+    }
+    if (available[SOI_COUNTER_MEM_BYTES] && times[s] > 0) {
+      fprintf(fp, ",gbytes_per_s=%f", n[SOI_COUNTER_MEM_BYTES]/times[s]/1e9);
+    }
+    if (available[SOI_COUNTER_FLOPS] && available[SOI_COUNTER_MEM_BYTES]) {
+      fprintf(fp, ",bytes_per_flop=%f", n[SOI_COUNTER_MEM_BYTES]/n[SOI_COUNTER_FLOPS]);
+    }
+    fprintf(fp, "\n");
+  }
+}
+
+void soi_counters_free(soi_counters_t *c)
+{
+  if (NULL == c) return;
+  for (int t = 0; t < MAX_THREADS; ++t) {
+    for (int e = 0; e < NUM_CORE_EVENTS; ++e) {
+      if (c->threads[t].fds[e] >= 0) close(c->threads[t].fds[e]);
+    }
+  }
+  for (int i = 0; i < c->num_imc_fds; ++i) close(c->imc_fds[i]);
+  free(c);
+}
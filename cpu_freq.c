@@ -1,37 +1,242 @@
 #include <stdlib.h>
 #include <float.h>
+#include <stdio.h>
+#include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
+#include <cpuid.h>
+#include <omp.h>
 #include "soi.h"
 
 static const double DEFAULT_CPU_FREQ = 2.2e9;
+static const double DEFAULT_MEMORY_LATENCY = 100e-9;
+static const double DEFAULT_MEMORY_BANDWIDTH = 10e9;
+
+/*
+ * The TSC frequency, which converts the __rdtsc differences of the stage
+ * timers to seconds. In order of preference:
+ *   CPUID leaf 0x15: crystal clock times the TSC/crystal ratio (with leaf
+ *     0x16's base frequency when the crystal isn't enumerated)
+ *   the hypervisor's CPUID leaf 0x40000010 (TSC kHz), e.g. on KVM and VMware
+ *   /sys/devices/system/cpu/cpu0/tsc_freq_khz of kernels that export it
+ *   calibration against CLOCK_MONOTONIC_RAW, the median of
+ *     TSC_CALIBRATION_TRIALS windows of TSC_CALIBRATION_WINDOW seconds
+ */
+
+#define TSC_CALIBRATION_TRIALS 3
+#define TSC_CALIBRATION_WINDOW 0.02
+
+static double tsc_freq = 0;
+static tsc_freq_source_t tsc_source;
+
+static double tsc_freq_from_cpuid()
+{
+  unsigned eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0, NULL) < 0x15) return 0;
+  __cpuid_count(0x15, 0, eax, ebx, ecx, edx);
+  if (0 == eax || 0 == ebx) return 0;
+  if (ecx) return (double)ecx*ebx/eax;
+  // crystal not enumerated: the TSC runs at the base frequency
+  if (__get_cpuid_max(0, NULL) < 0x16) return 0;
+  __cpuid_count(0x16, 0, eax, ebx, ecx, edx);
+  return (eax & 0xffff)*1e6;
+}
+
+static double tsc_freq_from_hypervisor()
+{
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 31))) return 0;
+  __cpuid(0x40000000, eax, ebx, ecx, edx);
+  if (eax < 0x40000010) return 0;
+  __cpuid(0x40000010, eax, ebx, ecx, edx);
+  return eax*1e3;
+}
+
+static double tsc_freq_from_kernel()
+{
+  FILE *fp = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r");
+  if (NULL == fp) return 0;
+  double khz = 0;
+  if (1 != fscanf(fp, "%lf", &khz)) khz = 0;
+  fclose(fp);
+  return khz*1e3;
+}
+
+static double monotonic_raw()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double calibrate_tsc_freq()
+{
+  double freqs[TSC_CALIBRATION_TRIALS];
+  for (int i = 0; i < TSC_CALIBRATION_TRIALS; ++i) {
+    double t1 = monotonic_raw(), t2;
+    unsigned long long c1 = __rdtsc();
+    do {
+      t2 = monotonic_raw();
+    } while (t2 - t1 < TSC_CALIBRATION_WINDOW);
+    unsigned long long c2 = __rdtsc();
+    freqs[i] = (c2 - c1)/(t2 - t1);
+  }
+  // median
+  for (int i = 1; i < TSC_CALIBRATION_TRIALS; ++i) {
+    for (int j = i; j > 0 && freqs[j - 1] > freqs[j]; --j) {
+      double t = freqs[j]; freqs[j] = freqs[j - 1]; freqs[j - 1] = t;
+    }
+  }
+  return freqs[TSC_CALIBRATION_TRIALS/2];
+}
 
 double get_cpu_freq()
 {
-  static double freq = DBL_MAX;
-  if (DBL_MAX == freq) {
-    volatile double a = rand()%1024, b = rand()%1024;
+  if (0 == tsc_freq) {
+    double freq;
+    tsc_freq_source_t source;
+    if ((freq = tsc_freq_from_cpuid()) > 0) source = TSC_FREQ_CPUID;
+    else if ((freq = tsc_freq_from_hypervisor()) > 0) source = TSC_FREQ_HYPERVISOR;
+    else if ((freq = tsc_freq_from_kernel()) > 0) source = TSC_FREQ_KERNEL;
+    else {
+      freq = calibrate_tsc_freq();
+      source = TSC_FREQ_CALIBRATED;
+    }
+    if (!(freq > 0)) freq = DEFAULT_CPU_FREQ;
+    tsc_source = source;
+    tsc_freq = freq;
+  }
+
+  return tsc_freq;
+}
+
+tsc_freq_source_t get_tsc_freq_source()
+{
+  get_cpu_freq();
+  return tsc_source;
+}
+
+const char *tsc_freq_source_name(tsc_freq_source_t source)
+{
+  switch (source) {
+  case TSC_FREQ_CPUID: return "cpuid";
+  case TSC_FREQ_HYPERVISOR: return "hypervisor";
+  case TSC_FREQ_KERNEL: return "kernel";
+  default: return "calibrated";
+  }
+}
+
+int tsc_is_invariant()
+{
+  unsigned eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0x80000000, NULL) < 0x80000007) return 0;
+  __cpuid(0x80000007, eax, ebx, ecx, edx);
+  return (edx >> 8) & 1;
+}
+static const size_t DEFAULT_LLC_SIZE = 8*1024*1024;
+
+size_t get_llc_size()
+{
+  static size_t llc_size = 0;
+  if (0 == llc_size) {
+    for (int index = 0; ; ++index) {
+      char path[256], buf[64];
+      snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+      FILE *fp = fopen(path, "rt");
+      if (NULL == fp) break;
+      if (fgets(buf, sizeof(buf), fp)) {
+        char *unit;
+        size_t size = strtoul(buf, &unit, 10);
+        if ('K' == *unit) size *= 1024;
+        else if ('M' == *unit) size *= 1024*1024;
+        llc_size = MAX(llc_size, size);
+      }
+      fclose(fp);
+    }
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    if (0 == llc_size) {
+      long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+      if (size > 0) llc_size = size;
+    }
+#endif
+    if (0 == llc_size) llc_size = DEFAULT_LLC_SIZE;
+  }
+
+  return llc_size;
+}
+
+double get_memory_latency()
+{
+  static double latency = 0;
+  if (0 == latency) {
+    // chase pointers through a random cycle of cache lines of a buffer that
+    // doesn't fit in the cache (Sattolo's algorithm), so that neither
+    // hardware prefetchers nor out-of-order execution hide the latency
+    size_t bytes = MIN(4*get_llc_size(), (size_t)64*1024*1024);
+    size_t n = bytes/64;
+    size_t *next = (size_t *)malloc(n*64);
+    if (NULL == next) return DEFAULT_MEMORY_LATENCY;
+    size_t *perm = (size_t *)malloc(n*sizeof(size_t));
+    if (NULL == perm) {
+      free(next);
+      return DEFAULT_MEMORY_LATENCY;
+    }
+    for (size_t i = 0; i < n; ++i) perm[i] = i;
+    unsigned long long seed = 12345;
+    for (size_t i = n - 1; i > 0; --i) {
+      seed = seed*6364136223846793005ULL + 1442695040888963407ULL;
+      size_t j = (seed >> 33)%i;
+      size_t t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+    }
+    for (size_t i = 0; i < n; ++i) next[perm[i]*8] = perm[(i + 1)%n]*8;
+    free(perm);
+
+    const size_t STEPS = 1 << 20;
+    size_t p = 0;
+    for (size_t i = 0; i < STEPS/16; ++i) p = next[p]; // warm up TLB
     struct timeval tv1, tv2;
     gettimeofday(&tv1, NULL);
-    unsigned long long t1 = __rdtsc();
-    for (size_t i = 0; i < 1024L*1024; i++) {
-      a += a*b + b/a;
-    }
-    unsigned long long dt = __rdtsc() - t1;
+    for (size_t i = 0; i < STEPS; ++i) p = next[p];
     gettimeofday(&tv2, NULL);
-    freq = dt/((tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec)/1.e6);
+    latency = ((tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec)/1.e6)/STEPS;
+    volatile size_t sink = p; // keep the chase alive
+    (void)sink;
+    free(next);
   }
 
-  return freq;
+  return latency;
 }
-/*double get_cpu_freq()
+
+double get_memory_bandwidth()
 {
-  FILE *fp = fopen("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq", "rt");
-  if (fp == NULL) {
-    //printf("Can't open /sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq\n"); fflush(0);
-    return DEFAULT_CPU_FREQ;
+  static double bandwidth = 0;
+  if (0 == bandwidth) {
+    // copy between two buffers that don't fit in the cache with all threads
+    size_t bytes = MIN(4*get_llc_size(), (size_t)64*1024*1024);
+    size_t n = bytes/sizeof(double);
+    double *a = (double *)malloc(bytes), *b = (double *)malloc(bytes);
+    if (NULL == a || NULL == b) {
+      free(a);
+      free(b);
+      return DEFAULT_MEMORY_BANDWIDTH;
+    }
+#pragma omp parallel for
+    for (size_t i = 0; i < n; ++i) {
+      a[i] = i; b[i] = 0; // first touch by the threads that copy
+    }
+    double best = DBL_MAX;
+    for (int r = 0; r < 4; ++r) {
+      double t = omp_get_wtime();
+#pragma omp parallel for
+      for (size_t i = 0; i < n; ++i) b[i] = a[i];
+      best = MIN(best, omp_get_wtime() - t);
+    }
+    volatile double sink = b[n/2]; // keep the copies alive
+    (void)sink;
+    free(a);
+    free(b);
+    bandwidth = 2*bytes/best; // read and write
   }
-  char buf[1024];
-  fgets(buf, sizeof(buf), fp);
-  fclose(fp);
-  return atof(buf)*1000;
-}*/
+
+  return bandwidth;
+}
@@ -0,0 +1,385 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+
+#include "soi.h"
+
+/*
+ * A distributed FFT that picks SOI, the MKL cluster DFT, or FFTW-MPI per
+ * problem shape (see soi_dft_init).
+ *
+ * All methods take the input and give the output in order, N/P elements per
+ * rank, in place. The Cooley-Tukey libraries are only candidates when their
+ * local input and output have that layout. A method is accurate enough if
+ * its SNR reaches soi_required_snr of the SOI parameters: SOI's
+ * predicted_snr, or for the Cooley-Tukey FFTs the RMS rounding error of
+ * about VAL_EPSILON*sqrt(log2(N)). Of those, the one with the smallest
+ * time predicted by the performance model, or measured if measure is set,
+ * is chosen. If none is accurate enough, the most accurate one is.
+ *
+ * The choice is kept for the shape (N, P, threads, and required SNR) for
+ * the rest of the process, and appended to soi.wisdom_file as lines of
+ *   dft <isa> N=.. P=.. threads=.. snr=.. : <method>
+ * whose last match is used next time.
+ */
+
+#define MAX_CACHED_SHAPES 64
+#define MEASURE_REPS 2
+
+#if PRECISION == 1
+#define VAL_EPSILON FLT_EPSILON
+#else
+#define VAL_EPSILON DBL_EPSILON
+#endif
+
+static const char *method_names[SOI_DFT_NUM_METHODS] = {
+  "soi", "mkl", "fftw",
+};
+
+const char *soi_dft_method_name(soi_dft_method_t method)
+{
+  return method >= 0 && method < SOI_DFT_NUM_METHODS ? method_names[method] : "auto";
+}
+
+typedef struct
+{
+  cfft_size_t N;
+  int P, threads;
+  double snr;
+  soi_dft_method_t method;
+} cached_shape_t;
+
+static cached_shape_t cached_shapes[MAX_CACHED_SHAPES];
+static int num_cached_shapes = 0;
+
+static int same_shape(const cached_shape_t *c, const soi_dft_t *p)
+{
+  return
+    c->N == p->soi.N && c->P == p->soi.P && c->threads == omp_get_max_threads() &&
+    c->snr == soi_required_snr(&p->soi);
+}
+
+static void dft_wisdom_key(const soi_dft_t *p, char *key, size_t len)
+{
+  snprintf(
+    key, len, "dft %s N=%ld P=%d threads=%d snr=%g",
+    soi_isa_name(SOI_ISA_AUTO == p->soi.isa ? soi_detect_isa() : p->soi.isa),
+    (long)p->soi.N, p->soi.P, omp_get_max_threads(), soi_required_snr(&p->soi));
+}
+
+/**
+ * @return the method cached for p's shape, SOI_DFT_AUTO if none.
+ *         Collective over p->soi.comm.
+ */
+static soi_dft_method_t lookup_method(const soi_dft_t *p)
+{
+  int method = SOI_DFT_AUTO;
+  // the oldest shapes are overwritten once the cache is full
+  for (int i = 0; i < MIN(num_cached_shapes, MAX_CACHED_SHAPES); ++i) {
+    if (same_shape(cached_shapes + i, p)) method = cached_shapes[i].method;
+  }
+  if (SOI_DFT_AUTO != method || NULL == p->soi.wisdom_file) return method;
+
+  if (0 == p->soi.rank) {
+    FILE *fp = fopen(p->soi.wisdom_file, "r");
+    if (fp) {
+      char key[256], line[512], name[64];
+      dft_wisdom_key(p, key, sizeof(key));
+      size_t key_len = strlen(key);
+      while (fgets(line, sizeof(line), fp)) {
+        if (0 == strncmp(line, key, key_len) && 1 == sscanf(line + key_len, " : %63s", name)) {
+          for (int m = 0; m < SOI_DFT_NUM_METHODS; ++m) {
+            if (0 == strcmp(name, method_names[m])) method = m;
+          }
+        }
+      }
+      fclose(fp);
+    }
+  }
+  MPI_Bcast(&method, 1, MPI_INT, 0, p->soi.comm);
+  return method;
+}
+
+static void cache_method(const soi_dft_t *p)
+{
+  cached_shape_t *c = cached_shapes + num_cached_shapes%MAX_CACHED_SHAPES;
+  c->N = p->soi.N;
+  c->P = p->soi.P;
+  c->threads = omp_get_max_threads();
+  c->snr = soi_required_snr(&p->soi);
+  c->method = p->method;
+  ++num_cached_shapes;
+
+  if (p->soi.wisdom_file && 0 == p->soi.rank) {
+    FILE *fp = fopen(p->soi.wisdom_file, "a");
+    if (NULL == fp) {
+      fprintf(stderr, "Failed to open wisdom file %s\n", p->soi.wisdom_file);
+      return;
+    }
+    char key[256];
+    dft_wisdom_key(p, key, sizeof(key));
+    fprintf(fp, "%s : %s\n", key, method_names[p->method]);
+    fclose(fp);
+  }
+}
+
+/**
+ * Create the plan of method m
+ * @return 0 if m isn't compiled in or doesn't have the in-order layout
+ */
+static int init_method(soi_dft_t *p, soi_dft_method_t m, cfft_size_t k)
+{
+  cfft_size_t N = p->soi.N, L = N/p->soi.P;
+  MPI_Comm comm = p->soi.comm;
+  switch (m) {
+  case SOI_DFT_SOI:
+    if (p->has_soi) return 1;
+    // compute_soi in place with the input in order
+    p->soi.input_layout = SOI_INPUT_ROW_MAJOR;
+    p->soi.use_vlc = 0;
+    init_soi_descriptor(&p->soi, comm, k);
+    p->has_soi = 1;
+    p->local_len[m] = p->soi.n_mu*L/p->soi.d_mu;
+    return 1;
+
+#ifdef SOI_USE_MKL
+  case SOI_DFT_MKL: {
+    if (p->mkl || p->mkl_dm) return 1;
+    MKL_LONG size = L;
+    if (1 == p->soi.P) {
+      CHECK_DFTI( DftiCreateDescriptor(&p->mkl, DFTI_TYPE, DFTI_COMPLEX, 1, N) );
+      CHECK_DFTI( DftiCommitDescriptor(p->mkl) );
+    }
+    else {
+      MKL_LONG nx, x_start, out_nx, out_x_start;
+      CHECK_DFTI( DftiCreateDescriptorDM(comm, &p->mkl_dm, DFTI_TYPE, DFTI_COMPLEX, 1, N) );
+      CHECK_DFTI( DftiGetValueDM(p->mkl_dm, CDFT_LOCAL_SIZE, &size) );
+      CHECK_DFTI( DftiGetValueDM(p->mkl_dm, CDFT_LOCAL_NX, &nx) );
+      CHECK_DFTI( DftiGetValueDM(p->mkl_dm, CDFT_LOCAL_X_START, &x_start) );
+      CHECK_DFTI( DftiGetValueDM(p->mkl_dm, CDFT_LOCAL_OUT_NX, &out_nx) );
+      CHECK_DFTI( DftiGetValueDM(p->mkl_dm, CDFT_LOCAL_OUT_X_START, &out_x_start) );
+      int in_order =
+        nx == L && x_start == p->soi.rank*L && out_nx == L && out_x_start == p->soi.rank*L;
+      MPI_Allreduce(MPI_IN_PLACE, &in_order, 1, MPI_INT, MPI_LAND, comm);
+      if (!in_order) {
+        CHECK_DFTI( DftiFreeDescriptorDM(&p->mkl_dm) );
+        p->mkl_dm = NULL;
+        return 0;
+      }
+      CHECK_DFTI( DftiSetValueDM(p->mkl_dm, DFTI_PLACEMENT, DFTI_INPLACE) );
+      CHECK_DFTI( DftiCommitDescriptorDM(p->mkl_dm) );
+    }
+    p->local_len[m] = size;
+    return 1;
+  }
+#endif
+
+#ifdef SOI_USE_FFTW
+  case SOI_DFT_FFTW: {
+    if (p->has_fftw) return 1;
+    ptrdiff_t size = L;
+    cfft_complex_t *buf;
+    FFTW_PLAN_WITH_NTHREADS(omp_get_max_threads());
+    if (1 == p->soi.P) {
+      buf = (cfft_complex_t *)FFTW_MALLOC(sizeof(FFTW_COMPLEX)*N);
+      p->fftw = FFTW_PLAN_DFT_1D(
+        N, (FFTW_COMPLEX *)buf, (FFTW_COMPLEX *)buf, FFTW_FORWARD, p->soi.fftw_flags);
+    }
+    else {
+      ptrdiff_t ni, i_start, no, o_start;
+      FFTW_MPI_INIT();
+      size = FFTW_MPI_LOCAL_SIZE_1D(N, comm, FFTW_FORWARD, p->soi.fftw_flags, &ni, &i_start, &no, &o_start);
+      int in_order = ni == L && i_start == p->soi.rank*L && no == L && o_start == p->soi.rank*L;
+      MPI_Allreduce(MPI_IN_PLACE, &in_order, 1, MPI_INT, MPI_LAND, comm);
+      if (!in_order) return 0;
+      buf = (cfft_complex_t *)FFTW_MALLOC(sizeof(FFTW_COMPLEX)*size);
+      p->fftw = FFTW_MPI_PLAN_DFT_1D(
+        N, (FFTW_COMPLEX *)buf, (FFTW_COMPLEX *)buf, comm, FFTW_FORWARD, p->soi.fftw_flags);
+    }
+    FFTW_FREE(buf);
+    p->has_fftw = 1;
+    p->local_len[m] = size;
+    return 1;
+  }
+#endif
+
+  default:
+    return 0;
+  }
+}
+
+static void free_method(soi_dft_t *p, soi_dft_method_t m)
+{
+  switch (m) {
+  case SOI_DFT_SOI:
+    if (p->has_soi) free_soi_descriptor(&p->soi);
+    p->has_soi = 0;
+    break;
+#ifdef SOI_USE_MKL
+  case SOI_DFT_MKL:
+    if (p->mkl) {
+      CHECK_DFTI( DftiFreeDescriptor(&p->mkl) );
+    }
+    if (p->mkl_dm) {
+      CHECK_DFTI( DftiFreeDescriptorDM(&p->mkl_dm) );
+    }
+    p->mkl = NULL;
+    p->mkl_dm = NULL;
+    break;
+#endif
+#ifdef SOI_USE_FFTW
+  case SOI_DFT_FFTW:
+    if (p->has_fftw) FFTW_DESTROY_PLAN(p->fftw);
+    p->has_fftw = 0;
+    break;
+#endif
+  default:
+    break;
+  }
+}
+
+static void compute_method(soi_dft_t *p, soi_dft_method_t m, cfft_complex_t *inout)
+{
+  switch (m) {
+  case SOI_DFT_SOI:
+    compute_soi(&p->soi, inout);
+    break;
+#ifdef SOI_USE_MKL
+  case SOI_DFT_MKL:
+    if (p->mkl) {
+      CHECK_DFTI( DftiComputeForward(p->mkl, inout) );
+    }
+    else {
+      CHECK_DFTI( DftiComputeForwardDM(p->mkl_dm, inout) );
+    }
+    break;
+#endif
+#ifdef SOI_USE_FFTW
+  case SOI_DFT_FFTW:
+    if (1 == p->soi.P) FFTW_EXECUTE_DFT(p->fftw, (FFTW_COMPLEX *)inout, (FFTW_COMPLEX *)inout);
+    else FFTW_MPI_EXECUTE_DFT(p->fftw, (FFTW_COMPLEX *)inout, (FFTW_COMPLEX *)inout);
+    break;
+#endif
+  default:
+    break;
+  }
+}
+
+/**
+ * Set p->time[m] to the time of one transform of zeros with method m (the
+ * minimum over MEASURE_REPS runs of the maximum over ranks)
+ */
+static void measure_method(soi_dft_t *p, soi_dft_method_t m)
+{
+  cfft_complex_t *buf = NULL;
+  posix_memalign((void **)&buf, 4096, sizeof(cfft_complex_t)*p->local_len[m]);
+  if (NULL == buf) {
+    fprintf(stderr, "Failed to allocate the buffer to time %s\n", method_names[m]);
+    exit(1);
+  }
+  p->time[m] = DBL_MAX;
+  for (int r = 0; r < MEASURE_REPS; ++r) {
+    memset(buf, 0, sizeof(cfft_complex_t)*p->local_len[m]);
+    MPI_Barrier(p->soi.comm);
+    double t = MPI_Wtime();
+    compute_method(p, m, buf);
+    t = MPI_Wtime() - t;
+    MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, p->soi.comm);
+    p->time[m] = MIN(p->time[m], t);
+  }
+  free(buf);
+}
+
+void set_default_soi_dft(soi_dft_t *p)
+{
+  memset(p, 0, sizeof(*p));
+  set_default_soi_descriptor(&p->soi);
+  p->method = SOI_DFT_AUTO;
+  p->measure = 0;
+}
+
+void soi_dft_init(soi_dft_t *p, MPI_Comm comm, cfft_size_t k)
+{
+  p->soi.comm = comm;
+  MPI_Comm_size(comm, &p->soi.P);
+  MPI_Comm_rank(comm, &p->soi.rank);
+  for (int m = 0; m < SOI_DFT_NUM_METHODS; ++m) {
+    p->time[m] = INFINITY;
+    p->snr[m] = NAN;
+  }
+
+  if (SOI_DFT_AUTO == p->method) p->method = lookup_method(p);
+  if (SOI_DFT_AUTO != p->method) {
+    if (!init_method(p, p->method, k)) {
+      if (0 == p->soi.rank) {
+        fprintf(
+          stderr, "%s can't compute the FFT in order. Using soi\n",
+          method_names[p->method]);
+      }
+      p->method = SOI_DFT_SOI;
+      init_method(p, p->method, k);
+    }
+    return;
+  }
+
+  double required = soi_required_snr(&p->soi);
+  int available[SOI_DFT_NUM_METHODS];
+  for (int m = 0; m < SOI_DFT_NUM_METHODS; ++m) {
+    available[m] = init_method(p, m, k);
+    if (!available[m]) continue;
+    p->snr[m] = SOI_DFT_SOI == m ?
+      p->soi.predicted_snr :
+      -10*log10(VAL_EPSILON*VAL_EPSILON*log2((double)p->soi.N));
+  }
+
+  if (p->measure) {
+    for (int m = 0; m < SOI_DFT_NUM_METHODS; ++m) {
+      if (available[m]) measure_method(p, m);
+    }
+  }
+  else {
+    soi_machine_model_t machine;
+    soi_calibrate_machine_model(&machine, &p->soi);
+    p->time[SOI_DFT_SOI] = soi_predict_time(
+      &machine, p->soi.N, p->soi.P, p->soi.k, p->soi.n_mu, p->soi.d_mu, p->soi.B).total;
+    double cooley_tukey = soi_predict_cooley_tukey_time(&machine, p->soi.N, p->soi.P);
+    for (int m = 0; m < SOI_DFT_NUM_METHODS; ++m) {
+      if (available[m] && SOI_DFT_SOI != m) p->time[m] = cooley_tukey;
+    }
+  }
+
+  // the fastest accurate enough one, or the most accurate one
+  int best = SOI_DFT_SOI;
+  for (int m = 0; m < SOI_DFT_NUM_METHODS; ++m) {
+    if (!available[m]) continue;
+    int accurate = !(p->snr[m] < required), best_accurate = !(p->snr[best] < required);
+    if ((accurate && (!best_accurate || p->time[m] < p->time[best])) ||
+        (!accurate && !best_accurate && p->snr[m] > p->snr[best])) {
+      best = m;
+    }
+  }
+  p->method = best;
+  for (int m = 0; m < SOI_DFT_NUM_METHODS; ++m) {
+    if (m != best) free_method(p, m);
+  }
+  cache_method(p);
+}
+
+cfft_size_t soi_dft_local_len(const soi_dft_t *p)
+{
+  return p->local_len[p->method];
+}
+
+void distributed_fft(soi_dft_t *p, cfft_complex_t *inout)
+{
+  compute_method(p, p->method, inout);
+}
+
+void soi_dft_free(soi_dft_t *p)
+{
+  free_method(p, p->method);
+}
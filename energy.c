@@ -0,0 +1,219 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "soi.h"
+
+/*
+ * Energy of the stages of compute_soi from the RAPL counters of the Linux
+ * powercap interface.
+ *
+ * The package and DRAM domains (intel-rapl:<package> named package-<n>, and
+ * their subdomains named dram) count the whole node, so only the first rank
+ * of each node reads them. Their energy_uj files are kept open and read
+ * with pread at the stage boundaries, on the thread calling compute_soi
+ * outside parallel regions. Counters wrap around at max_energy_range_uj.
+ * Without readable domains, nothing is read and soi_write_energy prints
+ * nothing.
+ */
+
+#ifndef SOI_POWERCAP_ROOT
+#define SOI_POWERCAP_ROOT "/sys/class/powercap"
+#endif
+
+#define MAX_DOMAINS 16
+
+typedef struct
+{
+  int fd;
+  int dram; // 0: package
+  double max_range; // joules
+  double last; // joules
+} rapl_domain_t;
+
+struct soi_energy
+{
+  rapl_domain_t domains[MAX_DOMAINS];
+  int num_domains;
+  double joules[SOI_ENERGY_NUM_STAGES][2]; // [stage][package, dram]
+  double time[SOI_ENERGY_NUM_STAGES];
+  double last_time;
+  double transforms;
+};
+
+static const char *stage_names[SOI_ENERGY_NUM_STAGES] = {
+  "filter",
+  "all_to_all",
+  "fused",
+};
+
+static int read_file(const char *path, char *buf, size_t len)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  ssize_t n = read(fd, buf, len - 1);
+  close(fd);
+  if (n <= 0) return -1;
+  buf[n] = 0;
+  return 0;
+}
+
+static double read_joules(int fd)
+{
+  char buf[32];
+  ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (n <= 0) return 0;
+  buf[n] = 0;
+  return strtoull(buf, NULL, 10)*1e-6;
+}
+
+// the longest file name add_domain appends to the directory of a domain
+#define MAX_DOMAIN_FILE_LEN (sizeof("/max_energy_range_uj") - 1)
+
+static void add_domain(soi_energy_t *e, const char *dir)
+{
+  char path[PATH_MAX], buf[64];
+  snprintf(path, sizeof(path), "%s/name", dir);
+  if (read_file(path, buf, sizeof(buf))) return;
+  int dram = !strncmp(buf, "dram", 4);
+  if (!dram && strncmp(buf, "package", 7)) return; // core, uncore, psys
+
+  snprintf(path, sizeof(path), "%s/max_energy_range_uj", dir);
+  if (read_file(path, buf, sizeof(buf))) return;
+  double max_range = strtoull(buf, NULL, 10)*1e-6;
+
+  snprintf(path, sizeof(path), "%s/energy_uj", dir);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return; // usually readable only by root
+  if (MAX_DOMAINS == e->num_domains) {
+    close(fd);
+    return;
+  }
+  rapl_domain_t *domain = e->domains + e->num_domains++;
+  domain->fd = fd;
+  domain->dram = dram;
+  domain->max_range = max_range;
+  domain->last = read_joules(fd);
+}
+
+soi_energy_t *soi_energy_create(MPI_Comm comm)
+{
+  soi_energy_t *e = (soi_energy_t *)malloc(sizeof(soi_energy_t));
+  if (NULL == e) {
+    fprintf(stderr, "Failed to allocate the energy counters\n");
+    exit(1);
+  }
+  memset(e, 0, sizeof(*e));
+
+  MPI_Comm node_comm;
+  int node_rank;
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+  MPI_Comm_rank(node_comm, &node_rank);
+  MPI_Comm_free(&node_comm);
+  if (0 != node_rank) return e;
+
+  // packages are intel-rapl:<n>, their subdomains intel-rapl:<n>:<m>
+  DIR *dir = opendir(SOI_POWERCAP_ROOT);
+  if (NULL == dir) return e;
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (strncmp(entry->d_name, "intel-rapl:", 11)) continue;
+    char path[PATH_MAX - MAX_DOMAIN_FILE_LEN];
+    int len = snprintf(path, sizeof(path), "%s/%s", SOI_POWERCAP_ROOT, entry->d_name);
+    if (len < 0 || len >= (int)sizeof(path)) continue;
+    add_domain(e, path);
+  }
+  closedir(dir);
+  return e;
+}
+
+int soi_energy_available(const soi_energy_t *e, MPI_Comm comm)
+{
+  int available = e->num_domains > 0;
+  MPI_Allreduce(MPI_IN_PLACE, &available, 1, MPI_INT, MPI_MAX, comm);
+  return available;
+}
+
+void soi_energy_start(soi_energy_t *e)
+{
+  for (int i = 0; i < e->num_domains; ++i) {
+    e->domains[i].last = read_joules(e->domains[i].fd);
+  }
+  e->last_time = MPI_Wtime();
+}
+
+void soi_energy_mark(soi_energy_t *e, soi_energy_stage_t stage)
+{
+  for (int i = 0; i < e->num_domains; ++i) {
+    rapl_domain_t *domain = e->domains + i;
+    double joules = read_joules(domain->fd);
+    double delta = joules - domain->last;
+    if (delta < 0) delta += domain->max_range;
+    e->joules[stage][domain->dram] += delta;
+    domain->last = joules;
+  }
+  double t = MPI_Wtime();
+  e->time[stage] += t - e->last_time;
+  e->last_time = t;
+  if (SOI_ENERGY_NUM_STAGES - 1 == stage) e->transforms += 1;
+}
+
+void soi_energy_reset(soi_energy_t *e)
+{
+  memset(e->joules, 0, sizeof(e->joules));
+  memset(e->time, 0, sizeof(e->time));
+  e->transforms = 0;
+}
+
+void soi_write_energy(const soi_energy_t *e, const soi_desc_t *d, FILE *fp)
+{
+  if (!soi_energy_available(e, d->comm)) return;
+
+  // joules summed over nodes, seconds of the slowest rank
+  double joules[SOI_ENERGY_NUM_STAGES][2], time[SOI_ENERGY_NUM_STAGES];
+  MPI_Reduce(e->joules, joules, 2*SOI_ENERGY_NUM_STAGES, MPI_DOUBLE, MPI_SUM, 0, d->comm);
+  MPI_Reduce(e->time, time, SOI_ENERGY_NUM_STAGES, MPI_DOUBLE, MPI_MAX, 0, d->comm);
+  if (0 != d->rank || 0 == e->transforms) return;
+
+  // flops of one transform per stage, as in perf_model.c
+  double N = d->N, mu = (double)d->n_mu/d->d_mu;
+  cfft_size_t S = d->k*d->P;
+  double M_hat = mu*N/S;
+  double flops[SOI_ENERGY_NUM_STAGES] = {
+    8*mu*N*d->B + 5*mu*N*log2(S), // complex multiply-adds and S-point FFTs
+    0,
+    5*mu*N*log2(M_hat) + 6*N, // M_hat-point FFTs and demodulation
+  };
+
+  double total_joules = 0, total_time = 0;
+  for (int s = 0; s < SOI_ENERGY_NUM_STAGES; ++s) {
+    double j = (joules[s][0] + joules[s][1])/e->transforms;
+    double t = time[s]/e->transforms;
+    total_joules += j;
+    total_time += t;
+    fprintf(
+      fp, "energy_%s\tpackage_j=%f,dram_j=%f,joules=%f,watts=%f,gflop_per_j=",
+      stage_names[s], joules[s][0]/e->transforms, joules[s][1]/e->transforms, j,
+      t > 0 ? j/t : 0);
+    if (flops[s] > 0 && j > 0) fprintf(fp, "%f\n", flops[s]/j/1e9);
+    else fprintf(fp, "n/a\n");
+  }
+  // GFLOP/J of the nominal 5*N*log2(N) flops, comparable to other FFTs
+  fprintf(
+    fp, "energy_total\tjoules_per_transform=%f,watts=%f,gflop_per_j=%f\n",
+    total_joules, total_time > 0 ? total_joules/total_time : 0,
+    total_joules > 0 ? 5*N*log2(N)/total_joules/1e9 : 0);
+  fflush(fp);
+}
+
+void soi_energy_free(soi_energy_t *e)
+{
+  if (NULL == e) return;
+  for (int i = 0; i < e->num_domains; ++i) close(e->domains[i].fd);
+  free(e);
+}
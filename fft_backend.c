@@ -0,0 +1,219 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include <omp.h>
+
+#include "soi.h"
+#include "fft_builtin.h"
+
+/*
+ * Thin dispatch layer over the FFT libraries SOI can use for its S-point
+ * (filter stage, batched over n_mu rows) and M_hat-point (segment) FFTs.
+ * All transforms are forward and in-place, except soi_fft_compute_strided
+ * that writes its output with a stride.
+ */
+
+struct soi_fft_plan {
+  soi_fft_backend_t backend;
+  cfft_size_t n;
+  cfft_size_t howmany, dist; // batch used by soi_fft_compute_batch
+#ifdef SOI_USE_MKL
+  DFTI_DESCRIPTOR_HANDLE dfti_single, dfti_batch;
+#endif
+#ifdef SOI_USE_FFTW
+  FFTW_PLAN fftw_single, fftw_batch;
+#endif
+  soi_builtin_fft_t *builtin;
+};
+
+static const char *backend_names[SOI_FFT_NUM_BACKENDS] = {
+  "mkl", "fftw", "builtin",
+};
+
+const char *soi_fft_backend_name(soi_fft_backend_t backend)
+{
+  return backend < SOI_FFT_NUM_BACKENDS ? backend_names[backend] : "unknown";
+}
+
+int soi_fft_backend_from_name(const char *name)
+{
+  for (int b = 0; b < SOI_FFT_NUM_BACKENDS; ++b) {
+    if (0 == strcmp(name, backend_names[b])) return b;
+  }
+  return -1;
+}
+
+int soi_fft_backend_available(soi_fft_backend_t backend)
+{
+  switch (backend) {
+#ifdef SOI_USE_MKL
+  case SOI_FFT_MKL: return 1;
+#endif
+#ifdef SOI_USE_FFTW
+  case SOI_FFT_FFTW: return 1;
+#endif
+  case SOI_FFT_BUILTIN: return 1;
+  default: return 0;
+  }
+}
+
+soi_fft_plan_t *soi_fft_create_plan(
+  soi_fft_backend_t backend, soi_isa_t isa,
+  cfft_size_t n, cfft_size_t howmany, cfft_size_t dist,
+  int user_threads, unsigned flags, cfft_complex_t *buf)
+{
+  if (!soi_fft_backend_available(backend)) {
+    fprintf(
+      stderr, "FFT backend %s is not available in this build\n",
+      soi_fft_backend_name(backend));
+    exit(-1);
+  }
+
+  soi_fft_plan_t *p = (soi_fft_plan_t *)malloc(sizeof(soi_fft_plan_t));
+  if (NULL == p) {
+    fprintf(stderr, "Failed to allocate fft plan\n");
+    exit(1);
+  }
+  p->backend = backend;
+  p->n = n;
+  p->howmany = howmany;
+  p->dist = dist;
+  p->builtin = NULL;
+
+  switch (backend) {
+#ifdef SOI_USE_MKL
+  case SOI_FFT_MKL:
+    CHECK_DFTI( DftiCreateDescriptor(&p->dfti_single, DFTI_TYPE, DFTI_COMPLEX, 1, (long)n) );
+    if (user_threads > 1) {
+      CHECK_DFTI( DftiSetValue(p->dfti_single, DFTI_NUMBER_OF_USER_THREADS, user_threads) );
+    }
+    CHECK_DFTI( DftiCommitDescriptor(p->dfti_single) );
+
+    CHECK_DFTI( DftiCreateDescriptor(&p->dfti_batch, DFTI_TYPE, DFTI_COMPLEX, 1, (long)n) );
+    CHECK_DFTI( DftiSetValue(p->dfti_batch, DFTI_NUMBER_OF_TRANSFORMS, (long)howmany) );
+    CHECK_DFTI( DftiSetValue(p->dfti_batch, DFTI_INPUT_DISTANCE, (long)dist) );
+    CHECK_DFTI( DftiSetValue(p->dfti_batch, DFTI_OUTPUT_DISTANCE, (long)dist) );
+    if (user_threads > 1) {
+      CHECK_DFTI( DftiSetValue(p->dfti_batch, DFTI_NUMBER_OF_USER_THREADS, user_threads) );
+    }
+    CHECK_DFTI( DftiCommitDescriptor(p->dfti_batch) );
+    break;
+#endif
+#ifdef SOI_USE_FFTW
+  case SOI_FFT_FFTW:
+  {
+    // Plans called concurrently from the filter stage threads are
+    // single-threaded. Otherwise, let FFTW use all the threads.
+    FFTW_INIT_THREADS();
+    FFTW_PLAN_WITH_NTHREADS(user_threads > 1 ? 1 : omp_get_max_threads());
+    int len = n;
+    p->fftw_single = FFTW_PLAN_DFT_1D(
+      n, (FFTW_COMPLEX *)buf, (FFTW_COMPLEX *)buf, FFTW_FORWARD, flags);
+    p->fftw_batch = FFTW_PLAN_MANY_DFT(
+      1, &len, howmany,
+      (FFTW_COMPLEX *)buf, NULL, 1, dist,
+      (FFTW_COMPLEX *)buf, NULL, 1, dist,
+      FFTW_FORWARD, flags);
+    if (NULL == p->fftw_single || NULL == p->fftw_batch) {
+      fprintf(stderr, "Failed to create FFTW plan of length %ld\n", (long)n);
+      exit(-1);
+    }
+    break;
+  }
+#endif
+  case SOI_FFT_BUILTIN:
+    p->builtin = soi_builtin_fft_create(n, user_threads, isa);
+    break;
+  default:
+    assert(0);
+  }
+
+  return p;
+}
+
+void soi_fft_compute(soi_fft_plan_t *p, cfft_complex_t *inout)
+{
+  switch (p->backend) {
+#ifdef SOI_USE_MKL
+  case SOI_FFT_MKL:
+    DftiComputeForward(p->dfti_single, inout);
+    break;
+#endif
+#ifdef SOI_USE_FFTW
+  case SOI_FFT_FFTW:
+    FFTW_EXECUTE_DFT(
+      p->fftw_single, (FFTW_COMPLEX *)inout, (FFTW_COMPLEX *)inout);
+    break;
+#endif
+  case SOI_FFT_BUILTIN:
+    soi_builtin_fft_compute(p->builtin, inout);
+    break;
+  default:
+    assert(0);
+  }
+}
+
+void soi_fft_compute_batch(soi_fft_plan_t *p, cfft_complex_t *inout)
+{
+  switch (p->backend) {
+#ifdef SOI_USE_MKL
+  case SOI_FFT_MKL:
+    DftiComputeForward(p->dfti_batch, inout);
+    break;
+#endif
+#ifdef SOI_USE_FFTW
+  case SOI_FFT_FFTW:
+    FFTW_EXECUTE_DFT(
+      p->fftw_batch, (FFTW_COMPLEX *)inout, (FFTW_COMPLEX *)inout);
+    break;
+#endif
+  case SOI_FFT_BUILTIN:
+    for (cfft_size_t b = 0; b < p->howmany; ++b) {
+      soi_builtin_fft_compute(p->builtin, inout + b*p->dist);
+    }
+    break;
+  default:
+    assert(0);
+  }
+}
+
+void soi_fft_compute_strided(
+  soi_fft_plan_t *p, cfft_complex_t *inout,
+  cfft_complex_t *out, cfft_size_t ostride)
+{
+  if (SOI_FFT_BUILTIN == p->backend) {
+    soi_builtin_fft_compute_strided(p->builtin, inout, out, ostride);
+  }
+  else {
+    soi_fft_compute(p, inout);
+    for (cfft_size_t k = 0; k < p->n; ++k) {
+      out[k*ostride] = inout[k];
+    }
+  }
+}
+
+void soi_fft_destroy_plan(soi_fft_plan_t *p)
+{
+  if (NULL == p) return;
+
+  switch (p->backend) {
+#ifdef SOI_USE_MKL
+  case SOI_FFT_MKL:
+    CHECK_DFTI( DftiFreeDescriptor(&p->dfti_single) );
+    CHECK_DFTI( DftiFreeDescriptor(&p->dfti_batch) );
+    break;
+#endif
+#ifdef SOI_USE_FFTW
+  case SOI_FFT_FFTW:
+    FFTW_DESTROY_PLAN(p->fftw_single);
+    FFTW_DESTROY_PLAN(p->fftw_batch);
+    break;
+#endif
+  case SOI_FFT_BUILTIN:
+    soi_builtin_fft_destroy(p->builtin);
+    break;
+  default:
+    assert(0);
+  }
+  free(p);
+}
@@ -0,0 +1,269 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+
+#include "fft_builtin.h"
+
+/*
+ * Power-of-two lengths between 64 and 16384 use the fixed-size codelets in
+ * fft_codelet.cpp. Other lengths use a Stockham auto-sort FFT (decimation
+ * in frequency).
+ * A stage with radix p on a sub-problem of length n_cur = p*m and stride s
+ * computes
+ *   y[q + s*(p*j + t)] = w_{n_cur}^(j*t) * sum_r x[q + s*(j + r*m)]*w_p^(r*t)
+ * for 0 <= j < m, 0 <= q < s, 0 <= t < p, and the next stage continues with
+ * n_cur = m and s = s*p. The output ends up in natural order without a
+ * separate bit-reversal pass.
+ * Since w_{n_cur}^(j*t) = w_n^(j*t*s) and w_p^(r*t) = w_n^((r*t)%p*n/p), all
+ * twiddle factors come from one table of length n.
+ */
+
+#define BUILTIN_FFT_MAX_FACTORS 64
+#define BUILTIN_FFT_PARALLEL_THRESHOLD (1 << 15)
+
+struct soi_builtin_fft {
+  cfft_size_t n;
+  int nfactors;
+  int factors[BUILTIN_FFT_MAX_FACTORS];
+  int user_threads;
+  complex_struct_t *twiddles; // twiddles[k] = exp(-2*pi*i*k/n)
+  complex_struct_t *scratch; // n elements per user thread
+  soi_fft_codelet_t codelet; // non-NULL if there is a codelet for n
+};
+
+#define CMUL(r, a, b)                                   \
+do {                                                    \
+  VAL_TYPE __re = (a).re*(b).re - (a).im*(b).im;        \
+  VAL_TYPE __im = (a).re*(b).im + (a).im*(b).re;        \
+  (r).re = __re; (r).im = __im;                         \
+} while (0)
+
+static void stage(
+  int p, cfft_size_t n_cur, cfft_size_t s,
+  const complex_struct_t *x, complex_struct_t *y,
+  const soi_builtin_fft_t *plan,
+  cfft_size_t j_begin, cfft_size_t j_end,
+  cfft_size_t q_begin, cfft_size_t q_end)
+{
+  const complex_struct_t *tw = plan->twiddles;
+  cfft_size_t m = n_cur/p;
+
+  if (4 == p) {
+    for (cfft_size_t j = j_begin; j < j_end; ++j) {
+      complex_struct_t w1 = tw[j*s], w2 = tw[2*j*s], w3 = tw[3*j*s];
+      for (cfft_size_t q = q_begin; q < q_end; ++q) {
+        complex_struct_t a = x[q + s*j], b = x[q + s*(j + m)];
+        complex_struct_t c = x[q + s*(j + 2*m)], d = x[q + s*(j + 3*m)];
+
+        complex_struct_t apc = { a.re + c.re, a.im + c.im };
+        complex_struct_t amc = { a.re - c.re, a.im - c.im };
+        complex_struct_t bpd = { b.re + d.re, b.im + d.im };
+        complex_struct_t jbmd = { d.im - b.im, b.re - d.re }; // i*(b - d)
+
+        complex_struct_t y1 = { amc.re - jbmd.re, amc.im - jbmd.im };
+        complex_struct_t y2 = { apc.re - bpd.re, apc.im - bpd.im };
+        complex_struct_t y3 = { amc.re + jbmd.re, amc.im + jbmd.im };
+
+        y[q + s*4*j].re = apc.re + bpd.re;
+        y[q + s*4*j].im = apc.im + bpd.im;
+        CMUL(y[q + s*(4*j + 1)], y1, w1);
+        CMUL(y[q + s*(4*j + 2)], y2, w2);
+        CMUL(y[q + s*(4*j + 3)], y3, w3);
+      }
+    }
+  }
+  else if (2 == p) {
+    for (cfft_size_t j = j_begin; j < j_end; ++j) {
+      complex_struct_t w1 = tw[j*s];
+      for (cfft_size_t q = q_begin; q < q_end; ++q) {
+        complex_struct_t a = x[q + s*j], b = x[q + s*(j + m)];
+        complex_struct_t amb = { a.re - b.re, a.im - b.im };
+
+        y[q + s*2*j].re = a.re + b.re;
+        y[q + s*2*j].im = a.im + b.im;
+        CMUL(y[q + s*(2*j + 1)], amb, w1);
+      }
+    }
+  }
+  else if (3 == p) {
+    const VAL_TYPE s3 = 0.86602540378443864676372317075294; // sqrt(3)/2
+    for (cfft_size_t j = j_begin; j < j_end; ++j) {
+      complex_struct_t w1 = tw[j*s], w2 = tw[2*j*s];
+      for (cfft_size_t q = q_begin; q < q_end; ++q) {
+        complex_struct_t a = x[q + s*j], b = x[q + s*(j + m)];
+        complex_struct_t c = x[q + s*(j + 2*m)];
+
+        complex_struct_t t1 = { a.re - (b.re + c.re)/2, a.im - (b.im + c.im)/2 };
+        complex_struct_t u = { s3*(b.im - c.im), -s3*(b.re - c.re) }; // -i*sqrt(3)/2*(b - c)
+        complex_struct_t y1 = { t1.re + u.re, t1.im + u.im };
+        complex_struct_t y2 = { t1.re - u.re, t1.im - u.im };
+
+        y[q + s*3*j].re = a.re + b.re + c.re;
+        y[q + s*3*j].im = a.im + b.im + c.im;
+        CMUL(y[q + s*(3*j + 1)], y1, w1);
+        CMUL(y[q + s*(3*j + 2)], y2, w2);
+      }
+    }
+  }
+  else {
+    cfft_size_t n_over_p = plan->n/p;
+    for (cfft_size_t j = j_begin; j < j_end; ++j) {
+      for (cfft_size_t q = q_begin; q < q_end; ++q) {
+        for (int t = 0; t < p; ++t) {
+          complex_struct_t acc = { 0, 0 };
+          for (int r = 0; r < p; ++r) {
+            complex_struct_t temp;
+            CMUL(temp, x[q + s*(j + r*m)], tw[(r*t)%p*n_over_p]);
+            acc.re += temp.re;
+            acc.im += temp.im;
+          }
+          CMUL(y[q + s*(p*j + t)], acc, tw[j*t*s]);
+        }
+      }
+    }
+  }
+}
+
+soi_builtin_fft_t *soi_builtin_fft_create(cfft_size_t n, int user_threads, soi_isa_t isa)
+{
+  soi_builtin_fft_t *p = (soi_builtin_fft_t *)malloc(sizeof(soi_builtin_fft_t));
+  if (NULL == p) {
+    fprintf(stderr, "Failed to allocate builtin fft plan\n");
+    exit(1);
+  }
+  p->n = n;
+  p->user_threads = MAX(user_threads, 1);
+  p->codelet = soi_fft_get_codelet(isa, n);
+
+  // radix 4 first, then 2, 3, 5, and remaining primes
+  cfft_size_t remaining = n;
+  p->nfactors = 0;
+  while (remaining%4 == 0) {
+    p->factors[p->nfactors++] = 4;
+    remaining /= 4;
+  }
+  for (cfft_size_t f = 2; remaining > 1; ) {
+    if (remaining%f == 0) {
+      assert(p->nfactors < BUILTIN_FFT_MAX_FACTORS);
+      p->factors[p->nfactors++] = f;
+      remaining /= f;
+    }
+    else {
+      ++f;
+    }
+  }
+
+  posix_memalign((void **)&p->twiddles, 4096, sizeof(complex_struct_t)*n);
+  posix_memalign(
+    (void **)&p->scratch, 4096, sizeof(complex_struct_t)*n*p->user_threads);
+  if (NULL == p->twiddles || NULL == p->scratch) {
+    fprintf(stderr, "Failed to allocate builtin fft plan buffers\n");
+    exit(1);
+  }
+
+#pragma omp parallel for if (n >= BUILTIN_FFT_PARALLEL_THRESHOLD)
+  for (cfft_size_t k = 0; k < n; ++k) {
+    p->twiddles[k].re = cosl(2*VERIFY_PI*k/n);
+    p->twiddles[k].im = -sinl(2*VERIFY_PI*k/n);
+  }
+
+  return p;
+}
+
+void soi_builtin_fft_compute(soi_builtin_fft_t *p, cfft_complex_t *inout)
+{
+  int in_parallel = omp_in_parallel();
+  int tid = in_parallel ? omp_get_thread_num() : 0;
+  assert(tid < p->user_threads);
+
+  complex_struct_t *x = (complex_struct_t *)inout;
+  complex_struct_t *y = p->scratch + tid*p->n;
+
+  if (p->codelet) {
+    p->codelet(inout, 1, (cfft_complex_t *)y);
+    memcpy(inout, y, sizeof(complex_struct_t)*p->n);
+    return;
+  }
+
+  int parallel =
+    !in_parallel && p->n >= BUILTIN_FFT_PARALLEL_THRESHOLD &&
+    omp_get_max_threads() > 1;
+
+  cfft_size_t n_cur = p->n, s = 1;
+  for (int f = 0; f < p->nfactors; ++f) {
+    int r = p->factors[f];
+    cfft_size_t m = n_cur/r;
+
+    if (parallel) {
+#pragma omp parallel
+      {
+        int nthreads = omp_get_num_threads();
+        int t = omp_get_thread_num();
+
+        if (m >= nthreads) {
+          cfft_size_t j_per_thread = (m + nthreads - 1)/nthreads;
+          cfft_size_t j_begin = MIN(j_per_thread*t, m);
+          cfft_size_t j_end = MIN(j_begin + j_per_thread, m);
+          stage(r, n_cur, s, x, y, p, j_begin, j_end, 0, s);
+        }
+        else {
+          cfft_size_t q_per_thread = (s + nthreads - 1)/nthreads;
+          cfft_size_t q_begin = MIN(q_per_thread*t, s);
+          cfft_size_t q_end = MIN(q_begin + q_per_thread, s);
+          stage(r, n_cur, s, x, y, p, 0, m, q_begin, q_end);
+        }
+      }
+    }
+    else {
+      stage(r, n_cur, s, x, y, p, 0, m, 0, s);
+    }
+
+    complex_struct_t *temp = x; x = y; y = temp;
+    n_cur = m;
+    s *= r;
+  }
+
+  if (x != (complex_struct_t *)inout) {
+    if (parallel) {
+#pragma omp parallel for
+      for (cfft_size_t i = 0; i < p->n; ++i) {
+        ((complex_struct_t *)inout)[i] = x[i];
+      }
+    }
+    else {
+      memcpy(inout, x, sizeof(complex_struct_t)*p->n);
+    }
+  }
+}
+
+void soi_builtin_fft_compute_strided(
+  soi_builtin_fft_t *p, cfft_complex_t *inout,
+  cfft_complex_t *out, cfft_size_t ostride)
+{
+  complex_struct_t *x = (complex_struct_t *)inout;
+  if (p->codelet) {
+    int tid = omp_in_parallel() ? omp_get_thread_num() : 0;
+    assert(tid < p->user_threads);
+
+    x = p->scratch + tid*p->n;
+    p->codelet(inout, 1, (cfft_complex_t *)x);
+  }
+  else {
+    soi_builtin_fft_compute(p, inout);
+  }
+
+  complex_struct_t *y = (complex_struct_t *)out;
+  for (cfft_size_t k = 0; k < p->n; ++k) {
+    y[k*ostride] = x[k];
+  }
+}
+
+void soi_builtin_fft_destroy(soi_builtin_fft_t *p)
+{
+  if (NULL == p) return;
+  free(p->twiddles);
+  free(p->scratch);
+  free(p);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "soi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Self-contained mixed-radix (4, 2, 3, 5 and generic odd radices) Stockham
+ * FFT used by SOI_FFT_BUILTIN backend when neither MKL nor FFTW is available.
+ * Power-of-two lengths between 64 and 16384 use fixed-size codelets.
+ */
+typedef struct soi_builtin_fft soi_builtin_fft_t;
+
+/**
+ * @param user_threads the maximum number of threads that can call
+ *        soi_builtin_fft_compute concurrently with the same plan
+ * @param isa the instruction set of the codelet
+ */
+soi_builtin_fft_t *soi_builtin_fft_create(cfft_size_t n, int user_threads, soi_isa_t isa);
+
+/**
+ * In-place forward transform. When called outside of an OpenMP parallel
+ * region and n is big enough, each radix stage is parallelized.
+ */
+void soi_builtin_fft_compute(soi_builtin_fft_t *p, cfft_complex_t *inout);
+
+/**
+ * Forward transform of inout (whose contents are destroyed) written to
+ * out[k*ostride]. Uses a codelet when one exists for n.
+ */
+void soi_builtin_fft_compute_strided(
+  soi_builtin_fft_t *p, cfft_complex_t *inout,
+  cfft_complex_t *out, cfft_size_t ostride);
+
+void soi_builtin_fft_destroy(soi_builtin_fft_t *p);
+
+/**
+ * Out-of-place forward transform of in[k*is] with contiguous output.
+ * out must not overlap in.
+ */
+typedef void (*soi_fft_codelet_t)(
+  const cfft_complex_t *in, ptrdiff_t is, cfft_complex_t *out);
+
+/**
+ * @return codelet of length n, or NULL if there is none (n is not a power
+ *         of two between 64 and 16384), compiled for isa (soi_detect_isa()
+ *         if SOI_ISA_AUTO). Thread-safe.
+ */
+soi_fft_codelet_t soi_fft_get_codelet(soi_isa_t isa, cfft_size_t n);
+
+#ifdef __cplusplus
+}
+#endif
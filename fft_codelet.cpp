@@ -0,0 +1,209 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+
+#include "soi.h"
+#include "isa.h"
+
+/*
+ * Fixed-size power-of-two FFT codelets for the S-point FFTs of the filter
+ * stage. S = P*k is usually a power of two between 64 and 16384, and its
+ * FFT is called once per row, so the per-call overhead of a general library
+ * plan is not negligible.
+ *
+ * A codelet of size N is generated at compile time by recursive radix-4
+ * decimation in time: codelet<N> calls codelet<N/4> 4 times on the input
+ * decimated by 4 and combines the results with one radix-4 pass.
+ * The recursion bottoms out at straight-line radix-4 (N = 4^m) or radix-8
+ * (N = 2*4^m) kernels, so everything but the combine passes of the larger
+ * sizes is fully unrolled.
+ * Input can be strided (e.g. a column of a tile), output is contiguous;
+ * soi_builtin_fft_compute_strided scatters it with an arbitrary stride.
+ *
+ * Like parallel_filter_subsampling.cpp, this file is compiled once per
+ * instruction set (ISA_CXX_SRCS in Makefile), and soi_fft_get_codelet
+ * picks the variant of the given isa through soi_kernels_t. The templates are in an
+ * anonymous namespace so that the variants don't get merged by the linker.
+ */
+
+typedef complex_struct_t cs_t;
+
+static inline void butterfly4(cs_t &a, cs_t &b, cs_t &c, cs_t &d)
+{
+  cs_t apc = { a.re + c.re, a.im + c.im };
+  cs_t amc = { a.re - c.re, a.im - c.im };
+  cs_t bpd = { b.re + d.re, b.im + d.im };
+  cs_t jbmd = { d.im - b.im, b.re - d.re }; // i*(b - d)
+
+  a.re = apc.re + bpd.re; a.im = apc.im + bpd.im;
+  b.re = amc.re - jbmd.re; b.im = amc.im - jbmd.im;
+  c.re = apc.re - bpd.re; c.im = apc.im - bpd.im;
+  d.re = amc.re + jbmd.re; d.im = amc.im + jbmd.im;
+}
+
+static inline cs_t cmul(cs_t a, cs_t b)
+{
+  cs_t r = { a.re*b.re - a.im*b.im, a.re*b.im + a.im*b.re };
+  return r;
+}
+
+namespace {
+
+template<int N>
+struct codelet
+{
+  static const int Q = N/4;
+
+  // twiddles[r*Q + k] = w_N^((r + 1)*k)
+  static cs_t twiddles[3*Q];
+
+  static void init()
+  {
+    codelet<Q>::init();
+    for (int r = 0; r < 3; ++r) {
+      for (int k = 0; k < Q; ++k) {
+        twiddles[r*Q + k].re = cosl(2*VERIFY_PI*(r + 1)*k/N);
+        twiddles[r*Q + k].im = -sinl(2*VERIFY_PI*(r + 1)*k/N);
+      }
+    }
+  }
+
+  static void apply(const cs_t *in, ptrdiff_t is, cs_t *out)
+  {
+    codelet<Q>::apply(in, 4*is, out);
+    codelet<Q>::apply(in + is, 4*is, out + Q);
+    codelet<Q>::apply(in + 2*is, 4*is, out + 2*Q);
+    codelet<Q>::apply(in + 3*is, 4*is, out + 3*Q);
+
+#if PRECISION == 2
+    // Q >= 4 complex numbers, so this is a whole number of SIMD vectors
+    for (int k = 0; k < Q; k += SIMD_WIDTH/2) {
+      SIMDFPTYPE a = _MM_LOADU((VAL_TYPE *)(out + k));
+      SIMDFPTYPE b = _MM_LOADU((VAL_TYPE *)(out + Q + k));
+      SIMDFPTYPE c = _MM_LOADU((VAL_TYPE *)(out + 2*Q + k));
+      SIMDFPTYPE d = _MM_LOADU((VAL_TYPE *)(out + 3*Q + k));
+
+      SIMDFPTYPE w = _MM_LOADU((VAL_TYPE *)(twiddles + k));
+      b = _MM_FMADDSUB(_MM_MOVELDUP(w), b, _MM_SWAP_REAL_IMAG(_MM_MUL(_MM_MOVEHDUP(w), b)));
+      w = _MM_LOADU((VAL_TYPE *)(twiddles + Q + k));
+      c = _MM_FMADDSUB(_MM_MOVELDUP(w), c, _MM_SWAP_REAL_IMAG(_MM_MUL(_MM_MOVEHDUP(w), c)));
+      w = _MM_LOADU((VAL_TYPE *)(twiddles + 2*Q + k));
+      d = _MM_FMADDSUB(_MM_MOVELDUP(w), d, _MM_SWAP_REAL_IMAG(_MM_MUL(_MM_MOVEHDUP(w), d)));
+
+      SIMDFPTYPE apc = _MM_ADD(a, c);
+      SIMDFPTYPE amc = _MM_SUB(a, c);
+      SIMDFPTYPE bpd = _MM_ADD(b, d);
+      // i*(b - d) = (0 - im, 0 + re)
+      SIMDFPTYPE jbmd = _MM_ADDSUB(_MM_SETZERO(), _MM_SWAP_REAL_IMAG(_MM_SUB(b, d)));
+
+      _MM_STOREU((VAL_TYPE *)(out + k), _MM_ADD(apc, bpd));
+      _MM_STOREU((VAL_TYPE *)(out + Q + k), _MM_SUB(amc, jbmd));
+      _MM_STOREU((VAL_TYPE *)(out + 2*Q + k), _MM_SUB(apc, bpd));
+      _MM_STOREU((VAL_TYPE *)(out + 3*Q + k), _MM_ADD(amc, jbmd));
+    }
+#else
+    for (int k = 0; k < Q; ++k) {
+      cs_t a = out[k];
+      cs_t b = cmul(out[Q + k], twiddles[k]);
+      cs_t c = cmul(out[2*Q + k], twiddles[Q + k]);
+      cs_t d = cmul(out[3*Q + k], twiddles[2*Q + k]);
+      butterfly4(a, b, c, d);
+      out[k] = a; out[Q + k] = b; out[2*Q + k] = c; out[3*Q + k] = d;
+    }
+#endif
+  }
+};
+
+template<int N> cs_t codelet<N>::twiddles[3*codelet<N>::Q];
+
+template<>
+struct codelet<4>
+{
+  static void init() { }
+
+  static void apply(const cs_t *in, ptrdiff_t is, cs_t *out)
+  {
+    cs_t a = in[0], b = in[is], c = in[2*is], d = in[3*is];
+    butterfly4(a, b, c, d);
+    out[0] = a; out[1] = b; out[2] = c; out[3] = d;
+  }
+};
+
+template<>
+struct codelet<8>
+{
+  static void init() { }
+
+  // radix-2 decimation in time over two radix-4 butterflies
+  static void apply(const cs_t *in, ptrdiff_t is, cs_t *out)
+  {
+    const VAL_TYPE r2 = 0.70710678118654752440084436210484904; // sqrt(2)/2
+
+    cs_t e0 = in[0], e1 = in[2*is], e2 = in[4*is], e3 = in[6*is];
+    cs_t o0 = in[is], o1 = in[3*is], o2 = in[5*is], o3 = in[7*is];
+    butterfly4(e0, e1, e2, e3);
+    butterfly4(o0, o1, o2, o3);
+
+    // o_k *= w_8^k
+    cs_t t1 = { r2*(o1.re + o1.im), r2*(o1.im - o1.re) };
+    cs_t t2 = { o2.im, -o2.re };
+    cs_t t3 = { r2*(o3.im - o3.re), -r2*(o3.re + o3.im) };
+
+    out[0].re = e0.re + o0.re; out[0].im = e0.im + o0.im;
+    out[1].re = e1.re + t1.re; out[1].im = e1.im + t1.im;
+    out[2].re = e2.re + t2.re; out[2].im = e2.im + t2.im;
+    out[3].re = e3.re + t3.re; out[3].im = e3.im + t3.im;
+    out[4].re = e0.re - o0.re; out[4].im = e0.im - o0.im;
+    out[5].re = e1.re - t1.re; out[5].im = e1.im - t1.im;
+    out[6].re = e2.re - t2.re; out[6].im = e2.im - t2.im;
+    out[7].re = e3.re - t3.re; out[7].im = e3.im - t3.im;
+  }
+};
+
+} // namespace
+
+template<int N>
+static void apply_codelet(const cfft_complex_t *in, ptrdiff_t is, cfft_complex_t *out)
+{
+  codelet<N>::apply((const cs_t *)in, is, (cs_t *)out);
+}
+
+static const struct {
+  cfft_size_t n;
+  soi_fft_codelet_t apply;
+  void (*init)();
+} codelets[] = {
+  { 64, apply_codelet<64>, codelet<64>::init },
+  { 128, apply_codelet<128>, codelet<128>::init },
+  { 256, apply_codelet<256>, codelet<256>::init },
+  { 512, apply_codelet<512>, codelet<512>::init },
+  { 1024, apply_codelet<1024>, codelet<1024>::init },
+  { 2048, apply_codelet<2048>, codelet<2048>::init },
+  { 4096, apply_codelet<4096>, codelet<4096>::init },
+  { 8192, apply_codelet<8192>, codelet<8192>::init },
+  { 16384, apply_codelet<16384>, codelet<16384>::init },
+};
+
+static const size_t num_codelets = sizeof(codelets)/sizeof(codelets[0]);
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+// The twiddle tables are shared by all plans, and the init of a codelet
+// also initializes the smaller ones it calls, so all of them are computed
+// once up front rather than per size
+static void init_codelets()
+{
+  for (size_t i = 0; i < num_codelets; ++i) codelets[i].init();
+}
+
+extern "C"
+soi_fft_codelet_t SOI_ISA_FN(fft_get_codelet)(cfft_size_t n)
+{
+  for (size_t i = 0; i < num_codelets; ++i) {
+    if (codelets[i].n == n) {
+      pthread_once(&init_once, init_codelets);
+      return codelets[i].apply;
+    }
+  }
+  return NULL;
+}
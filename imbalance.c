@@ -0,0 +1,344 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+
+#include "soi.h"
+
+/*
+ * Load-imbalance analysis of the filter stage.
+ *
+ * parallel_filter_subsampling reports each piece of work a thread does as
+ * a (stage, i range, j range) with soi_imbalance_end, and the time each
+ * thread waits at the barriers after the convolution and the S-point FFTs.
+ * Each thread accumulates its time and work units ((j_end - j_begin)*
+ * (i_end - i_begin)) per stage, and keeps its slowest pieces, without
+ * synchronization. soi_imbalance_write gathers them to rank 0, which prints
+ * per stage a histogram of the time of all threads of all ranks, the
+ * slowest pieces, and the systematic skews it finds:
+ *
+ * - uneven_rows: threads of a rank get different amounts of work, such as
+ *   from rounding j_per_thread up to J_UNROLL_FACTOR
+ * - tail: the K_0%J_UNROLL_FACTOR remainder rows and the rows after the
+ *   ghost exchange take a large part of the time, or leave threads idle
+ * - slow_thread: a thread takes much longer per unit of work than the
+ *   median
+ * - slow_rank: a rank is busy for much longer than the median rank
+ *
+ * soi_imbalance_feedback turns the measured speed of each thread into the
+ * weights that the static partitions of the filter stage use.
+ */
+
+#define NUM_SLOWEST 4 // pieces kept per thread and stage
+#define NUM_BINS 8 // of the histograms
+#define SKEW_FACTOR 1.2 // slower than this times the median is reported
+#define TAIL_FRACTION 0.1 // larger share of the busy time of the tail is reported
+
+typedef struct
+{
+  int stage, rank, thread;
+  long i_begin, i_end, j_begin, j_end;
+  double time;
+} piece_t;
+
+typedef struct
+{
+  double time, units, count;
+} stage_sum_t;
+
+typedef struct
+{
+  stage_sum_t sums[SOI_IMBALANCE_NUM_STAGES];
+  piece_t slowest[SOI_IMBALANCE_NUM_STAGES][NUM_SLOWEST]; // descending time
+  char pad[64]; // keep threads in separate cache lines
+} thread_stats_t;
+
+struct soi_imbalance
+{
+  int rank, P, nthreads;
+  thread_stats_t *threads;
+  double weights[MAX_THREADS];
+};
+
+static const char *stage_names[SOI_IMBALANCE_NUM_STAGES] = {
+  "conv",
+  "conv_wait",
+  "fft_s",
+  "fft_s_wait",
+  "tail",
+  "last",
+};
+
+static int is_wait(int stage)
+{
+  return SOI_IMBALANCE_CONV_WAIT == stage || SOI_IMBALANCE_FFT_S_WAIT == stage;
+}
+
+soi_imbalance_t *soi_imbalance_create(MPI_Comm comm)
+{
+  soi_imbalance_t *a = (soi_imbalance_t *)malloc(sizeof(soi_imbalance_t));
+  if (NULL == a) {
+    fprintf(stderr, "Failed to allocate the load-imbalance analyzer\n");
+    exit(1);
+  }
+  MPI_Comm_rank(comm, &a->rank);
+  MPI_Comm_size(comm, &a->P);
+  a->nthreads = MIN(omp_get_max_threads(), MAX_THREADS);
+  a->threads = (thread_stats_t *)malloc(sizeof(thread_stats_t)*a->nthreads);
+  for (int t = 0; t < MAX_THREADS; ++t) a->weights[t] = 1;
+  soi_imbalance_reset(a);
+  return a;
+}
+
+void soi_imbalance_reset(soi_imbalance_t *a)
+{
+  memset(a->threads, 0, sizeof(thread_stats_t)*a->nthreads);
+}
+
+void soi_imbalance_record(
+  soi_imbalance_t *a, soi_imbalance_stage_t stage,
+  long i_begin, long i_end, long j_begin, long j_end, double begin)
+{
+  double time = MPI_Wtime() - begin;
+  int thread = omp_get_thread_num();
+  if (thread >= a->nthreads) return;
+  thread_stats_t *s = a->threads + thread;
+  s->sums[stage].time += time;
+  s->sums[stage].units += (double)(j_end - j_begin)*(i_end - i_begin);
+  s->sums[stage].count += 1;
+
+  piece_t *slowest = s->slowest[stage];
+  int n = NUM_SLOWEST - 1;
+  if (slowest[n].time >= time) return;
+  for ( ; n > 0 && slowest[n - 1].time < time; --n) slowest[n] = slowest[n - 1];
+  piece_t p = { stage, a->rank, thread, i_begin, i_end, j_begin, j_end, time };
+  slowest[n] = p;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static double median(double *v, int n)
+{
+  qsort(v, n, sizeof(double), compare_doubles);
+  return n ? v[n/2] : 0;
+}
+
+static int compare_pieces(const void *a, const void *b)
+{
+  double x = ((const piece_t *)a)->time, y = ((const piece_t *)b)->time;
+  return x > y ? -1 : x < y;
+}
+
+void soi_imbalance_write(soi_imbalance_t *a, MPI_Comm comm, FILE *fp)
+{
+  int P = a->P, nthreads = a->nthreads;
+  const int NS = SOI_IMBALANCE_NUM_STAGES;
+
+  // slowest pieces of this rank
+  piece_t slowest[SOI_IMBALANCE_NUM_STAGES][NUM_SLOWEST];
+  for (int s = 0; s < NS; ++s) {
+    piece_t *all = (piece_t *)malloc(sizeof(piece_t)*nthreads*NUM_SLOWEST);
+    for (int t = 0; t < nthreads; ++t) {
+      memcpy(all + t*NUM_SLOWEST, a->threads[t].slowest[s], sizeof(piece_t)*NUM_SLOWEST);
+    }
+    qsort(all, nthreads*NUM_SLOWEST, sizeof(piece_t), compare_pieces);
+    memcpy(slowest[s], all, sizeof(piece_t)*NUM_SLOWEST);
+    free(all);
+  }
+
+  double *sums = (double *)malloc(sizeof(stage_sum_t)*NS*nthreads);
+  for (int t = 0; t < nthreads; ++t) {
+    memcpy(sums + t*3*NS, a->threads[t].sums, sizeof(stage_sum_t)*NS);
+  }
+  double *all_sums = NULL;
+  piece_t *all_slowest = NULL;
+  if (0 == a->rank) {
+    all_sums = (double *)malloc(sizeof(stage_sum_t)*NS*nthreads*P);
+    all_slowest = (piece_t *)malloc(sizeof(slowest)*P);
+  }
+  MPI_Gather(sums, 3*NS*nthreads, MPI_DOUBLE, all_sums, 3*NS*nthreads, MPI_DOUBLE, 0, comm);
+  MPI_Gather(
+    slowest, sizeof(slowest), MPI_BYTE, all_slowest, sizeof(slowest), MPI_BYTE, 0, comm);
+  free(sums);
+  if (0 != a->rank) return;
+
+  // sum of stage s of thread t of rank r
+#define SUM(r, t, s) (((stage_sum_t *)all_sums)[((r)*nthreads + (t))*NS + (s)])
+
+  double *v = (double *)malloc(sizeof(double)*P*nthreads);
+  double busy_total = 0, tail_total = 0;
+  for (int s = 0; s < NS; ++s) {
+    int n = 0;
+    double min = 1e300, max = 0, avg = 0;
+    for (int r = 0; r < P; ++r) {
+      for (int t = 0; t < nthreads; ++t) {
+        double time = SUM(r, t, s).time;
+        min = MIN(min, time);
+        max = MAX(max, time);
+        avg += time;
+        v[n++] = time;
+      }
+    }
+    avg /= n;
+    if (!is_wait(s)) busy_total += avg;
+    if (SOI_IMBALANCE_TAIL == s || SOI_IMBALANCE_LAST == s) tail_total += avg;
+
+    int hist[NUM_BINS] = { 0 };
+    for (int i = 0; i < n; ++i) {
+      int b = max > min ? (int)((v[i] - min)/(max - min)*NUM_BINS) : 0;
+      ++hist[MIN(b, NUM_BINS - 1)];
+    }
+    fprintf(
+      fp, "imbalance_%s\tmin=%f,avg=%f,max=%f,max_over_avg=%f,hist=",
+      stage_names[s], min, avg, max, avg > 0 ? max/avg : 0);
+    for (int b = 0; b < NUM_BINS; ++b) fprintf(fp, "%s%d", b ? "|" : "", hist[b]);
+    fprintf(fp, "\n");
+
+    // slowest pieces of all ranks
+    piece_t *pieces = (piece_t *)malloc(sizeof(piece_t)*P*NUM_SLOWEST);
+    for (int r = 0; r < P; ++r) {
+      memcpy(
+        pieces + r*NUM_SLOWEST, all_slowest + (r*NS + s)*NUM_SLOWEST,
+        sizeof(piece_t)*NUM_SLOWEST);
+    }
+    qsort(pieces, P*NUM_SLOWEST, sizeof(piece_t), compare_pieces);
+    for (int i = 0; i < NUM_SLOWEST && !is_wait(s); ++i) {
+      const piece_t *p = pieces + i;
+      if (0 == p->time) break;
+      fprintf(
+        fp, "imbalance_slowest_%s\trank=%d,thread=%d,i=%ld-%ld,j=%ld-%ld,time=%f\n",
+        stage_names[s], p->rank, p->thread, p->i_begin, p->i_end, p->j_begin, p->j_end,
+        p->time);
+    }
+    free(pieces);
+  }
+
+  // uneven work among the threads of a rank
+  for (int s = 0; s < NS; ++s) {
+    if (is_wait(s) || SOI_IMBALANCE_LAST == s) continue;
+    double worst = 1, worst_min = 0, worst_max = 0;
+    int worst_rank = 0, idle = 0;
+    for (int r = 0; r < P; ++r) {
+      double min = 1e300, max = 0;
+      int rank_idle = 0;
+      for (int t = 0; t < nthreads; ++t) {
+        min = MIN(min, SUM(r, t, s).units);
+        max = MAX(max, SUM(r, t, s).units);
+        if (0 == SUM(r, t, s).units) ++rank_idle;
+      }
+      if (max > 0 && (0 == min || max/min > worst)) {
+        worst = 0 == min ? 1e300 : max/min;
+        worst_min = min;
+        worst_max = max;
+        worst_rank = r;
+      }
+      if (max > 0) idle = MAX(idle, rank_idle);
+    }
+    if (worst > 1.05) {
+      fprintf(
+        fp, "imbalance_skew\tuneven_rows,stage=%s,rank=%d,min_units=%g,max_units=%g,idle_threads=%d\n",
+        stage_names[s], worst_rank, worst_min, worst_max, idle);
+    }
+  }
+
+  if (tail_total > busy_total*TAIL_FRACTION) {
+    fprintf(fp, "imbalance_skew\ttail,fraction=%f\n", tail_total/busy_total);
+  }
+
+  // time per unit of work of each thread, relative to the median
+  for (int s = 0; s < NS; ++s) {
+    if (is_wait(s)) continue;
+    int n = 0;
+    for (int r = 0; r < P; ++r) {
+      for (int t = 0; t < nthreads; ++t) {
+        if (SUM(r, t, s).units > 0) v[n++] = SUM(r, t, s).time/SUM(r, t, s).units;
+      }
+    }
+    double m = median(v, n);
+    for (int r = 0; r < P; ++r) {
+      for (int t = 0; t < nthreads; ++t) {
+        if (0 == SUM(r, t, s).units) continue;
+        double per_unit = SUM(r, t, s).time/SUM(r, t, s).units;
+        if (per_unit > m*SKEW_FACTOR) {
+          fprintf(
+            fp, "imbalance_skew\tslow_thread,stage=%s,rank=%d,thread=%d,ns_per_unit=%f,median=%f\n",
+            stage_names[s], r, t, per_unit*1e9, m*1e9);
+        }
+      }
+    }
+  }
+
+  // busy time of each rank: of its slowest thread
+  double *rank_busy = (double *)malloc(sizeof(double)*P);
+  for (int r = 0; r < P; ++r) {
+    rank_busy[r] = 0;
+    for (int t = 0; t < nthreads; ++t) {
+      double busy = 0;
+      for (int s = 0; s < NS; ++s) {
+        if (!is_wait(s)) busy += SUM(r, t, s).time;
+      }
+      rank_busy[r] = MAX(rank_busy[r], busy);
+    }
+    v[r] = rank_busy[r];
+  }
+  double m = median(v, P);
+  for (int r = 0; r < P; ++r) {
+    if (rank_busy[r] > m*SKEW_FACTOR) {
+      fprintf(fp, "imbalance_skew\tslow_rank,rank=%d,busy=%f,median=%f\n", r, rank_busy[r], m);
+    }
+  }
+#undef SUM
+
+  fflush(fp);
+  free(rank_busy);
+  free(v);
+  free(all_sums);
+  free(all_slowest);
+}
+
+void soi_imbalance_feedback(soi_imbalance_t *a, soi_desc_t *d)
+{
+  // speed of each thread in the partitioned stages relative to the mean,
+  // averaged over the stages
+  const int stages[] = { SOI_IMBALANCE_CONV, SOI_IMBALANCE_FFT_S };
+  double speed[MAX_THREADS] = { 0 };
+  int num_stages[MAX_THREADS] = { 0 };
+  for (int i = 0; i < (int)(sizeof(stages)/sizeof(stages[0])); ++i) {
+    int s = stages[i], n = 0;
+    double mean = 0;
+    for (int t = 0; t < a->nthreads; ++t) {
+      const stage_sum_t *sum = a->threads[t].sums + s;
+      if (sum->units > 0 && sum->time > 0) {
+        mean += sum->units/sum->time;
+        ++n;
+      }
+    }
+    if (0 == n) continue;
+    mean /= n;
+    for (int t = 0; t < a->nthreads; ++t) {
+      const stage_sum_t *sum = a->threads[t].sums + s;
+      if (sum->units > 0 && sum->time > 0) {
+        speed[t] += sum->units/sum->time/mean;
+        ++num_stages[t];
+      }
+    }
+  }
+  // half way to the measured speeds, to damp noise
+  for (int t = 0; t < a->nthreads; ++t) {
+    if (num_stages[t]) a->weights[t] = (a->weights[t] + speed[t]/num_stages[t])/2;
+  }
+  d->thread_weights = a->weights;
+}
+
+void soi_imbalance_free(soi_imbalance_t *a)
+{
+  if (NULL == a) return;
+  free(a->threads);
+  free(a);
+}
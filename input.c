@@ -2,8 +2,10 @@
 #include <math.h>
 
 #include "soi.h"
+#ifdef SOI_USE_MKL
 #include <mkl.h>
 #include <mkl_cdft.h>
+#endif
 #include <omp.h>
 #include <fstream>
 
@@ -193,7 +195,13 @@ void populate_input(
           buf[idx2 - idx] = -r2/SIGMA;
           //input[idx2] += charge*exp(-r2/SIGMA);
         }
+#ifdef SOI_USE_MKL
         vmdExp(min(BUF_LEN, iEnd - idx), buf, buf2, VML_EP);
+#else
+        for (int idx2 = 0; idx2 < min(BUF_LEN, iEnd - idx); ++idx2) {
+          buf2[idx2] = exp(buf[idx2]);
+        }
+#endif
         for (int idx2 = idx; idx2 < min(idx + BUF_LEN, iEnd); ++idx2) {
           if (idx2 + offset < sampleLen) {
             input[idx2] += charge*buf2[idx2 - idx];
@@ -293,7 +301,21 @@ double compute_snr(
   cfft_complex_t *output, size_t localLen, size_t offset, size_t globalLen, int kind,
   soi_desc_t *d) {
   if ((2 == kind || 4 == kind || 5 == kind) && output2 == NULL) {
-    assert(d);
+    if (NULL == d) {
+      // the reference is partitioned like the output of d
+      int rank;
+      MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+      if (0 == rank) {
+        fprintf(stderr, "Reference output of input kind %d requires a SOI run first\n", kind);
+      }
+      return NAN;
+    }
+#ifndef SOI_USE_MKL
+    if (0 == d->rank) {
+      fprintf(stderr, "Reference output of input kind %d requires MKL\n", kind);
+    }
+    return NAN;
+#else
 
     DFTI_DESCRIPTOR_DM_HANDLE desc;
     CHECK_DFTI( DftiCreateDescriptorDM(MPI_COMM_WORLD, &desc, DFTI_TYPE, DFTI_COMPLEX, 1, globalLen) );
@@ -369,6 +391,7 @@ double compute_snr(
 
     DftiComputeForward(desc, output2);
     DftiFreeDescriptor(&desc);*/
+#endif // SOI_USE_MKL
   }
 
   double powerErr = 0, powerSig = 0;
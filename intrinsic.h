@@ -5,25 +5,92 @@
 #define PRECISION 2
 #endif
 
+/*
+ * _MM_* macros are mapped to the widest instruction set enabled by the
+ * compiler flags of the translation unit: AVX-512, AVX (with FMA for AVX2
+ * builds), or SSE4.2.
+ * Kernels written against these macros are compiled once per ISA (see
+ * ISA_CXX_SRCS in Makefile), and their entry points get the ISA name as a
+ * suffix through SOI_ISA_FN so that the variants can coexist in one binary.
+ * SOI_HAS_SPLIT_COMPLEX is defined when a cache line holds at least two
+ * vectors, which the split complex layout (soi_desc_t::use_split_complex)
+ * needs to keep real and imaginary parts in separate vectors.
+ */
+
+#if defined(__AVX512F__)
+#define SOI_ISA_SUFFIX avx512
+#elif defined(__AVX2__) && defined(__FMA__)
+#define SOI_ISA_SUFFIX avx2
+#elif defined(__AVX__)
+#define SOI_ISA_SUFFIX avx
+#else
+#define SOI_ISA_SUFFIX sse42
+#endif
+
+#define SOI_ISA_CAT_(a, b) a##_##b
+#define SOI_ISA_CAT(a, b) SOI_ISA_CAT_(a, b)
+#define SOI_ISA_FN(name) SOI_ISA_CAT(name, SOI_ISA_SUFFIX)
+
+#define _MM_PREFETCH1(a) _mm_prefetch((char *)(a), _MM_HINT_T0)
+#define _MM_PREFETCH2(a) _mm_prefetch((char *)(a), _MM_HINT_T1)
+
 #if PRECISION == 2
+
+#if defined(__AVX512F__)
+
+#define SIMD_WIDTH 8
+#define SIMDFPTYPE __m512d
+
+#define _MM_LOAD(a) _mm512_load_pd((VAL_TYPE *)(a))
+#define _MM_LOADU(a) _mm512_loadu_pd((VAL_TYPE *)(a))
+// load SIMD_WIDTH floats and widen
+#define _MM_LOAD_FLOAT(a) _mm512_cvtps_pd(_mm256_load_ps((float *)(a)))
+
+#define _MM_STORE(a, v) _mm512_store_pd((VAL_TYPE *)(a), v)
+#define _MM_STOREU(a, v) _mm512_storeu_pd((VAL_TYPE *)(a), v)
+#define _MM_STREAM(a, v) _mm512_stream_pd((VAL_TYPE *)(a), v)
+
+#define _MM_ADD _mm512_add_pd
+#define _MM_SUB _mm512_sub_pd
+#define _MM_MUL _mm512_mul_pd
+#define _MM_FMADD _mm512_fmadd_pd
+#define _MM_FNMADD _mm512_fnmadd_pd
+#define _MM_FMADDSUB _mm512_fmaddsub_pd
+#define _MM_ADDSUB(a, b) _mm512_fmaddsub_pd(a, _mm512_set1_pd(1), b)
+#define _MM_SETZERO _mm512_setzero_pd
+#define _MM_SET1 _mm512_set1_pd
+
+#define _MM_SWAP_REAL_IMAG(a) _mm512_permute_pd(a, 0x55)
+#define _MM_MOVELDUP _mm512_movedup_pd
+#define _MM_MOVEHDUP(a) _mm512_permute_pd(a, 0xff)
+
+#elif defined(__AVX__)
+
 #define SIMD_WIDTH 4
 #define SIMDFPTYPE __m256d
 
 #define _MM_LOAD(a) _mm256_load_pd((VAL_TYPE *)(a))
 #define _MM_LOADU _mm256_loadu_pd
+#define _MM_LOAD_FLOAT(a) _mm256_cvtps_pd(_mm_load_ps((float *)(a)))
 
 #define _MM_STORE(a, v) _mm256_store_pd((VAL_TYPE *)(a), v)
 #define _MM_STOREU(a, v) _mm256_storeu_pd((VAL_TYPE *)(a), v)
 #define _MM_MASKSTORE _mm256_maskstore_pd
 #define _MM_STREAM(a, v) _mm256_stream_pd((VAL_TYPE *)(a), v)
-#define _MM_PREFETCH1(a) _mm_prefetch((char *)(a), _MM_HINT_T0)
 
 #define _MM_ADD _mm256_add_pd
+#define _MM_SUB _mm256_sub_pd
 #define _MM_MUL _mm256_mul_pd
 #define _MM_ADDSUB _mm256_addsub_pd
-#ifdef __AVX2__
+#define _MM_SETZERO _mm256_setzero_pd
+#define _MM_SET1 _mm256_set1_pd
+#ifdef __FMA__
+#define _MM_FMADD _mm256_fmadd_pd
+#define _MM_FNMADD _mm256_fnmadd_pd
 #define _MM_FMADDSUB _mm256_fmaddsub_pd
 #else
+#define _MM_FMADD(a, b, c) _MM_ADD(_MM_MUL(a, b), c)
+#define _MM_FNMADD(a, b, c) _MM_SUB(c, _MM_MUL(a, b))
 #define _MM_FMADDSUB(a, b, c) _MM_ADDSUB(_MM_MUL(a, b), c)
 #endif
 
@@ -31,9 +98,77 @@
 #define _MM_MOVELDUP _mm256_movedup_pd
 #define _MM_MOVEHDUP(a) _mm256_permute_pd(a, 0xf)
 
+// (re0 re1 re2 re3), (im0 im1 im2 im3) -> (re0 im0 re1 im1) or (re2 im2 re3 im3)
+#define _MM_INTERLEAVE_LO(re, im) \
+  _mm256_permute2f128_pd(_mm256_unpacklo_pd(re, im), _mm256_unpackhi_pd(re, im), 0x20)
+#define _MM_INTERLEAVE_HI(re, im) \
+  _mm256_permute2f128_pd(_mm256_unpacklo_pd(re, im), _mm256_unpackhi_pd(re, im), 0x31)
+#define SOI_HAS_SPLIT_COMPLEX
+
+#else // SSE4.2
+
+#define SIMD_WIDTH 2
+#define SIMDFPTYPE __m128d
+
+#define _MM_LOAD(a) _mm_load_pd((VAL_TYPE *)(a))
+#define _MM_LOADU(a) _mm_loadu_pd((VAL_TYPE *)(a))
+#define _MM_LOAD_FLOAT(a) _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((__m128i *)(a))))
+
+#define _MM_STORE(a, v) _mm_store_pd((VAL_TYPE *)(a), v)
+#define _MM_STOREU(a, v) _mm_storeu_pd((VAL_TYPE *)(a), v)
+#define _MM_STREAM(a, v) _mm_stream_pd((VAL_TYPE *)(a), v)
+
+#define _MM_ADD _mm_add_pd
+#define _MM_SUB _mm_sub_pd
+#define _MM_MUL _mm_mul_pd
+#define _MM_ADDSUB _mm_addsub_pd
+#define _MM_SETZERO _mm_setzero_pd
+#define _MM_SET1 _mm_set1_pd
+#define _MM_FMADD(a, b, c) _MM_ADD(_MM_MUL(a, b), c)
+#define _MM_FNMADD(a, b, c) _MM_SUB(c, _MM_MUL(a, b))
+#define _MM_FMADDSUB(a, b, c) _MM_ADDSUB(_MM_MUL(a, b), c)
+
+#define _MM_SWAP_REAL_IMAG(a) _mm_shuffle_pd(a, a, 0x1)
+#define _MM_MOVELDUP _mm_movedup_pd
+#define _MM_MOVEHDUP(a) _mm_unpackhi_pd(a, a)
+
+#define _MM_INTERLEAVE_LO _mm_unpacklo_pd
+#define _MM_INTERLEAVE_HI _mm_unpackhi_pd
+#define SOI_HAS_SPLIT_COMPLEX
+
+#endif
+
 #else
 // PRECISION == 1
 
+#if defined(__AVX512F__)
+
+#define SIMD_WIDTH 16
+#define SIMDFPTYPE __m512
+
+#define _MM_LOAD _mm512_load_ps
+#define _MM_LOADU _mm512_loadu_ps
+
+#define _MM_STORE _mm512_store_ps
+#define _MM_STOREU _mm512_storeu_ps
+#define _MM_STREAM _mm512_stream_ps
+
+#define _MM_ADD _mm512_add_ps
+#define _MM_SUB _mm512_sub_ps
+#define _MM_MUL _mm512_mul_ps
+#define _MM_FMADD _mm512_fmadd_ps
+#define _MM_FNMADD _mm512_fnmadd_ps
+#define _MM_FMADDSUB _mm512_fmaddsub_ps
+#define _MM_ADDSUB(a, b) _mm512_fmaddsub_ps(a, _mm512_set1_ps(1), b)
+#define _MM_SETZERO _mm512_setzero_ps
+#define _MM_SET1 _mm512_set1_ps
+
+#define _MM_SWAP_REAL_IMAG(a) _mm512_permute_ps(a, 0xb1)
+#define _MM_MOVELDUP _mm512_moveldup_ps
+#define _MM_MOVEHDUP _mm512_movehdup_ps
+
+#elif defined(__AVX__)
+
 #define SIMD_WIDTH 8
 #define SIMDFPTYPE __m256
 
@@ -46,15 +181,72 @@
 #define _MM_STREAM _mm256_stream_ps
 
 #define _MM_ADD _mm256_add_ps
+#define _MM_SUB _mm256_sub_ps
 #define _MM_MUL _mm256_mul_ps
 #define _MM_ADDSUB _mm256_addsub_ps
+#define _MM_SETZERO _mm256_setzero_ps
+#define _MM_SET1 _mm256_set1_ps
+#ifdef __FMA__
+#define _MM_FMADD _mm256_fmadd_ps
+#define _MM_FNMADD _mm256_fnmadd_ps
+#define _MM_FMADDSUB _mm256_fmaddsub_ps
+#else
+#define _MM_FMADD(a, b, c) _MM_ADD(_MM_MUL(a, b), c)
+#define _MM_FNMADD(a, b, c) _MM_SUB(c, _MM_MUL(a, b))
+#define _MM_FMADDSUB(a, b, c) _MM_ADDSUB(_MM_MUL(a, b), c)
+#endif
 
 #define _MM_SWAP_REAL_IMAG(a) _mm256_permute_ps(a, 0xb1)
 #define _MM_MOVELDUP _mm256_moveldup_ps
 #define _MM_MOVEHDUP _mm256_movehdup_ps
 
+#define _MM_INTERLEAVE_LO(re, im) \
+  _mm256_permute2f128_ps(_mm256_unpacklo_ps(re, im), _mm256_unpackhi_ps(re, im), 0x20)
+#define _MM_INTERLEAVE_HI(re, im) \
+  _mm256_permute2f128_ps(_mm256_unpacklo_ps(re, im), _mm256_unpackhi_ps(re, im), 0x31)
+#define SOI_HAS_SPLIT_COMPLEX
+
+#else // SSE4.2
+
+#define SIMD_WIDTH 4
+#define SIMDFPTYPE __m128
+
+#define _MM_LOAD _mm_load_ps
+#define _MM_LOADU _mm_loadu_ps
+
+#define _MM_STORE _mm_store_ps
+#define _MM_STOREU _mm_storeu_ps
+#define _MM_STREAM _mm_stream_ps
+
+#define _MM_ADD _mm_add_ps
+#define _MM_SUB _mm_sub_ps
+#define _MM_MUL _mm_mul_ps
+#define _MM_ADDSUB _mm_addsub_ps
+#define _MM_SETZERO _mm_setzero_ps
+#define _MM_SET1 _mm_set1_ps
+#define _MM_FMADD(a, b, c) _MM_ADD(_MM_MUL(a, b), c)
+#define _MM_FNMADD(a, b, c) _MM_SUB(c, _MM_MUL(a, b))
+#define _MM_FMADDSUB(a, b, c) _MM_ADDSUB(_MM_MUL(a, b), c)
+
+#define _MM_SWAP_REAL_IMAG(a) _mm_shuffle_ps(a, a, 0xb1)
+#define _MM_MOVELDUP _mm_moveldup_ps
+#define _MM_MOVEHDUP _mm_movehdup_ps
+
+#define _MM_INTERLEAVE_LO _mm_unpacklo_ps
+#define _MM_INTERLEAVE_HI _mm_unpackhi_ps
+#define SOI_HAS_SPLIT_COMPLEX
+
+#endif
+
 #endif // PRECISION == 1
 
+// number of SIMD vectors per cache line
+#define VECS_PER_LINE (CACHE_LINE_LEN/SIMD_WIDTH)
+// w_dup has real and imaginary parts duplicated into separate vectors, so
+// each cache line of w becomes 2*VECS_PER_LINE vectors
+#define W_DUP_PER_LINE (2*VECS_PER_LINE)
+
+#ifdef __AVX__
 static void printv_pd(__m256d v, char *str)
 {
   int i;
@@ -76,5 +268,6 @@ static void printv_ps(__m256 v, char *str)
     printf("[%d]=%g ", i, tmp[i]);
   printf("\n");
 }
+#endif
 
 #endif // _SOI_FFT_INTRINSIC_H_
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+#include <cpuid.h>
+
+#include "soi.h"
+#include "isa.h"
+
+/*
+ * Runtime selection among the SIMD kernel variants compiled from
+ * parallel_filter_subsampling.cpp and fft_codelet.cpp
+ */
+
+static const char *isa_names[SOI_ISA_NUM] = {
+  "sse42", "avx2", "avx512",
+};
+
+static const soi_kernels_t kernels[SOI_ISA_NUM] = {
+#define SOI_KERNELS(isa, split_complex)                                   \
+  { parallel_filter_subsampling_##isa, init_w_dup_##isa, demodulate_##isa, \
+    split_complex, conv_variants_##isa, time_conv_##isa, fft_get_codelet_##isa }
+  SOI_KERNELS(sse42, 1),
+  SOI_KERNELS(avx2, 1),
+  SOI_KERNELS(avx512, 0), // a ZMM register holds a whole cache line
+#undef SOI_KERNELS
+};
+
+const char *soi_isa_name(soi_isa_t isa)
+{
+  return isa >= 0 && isa < SOI_ISA_NUM ? isa_names[isa] : "unknown";
+}
+
+int soi_isa_from_name(const char *name)
+{
+  for (int i = 0; i < SOI_ISA_NUM; ++i) {
+    if (0 == strcmp(name, isa_names[i])) return i;
+  }
+  return -1;
+}
+
+static unsigned long long xgetbv0()
+{
+  unsigned eax, edx;
+  __asm__ __volatile__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((unsigned long long)edx << 32) | eax;
+}
+
+int soi_isa_supported(soi_isa_t isa)
+{
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+
+  int sse42 = (ecx & bit_SSE4_2) != 0;
+  if (SOI_ISA_SSE42 == isa) return sse42;
+
+  // the OS must save the AVX (and AVX-512) register state
+  int osxsave = (ecx & bit_OSXSAVE) != 0;
+  int fma = (ecx & bit_FMA) != 0;
+  if (!osxsave) return 0;
+  unsigned long long xcr0 = xgetbv0();
+  if ((xcr0 & 0x6) != 0x6) return 0; // XMM and YMM state
+
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+  int avx2 = fma && (ebx & bit_AVX2) != 0;
+  if (SOI_ISA_AVX2 == isa) return avx2;
+
+  if (SOI_ISA_AVX512 == isa) {
+    // -xCORE-AVX512 lets the compiler use BW, DQ and VL besides F, which
+    // Xeon Phi doesn't have
+    const unsigned avx512 = bit_AVX512F | bit_AVX512BW | bit_AVX512DQ | bit_AVX512VL;
+    // opmask, upper halves of ZMM0-15, and ZMM16-31 state
+    return avx2 && (ebx & avx512) == avx512 && (xcr0 & 0xe0) == 0xe0;
+  }
+  return 0;
+}
+
+soi_isa_t soi_detect_isa()
+{
+  const char *env = getenv("SOI_ISA");
+  if (env) {
+    int isa = soi_isa_from_name(env);
+    if (isa >= 0 && soi_isa_supported(isa)) return isa;
+    fprintf(stderr, "SOI_ISA=%s is not supported on this machine. Ignored\n", env);
+  }
+
+  for (int isa = SOI_ISA_NUM - 1; isa >= 0; --isa) {
+    if (soi_isa_supported(isa)) return isa;
+  }
+  fprintf(stderr, "SOI requires at least SSE4.2\n");
+  exit(-1);
+}
+
+const soi_kernels_t *soi_get_kernels(soi_isa_t isa)
+{
+  return kernels + isa;
+}
+
+void parallel_filter_subsampling(soi_desc_t *d, cfft_complex_t *alpha_dt)
+{
+  kernels[d->isa].filter_subsampling(d, alpha_dt);
+}
+
+soi_fft_codelet_t soi_fft_get_codelet(soi_isa_t isa, cfft_size_t n)
+{
+  if (SOI_ISA_AUTO == isa) isa = soi_detect_isa();
+  return kernels[isa].fft_get_codelet(n);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "soi.h"
+#include "fft_builtin.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * SIMD kernels compiled once per instruction set from
+ * parallel_filter_subsampling.cpp and fft_codelet.cpp
+ */
+typedef struct
+{
+  void (*filter_subsampling)(soi_desc_t *d, cfft_complex_t *alpha_dt);
+  /**
+   * Fill d->w_dup from d->w
+   */
+  void (*init_w_dup)(soi_desc_t *d);
+  /**
+   * out[i] = W_inv[i]*in[i] for 0 <= i < M. With stream, out is written
+   * with non-temporal stores and should be cache line aligned.
+   */
+  void (*demodulate)(
+    cfft_complex_t *out, const cfft_complex_t *in,
+    const cfft_complex_t *W_inv, cfft_size_t M, int stream);
+  int split_complex; // supports soi_desc_t::use_split_complex
+  /**
+   * Write the register blocking variants compiled for d->n_mu and d->d_mu
+   * to configs, the default one first.
+   * @return the number of variants written (at most max)
+   */
+  int (*conv_variants)(soi_desc_t *d, soi_conv_config_t *configs, int max);
+  /**
+   * @return seconds taken by the filter stage convolution of the first K
+   *         block rows of alpha into d->gamma_tilde with config
+   */
+  double (*time_conv)(
+    soi_desc_t *d, const cfft_complex_t *alpha, cfft_size_t K,
+    const soi_conv_config_t *config);
+  /**
+   * @return the S-point FFT codelet of length n, or NULL (see
+   *         soi_fft_get_codelet)
+   */
+  soi_fft_codelet_t (*fft_get_codelet)(cfft_size_t n);
+} soi_kernels_t;
+
+#define SOI_DECLARE_KERNELS(isa)                                          \
+  void parallel_filter_subsampling_##isa(soi_desc_t *d, cfft_complex_t *alpha_dt); \
+  void init_w_dup_##isa(soi_desc_t *d);                                   \
+  void demodulate_##isa(                                                  \
+    cfft_complex_t *out, const cfft_complex_t *in,                        \
+    const cfft_complex_t *W_inv, cfft_size_t M, int stream);              \
+  int conv_variants_##isa(soi_desc_t *d, soi_conv_config_t *configs, int max); \
+  double time_conv_##isa(                                                 \
+    soi_desc_t *d, const cfft_complex_t *alpha, cfft_size_t K,            \
+    const soi_conv_config_t *config);                                     \
+  soi_fft_codelet_t fft_get_codelet_##isa(cfft_size_t n);
+
+SOI_DECLARE_KERNELS(sse42)
+SOI_DECLARE_KERNELS(avx2)
+SOI_DECLARE_KERNELS(avx512)
+
+const soi_kernels_t *soi_get_kernels(soi_isa_t isa);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,272 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+
+#include "soi.h"
+#include "isa.h"
+#include "fft_builtin.h"
+
+/*
+ * Plan-time choice of the segments per rank k (see soi_plan_k).
+ *
+ * k sets S = k*P, so it decides the size of the window table (B*S*n_mu)
+ * and the length of the S-point FFTs, the segment length M_hat and so the
+ * all-to-all message size l = M_hat/P, and how many segments the
+ * all-to-all and the M_hat-point FFTs are pipelined over. The flops of
+ * the filter stage don't depend on k, but whether the window table stays
+ * in cache does, and the FFTs trade log(S) against log(M_hat).
+ *
+ * For each valid k, each stage runs briefly on scratch buffers of the
+ * real sizes: the convolution of a few block rows with the default
+ * register blocking, a few block rows of S-point FFTs, one M_hat-point FFT
+ * and one demodulation, one all-to-all of a segment, and the ghost
+ * exchange. The measurements are scaled to the whole transform and
+ * combined with soi_pipelined_time. Each stage takes the maximum over
+ * ranks.
+ */
+
+#define MAX_PLANNED_K 256
+#define TRIAL_ROWS 64 // block rows convolved and S-point transformed per trial
+#define TRIAL_REPS 3
+
+/**
+ * @return the minimum time of n_mu S-point FFTs of each of rows block rows
+ *         of in written transposed into out, as done by the filter stage
+ */
+static double min_time_fft_s(
+  soi_fft_plan_t *p, cfft_complex_t *in, cfft_complex_t *out,
+  cfft_size_t S, int n_mu, cfft_size_t rows)
+{
+  double best = DBL_MAX;
+  for (int r = 0; r < TRIAL_REPS; ++r) {
+    double t = omp_get_wtime();
+#pragma omp parallel for
+    for (cfft_size_t j = 0; j < rows; ++j) {
+      for (int theta = 0; theta < n_mu; ++theta) {
+        soi_fft_compute_strided(p, in + (j*n_mu + theta)*S, out + j*n_mu + theta, rows*n_mu);
+      }
+    }
+    best = MIN(best, omp_get_wtime() - t);
+  }
+  return best;
+}
+
+/**
+ * @return 1 if the filter stage and the FFTs can run with k segments per
+ *         rank and d's window parameters
+ */
+static int valid_k(const soi_desc_t *d, cfft_size_t k)
+{
+  cfft_size_t S = k*d->P;
+  if (S%(CACHE_LINE_LEN/2) || d->N%S) return 0;
+  cfft_size_t M = d->N/S;
+  if (M%(d->d_mu*d->P) || M/d->P < d->B + d->d_mu) return 0;
+  int nthreads = omp_get_max_threads();
+  int num_thread_groups = MIN(S/(CACHE_LINE_LEN/2), 8);
+  return nthreads >= num_thread_groups && 0 == nthreads%num_thread_groups;
+}
+
+/**
+ * Time the stages of a transform with t->k segments per rank (the other
+ * fields of t are d's) on scratch buffers
+ */
+static soi_time_breakdown_t time_stages(soi_desc_t *t)
+{
+  soi_time_breakdown_t b = { 0 };
+  cfft_size_t k = t->k;
+  cfft_size_t S = k*t->P;
+  cfft_size_t M = t->N/S;
+  cfft_size_t M_hat = t->n_mu*M/t->d_mu;
+  cfft_size_t l = M_hat/t->P;
+  cfft_size_t rows = M/t->P/t->d_mu; // block rows of gamma_tilde per rank
+  cfft_size_t K = MIN((M/t->P - t->B)/t->d_mu, TRIAL_ROWS);
+  const soi_kernels_t *kernels = soi_get_kernels(t->isa);
+  unsigned fft_flags = 0;
+#ifdef SOI_USE_FFTW
+  fft_flags = t->fftw_flags;
+#endif
+
+  // the filter stage input and output, and the window table in the layout
+  // conv reads (its values don't matter for timing). gamma also holds W_inv
+  // after a segment, and alpha the S-point FFT outputs.
+  cfft_size_t alpha_len = MAX(M_hat*k, MAX(K*t->d_mu + t->B, K*t->n_mu)*S);
+  cfft_size_t gamma_len = MAX(2*M_hat*k, K*t->n_mu*S);
+  cfft_complex_t *alpha = NULL, *gamma = NULL;
+  posix_memalign((void **)&alpha, 4096, sizeof(cfft_complex_t)*alpha_len);
+  posix_memalign((void **)&gamma, 4096, sizeof(cfft_complex_t)*gamma_len);
+  if (NULL == alpha || NULL == gamma) {
+    fprintf(stderr, "Failed to allocate the buffers to plan k\n");
+    exit(1);
+  }
+  memset(alpha, 0, sizeof(cfft_complex_t)*alpha_len);
+  memset(gamma, 0, sizeof(cfft_complex_t)*gamma_len);
+  t->alpha_tilde = alpha;
+  t->gamma_tilde = gamma;
+  size_t w_bytes = (t->use_split_complex ? 1 : 2)*sizeof(cfft_complex_t)*t->B*S*t->n_mu;
+  VAL_TYPE *w = NULL;
+  posix_memalign((void **)&w, 4096, w_bytes);
+  if (NULL == w) {
+    fprintf(stderr, "Failed to allocate the window table to plan k\n");
+    exit(1);
+  }
+  memset(w, 0, w_bytes);
+  if (t->use_split_complex) t->w_split = w;
+  else t->w_dup = w;
+
+  soi_conv_config_t config;
+  kernels->conv_variants(t, &config, 1);
+  kernels->time_conv(t, alpha, K, &config); // warm up
+  b.conv = DBL_MAX;
+  for (int r = 0; r < TRIAL_REPS; ++r) {
+    b.conv = MIN(b.conv, kernels->time_conv(t, alpha, K, &config));
+  }
+  b.conv *= (double)rows/K;
+  free(w);
+  t->w_dup = NULL;
+  t->w_split = NULL;
+
+  // S-point FFTs of K block rows, with the codelets if they're faster as
+  // in init_soi_descriptor
+  soi_fft_plan_t *p = soi_fft_create_plan(
+    t->fft_backend, t->isa, S, t->n_mu, S, omp_get_max_threads(), fft_flags, gamma);
+  b.fft_s = min_time_fft_s(p, gamma, alpha, S, t->n_mu, K);
+  soi_fft_destroy_plan(p);
+  if (SOI_FFT_BUILTIN != t->fft_backend && t->use_fft_codelet && soi_fft_get_codelet(t->isa, S)) {
+    p = soi_fft_create_plan(SOI_FFT_BUILTIN, t->isa, S, t->n_mu, S, omp_get_max_threads(), fft_flags, gamma);
+    b.fft_s = MIN(b.fft_s, min_time_fft_s(p, gamma, alpha, S, t->n_mu, K));
+    soi_fft_destroy_plan(p);
+  }
+  b.fft_s *= (double)rows/K;
+
+  // one segment of the fused loop
+  p = soi_fft_create_plan(t->fft_backend, t->isa, M_hat, 1, M_hat, 1, fft_flags, gamma);
+  soi_fft_compute(p, gamma); // warm up
+  b.fft_m_hat = DBL_MAX;
+  b.demodulate = DBL_MAX;
+  for (int r = 0; r < TRIAL_REPS; ++r) {
+    memset(gamma, 0, sizeof(cfft_complex_t)*M_hat);
+    double t0 = omp_get_wtime();
+    soi_fft_compute(p, gamma);
+    double t1 = omp_get_wtime();
+#pragma omp parallel
+    {
+      int nthreads = omp_get_num_threads();
+      cfft_size_t i_per_thread = (M + nthreads - 1)/nthreads;
+      i_per_thread = (i_per_thread + CACHE_LINE_LEN/2 - 1)/(CACHE_LINE_LEN/2)*(CACHE_LINE_LEN/2);
+      cfft_size_t i_begin = MIN(i_per_thread*omp_get_thread_num(), M);
+      cfft_size_t i_end = MIN(i_begin + i_per_thread, M);
+      kernels->demodulate(
+        alpha + i_begin, gamma + i_begin, gamma + M_hat + i_begin, i_end - i_begin,
+        SOI_STORE_STREAM == t->store_policy.demodulate);
+    }
+    double t2 = omp_get_wtime();
+    b.fft_m_hat = MIN(b.fft_m_hat, t1 - t0);
+    b.demodulate = MIN(b.demodulate, t2 - t1);
+  }
+  b.fft_m_hat *= k;
+  b.demodulate *= k;
+  soi_fft_destroy_plan(p);
+
+  // the ghost rows from the right neighbor and one segment of the all-to-all
+  int left = (t->rank + t->P - 1)%t->P, right = (t->rank + 1)%t->P;
+  cfft_size_t n_ghost = (t->B - t->d_mu)*S;
+  b.ghost = DBL_MAX;
+  b.all_to_all = DBL_MAX;
+  for (int r = 0; r < TRIAL_REPS; ++r) {
+    MPI_Barrier(t->comm);
+    double t0 = MPI_Wtime();
+    MPI_Sendrecv(
+      alpha, n_ghost*2, MPI_TYPE, left, 0,
+      gamma, n_ghost*2, MPI_TYPE, right, 0, t->comm, MPI_STATUS_IGNORE);
+    double t1 = MPI_Wtime();
+    MPI_Barrier(t->comm);
+    double t2 = MPI_Wtime();
+    MPI_Alltoall(alpha, l*2, MPI_TYPE, gamma, l*2, MPI_TYPE, t->comm);
+    double t3 = MPI_Wtime();
+    b.ghost = MIN(b.ghost, t1 - t0);
+    b.all_to_all = MIN(b.all_to_all, t3 - t2);
+  }
+  b.all_to_all *= k;
+
+  free(alpha);
+  free(gamma);
+  t->alpha_tilde = NULL;
+  t->gamma_tilde = NULL;
+
+  MPI_Allreduce(MPI_IN_PLACE, &b, sizeof(b)/sizeof(double), MPI_DOUBLE, MPI_MAX, t->comm);
+  b.total = soi_pipelined_time(&b, k);
+  return b;
+}
+
+/**
+ * Set t to d with what the trials use resolved
+ * @return 0 if the filter stage has no kernels for d's n_mu and d_mu
+ */
+static int prepare_trials(const soi_desc_t *d, soi_desc_t *t)
+{
+  *t = *d;
+  if (SOI_ISA_AUTO == t->isa) t->isa = soi_detect_isa();
+  if (t->use_split_complex && !soi_get_kernels(t->isa)->split_complex) {
+    t->use_split_complex = 0;
+  }
+  // window tables in row major input layout
+  t->window_mode = SOI_WINDOW_TABLE;
+  t->window_precision = SOI_WINDOW_PRECISION_FULL;
+  t->input_layout = SOI_INPUT_ROW_MAJOR;
+  t->input_tile_rows = 1;
+  // as resolve_store_policy in pfft.c. Neither gamma_tilde, M_hat*k, nor
+  // the output, M*k, depends on k
+  size_t output_bytes = sizeof(cfft_complex_t)*(t->N/t->P);
+  if (SOI_STORE_AUTO == t->store_policy.conv) {
+    t->store_policy.conv =
+      output_bytes*t->n_mu/t->d_mu > get_llc_size()/2 ? SOI_STORE_STREAM : SOI_STORE_REGULAR;
+  }
+  if (SOI_STORE_AUTO == t->store_policy.demodulate) {
+    t->store_policy.demodulate =
+      output_bytes > get_llc_size()/2 ? SOI_STORE_STREAM : SOI_STORE_REGULAR;
+  }
+  soi_conv_config_t config;
+  return soi_get_kernels(t->isa)->conv_variants(t, &config, 1);
+}
+
+soi_time_breakdown_t soi_time_stages(const soi_desc_t *d)
+{
+  soi_desc_t t;
+  if (!prepare_trials(d, &t) || !valid_k(&t, t.k)) {
+    soi_time_breakdown_t b = { NAN, NAN, NAN, NAN, NAN, NAN, NAN };
+    return b;
+  }
+  return time_stages(&t);
+}
+
+void soi_plan_k(soi_desc_t *d)
+{
+  soi_desc_t t;
+  int has_kernels = prepare_trials(d, &t);
+
+  cfft_size_t best_k = 0;
+  d->predicted_times.total = INFINITY;
+  for (cfft_size_t k = 1; k <= MAX_PLANNED_K && has_kernels; k *= 2) {
+    if (!valid_k(&t, k)) continue;
+    t.k = k;
+    soi_time_breakdown_t b = time_stages(&t);
+    if (b.total < d->predicted_times.total) {
+      best_k = k;
+      d->predicted_times = b;
+    }
+  }
+
+  if (0 == best_k) {
+    if (0 == d->rank) {
+      fprintf(
+        stderr, "No k up to %d is valid for N=%ld with n_mu=%d d_mu=%d B=%ld and %d threads\n",
+        MAX_PLANNED_K, (long)d->N, d->n_mu, d->d_mu, (long)d->B, omp_get_max_threads());
+    }
+    exit(-1);
+  }
+  d->k = best_k;
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/resource.h>
+
+#include "soi.h"
+#include "isa.h"
+
+/*
+ * Bytes of the buffers of a SOI transform per rank.
+ *
+ * soi_predict_memory computes them from the parameters of a descriptor
+ * before init_soi_descriptor, resolving SOI_WINDOW_AUTO the way it does and
+ * assuming full precision for SOI_WINDOW_PRECISION_AUTO, which can only
+ * shrink the window table. soi_descriptor_memory reports the bytes
+ * init_soi_descriptor and compute_soi recorded in soi_desc_t::buffer_bytes
+ * as they allocated each buffer. Both include the input buffer of M_hat*k
+ * elements that the caller allocates (and the second one of
+ * SOI_INPUT_TILED), but not the FFT plans, whose workspace depends on the
+ * backend, or MPI's buffers.
+ *
+ * The peak adds to the total the largest buffer that only lives during
+ * init_soi_descriptor: the frequency response of the window, the full
+ * precision window table while it's converted to float, or the Chebyshev
+ * coefficients of the window fit of SOI_WINDOW_OTF.
+ */
+
+static const char *buffer_names[SOI_NUM_BUFFERS] = {
+  "input",
+  "tiled_input",
+  "w",
+  "w_dup",
+  "w_split",
+  "w_dup_float",
+  "w_otf",
+  "W_inv",
+  "gamma_tilde",
+  "alpha_tilde",
+  "beta_tilde",
+  "alpha_ghost",
+  "delta",
+  "epsilon",
+  "requests",
+};
+
+const char *soi_buffer_name(soi_buffer_t buffer)
+{
+  return buffer_names[buffer];
+}
+
+/**
+ * Fill the bytes of the buffers that don't depend on the window
+ */
+static void common_buffers(const soi_desc_t *d, size_t *bytes)
+{
+  size_t S = d->k*d->P;
+  size_t M = d->N/S;
+  size_t M_hat = d->n_mu*M/d->d_mu;
+  const size_t C = sizeof(cfft_complex_t);
+
+  bytes[SOI_BUFFER_INPUT] = C*M_hat*d->k;
+  bytes[SOI_BUFFER_TILED_INPUT] = SOI_INPUT_TILED == d->input_layout ? C*M_hat*d->k : 0;
+  bytes[SOI_BUFFER_W_INV] = C*M;
+  bytes[SOI_BUFFER_GAMMA_TILDE] = C*M_hat*d->k*2;
+  bytes[SOI_BUFFER_ALPHA_TILDE] = C*M_hat*d->k;
+  bytes[SOI_BUFFER_BETA_TILDE] = C*M_hat*d->k;
+  bytes[SOI_BUFFER_ALPHA_GHOST] =
+    C*(SOI_INPUT_TILED == d->input_layout ? 3 : 2)*d->B*S;
+  bytes[SOI_BUFFER_DELTA] = sizeof(int)*4*M_hat*d->k;
+  bytes[SOI_BUFFER_EPSILON] = d->use_vlc ? sizeof(int)*4*M_hat*d->k : 0;
+  bytes[SOI_BUFFER_REQUESTS] = sizeof(MPI_Request)*(d->P*d->k + d->P*S);
+}
+
+static void sum_buffers(soi_memory_t *m, size_t transient)
+{
+  m->total = 0;
+  for (int b = 0; b < SOI_NUM_BUFFERS; ++b) m->total += m->bytes[b];
+  m->peak = m->total + transient;
+}
+
+void soi_predict_memory(const soi_desc_t *d, soi_memory_t *m)
+{
+  memset(m, 0, sizeof(*m));
+  common_buffers(d, m->bytes);
+
+  size_t S = d->k*d->P;
+  size_t w_len = d->B*S*d->n_mu;
+  const size_t C = sizeof(cfft_complex_t);
+
+  soi_isa_t isa = SOI_ISA_AUTO == d->isa ? soi_detect_isa() : d->isa;
+  int split = d->use_split_complex && soi_get_kernels(isa)->split_complex;
+  soi_window_mode_t mode = d->window_mode;
+  if (SOI_WINDOW_AUTO == mode) {
+    mode = !split && 2*C*w_len > get_llc_size() ? SOI_WINDOW_OTF : SOI_WINDOW_TABLE;
+  }
+
+  size_t transient = sizeof(double)*(d->N/S); // frequency response
+  if (SOI_WINDOW_OTF == mode) {
+    // with the pieces the fit starts from, and the highest degree it
+    // accepts. It takes more pieces only if that degree isn't enough
+    size_t num_fits = soi_window_otf_pieces(S)*d->B*d->n_mu;
+    m->bytes[SOI_BUFFER_W_OTF] =
+      C*d->n_mu*S + sizeof(VAL_TYPE)*SOI_OTF_MAX_DEGREE*num_fits;
+    transient = MAX(transient, sizeof(long double)*(SOI_OTF_MAX_DEGREE + 1)*num_fits);
+  }
+  else {
+    m->bytes[SOI_BUFFER_W] = C*w_len;
+    if (split) {
+      m->bytes[SOI_BUFFER_W_SPLIT] = C*w_len;
+    }
+    else if (
+      SOI_WINDOW_PRECISION_FLOAT == d->window_precision && 2 == PRECISION &&
+      !d->use_compensated_sum) {
+      m->bytes[SOI_BUFFER_W_DUP_FLOAT] = sizeof(float)*4*w_len;
+      transient = MAX(transient, 2*C*w_len);
+    }
+    else {
+      m->bytes[SOI_BUFFER_W_DUP] = 2*C*w_len;
+    }
+  }
+  sum_buffers(m, transient);
+}
+
+void soi_descriptor_memory(const soi_desc_t *d, soi_memory_t *m)
+{
+  memset(m, 0, sizeof(*m));
+  memcpy(m->bytes, d->buffer_bytes, sizeof(m->bytes));
+
+  // the input buffers are the caller's
+  size_t caller_bytes[SOI_NUM_BUFFERS];
+  common_buffers(d, caller_bytes);
+  m->bytes[SOI_BUFFER_INPUT] = caller_bytes[SOI_BUFFER_INPUT];
+  m->bytes[SOI_BUFFER_TILED_INPUT] = caller_bytes[SOI_BUFFER_TILED_INPUT];
+  sum_buffers(m, d->transient_bytes);
+}
+
+void soi_write_memory(
+  const soi_memory_t *predicted, const soi_memory_t *actual, MPI_Comm comm, FILE *fp)
+{
+  // of the rank with the most, as the peak of a job is
+  soi_memory_t max;
+  if (actual) {
+    MPI_Allreduce(
+      (void *)actual, &max, sizeof(max)/sizeof(size_t), MPI_UNSIGNED_LONG, MPI_MAX, comm);
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  long rss = actual ? usage.ru_maxrss : 0; // KiB on Linux
+  MPI_Allreduce(MPI_IN_PLACE, &rss, 1, MPI_LONG, MPI_MAX, comm);
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  if (0 != rank) return;
+
+  for (int b = 0; b < SOI_NUM_BUFFERS; ++b) {
+    fprintf(fp, "memory_%s\tpredicted=%zu", buffer_names[b], predicted->bytes[b]);
+    if (actual) fprintf(fp, ",actual=%zu", max.bytes[b]);
+    fprintf(fp, "\n");
+  }
+  fprintf(fp, "memory_total\tpredicted=%zu", predicted->total);
+  if (actual) fprintf(fp, ",actual=%zu", max.total);
+  fprintf(fp, "\nmemory_peak\tpredicted=%zu", predicted->peak);
+  if (actual) fprintf(fp, ",actual=%zu,rss_peak=%ld", max.peak, rss*1024);
+  fprintf(fp, "\n");
+  fflush(fp);
+}
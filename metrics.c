@@ -0,0 +1,128 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "soi.h"
+
+/*
+ * Cumulative counters of compute_soi in a shared memory file per rank,
+ * /dev/shm/<name>.<rank>, laid out as soi_metrics_page_t, for monitoring
+ * agents to read while the process runs.
+ *
+ * compute_soi updates the page once at its end with plain stores, so the
+ * stages themselves are unaffected. The sequence number is odd while an
+ * update is in progress: a reader copies the page and retries if the
+ * sequence was odd or changed meanwhile.
+ */
+
+struct soi_metrics
+{
+  soi_metrics_page_t *page;
+  char path[256];
+};
+
+soi_metrics_t *soi_metrics_create(MPI_Comm comm, const char *name)
+{
+  int rank, P;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &P);
+
+  soi_metrics_t *m = (soi_metrics_t *)malloc(sizeof(soi_metrics_t));
+  if (NULL == m) {
+    fprintf(stderr, "Failed to allocate the metrics\n");
+    exit(1);
+  }
+  snprintf(m->path, sizeof(m->path), "/dev/shm/%s.%d", name, rank);
+  int fd = open(m->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, sizeof(soi_metrics_page_t))) {
+    fprintf(stderr, "Failed to create %s: %s\n", m->path, strerror(errno));
+    if (fd >= 0) close(fd);
+    free(m);
+    return NULL;
+  }
+  void *p = mmap(NULL, sizeof(soi_metrics_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (MAP_FAILED == p) {
+    fprintf(stderr, "Failed to map %s: %s\n", m->path, strerror(errno));
+    free(m);
+    return NULL;
+  }
+
+  m->page = (soi_metrics_page_t *)p;
+  memset(m->page, 0, sizeof(soi_metrics_page_t));
+  m->page->version = SOI_METRICS_VERSION;
+  m->page->rank = rank;
+  m->page->P = P;
+  m->page->pid = getpid();
+  m->page->snr_min = INFINITY;
+  // the magic last, so agents don't read a half-initialized page
+  __atomic_store_n(&m->page->magic, SOI_METRICS_MAGIC, __ATOMIC_RELEASE);
+  return m;
+}
+
+static void begin_update(soi_metrics_page_t *p)
+{
+  __atomic_store_n(&p->sequence, p->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_update(soi_metrics_page_t *p)
+{
+  __atomic_store_n(&p->sequence, p->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @return the bucket of soi_metrics_page_t::stage_histogram of seconds
+ */
+static int bucket(double seconds)
+{
+  double us = seconds*1e6;
+  int b = 0;
+  for ( ; us >= 2 && b < SOI_METRICS_BUCKETS - 1; us /= 2) ++b;
+  return b;
+}
+
+void soi_metrics_update(soi_metrics_t *m, const soi_desc_t *d)
+{
+  soi_metrics_page_t *p = m->page;
+  begin_update(p);
+  p->N = d->N;
+  p->k = d->k;
+  ++p->transforms;
+  for (int s = 0; s < SOI_NUM_STATS; ++s) {
+    if (0 == d->stats[s]) continue; // not run
+    ++p->stage_histogram[s][bucket(d->stats[s])];
+    p->stage_seconds[s] += d->stats[s];
+  }
+  p->bytes_sent += d->sent_bytes;
+  p->bytes_received += d->received_bytes;
+  p->bytes_uncompressed += d->uncompressed_bytes;
+  p->compression_ratio =
+    p->bytes_uncompressed ? (double)p->bytes_sent/p->bytes_uncompressed : 1;
+  double imbalance = d->stats[SOI_STAT_FSS_IMBALANCE_MAX] - d->stats[SOI_STAT_FSS_IMBALANCE_MIN];
+  p->imbalance_last = imbalance;
+  p->imbalance_max = MAX(p->imbalance_max, imbalance);
+  p->imbalance_sum += imbalance;
+  end_update(p);
+}
+
+void soi_metrics_record_snr(soi_metrics_t *m, double snr)
+{
+  soi_metrics_page_t *p = m->page;
+  begin_update(p);
+  ++p->snr_checks;
+  p->snr_last = snr;
+  p->snr_min = MIN(p->snr_min, snr);
+  end_update(p);
+}
+
+void soi_metrics_free(soi_metrics_t *m)
+{
+  if (NULL == m) return;
+  munmap(m->page, sizeof(soi_metrics_page_t));
+  free(m);
+}
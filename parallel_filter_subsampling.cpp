@@ -6,6 +6,7 @@
 #include <omp.h>
 
 #include "soi.h"
+#include "isa.h"
 
 /*
 %..This is the step for filter and subsample.
@@ -49,92 +50,406 @@
 
 extern double get_cpu_freq();
 
-template<int N_MU = 5, int D_MU = 4>
-void parallel_filter_subsampling(soi_desc_t * d, cfft_complex_t * alpha_dt)
+// w_dup vectors of the cache line of w starting at complex index i for all
+// (kkk, theta) pairs
+#define W_DUP_LINE(d, i) \
+  ((SIMDFPTYPE *)(d)->w_dup + (i)/(CACHE_LINE_LEN/2)*(d)->B*(d)->n_mu*W_DUP_PER_LINE)
+
+/*
+%..This file is compiled once per instruction set (ISA_CXX_SRCS in Makefile).
+%..Everything except the SOI_ISA_FN entry points at the bottom must have
+%..internal linkage so that the variants don't get merged by the linker.
+*/
+
+static inline void load_line(SIMDFPTYPE *y, const void *p)
 {
-  cfft_complex_t *gamma_tilde_dt = d->gamma_tilde;
-  cfft_complex_t *w = d->w;
-  cfft_size_t B = d->B;
-	MPI_Request request_send, request_receive;
+  for (int v = 0; v < VECS_PER_LINE; ++v) y[v] = _MM_LOAD((VAL_TYPE *)p + v*SIMD_WIDTH);
+}
 
-	MPI_Comm comm = d->comm;
-	cfft_size_t P = d->P;
-	cfft_size_t rank = d->rank;
-	cfft_size_t PID_left = (P+rank-1)%P;
-	cfft_size_t PID_right = (rank+1)%P;
+/*
+%..Complex index of the cache line of S starting at i of block row r of
+%..alpha_dt in d->input_layout (see soi_input_index). Both layouts are
+%..block_stride*(r/R) + row_stride*(r%R) + i_scale*i with R a power of 2:
+%..R = 1 for row major.
+*/
+struct alpha_layout
+{
+  int block_shift;
+  cfft_size_t row_mask, block_stride, row_stride, i_scale;
 
-  cfft_size_t S = d->k*d->P; // total number of segments
-	cfft_size_t d_mu = d->d_mu;
-	cfft_size_t n_mu = d->n_mu;
-  cfft_size_t M = d->N/S; // length of one segment, before oversampling
-  cfft_size_t M_hat = d->n_mu*M/d->d_mu; // length of one segment, after oversampling
+  alpha_layout(const soi_desc_t *d)
+  {
+    cfft_size_t S = d->k*d->P;
+    cfft_size_t R = SOI_INPUT_TILED == d->input_layout ? d->input_tile_rows : 1;
+    block_shift = 0;
+    while (((cfft_size_t)1 << block_shift) < R) ++block_shift;
+    row_mask = R - 1;
+    block_stride = R*S;
+    row_stride = CACHE_LINE_LEN/2;
+    i_scale = R;
+  }
+
+  cfft_size_t operator()(cfft_size_t r, cfft_size_t i) const
+  {
+    return (r >> block_shift)*block_stride + (r & row_mask)*row_stride + i*i_scale;
+  }
+};
 
 /*
-%..Let's begin. First carry out the computation with data that is already
-%..in the processor.
-%..We compute n_mu block rows as a unit because they all start at the same
-%..column number (that is, they use the same alpha data). After n_mu block,
-%..the rows right shift by d_mu blocks. 
-%..The global alpha data has  M=(N/S)  blocks of S-block. So each processor
-%..has M/P blocks of alpha. Also, because each row of the matrix is B
-%..blocks, we can compute  FLOOR( ((M/P) - B)/d_mu  )  S-blocks of
-%..gamma_tilde without need some alpha that is not in the processor.
+%..Copy block rows [r_begin, r_end) of alpha_dt to out in row major
 */
+static void gather_rows(
+  cfft_complex_t *out, const cfft_complex_t *alpha_dt, const alpha_layout &layout,
+  cfft_size_t r_begin, cfft_size_t r_end, cfft_size_t S)
+{
+#pragma omp parallel for collapse(2)
+  for (cfft_size_t r = r_begin; r < r_end; ++r) {
+    for (cfft_size_t i = 0; i < S; i += CACHE_LINE_LEN/2) {
+      memcpy(
+        out + (r - r_begin)*S + i, alpha_dt + layout(r, i),
+        sizeof(cfft_complex_t)*(CACHE_LINE_LEN/2));
+    }
+  }
+}
+
+// see soi_store_policy_t
+static inline void store_or_stream(void *p, SIMDFPTYPE v, bool stream)
+{
+  if (stream) _MM_STREAM(p, v);
+  else _MM_STORE(p, v);
+}
 
 /*
-%...first compute the gamma_tilde that requires only alpha that the
-%...processor has
+%..Window policies. A policy object is constructed for the cache line of S
+%..starting at i. load gets the window coefficients of (kkk*n_mu + theta)
+%..(W_VECS vectors), mul/mac multiply them with one cache line of input
+%..(VECS_PER_LINE vectors) into the accumulator (ACC_VECS vectors), and
+%..stream/store write the accumulated line of filter row theta back as
+%..interleaved complex numbers. table_line returns
+%..the window table of line i and its size for prefetching (NULL if the
+%..policy has no table).
 */
-	cfft_size_t K_0 = floor(  ((M/P)-B) / d_mu );
-  if (M/P < B) {
-    if (0 == rank) {
-      fprintf(stderr, "input size too small\n");
+
+// Interleaved complex input, window duplicated into real and imaginary
+// vectors (w_dup)
+struct interleaved_window
+{
+  static const bool SPLIT = false;
+  static const int W_VECS = W_DUP_PER_LINE;
+  static const int ACC_VECS = VECS_PER_LINE;
+
+  const SIMDFPTYPE *in;
+
+  interleaved_window(soi_desc_t *d, cfft_size_t i) : in(W_DUP_LINE(d, i)) { }
+
+  static const char *table_line(soi_desc_t *d, cfft_size_t i, size_t *bytes)
+  {
+    *bytes = d->B*d->n_mu*W_DUP_PER_LINE*sizeof(SIMDFPTYPE);
+    return (const char *)W_DUP_LINE(d, i);
+  }
+
+protected:
+  interleaved_window() : in(NULL) { }
+
+public:
+
+  inline void load(int j, SIMDFPTYPE *x) const
+  {
+    for (int v = 0; v < W_VECS; ++v) x[v] = _MM_LOAD(in + j*W_VECS + v);
+  }
+
+  static inline void mul(SIMDFPTYPE *acc, const SIMDFPTYPE *x, const SIMDFPTYPE *y)
+  {
+    for (int v = 0; v < VECS_PER_LINE; ++v) {
+      acc[v] = _MM_FMADDSUB(x[2*v], y[v], _MM_SWAP_REAL_IMAG(_MM_MUL(x[2*v + 1], y[v])));
     }
-    exit(0);
   }
-  if (0 == rank)
-    printf(
-      "k = %ld, S = %ld, M = %ld, M_hat = %ld, K_0 = %ld\n",
-      d->k, S, M, M_hat, K_0);
 
-MPI_TIMED_SECTION_BEGIN();
-	cfft_size_t b_cnt = M/P - K_0*d_mu;
-  memcpy(d->alpha_ghost, alpha_dt + K_0*d_mu*S, b_cnt*S*sizeof(cfft_complex_t));
-	cfft_size_t n_elements = (B-d_mu)*S;
-	cfft_size_t addr_start = b_cnt*S;
-	CFFT_ASSERT_MPI( MPI_Irecv(d->alpha_ghost + addr_start, n_elements*2, 
-							   MPI_TYPE, PID_right, 0, d->comm, &request_receive) );
-	CFFT_ASSERT_MPI( MPI_Isend(alpha_dt, n_elements*2,
-                 MPI_TYPE, PID_left, 0, d->comm, &request_send) );
-MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_ghost");
+  static inline void mac(SIMDFPTYPE *acc, const SIMDFPTYPE *x, const SIMDFPTYPE *y)
+  {
+    for (int v = 0; v < VECS_PER_LINE; ++v) {
+      acc[v] = _MM_ADD(
+        acc[v], _MM_FMADDSUB(x[2*v], y[v], _MM_SWAP_REAL_IMAG(_MM_MUL(x[2*v + 1], y[v]))));
+    }
+  }
 
-  unsigned long long conv_clks = 0, fft_clks = 0, transpose_clks = 0;
-  int nthreads = omp_get_max_threads();
+  inline void stream(void *out, int theta, const SIMDFPTYPE *acc) const
+  {
+    for (int v = 0; v < VECS_PER_LINE; ++v) _MM_STREAM((VAL_TYPE *)out + v*SIMD_WIDTH, acc[v]);
+  }
 
-#ifdef SOI_MEASURE_LOAD_IMBALANCE
-  for (int i = 0; i < omp_get_max_threads(); i++)
-    load_imbalance_times[i] = 0;
+  inline void store(void *out, int theta, const SIMDFPTYPE *acc) const
+  {
+    for (int v = 0; v < VECS_PER_LINE; ++v) _MM_STORE((VAL_TYPE *)out + v*SIMD_WIDTH, acc[v]);
+  }
+};
+
+#if PRECISION == 2
+// Same as interleaved_window with w_dup stored in float (w_dup_float) and
+// widened to double on load
+struct float_window : interleaved_window
+{
+  const float *in_float;
+
+  float_window(soi_desc_t *d, cfft_size_t i) : in_float(line(d, i)) { }
+
+  static const float *line(soi_desc_t *d, cfft_size_t i)
+  {
+    return d->w_dup_float + i/(CACHE_LINE_LEN/2)*d->B*d->n_mu*W_DUP_PER_LINE*SIMD_WIDTH;
+  }
+
+  static const char *table_line(soi_desc_t *d, cfft_size_t i, size_t *bytes)
+  {
+    *bytes = d->B*d->n_mu*W_DUP_PER_LINE*SIMD_WIDTH*sizeof(float);
+    return (const char *)line(d, i);
+  }
+
+  inline void load(int j, SIMDFPTYPE *x) const
+  {
+    for (int v = 0; v < W_VECS; ++v) x[v] = _MM_LOAD_FLOAT(in_float + (j*W_VECS + v)*SIMD_WIDTH);
+  }
+};
 #endif
 
-#ifdef __AVX512F__
-  const int REG_BLOCK_SIZE = 30; // use at most 30 SIMD registers out of 32
-#else
-  const int REG_BLOCK_SIZE = 14; // use at most 14 SIMD registers out of 16
+// Window generated in registers from the piecewise polynomials of
+// soi_init_window_otf. Each coefficient is real (the envelope), so it's
+// evaluated with lanes duplicated for real and imaginary parts and
+// multiplied without shuffles. The phase, which only depends on theta and
+// the position in S, is applied once to the sum.
+struct otf_window
+{
+  static const bool SPLIT = false;
+  static const int W_VECS = VECS_PER_LINE;
+  static const int ACC_VECS = VECS_PER_LINE;
+
+  const VAL_TYPE *poly; // polynomials of the piece of S containing line i
+  int degree;
+  const cfft_complex_t *phase; // w_phase + i
+  cfft_size_t S;
+  SIMDFPTYPE x[VECS_PER_LINE]; // polynomial variable of each lane
+
+  otf_window(soi_desc_t *d, cfft_size_t i)
+  {
+    S = d->k*d->P;
+    cfft_size_t L = S/d->w_poly_pieces;
+    cfft_size_t piece = i/L;
+    degree = d->w_poly_degree;
+    poly = d->w_poly + piece*d->B*d->n_mu*(degree + 1);
+    phase = d->w_phase + i;
+
+    // maps [piece*L, (piece + 1)*L - 1] to [-1, 1]
+    VAL_TYPE center = piece*L + (L - 1)/(VAL_TYPE)2, inv_half = 2/(VAL_TYPE)(L - 1);
+    __declspec(aligned(64)) VAL_TYPE xs[CACHE_LINE_LEN];
+    for (int c = 0; c < CACHE_LINE_LEN/2; ++c) {
+      xs[2*c] = xs[2*c + 1] = (i + c - center)*inv_half;
+    }
+    for (int v = 0; v < VECS_PER_LINE; ++v) x[v] = _MM_LOAD(xs + v*SIMD_WIDTH);
+  }
+
+  static const char *table_line(soi_desc_t *d, cfft_size_t i, size_t *bytes)
+  {
+    *bytes = 0; // the polynomials are shared by many lines and stay in cache
+    return NULL;
+  }
+
+  inline void load(int j, SIMDFPTYPE *r) const
+  {
+    const VAL_TYPE *c = poly + j*(degree + 1);
+    for (int v = 0; v < VECS_PER_LINE; ++v) r[v] = _MM_SET1(c[degree]);
+    for (int n = degree - 1; n >= 0; --n) {
+      SIMDFPTYPE cn = _MM_SET1(c[n]);
+      for (int v = 0; v < VECS_PER_LINE; ++v) r[v] = _MM_FMADD(r[v], x[v], cn);
+    }
+  }
+
+  static inline void mul(SIMDFPTYPE *acc, const SIMDFPTYPE *r, const SIMDFPTYPE *y)
+  {
+    for (int v = 0; v < VECS_PER_LINE; ++v) acc[v] = _MM_MUL(r[v], y[v]);
+  }
+
+  static inline void mac(SIMDFPTYPE *acc, const SIMDFPTYPE *r, const SIMDFPTYPE *y)
+  {
+    for (int v = 0; v < VECS_PER_LINE; ++v) acc[v] = _MM_FMADD(r[v], y[v], acc[v]);
+  }
+
+  inline SIMDFPTYPE rotate(int theta, int v, SIMDFPTYPE a) const
+  {
+    SIMDFPTYPE p = _MM_LOADU((VAL_TYPE *)(phase + theta*S) + v*SIMD_WIDTH);
+    return _MM_FMADDSUB(_MM_MOVELDUP(p), a, _MM_SWAP_REAL_IMAG(_MM_MUL(_MM_MOVEHDUP(p), a)));
+  }
+
+  inline void stream(void *out, int theta, const SIMDFPTYPE *acc) const
+  {
+    for (int v = 0; v < VECS_PER_LINE; ++v) {
+      _MM_STREAM((VAL_TYPE *)out + v*SIMD_WIDTH, rotate(theta, v, acc[v]));
+    }
+  }
+
+  inline void store(void *out, int theta, const SIMDFPTYPE *acc) const
+  {
+    for (int v = 0; v < VECS_PER_LINE; ++v) {
+      _MM_STORE((VAL_TYPE *)out + v*SIMD_WIDTH, rotate(theta, v, acc[v]));
+    }
+  }
+};
+
+#ifdef SOI_HAS_SPLIT_COMPLEX
+// Input and window lines hold CACHE_LINE_LEN/2 real parts followed by the
+// imaginary parts (soi_split_complex_lines), so a complex multiply-add is
+// 4 FMAs per pair of vectors without shuffles. The result is interleaved
+// again when stored because the FFT libraries need interleaved input.
+struct split_window
+{
+  static const bool SPLIT = true;
+  static const int W_VECS = VECS_PER_LINE;
+  static const int ACC_VECS = VECS_PER_LINE;
+  static const int H = VECS_PER_LINE/2;
+
+  const SIMDFPTYPE *in;
+
+  split_window(soi_desc_t *d, cfft_size_t i)
+    : in((SIMDFPTYPE *)(d->w_split + 2*i*d->B*d->n_mu)) { }
+
+  static const char *table_line(soi_desc_t *d, cfft_size_t i, size_t *bytes)
+  {
+    *bytes = d->B*d->n_mu*CACHE_LINE_LEN*sizeof(VAL_TYPE);
+    return (const char *)(d->w_split + 2*i*d->B*d->n_mu);
+  }
+
+  inline void load(int j, SIMDFPTYPE *x) const
+  {
+    for (int v = 0; v < W_VECS; ++v) x[v] = _MM_LOAD(in + j*W_VECS + v);
+  }
+
+  static inline void mul(SIMDFPTYPE *acc, const SIMDFPTYPE *x, const SIMDFPTYPE *y)
+  {
+    for (int h = 0; h < H; ++h) {
+      acc[h] = _MM_FNMADD(x[H + h], y[H + h], _MM_MUL(x[h], y[h]));
+      acc[H + h] = _MM_FMADD(x[H + h], y[h], _MM_MUL(x[h], y[H + h]));
+    }
+  }
+
+  static inline void mac(SIMDFPTYPE *acc, const SIMDFPTYPE *x, const SIMDFPTYPE *y)
+  {
+    for (int h = 0; h < H; ++h) {
+      acc[h] = _MM_FNMADD(x[H + h], y[H + h], _MM_FMADD(x[h], y[h], acc[h]));
+      acc[H + h] = _MM_FMADD(x[H + h], y[h], _MM_FMADD(x[h], y[H + h], acc[H + h]));
+    }
+  }
+
+  inline void stream(void *out, int theta, const SIMDFPTYPE *acc) const
+  {
+    for (int h = 0; h < H; ++h) {
+      _MM_STREAM((VAL_TYPE *)out + 2*h*SIMD_WIDTH, _MM_INTERLEAVE_LO(acc[h], acc[H + h]));
+      _MM_STREAM((VAL_TYPE *)out + (2*h + 1)*SIMD_WIDTH, _MM_INTERLEAVE_HI(acc[h], acc[H + h]));
+    }
+  }
+
+  inline void store(void *out, int theta, const SIMDFPTYPE *acc) const
+  {
+    for (int h = 0; h < H; ++h) {
+      _MM_STORE((VAL_TYPE *)out + 2*h*SIMD_WIDTH, _MM_INTERLEAVE_LO(acc[h], acc[H + h]));
+      _MM_STORE((VAL_TYPE *)out + (2*h + 1)*SIMD_WIDTH, _MM_INTERLEAVE_HI(acc[h], acc[H + h]));
+    }
+  }
+};
+#endif // SOI_HAS_SPLIT_COMPLEX
+
+/*
+%..W with compensated accumulation (use_compensated_sum). The accumulator
+%..holds the sum followed by the rounding errors of its additions, found
+%..with TwoSum (which doesn't need |sum| >= |product|) and added together
+%..to the sum when stored. The error of the sum then no longer grows with
+%..B; each product is still rounded once.
+*/
+// TwoSum mustn't be reassociated, whatever the floating point model flags
+#if defined(__INTEL_COMPILER) || defined(__clang__)
+#pragma float_control(precise, on, push)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("no-fast-math")
 #endif
+template<class W>
+struct compensated : W
+{
+  static const int ACC_VECS = 2*VECS_PER_LINE;
 
-  const int THETA_UNROLL_FACTOR = N_MU <= REG_BLOCK_SIZE ? N_MU : REG_BLOCK_SIZE;
-  const int J_UNROLL_FACTOR = REG_BLOCK_SIZE/THETA_UNROLL_FACTOR < 1 ? 1 : REG_BLOCK_SIZE/THETA_UNROLL_FACTOR;
+  compensated(soi_desc_t *d, cfft_size_t i) : W(d, i) { }
 
-  int num_thread_groups = MIN(S/(CACHE_LINE_LEN/2), 8);
-  if (0 == rank && nthreads < num_thread_groups) {
-    fprintf(stderr, "OMP_NUM_THREADS should be greater than equal to %d. Consider increasing OMP_NUM_THREADS or decreasing k\n", num_thread_groups);
-    exit(-1);
+  static inline void mul(SIMDFPTYPE *acc, const SIMDFPTYPE *x, const SIMDFPTYPE *y)
+  {
+    W::mul(acc, x, y);
+    for (int v = 0; v < VECS_PER_LINE; ++v) acc[VECS_PER_LINE + v] = _MM_SETZERO();
   }
 
-#pragma omp parallel
+  static inline void mac(SIMDFPTYPE *acc, const SIMDFPTYPE *x, const SIMDFPTYPE *y)
+  {
+    SIMDFPTYPE p[VECS_PER_LINE];
+    W::mul(p, x, y);
+    for (int v = 0; v < VECS_PER_LINE; ++v) {
+      SIMDFPTYPE sum = _MM_ADD(acc[v], p[v]);
+      SIMDFPTYPE p_rounded = _MM_SUB(sum, acc[v]);
+      SIMDFPTYPE err = _MM_ADD(
+        _MM_SUB(acc[v], _MM_SUB(sum, p_rounded)), _MM_SUB(p[v], p_rounded));
+      acc[v] = sum;
+      acc[VECS_PER_LINE + v] = _MM_ADD(acc[VECS_PER_LINE + v], err);
+    }
+  }
+
+  inline void stream(void *out, int theta, const SIMDFPTYPE *acc) const
   {
-  size_t input_buffer_len = 128; // B + (J_UNROLL_FACTOR - 1)*d_mu
-  __declspec(aligned(64)) SIMDFPTYPE input_buffer[input_buffer_len*2];
+    SIMDFPTYPE sum[VECS_PER_LINE];
+    for (int v = 0; v < VECS_PER_LINE; ++v) sum[v] = _MM_ADD(acc[v], acc[VECS_PER_LINE + v]);
+    W::stream(out, theta, sum);
+  }
+
+  inline void store(void *out, int theta, const SIMDFPTYPE *acc) const
+  {
+    SIMDFPTYPE sum[VECS_PER_LINE];
+    for (int v = 0; v < VECS_PER_LINE; ++v) sum[v] = _MM_ADD(acc[v], acc[VECS_PER_LINE + v]);
+    W::store(out, theta, sum);
+  }
+};
+#if defined(__INTEL_COMPILER) || defined(__clang__)
+#pragma float_control(pop)
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+/*
+%..Convolution of the first K_0 block rows, the ones that don't need ghost
+%..alpha. Called by every thread of a parallel region: S is split among
+%..(at most 8) thread groups, and the block rows among the threads of each
+%..group. config->i_tile cache lines of S are processed for each block of
+%..config->j_block rows (rounded up to J_UNROLL_FACTOR) before moving on.
+%..Hardware prefetchers don't follow the stride S between rows of alpha_dt,
+%..so we prefetch config->prefetch_rows rows ahead, and, with
+%..config->prefetch_window, spread prefetches of the window table of the next
+%..line over the block rows of the current one. With SOI_INPUT_TILED, the rows
+%..of a cache line of S are consecutive within a tile, which hardware
+%..prefetchers do follow.
+*/
+template<int N_MU, int D_MU, int THETA_UNROLL_FACTOR, int J_UNROLL_FACTOR, class W>
+static void conv(
+  soi_desc_t *d, const cfft_complex_t *alpha_dt, cfft_size_t K_0,
+  const soi_conv_config_t *config)
+{
+  cfft_complex_t *gamma_tilde_dt = d->gamma_tilde;
+  cfft_size_t B = d->B;
+  cfft_size_t S = d->k*d->P; // total number of segments
+  cfft_size_t d_mu = d->d_mu;
+  int nthreads = omp_get_num_threads();
+  int num_thread_groups = MIN(S/(CACHE_LINE_LEN/2), 8);
+  const bool stream = SOI_STORE_STREAM == d->store_policy.conv;
+  const alpha_layout layout(d);
+
+  // ring buffer of the B + (J_UNROLL_FACTOR - 1)*d_mu rows of alpha_dt that
+  // J_UNROLL_FACTOR block rows read, rounded up to a power of 2 so that
+  // wrapping around is a mask
+  size_t input_buffer_len = 128;
+  while (input_buffer_len < B + (J_UNROLL_FACTOR - 1)*d_mu) input_buffer_len *= 2;
+  const size_t input_buffer_mask = input_buffer_len - 1;
+  __declspec(aligned(64)) SIMDFPTYPE input_buffer[input_buffer_len*VECS_PER_LINE];
   size_t input_buffer_ptr = 0;
 
   int threadid = omp_get_thread_num();
@@ -161,166 +476,325 @@ MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_ghost");
   j_per_thread = (j_per_thread + J_UNROLL_FACTOR - 1)/J_UNROLL_FACTOR*J_UNROLL_FACTOR;
   size_t j_begin = MIN(j_per_thread*group_local_thread_id, end);
   size_t j_end = MIN(j_begin + j_per_thread, end);
+  if (d->thread_weights) {
+    size_t threads_per_group = nthreads/num_thread_groups;
+    soi_weighted_partition(
+      d->thread_weights, thread_group*threads_per_group, threads_per_group,
+      group_local_thread_id, end, J_UNROLL_FACTOR, &j_begin, &j_end);
+    j_per_thread = MAX(j_end - j_begin, J_UNROLL_FACTOR);
+  }
 
-  unsigned long long t1 = __rdtsc();
-
-  for (cfft_size_t i = i_begin; i < i_end; i += CACHE_LINE_LEN/2) {
-    input_buffer_ptr = 0;
-    for (cfft_size_t k = 0; k < B - d_mu; k++) {
-      input_buffer[2*k] = _MM_LOAD((VAL_TYPE *)(alpha_dt + (j_begin*d_mu + k)*S + i));
-      input_buffer[2*k + 1] = _MM_LOAD((VAL_TYPE *)(alpha_dt + (j_begin*d_mu + k)*S + i) + SIMD_WIDTH);
-    }
+  size_t i_tile = MAX(config->i_tile, 1)*(CACHE_LINE_LEN/2);
+  size_t j_block = config->j_block > 0 ? config->j_block : j_per_thread;
+  j_block = MAX((j_block + J_UNROLL_FACTOR - 1)/J_UNROLL_FACTOR*J_UNROLL_FACTOR, J_UNROLL_FACTOR);
+  const int prefetch_rows = MAX(config->prefetch_rows, 0);
+  const size_t LINE_BYTES = CACHE_LINE_LEN*sizeof(VAL_TYPE);
+
+  for (cfft_size_t i0 = i_begin; i0 < i_end; i0 += i_tile) {
+    for (cfft_size_t jb = j_begin; jb < j_end; jb += j_block) {
+      double trace_begin = soi_trace_begin(d->trace);
+      double imbalance_begin = soi_imbalance_begin(d->imbalance);
+      for (cfft_size_t i = i0; i < MIN(i0 + i_tile, i_end); i += CACHE_LINE_LEN/2) {
+        input_buffer_ptr = 0;
+        W w(d, i);
+
+        // window of the line processed next
+        const char *w_next = NULL, *w_next_end = NULL;
+        size_t w_prefetch_per_iter = 0;
+        if (config->prefetch_window) {
+          cfft_size_t i_next =
+            i + CACHE_LINE_LEN/2 < MIN(i0 + i_tile, i_end) ? i + CACHE_LINE_LEN/2 :
+            jb + j_block < j_end ? i0 : i0 + i_tile;
+          size_t bytes = 0;
+          if (i_next < i_end) w_next = W::table_line(d, i_next, &bytes);
+          w_next_end = w_next + bytes;
+          size_t iters = (MIN(jb + j_block, j_end) - jb + J_UNROLL_FACTOR - 1)/J_UNROLL_FACTOR;
+          w_prefetch_per_iter = (bytes + iters - 1)/iters;
+        }
+        for (cfft_size_t k = 0; k < B - d_mu; k++) {
+          for (int v = 0; v < VECS_PER_LINE; ++v) {
+            input_buffer[VECS_PER_LINE*k + v] =
+              _MM_LOAD((VAL_TYPE *)(alpha_dt + layout(jb*d_mu + k, i)) + v*SIMD_WIDTH);
+          }
+        }
 
-    for (cfft_size_t j0 = j_begin; j0 < j_end; j0 += J_UNROLL_FACTOR) {
+        for (cfft_size_t j0 = jb; j0 < MIN(jb + j_block, j_end); j0 += J_UNROLL_FACTOR) {
 
 #pragma unroll(D_MU*J_UNROLL_FACTOR)
-      for (int k = 0; k < D_MU*J_UNROLL_FACTOR; ++k) {
-        input_buffer[(input_buffer_ptr + B - d_mu + k)%input_buffer_len*2] =
-          _MM_LOAD((VAL_TYPE *)(alpha_dt + (j0*d_mu + B - d_mu + k)*S + i));
-        input_buffer[(input_buffer_ptr + B - d_mu + k)%input_buffer_len*2 + 1] =
-          _MM_LOAD((VAL_TYPE *)(alpha_dt + (j0*d_mu + B - d_mu + k)*S + i) + SIMD_WIDTH);
-        //_MM_PREFETCH1(alpha_dt + (j0*d_mu + B + k)*S + i);
-      }
-
-      cfft_complex_t *v_tmp = gamma_tilde_dt + S*j0*N_MU + i;
+          for (int k = 0; k < D_MU*J_UNROLL_FACTOR; ++k) {
+            for (int v = 0; v < VECS_PER_LINE; ++v) {
+              input_buffer[((input_buffer_ptr + B - d_mu + k)&input_buffer_mask)*VECS_PER_LINE + v] =
+                _MM_LOAD((VAL_TYPE *)(alpha_dt + layout(j0*d_mu + B - d_mu + k, i)) + v*SIMD_WIDTH);
+            }
+            if (prefetch_rows) {
+              _MM_PREFETCH1(alpha_dt + layout(j0*d_mu + B - d_mu + k + prefetch_rows, i));
+            }
+          }
+          for (size_t b = 0; b < w_prefetch_per_iter && w_next < w_next_end; b += LINE_BYTES) {
+            _MM_PREFETCH2(w_next);
+            w_next += LINE_BYTES;
+          }
 
-      for (cfft_size_t theta_0 = 0; theta_0 < N_MU; theta_0 += THETA_UNROLL_FACTOR) {
+          cfft_complex_t *v_tmp = gamma_tilde_dt + S*j0*N_MU + i;
 
-        SIMDFPTYPE *in = d->w_dup + i*B*N_MU;
+          for (cfft_size_t theta_0 = 0; theta_0 < N_MU; theta_0 += THETA_UNROLL_FACTOR) {
 
-        SIMDFPTYPE xl[THETA_UNROLL_FACTOR][2], xh[THETA_UNROLL_FACTOR][2];
+            SIMDFPTYPE x[THETA_UNROLL_FACTOR][W::W_VECS];
 
-        cfft_size_t kkk = 0;
+            cfft_size_t kkk = 0;
 #pragma unroll(THETA_UNROLL_FACTOR)
-        for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
-          xl[theta][0] = _MM_LOAD(in + (kkk*N_MU + theta_0 + theta)*(CACHE_LINE_LEN/2) + 0*2);
-          xh[theta][0] = _MM_LOAD(in + (kkk*N_MU + theta_0 + theta)*(CACHE_LINE_LEN/2) + 0*2 + 1);
-
-          xl[theta][1] = _MM_LOAD(in + (kkk*N_MU + theta_0 + theta)*(CACHE_LINE_LEN/2) + 1*2);
-          xh[theta][1] = _MM_LOAD(in + (kkk*N_MU + theta_0 + theta)*(CACHE_LINE_LEN/2) + 1*2 + 1);
-        }
+            for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
+              w.load(kkk*N_MU + theta_0 + theta, x[theta]);
+            }
 
-        SIMDFPTYPE temp[J_UNROLL_FACTOR][THETA_UNROLL_FACTOR][2];
-        SIMDFPTYPE ytemp[J_UNROLL_FACTOR][2];
+            SIMDFPTYPE temp[J_UNROLL_FACTOR][THETA_UNROLL_FACTOR][W::ACC_VECS];
+            SIMDFPTYPE ytemp[J_UNROLL_FACTOR][VECS_PER_LINE];
 
 #pragma unroll(J_UNROLL_FACTOR)
-        for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
-          ytemp[j][0] = _MM_LOAD(
-            input_buffer + (input_buffer_ptr + j*d_mu + kkk)%input_buffer_len*2 + 0);
-          ytemp[j][1] = _MM_LOAD(
-            input_buffer + (input_buffer_ptr + j*d_mu + kkk)%input_buffer_len*2 + 1);
-        }
+            for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
+              for (int v = 0; v < VECS_PER_LINE; ++v) {
+                ytemp[j][v] = _MM_LOAD(
+                  input_buffer + ((input_buffer_ptr + j*d_mu + kkk)&input_buffer_mask)*VECS_PER_LINE + v);
+              }
+            }
 
 #pragma unroll(J_UNROLL_FACTOR)
-        for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
+            for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
 #pragma unroll(THETA_UNROLL_FACTOR)
-          for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
-            temp[j][theta][0] = _MM_FMADDSUB(
-              xl[theta][0], ytemp[j][0],
-              _MM_SWAP_REAL_IMAG(_MM_MUL(xh[theta][0], ytemp[j][0])));
-            temp[j][theta][1] = _MM_FMADDSUB(
-              xl[theta][1], ytemp[j][1],
-              _MM_SWAP_REAL_IMAG(_MM_MUL(xh[theta][1], ytemp[j][1])));
-          }
-        }
+              for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
+                W::mul(temp[j][theta], x[theta], ytemp[j]);
+              }
+            }
 
-        for (kkk = 1; kkk < B; kkk++) {
+            for (kkk = 1; kkk < B; kkk++) {
 #pragma unroll(THETA_UNROLL_FACTOR)
-          for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
-            xl[theta][0] = _MM_LOAD(in + (kkk*N_MU + theta_0 + theta)*(CACHE_LINE_LEN/2) + 0*2);
-            xh[theta][0] = _MM_LOAD(in + (kkk*N_MU + theta_0 + theta)*(CACHE_LINE_LEN/2) + 0*2 + 1);
-
-            xl[theta][1] = _MM_LOAD(in + (kkk*N_MU + theta_0 + theta)*(CACHE_LINE_LEN/2) + 1*2);
-            xh[theta][1] = _MM_LOAD(in + (kkk*N_MU + theta_0 + theta)*(CACHE_LINE_LEN/2) + 1*2 + 1);
-          }
+              for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
+                w.load(kkk*N_MU + theta_0 + theta, x[theta]);
+              }
 
 #pragma unroll(J_UNROLL_FACTOR)
-          for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
-            ytemp[j][0] = _MM_LOAD(
-              input_buffer + (input_buffer_ptr + j*d_mu + kkk)%input_buffer_len*2 + 0);
-            ytemp[j][1] = _MM_LOAD(
-              input_buffer + (input_buffer_ptr + j*d_mu + kkk)%input_buffer_len*2 + 1);
-          }
+              for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
+                for (int v = 0; v < VECS_PER_LINE; ++v) {
+                  ytemp[j][v] = _MM_LOAD(
+                    input_buffer + ((input_buffer_ptr + j*d_mu + kkk)&input_buffer_mask)*VECS_PER_LINE + v);
+                }
+              }
 
 #pragma unroll(J_UNROLL_FACTOR)
-          for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
+              for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
 #pragma unroll(THETA_UNROLL_FACTOR)
-            for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
-              temp[j][theta][0] = _MM_ADD(
-                temp[j][theta][0],
-                _MM_FMADDSUB(
-                  xl[theta][0], ytemp[j][0],
-                  _MM_SWAP_REAL_IMAG(_MM_MUL(xh[theta][0], ytemp[j][0]))));
-              temp[j][theta][1] = _MM_ADD(
-                temp[j][theta][1],
-                _MM_FMADDSUB(
-                  xl[theta][1], ytemp[j][1],
-                  _MM_SWAP_REAL_IMAG(_MM_MUL(xh[theta][1], ytemp[j][1]))));
+                for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
+                  W::mac(temp[j][theta], x[theta], ytemp[j]);
+                }
+              }
             }
-          }
-        }
 
 #pragma unroll(J_UNROLL_FACTOR)
-        for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
+            for (int j = 0; j < J_UNROLL_FACTOR; ++j) {
 #pragma unroll(THETA_UNROLL_FACTOR)
-          for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
-            _MM_STREAM(
-              (VAL_TYPE *)(v_tmp + S*(j*N_MU + theta_0 + theta)),
-              temp[j][theta][0]);
-            _MM_STREAM(
-              (VAL_TYPE *)(v_tmp + S*(j*N_MU + theta_0 + theta)) + SIMD_WIDTH,
-              temp[j][theta][1]);
-          }
-        }
+              for (int theta = 0; theta < THETA_UNROLL_FACTOR; ++theta) {
+                if (stream) {
+                  w.stream(v_tmp + S*(j*N_MU + theta_0 + theta), theta_0 + theta, temp[j][theta]);
+                }
+                else {
+                  w.store(v_tmp + S*(j*N_MU + theta_0 + theta), theta_0 + theta, temp[j][theta]);
+                }
+              }
+            }
 
-        /*if (0 == rank && 0 == threadid) {
-          for (int t = 0; t < THETA_UNROLL_FACTOR; ++t) {
-            cfft_complex_t c = v_tmp[S*(theta + t)];
-            printf("(%g %g) ", __real__(c), __imag__(c));
-          }
-          printf("\n");
-        }*/
-      } // theta
+            /*if (0 == rank && 0 == threadid) {
+              for (int t = 0; t < THETA_UNROLL_FACTOR; ++t) {
+                cfft_complex_t c = v_tmp[S*(theta + t)];
+                printf("(%g %g) ", __real__(c), __imag__(c));
+              }
+              printf("\n");
+            }*/
+          } // theta
+
+          input_buffer_ptr = (input_buffer_ptr + d_mu*J_UNROLL_FACTOR)&input_buffer_mask;
+        } // JJ
+      } // i
+      soi_trace_end(d->trace, SOI_TRACE_CONV_TILE, trace_begin, jb);
+      soi_imbalance_end(
+        d->imbalance, SOI_IMBALANCE_CONV, i0, MIN(i0 + i_tile, i_end),
+        jb, MIN(jb + j_block, j_end), imbalance_begin);
+    } // jb
+  } // i0
+}
+
+/*
+%..Time conv over the first K block rows of alpha with all threads.
+*/
+template<int N_MU, int D_MU, int THETA_UNROLL_FACTOR, int J_UNROLL_FACTOR, class W>
+static double time_conv(
+  soi_desc_t *d, const cfft_complex_t *alpha, cfft_size_t K,
+  const soi_conv_config_t *config)
+{
+  // trials aren't part of the timeline or the load-imbalance analysis
+  soi_trace_t *trace = d->trace;
+  soi_imbalance_t *imbalance = d->imbalance;
+  d->trace = NULL;
+  d->imbalance = NULL;
+  double t = omp_get_wtime();
+#pragma omp parallel
+  {
+    conv<N_MU, D_MU, THETA_UNROLL_FACTOR, J_UNROLL_FACTOR, W>(d, alpha, K, config);
+  }
+  t = omp_get_wtime() - t;
+  d->trace = trace;
+  d->imbalance = imbalance;
+  return t;
+}
+
+template<int N_MU, int D_MU, int THETA_UNROLL_FACTOR, int J_UNROLL_FACTOR, class W>
+static void parallel_filter_subsampling(soi_desc_t * d, cfft_complex_t * alpha_dt)
+{
+  cfft_complex_t *gamma_tilde_dt = d->gamma_tilde;
+  cfft_size_t B = d->B;
+	MPI_Request request_send, request_receive;
+
+	MPI_Comm comm = d->comm;
+	cfft_size_t P = d->P;
+	cfft_size_t rank = d->rank;
+	cfft_size_t PID_left = (P+rank-1)%P;
+	cfft_size_t PID_right = (rank+1)%P;
+
+  cfft_size_t S = d->k*d->P; // total number of segments
+	cfft_size_t d_mu = d->d_mu;
+	cfft_size_t n_mu = d->n_mu;
+  cfft_size_t M = d->N/S; // length of one segment, before oversampling
+  cfft_size_t M_hat = d->n_mu*M/d->d_mu; // length of one segment, after oversampling
+  const alpha_layout layout(d);
 
-      input_buffer_ptr = (input_buffer_ptr + d_mu*J_UNROLL_FACTOR)%input_buffer_len;
-    } // JJ
-  } // i
+/*
+%..Let's begin. First carry out the computation with data that is already
+%..in the processor.
+%..We compute n_mu block rows as a unit because they all start at the same
+%..column number (that is, they use the same alpha data). After n_mu block,
+%..the rows right shift by d_mu blocks. 
+%..The global alpha data has  M=(N/S)  blocks of S-block. So each processor
+%..has M/P blocks of alpha. Also, because each row of the matrix is B
+%..blocks, we can compute  FLOOR( ((M/P) - B)/d_mu  )  S-blocks of
+%..gamma_tilde without need some alpha that is not in the processor.
+*/
+
+/*
+%...first compute the gamma_tilde that requires only alpha that the
+%...processor has
+*/
+	cfft_size_t K_0 = floor(  ((M/P)-B) / d_mu );
+  if (M/P < B) {
+    if (0 == rank) {
+      fprintf(stderr, "input size too small\n");
+    }
+    exit(0);
+  }
+  if (0 == rank && !d->quiet)
+    printf(
+      "k = %ld, S = %ld, M = %ld, M_hat = %ld, K_0 = %ld\n",
+      d->k, S, M, M_hat, K_0);
+
+  if (W::SPLIT) {
+    // before anything is copied to alpha_ghost or sent to the left neighbor
+    double trace_begin = soi_trace_begin(d->trace);
+MPI_TIMED_SECTION_BEGIN();
+    soi_split_complex_lines(alpha_dt, alpha_dt, d->N/P);
+MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_split", SOI_STAT_FSS_SPLIT);
+    soi_trace_end(d->trace, SOI_TRACE_SPLIT, trace_begin, 0);
+  }
+
+  double trace_begin = soi_trace_begin(d->trace);
+MPI_TIMED_SECTION_BEGIN();
+	cfft_size_t b_cnt = M/P - K_0*d_mu;
+	cfft_size_t n_elements = (B-d_mu)*S;
+	cfft_size_t addr_start = b_cnt*S;
+  // alpha_ghost and what the neighbors exchange are row major
+  const cfft_complex_t *ghost_send = alpha_dt;
+  if (SOI_INPUT_TILED == d->input_layout) {
+    gather_rows(d->alpha_ghost, alpha_dt, layout, K_0*d_mu, M/P, S);
+    // the third B*S of alpha_ghost is allocated for this
+    cfft_complex_t *send_buf = d->alpha_ghost + 2*B*S;
+    gather_rows(send_buf, alpha_dt, layout, 0, B - d_mu, S);
+    ghost_send = send_buf;
+  }
+  else {
+    memcpy(d->alpha_ghost, alpha_dt + K_0*d_mu*S, b_cnt*S*sizeof(cfft_complex_t));
+  }
+	CFFT_ASSERT_MPI( MPI_Irecv(d->alpha_ghost + addr_start, n_elements*2, 
+							   MPI_TYPE, PID_right, 0, d->comm, &request_receive) );
+	CFFT_ASSERT_MPI( MPI_Isend((void *)ghost_send, n_elements*2,
+                 MPI_TYPE, PID_left, 0, d->comm, &request_send) );
+MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_ghost", SOI_STAT_FSS_GHOST);
+  soi_trace_end(d->trace, SOI_TRACE_GHOST_SEND, trace_begin, 0);
+
+  unsigned long long conv_clks = 0, fft_clks = 0, transpose_clks = 0;
+  int nthreads = omp_get_max_threads();
+
+#ifdef SOI_MEASURE_LOAD_IMBALANCE
+  for (int i = 0; i < omp_get_max_threads(); i++)
+    load_imbalance_times[i] = 0;
+#endif
 
+  int num_thread_groups = MIN(S/(CACHE_LINE_LEN/2), 8);
+  if (0 == rank && nthreads < num_thread_groups) {
+    fprintf(stderr, "OMP_NUM_THREADS should be greater than equal to %d. Consider increasing OMP_NUM_THREADS or decreasing k\n", num_thread_groups);
+    exit(-1);
+  }
+
+#pragma omp parallel
+  {
+  int threadid = omp_get_thread_num();
+  int threadid_trans = threadid;
+  size_t end = K_0/J_UNROLL_FACTOR*J_UNROLL_FACTOR;
+
+  unsigned long long t1 = __rdtsc();
+  soi_counter_snapshot_t counts;
+  soi_counters_begin(d->counters, &counts);
+
+  conv<N_MU, D_MU, THETA_UNROLL_FACTOR, J_UNROLL_FACTOR, W>(d, alpha_dt, K_0, &d->conv_config);
+  soi_counters_end(d->counters, SOI_COUNTED_CONV, &counts);
+
+  double imbalance_begin = soi_imbalance_begin(d->imbalance);
 #pragma omp barrier
+  soi_imbalance_end(d->imbalance, SOI_IMBALANCE_CONV_WAIT, 0, 0, 0, 0, imbalance_begin);
 
   if (0 == threadid) conv_clks += __rdtsc() - t1;
 
-  j_per_thread = (end + nthreads - 1)/nthreads;
-  j_begin = MIN(j_per_thread*threadid_trans, end);
-  j_end = MIN(j_begin + j_per_thread, end);
+  size_t j_per_thread = (end + nthreads - 1)/nthreads;
+  size_t j_begin = MIN(j_per_thread*threadid_trans, end);
+  size_t j_end = MIN(j_begin + j_per_thread, end);
+  if (d->thread_weights) {
+    soi_weighted_partition(
+      d->thread_weights, 0, nthreads, threadid_trans, end, 1, &j_begin, &j_end);
+  }
 
   for (cfft_size_t j = j_begin; j < j_end; j++) {
     cfft_complex_t *v_tmp = gamma_tilde_dt + S*j*n_mu;
 
-    unsigned long long t2 = __rdtsc();
-    for (int theta = 0; theta < N_MU; theta++) {
-      /*if (0 == rank && 0 == threadid) {
-        for (int k = 0; k < S; ++k) {
-          printf("(%g %g) ", __real__(v_tmp[S*theta + k]), __real__(v_tmp[S*theta + k]));
-        }
-        printf("\n");
-      }*/
-      DftiComputeForward(d->desc_dft_s, v_tmp + S*theta);
-      for (size_t i = 0; i < S; i += CACHE_LINE_LEN)
-        _MM_PREFETCH1(v_tmp + S*(theta + n_mu) + i);
-    }
-
-    unsigned long long t3 = __rdtsc();
+    unsigned long long t2 = __rdtsc(), t3;
+    double trace_t2 = soi_trace_begin(d->trace);
+    imbalance_begin = soi_imbalance_begin(d->imbalance);
+    soi_counters_begin(d->counters, &counts);
     cfft_size_t l = M_hat/d->P;
 
-#ifdef __AVX__
-    if (8 == N_MU) {
+#if PRECISION == 2 && SIMD_WIDTH == 4 // AVX
+    if (8 == N_MU && !d->use_fft_codelet) {
+      const bool stream_transpose = SOI_STORE_STREAM == d->store_policy.transpose;
+      soi_fft_compute_batch(d->fft_s, v_tmp);
+      for (int theta = 0; theta < N_MU; theta++) {
+        for (size_t i = 0; i < S; i += CACHE_LINE_LEN)
+          _MM_PREFETCH1(v_tmp + S*(theta + n_mu) + i);
+      }
+
+      t3 = __rdtsc();
+      double trace_t3 = soi_trace_begin(d->trace);
+      soi_trace_end(d->trace, SOI_TRACE_FFT_S, trace_t2, j);
+      soi_counters_end(d->counters, SOI_COUNTED_FFT_S, &counts);
+      soi_counters_begin(d->counters, &counts);
+
       for (int jj = j*n_mu ; jj < (j + 1)*n_mu/SIMD_WIDTH*SIMD_WIDTH; jj += 2*SIMD_WIDTH) {
         cfft_size_t s = 0;
         for (cfft_size_t s = 0; s < S; s += SIMD_WIDTH) {
-#if PRECISION == 1
-          // TODO!
-#else
           cfft_complex_t *in = v_tmp + S*(jj - j*n_mu) + s;
 
           SIMDFPTYPE a11 = _MM_LOAD(in);
@@ -361,82 +835,95 @@ MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_ghost");
 
           cfft_complex_t *out = d->alpha_tilde + s*l + jj;
 
-          _MM_STREAM(out, b11);
-          _MM_STREAM(out + 2, b31);
-          _MM_STREAM(out + 4, b51);
-          _MM_STREAM(out + 6, b71);
-          _MM_STREAM(out + l, b12);
-          _MM_STREAM(out + l + 2, b32);
-          _MM_STREAM(out + l + 4, b52);
-          _MM_STREAM(out + l + 6, b72);
-          _MM_STREAM(out + 2*l, b21);
-          _MM_STREAM(out + 2*l + 2, b41);
-          _MM_STREAM(out + 2*l + 4, b61);
-          _MM_STREAM(out + 2*l + 6, b81);
-          _MM_STREAM(out + 3*l, b22);
-          _MM_STREAM(out + 3*l + 2, b42);
-          _MM_STREAM(out + 3*l + 4, b62);
-          _MM_STREAM(out + 3*l + 6, b82);
-#endif // PRECISION
+          store_or_stream(out, b11, stream_transpose);
+          store_or_stream(out + 2, b31, stream_transpose);
+          store_or_stream(out + 4, b51, stream_transpose);
+          store_or_stream(out + 6, b71, stream_transpose);
+          store_or_stream(out + l, b12, stream_transpose);
+          store_or_stream(out + l + 2, b32, stream_transpose);
+          store_or_stream(out + l + 4, b52, stream_transpose);
+          store_or_stream(out + l + 6, b72, stream_transpose);
+          store_or_stream(out + 2*l, b21, stream_transpose);
+          store_or_stream(out + 2*l + 2, b41, stream_transpose);
+          store_or_stream(out + 2*l + 4, b61, stream_transpose);
+          store_or_stream(out + 2*l + 6, b81, stream_transpose);
+          store_or_stream(out + 3*l, b22, stream_transpose);
+          store_or_stream(out + 3*l + 2, b42, stream_transpose);
+          store_or_stream(out + 3*l + 4, b62, stream_transpose);
+          store_or_stream(out + 3*l + 6, b82, stream_transpose);
         }
       }
+      soi_trace_end(d->trace, SOI_TRACE_TRANSPOSE, trace_t3, j);
+      soi_counters_end(d->counters, SOI_COUNTED_TRANSPOSE, &counts);
     }
     else
-#endif // __AVX__
-    { // N_MU == 8
+#endif // AVX
+    {
+      // FFT each row and write it transposed to alpha_tilde in one pass
       for (cfft_size_t theta = 0; theta < n_mu; ++theta) {
-        for (int s = 0; s < S; s++) {
-          cfft_size_t l = M_hat/d->P;
-
-          d->alpha_tilde[s*l + j*n_mu + theta] =
-            gamma_tilde_dt[S*(j*n_mu + theta) + s];
-        }
+        soi_fft_compute_strided(
+          d->fft_s, v_tmp + S*theta, d->alpha_tilde + j*n_mu + theta, l);
+      }
+      for (int theta = 0; theta < N_MU; theta++) {
+        for (size_t i = 0; i < S; i += CACHE_LINE_LEN)
+          _MM_PREFETCH1(v_tmp + S*(theta + n_mu) + i);
       }
+
+      t3 = __rdtsc();
+      soi_trace_end(d->trace, SOI_TRACE_FFT_S, trace_t2, j);
+      soi_counters_end(d->counters, SOI_COUNTED_FFT_S, &counts);
     }
 
+    soi_imbalance_end(d->imbalance, SOI_IMBALANCE_FFT_S, 0, S, j, j + 1, imbalance_begin);
+
     if (0 == threadid) {
       transpose_clks += __rdtsc() - t3;
       fft_clks += t3 - t2;
     }
   } // for (cfft_size_t j=0; j<K_0; j++)
 
+  if (d->imbalance) {
+    // only analyzed: the loop below waits at its end anyway
+    imbalance_begin = soi_imbalance_begin(d->imbalance);
+#pragma omp barrier
+    soi_imbalance_end(d->imbalance, SOI_IMBALANCE_FFT_S_WAIT, 0, 0, 0, 0, imbalance_begin);
+  }
+
 #pragma omp for
   for (cfft_size_t j = K_0/J_UNROLL_FACTOR*J_UNROLL_FACTOR; j < K_0; j++) {
 	  for (cfft_size_t theta = 0; theta < n_mu; theta++) {
       unsigned long long t1 = __rdtsc();
+      double trace_t1 = soi_trace_begin(d->trace);
+      double imbalance_t1 = soi_imbalance_begin(d->imbalance);
+      soi_counters_begin(d->counters, &counts);
 			cfft_complex_t *v_tmp = gamma_tilde_dt + S*(j*n_mu + theta);
       for (cfft_size_t i = 0; i < S; i += CACHE_LINE_LEN/2) {
-        for (cfft_size_t ii = 0; ii < 2; ii++) {
-          SIMDFPTYPE *in = d->w_dup + i*B*n_mu + theta*(CACHE_LINE_LEN/2) + ii*2;
-          //VAL_TYPE *in_end = d->w_dup + ((i + SIMD_WIDTH/2)*B*n_mu + theta*(CACHE_LINE_LEN/2))*SIMD_WIDTH;
-
-          SIMDFPTYPE xl = _MM_LOAD(in);
-          SIMDFPTYPE xh = _MM_LOAD(in + 1);
-          SIMDFPTYPE ytemp = _MM_LOAD((VAL_TYPE *)(alpha_dt + j*d_mu*S + i) + ii*SIMD_WIDTH);
-          SIMDFPTYPE temp = _MM_FMADDSUB(xl, ytemp, _MM_SWAP_REAL_IMAG(_MM_MUL(xh, ytemp)));
-
-          in += n_mu*(CACHE_LINE_LEN/2);
-
-          for (cfft_size_t kkk = 1; kkk < B; kkk++, in += n_mu*(CACHE_LINE_LEN/2)) {
-            xl = _MM_LOAD(in);
-            xh = _MM_LOAD(in + 1);
-            ytemp = _MM_LOAD((VAL_TYPE *)(alpha_dt + (j*d_mu + kkk)*S + i) + ii*SIMD_WIDTH);
-            temp = _MM_ADD(temp, _MM_FMADDSUB(xl, ytemp, _MM_SWAP_REAL_IMAG(_MM_MUL(xh, ytemp))));
-          }
-          _MM_STORE((VAL_TYPE *)(v_tmp + i) + ii*SIMD_WIDTH, temp);
+        W w(d, i);
+        SIMDFPTYPE x[W::W_VECS], ytemp[VECS_PER_LINE], temp[W::ACC_VECS];
+
+        w.load(theta, x);
+        load_line(ytemp, alpha_dt + layout(j*d_mu, i));
+        W::mul(temp, x, ytemp);
+
+        for (cfft_size_t kkk = 1; kkk < B; kkk++) {
+          w.load(kkk*n_mu + theta, x);
+          load_line(ytemp, alpha_dt + layout(j*d_mu + kkk, i));
+          W::mac(temp, x, ytemp);
         }
+        w.store(v_tmp + i, theta, temp);
       }
 
       unsigned long long t2 = __rdtsc();
+      double trace_t2 = soi_trace_begin(d->trace);
+      soi_trace_end(d->trace, SOI_TRACE_CONV_TILE, trace_t1, j);
+      soi_counters_end(d->counters, SOI_COUNTED_CONV, &counts);
+      soi_counters_begin(d->counters, &counts);
 
-			DftiComputeForward(d->desc_dft_s, v_tmp);
-
-      for (int s = 0; s < S; s++) {
-        cfft_size_t l = M_hat/d->P;
-
-        d->alpha_tilde[s*l + j*n_mu + theta] =
-          gamma_tilde_dt[S*(j*n_mu + theta) + s];
-      }
+      soi_fft_compute_strided(
+        d->fft_s, v_tmp, d->alpha_tilde + j*n_mu + theta, M_hat/d->P);
+      soi_trace_end(d->trace, SOI_TRACE_FFT_S, trace_t2, j);
+      soi_counters_end(d->counters, SOI_COUNTED_FFT_S, &counts);
+      soi_imbalance_end(d->imbalance, SOI_IMBALANCE_TAIL, 0, S, j, j + 1, imbalance_t1);
 
       if (0 == threadid) {
         conv_clks += t2 - t1;
@@ -452,7 +939,10 @@ MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_ghost");
 #endif
 
   }
-  if (0 == rank) {
+  d->stats[SOI_STAT_FSS_CONV] = conv_clks/get_cpu_freq();
+  d->stats[SOI_STAT_FSS_FFT] = fft_clks/get_cpu_freq();
+  d->stats[SOI_STAT_FSS_TRANS] = transpose_clks/get_cpu_freq();
+  if (0 == rank && !d->quiet) {
     printf("\ttime_fss_conv\t%f", conv_clks/get_cpu_freq());
     printf("\ttime_fss_fft\t%f", fft_clks/get_cpu_freq());
     printf("\ttime_fss_trans\t%f", transpose_clks/get_cpu_freq());
@@ -479,9 +969,11 @@ MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_ghost");
 %...alpha_ghost already has b_cnt-1 block of S elements filled up.
 %...so starting address is  b_cnt*S, ending address is b_cnt*S+(B-d_mu)*S-1
 */
+  trace_begin = soi_trace_begin(d->trace);
 MPI_TIMED_SECTION_BEGIN();
 	CFFT_ASSERT_MPI( MPI_Wait(&request_receive, MPI_STATUS_IGNORE) );
-MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_mpi");
+MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_mpi", SOI_STAT_FSS_MPI);
+  soi_trace_end(d->trace, SOI_TRACE_GHOST_WAIT, trace_begin, 0);
 
 /*
 %...now finish the remaining computation of gamma_tilde
@@ -494,36 +986,42 @@ MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "\ttime_fss_mpi");
 */
 MPI_TIMED_SECTION_BEGIN();
 #pragma omp parallel for
-  for (cfft_size_t j=0; j<(M_hat/(P*n_mu))-K_0; j++)
+  for (cfft_size_t j=0; j<(M_hat/(P*n_mu))-K_0; j++) {
+    double trace_begin = soi_trace_begin(d->trace);
+    double imbalance_begin = soi_imbalance_begin(d->imbalance);
     for (cfft_size_t theta=0; theta<n_mu; theta++) {
       cfft_complex_t *v_tmp = gamma_tilde_dt + (K_0*n_mu + j*n_mu + theta)*S;
+      soi_counter_snapshot_t counts;
+      soi_counters_begin(d->counters, &counts);
       for (cfft_size_t i = 0; i < S; i += CACHE_LINE_LEN/2) {
-        for (cfft_size_t ii = 0; ii < 2; ii++) {
-          SIMDFPTYPE xl = _MM_LOAD(d->w_dup + i*B*n_mu + theta*(CACHE_LINE_LEN/2) + ii*2);
-          SIMDFPTYPE xh = _MM_LOAD(d->w_dup + i*B*n_mu + theta*(CACHE_LINE_LEN/2) + ii*2 + 1);
-          SIMDFPTYPE ytemp = _MM_LOAD((VAL_TYPE *)(d->alpha_ghost + j*d_mu*S + i) + ii*SIMD_WIDTH);
-          SIMDFPTYPE temp = _MM_FMADDSUB(xl, ytemp, _MM_SWAP_REAL_IMAG(_MM_MUL(xh, ytemp)));
-
-          for (cfft_size_t kkk=1; kkk<B; kkk++) {
-            xl = _MM_LOAD(d->w_dup + i*B*n_mu + (kkk*n_mu + theta)*(CACHE_LINE_LEN/2) + ii*2);
-            xh = _MM_LOAD(d->w_dup + i*B*n_mu + (kkk*n_mu + theta)*(CACHE_LINE_LEN/2) + ii*2 + 1);
-            ytemp = _MM_LOAD((VAL_TYPE *)(d->alpha_ghost + (j*d_mu + kkk)*S + i) + ii*SIMD_WIDTH);
-            temp = _MM_ADD(temp, _MM_FMADDSUB(xl, ytemp, _MM_SWAP_REAL_IMAG(_MM_MUL(xh, ytemp))));
-          }
-          _MM_STORE((VAL_TYPE *)(v_tmp + i) + ii*SIMD_WIDTH, temp);
+        W w(d, i);
+        SIMDFPTYPE x[W::W_VECS], ytemp[VECS_PER_LINE], temp[W::ACC_VECS];
+
+        w.load(theta, x);
+        load_line(ytemp, d->alpha_ghost + j*d_mu*S + i);
+        W::mul(temp, x, ytemp);
+
+        for (cfft_size_t kkk=1; kkk<B; kkk++) {
+          w.load(kkk*n_mu + theta, x);
+          load_line(ytemp, d->alpha_ghost + (j*d_mu + kkk)*S + i);
+          W::mac(temp, x, ytemp);
         }
+        w.store(v_tmp + i, theta, temp);
       }
 
-      DftiComputeForward(d->desc_dft_s, v_tmp);
-
-      for (int s = 0; s < S; s++) {
-        cfft_size_t l = M_hat/d->P;
+      soi_counters_end(d->counters, SOI_COUNTED_CONV, &counts);
+      soi_counters_begin(d->counters, &counts);
 
-        d->alpha_tilde[s*l + (K_0 + j)*n_mu + theta] = v_tmp[s];
-      }
+      soi_fft_compute_strided(
+        d->fft_s, v_tmp, d->alpha_tilde + (K_0 + j)*n_mu + theta, M_hat/d->P);
+      soi_counters_end(d->counters, SOI_COUNTED_FFT_S, &counts);
     }
+    soi_trace_end(d->trace, SOI_TRACE_CONV_LAST, trace_begin, K_0 + j);
+    soi_imbalance_end(
+      d->imbalance, SOI_IMBALANCE_LAST, 0, S, K_0 + j, K_0 + j + 1, imbalance_begin);
+  }
 	CFFT_ASSERT_MPI( MPI_Wait(&request_send, MPI_STATUS_IGNORE) );
-MPI_TIMED_SECTION_END(d->comm, "\ttime_fss_last");
+MPI_TIMED_SECTION_END(d->comm, "\ttime_fss_last", SOI_STAT_FSS_LAST);
 }
 
 extern "C"
@@ -531,20 +1029,208 @@ extern "C"
 extern void parallel_filter_subsampling_n_mu_8(soi_desc_t * d, cfft_complex_t * alpha_dt);
 }
 
-__declspec(noinline)
-void parallel_filter_subsampling(soi_desc_t * d, cfft_complex_t * alpha_dt)
+#ifdef __AVX512F__
+#define REG_BLOCK_SIZE 30 // use at most 30 SIMD registers out of 32
+#else
+#define REG_BLOCK_SIZE 14 // use at most 14 SIMD registers out of 16
+#endif
+
+// theta unroll factor that uses the whole register block, and the matching
+// j unroll factor
+#define DEFAULT_THETA_UNROLL(n_mu) ((n_mu) <= REG_BLOCK_SIZE ? (n_mu) : REG_BLOCK_SIZE)
+#define DEFAULT_J_UNROLL(n_mu) \
+  (REG_BLOCK_SIZE/DEFAULT_THETA_UNROLL(n_mu) < 1 ? 1 : REG_BLOCK_SIZE/DEFAULT_THETA_UNROLL(n_mu))
+
+typedef void (*filter_fn_t)(soi_desc_t *d, cfft_complex_t *alpha_dt);
+typedef double (*time_conv_fn_t)(
+  soi_desc_t *d, const cfft_complex_t *alpha, cfft_size_t K,
+  const soi_conv_config_t *config);
+
+enum
+{
+  WINDOW_INTERLEAVED, WINDOW_SPLIT, WINDOW_OTF, WINDOW_FLOAT,
+  // with use_compensated_sum, which init_soi_descriptor doesn't allow with
+  // the float window
+  WINDOW_COMPENSATED_INTERLEAVED, WINDOW_COMPENSATED_SPLIT, WINDOW_COMPENSATED_OTF,
+  NUM_WINDOW_POLICIES
+};
+
+static int window_policy(const soi_desc_t *d)
 {
-  if (5 == d->n_mu && 4 == d->d_mu) {
-    parallel_filter_subsampling<5, 4>(d, alpha_dt);
+  if (SOI_WINDOW_OTF == d->window_mode) {
+    return d->use_compensated_sum ? WINDOW_COMPENSATED_OTF : WINDOW_OTF;
   }
-  else if (8 == d->n_mu && 7 == d->d_mu) {
-    parallel_filter_subsampling<8, 7>(d, alpha_dt);
+  if (SOI_WINDOW_PRECISION_FLOAT == d->window_precision) return WINDOW_FLOAT;
+  if (d->use_compensated_sum) {
+    return d->use_split_complex ? WINDOW_COMPENSATED_SPLIT : WINDOW_COMPENSATED_INTERLEAVED;
   }
-  else {
+  return d->use_split_complex ? WINDOW_SPLIT : WINDOW_INTERLEAVED;
+}
+
+#ifdef SOI_HAS_SPLIT_COMPLEX
+#define SPLIT_WINDOW_FN(fn, n_mu, d_mu, theta_unroll, j_unroll) \
+  fn<n_mu, d_mu, theta_unroll, j_unroll, split_window>
+#define COMPENSATED_SPLIT_WINDOW_FN(fn, n_mu, d_mu, theta_unroll, j_unroll) \
+  fn<n_mu, d_mu, theta_unroll, j_unroll, compensated<split_window> >
+#else
+#define SPLIT_WINDOW_FN(fn, n_mu, d_mu, theta_unroll, j_unroll) NULL
+#define COMPENSATED_SPLIT_WINDOW_FN(fn, n_mu, d_mu, theta_unroll, j_unroll) NULL
+#endif
+
+#if PRECISION == 2
+#define FLOAT_WINDOW_FN(fn, n_mu, d_mu, theta_unroll, j_unroll) \
+  fn<n_mu, d_mu, theta_unroll, j_unroll, float_window>
+#else
+#define FLOAT_WINDOW_FN(fn, n_mu, d_mu, theta_unroll, j_unroll) NULL
+#endif
+
+/*
+%..Register blocking variants compiled in for the autotuner.
+%..The theta unroll factor must divide n_mu. The first variant of each
+%..(n_mu, d_mu) is the default used when the autotuner is off.
+%..Functions are indexed by window_policy.
+*/
+static const struct conv_variant
+{
+  int n_mu, d_mu, theta_unroll, j_unroll;
+  filter_fn_t filter[NUM_WINDOW_POLICIES];
+  time_conv_fn_t time_conv[NUM_WINDOW_POLICIES];
+} conv_variants[] = {
+#define CONV_VARIANT(n_mu, d_mu, theta_unroll, j_unroll) \
+  { n_mu, d_mu, theta_unroll, j_unroll, \
+    { parallel_filter_subsampling<n_mu, d_mu, theta_unroll, j_unroll, interleaved_window>, \
+      SPLIT_WINDOW_FN(parallel_filter_subsampling, n_mu, d_mu, theta_unroll, j_unroll), \
+      parallel_filter_subsampling<n_mu, d_mu, theta_unroll, j_unroll, otf_window>, \
+      FLOAT_WINDOW_FN(parallel_filter_subsampling, n_mu, d_mu, theta_unroll, j_unroll), \
+      parallel_filter_subsampling<n_mu, d_mu, theta_unroll, j_unroll, compensated<interleaved_window> >, \
+      COMPENSATED_SPLIT_WINDOW_FN(parallel_filter_subsampling, n_mu, d_mu, theta_unroll, j_unroll), \
+      parallel_filter_subsampling<n_mu, d_mu, theta_unroll, j_unroll, compensated<otf_window> > }, \
+    { time_conv<n_mu, d_mu, theta_unroll, j_unroll, interleaved_window>, \
+      SPLIT_WINDOW_FN(time_conv, n_mu, d_mu, theta_unroll, j_unroll), \
+      time_conv<n_mu, d_mu, theta_unroll, j_unroll, otf_window>, \
+      FLOAT_WINDOW_FN(time_conv, n_mu, d_mu, theta_unroll, j_unroll), \
+      time_conv<n_mu, d_mu, theta_unroll, j_unroll, compensated<interleaved_window> >, \
+      COMPENSATED_SPLIT_WINDOW_FN(time_conv, n_mu, d_mu, theta_unroll, j_unroll), \
+      time_conv<n_mu, d_mu, theta_unroll, j_unroll, compensated<otf_window> > } }
+  CONV_VARIANT(5, 4, DEFAULT_THETA_UNROLL(5), DEFAULT_J_UNROLL(5)),
+  CONV_VARIANT(5, 4, 5, 1),
+  CONV_VARIANT(5, 4, 5, 2),
+  CONV_VARIANT(5, 4, 5, 4),
+  CONV_VARIANT(5, 4, 1, 4),
+  CONV_VARIANT(5, 4, 1, 8),
+
+  CONV_VARIANT(8, 7, DEFAULT_THETA_UNROLL(8), DEFAULT_J_UNROLL(8)),
+  CONV_VARIANT(8, 7, 8, 1),
+  CONV_VARIANT(8, 7, 8, 2),
+  CONV_VARIANT(8, 7, 4, 1),
+  CONV_VARIANT(8, 7, 4, 2),
+  CONV_VARIANT(8, 7, 2, 4),
+#undef CONV_VARIANT
+};
+
+static const int NUM_CONV_VARIANTS = sizeof(conv_variants)/sizeof(conv_variants[0]);
+
+/*
+%..@return the variant for d->n_mu, d->d_mu and the unroll factors of
+%..config, the default variant if config has none, or NULL if n_mu and d_mu
+%..are not supported
+*/
+static const conv_variant *find_conv_variant(soi_desc_t *d, const soi_conv_config_t *config)
+{
+  const conv_variant *dflt = NULL;
+  for (int i = 0; i < NUM_CONV_VARIANTS; ++i) {
+    const conv_variant *v = conv_variants + i;
+    if (v->n_mu != d->n_mu || v->d_mu != d->d_mu) continue;
+    if (NULL == dflt) dflt = v;
+    if (v->theta_unroll == config->theta_unroll && v->j_unroll == config->j_unroll) return v;
+  }
+  return dflt;
+}
+
+__declspec(noinline)
+void SOI_ISA_FN(parallel_filter_subsampling)(soi_desc_t * d, cfft_complex_t * alpha_dt)
+{
+  const conv_variant *v = find_conv_variant(d, &d->conv_config);
+  if (NULL == v) {
     if (0 == d->rank) {
       fprintf(stderr, "Unsupported n_mu and d_mu. Try n_mu=5 && d_mu=4 or n_mu=8 && d_mu=7\n");
     }
     exit(-1);
     assert(0);
   }
+  assert(v->filter[window_policy(d)]);
+  v->filter[window_policy(d)](d, alpha_dt);
+}
+
+int SOI_ISA_FN(conv_variants)(soi_desc_t *d, soi_conv_config_t *configs, int max)
+{
+  int n = 0;
+  for (int i = 0; i < NUM_CONV_VARIANTS && n < max; ++i) {
+    const conv_variant *v = conv_variants + i;
+    if (v->n_mu != d->n_mu || v->d_mu != d->d_mu) continue;
+
+    int dup = 0;
+    for (int j = 0; j < n; ++j) {
+      dup |= configs[j].theta_unroll == v->theta_unroll && configs[j].j_unroll == v->j_unroll;
+    }
+    if (dup) continue;
+
+    configs[n].theta_unroll = v->theta_unroll;
+    configs[n].j_unroll = v->j_unroll;
+    configs[n].i_tile = 1;
+    configs[n].j_block = 0;
+    configs[n].prefetch_rows = 0;
+    configs[n].prefetch_window = 0;
+    ++n;
+  }
+  return n;
+}
+
+double SOI_ISA_FN(time_conv)(
+  soi_desc_t *d, const cfft_complex_t *alpha, cfft_size_t K,
+  const soi_conv_config_t *config)
+{
+  const conv_variant *v = find_conv_variant(d, config);
+  assert(v && v->theta_unroll == config->theta_unroll && v->j_unroll == config->j_unroll);
+  return v->time_conv[window_policy(d)](d, alpha, K, config);
+}
+
+void SOI_ISA_FN(init_w_dup)(soi_desc_t *d)
+{
+  cfft_size_t S = d->k*d->P;
+  cfft_size_t B = d->B;
+  cfft_size_t n_mu = d->n_mu;
+
+#pragma omp parallel for
+  for (cfft_size_t i = 0; i < S; i += CACHE_LINE_LEN/2) {
+    for (cfft_size_t j = 0; j < B*n_mu; j++) { // j = kkk*n_mu + theta
+      for (int v = 0; v < VECS_PER_LINE; v++) {
+        SIMDFPTYPE temp = _MM_LOADU((VAL_TYPE *)(d->w + i*B*n_mu + j*(CACHE_LINE_LEN/2)) + v*SIMD_WIDTH);
+        _MM_STOREU(W_DUP_LINE(d, i) + j*W_DUP_PER_LINE + 2*v, _MM_MOVELDUP(temp));
+        _MM_STOREU(W_DUP_LINE(d, i) + j*W_DUP_PER_LINE + 2*v + 1, _MM_MOVEHDUP(temp));
+      }
+    }
+  }
+}
+
+void SOI_ISA_FN(demodulate)(
+  cfft_complex_t *out, const cfft_complex_t *in,
+  const cfft_complex_t *W_inv, cfft_size_t M, int stream)
+{
+  cfft_size_t i = 0;
+  // peel until out is aligned for aligned or streaming stores
+  for ( ; i < M && (size_t)(out + i)%(SIMD_WIDTH*sizeof(VAL_TYPE)); i++) {
+    out[i] = W_inv[i]*in[i];
+  }
+  for ( ; i + SIMD_WIDTH/2 <= M; i += SIMD_WIDTH/2) {
+    SIMDFPTYPE xtemp = _MM_LOADU((VAL_TYPE *)(W_inv + i));
+    SIMDFPTYPE xl = _MM_MOVELDUP(xtemp);
+    SIMDFPTYPE xh = _MM_MOVEHDUP(xtemp);
+    SIMDFPTYPE ytemp = _MM_LOADU((VAL_TYPE *)(in + i));
+    SIMDFPTYPE temp = _MM_FMADDSUB(xl, ytemp, _MM_SWAP_REAL_IMAG(_MM_MUL(xh, ytemp)));
+    store_or_stream(out + i, temp, stream);
+  }
+  for ( ; i < M; i++) {
+    out[i] = W_inv[i]*in[i];
+  }
 }
@@ -0,0 +1,164 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+
+#include "soi.h"
+
+/*
+ * Analytic performance model of SOI and of the Cooley-Tukey distributed
+ * FFTs (MKL cluster DFT, FFTW-MPI) it's compared against.
+ *
+ * Per rank, with L = N/P, mu = n_mu/d_mu, S = k*P, M_hat = mu*N/S, and
+ * l = M_hat/P:
+ *   conv       = mu*L*B/conv_rate
+ *                + window table traffic if it doesn't fit in the cache:
+ *                  (M/P/d_mu block rows)*(2*B*S*n_mu complex)/mem_bandwidth
+ *   fft_s      = 5*mu*L*log2(S)/fft_batch_rate
+ *   fft_m_hat  = 5*mu*L*log2(M_hat)/fft_rate
+ *   demodulate = 3*L complex/mem_bandwidth (W_inv, input, output)
+ *   ghost      = net_latency + (B - d_mu)*S complex/net_bandwidth
+ *   all_to_all = k*(P - 1)*(net_latency + l complex/net_bandwidth)
+ * combined by soi_pipelined_time. A Cooley-Tukey transform does three
+ * all-to-alls of L complex (the six-step algorithm with the output in
+ * order), 5*L*log2(N) flops of local FFTs at fft_rate, and two passes
+ * over the local data for the twiddles and local transposes.
+ *
+ * The rates are fitted to the stages of a trial run (soi_time_stages) of
+ * the descriptor the model is calibrated with, so they include what the
+ * flop counts miss at those sizes (e.g. FFT efficiency changes with n),
+ * and can be refitted to the measured stages of real runs
+ * (soi_measured_times). The memory bandwidth and the network come
+ * from micro-benchmarks, and the network can be overridden for what-if
+ * questions on other machines.
+ */
+
+#define PING_PONG_REPS 8
+#define PING_PONG_SMALL 1 // complex elements
+#define PING_PONG_LARGE (1 << 18)
+
+double soi_pipelined_time(const soi_time_breakdown_t *b, cfft_size_t k)
+{
+  // the first segment's all-to-all is exposed, and later ones progress
+  // while earlier segments are transformed
+  double fused = b->fft_m_hat + b->demodulate;
+  return
+    b->ghost + b->conv + b->fft_s +
+    MAX(b->all_to_all, fused) + MIN(b->all_to_all, fused)/k;
+}
+
+/**
+ * Measure the latency and bandwidth of messages between ranks 0 and 1 by
+ * ping-pong, and broadcast them
+ */
+static void measure_network(soi_machine_model_t *m, MPI_Comm comm)
+{
+  int rank, P;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &P);
+  if (1 == P) {
+    // the all-to-all is a local copy
+    m->net_latency = 0;
+    m->net_bandwidth = m->mem_bandwidth/2;
+    return;
+  }
+
+  cfft_complex_t *buf = (cfft_complex_t *)malloc(sizeof(cfft_complex_t)*PING_PONG_LARGE);
+  memset(buf, 0, sizeof(cfft_complex_t)*PING_PONG_LARGE);
+  double times[2];
+  int sizes[2] = { PING_PONG_SMALL, PING_PONG_LARGE };
+  for (int s = 0; s < 2; ++s) {
+    times[s] = DBL_MAX;
+    for (int r = 0; r < PING_PONG_REPS; ++r) {
+      MPI_Barrier(comm);
+      double t = MPI_Wtime();
+      if (0 == rank) {
+        MPI_Send(buf, 2*sizes[s], MPI_TYPE, 1, 0, comm);
+        MPI_Recv(buf, 2*sizes[s], MPI_TYPE, 1, 0, comm, MPI_STATUS_IGNORE);
+      }
+      else if (1 == rank) {
+        MPI_Recv(buf, 2*sizes[s], MPI_TYPE, 0, 0, comm, MPI_STATUS_IGNORE);
+        MPI_Send(buf, 2*sizes[s], MPI_TYPE, 0, 0, comm);
+      }
+      times[s] = MIN(times[s], (MPI_Wtime() - t)/2);
+    }
+  }
+  free(buf);
+  MPI_Bcast(times, 2, MPI_DOUBLE, 0, comm);
+
+  m->net_latency = times[0];
+  double bytes = sizeof(cfft_complex_t)*(double)(PING_PONG_LARGE - PING_PONG_SMALL);
+  m->net_bandwidth = bytes/MAX(times[1] - times[0], DBL_MIN);
+}
+
+/**
+ * @return seconds the convolution spends streaming the window table when
+ *         it doesn't fit in the last level cache
+ */
+static double window_table_time(
+  const soi_machine_model_t *m, cfft_size_t N, int P, cfft_size_t k,
+  int n_mu, int d_mu, cfft_size_t B)
+{
+  cfft_size_t S = k*P;
+  double table_bytes = 2.0*sizeof(cfft_complex_t)*B*S*n_mu;
+  if (table_bytes <= m->llc_size) return 0;
+  double rows = (double)N/S/P/d_mu;
+  return rows*table_bytes/m->mem_bandwidth;
+}
+
+void soi_fit_machine_model(
+  soi_machine_model_t *m, const soi_desc_t *d, const soi_time_breakdown_t *t)
+{
+  double L = (double)d->N/d->P, mu = (double)d->n_mu/d->d_mu;
+  double S = d->k*d->P, M_hat = mu*d->N/S;
+
+  double conv = t->conv - window_table_time(m, d->N, d->P, d->k, d->n_mu, d->d_mu, d->B);
+  if (conv > 0) m->conv_rate = mu*L*d->B/conv;
+  if (t->fft_s > 0) m->fft_batch_rate = 5*mu*L*log2(S)/t->fft_s;
+  if (t->fft_m_hat > 0) m->fft_rate = 5*mu*L*log2(M_hat)/t->fft_m_hat;
+}
+
+void soi_calibrate_machine_model(soi_machine_model_t *m, const soi_desc_t *d)
+{
+  m->threads = omp_get_max_threads();
+  m->llc_size = get_llc_size();
+  m->mem_bandwidth = get_memory_bandwidth();
+  // every rank takes the slowest
+  MPI_Allreduce(MPI_IN_PLACE, &m->mem_bandwidth, 1, MPI_DOUBLE, MPI_MIN, d->comm);
+  measure_network(m, d->comm);
+
+  m->conv_rate = m->fft_batch_rate = m->fft_rate = NAN;
+  soi_time_breakdown_t t = soi_time_stages(d);
+  if (!isnan(t.total)) soi_fit_machine_model(m, d, &t);
+}
+
+soi_time_breakdown_t soi_predict_time(
+  const soi_machine_model_t *m, cfft_size_t N, int P, cfft_size_t k,
+  int n_mu, int d_mu, cfft_size_t B)
+{
+  double L = (double)N/P, mu = (double)n_mu/d_mu;
+  double S = k*P, M_hat = mu*N/S, l = M_hat/P;
+  double c = sizeof(cfft_complex_t);
+
+  soi_time_breakdown_t b;
+  b.conv = mu*L*B/m->conv_rate + window_table_time(m, N, P, k, n_mu, d_mu, B);
+  b.fft_s = 5*mu*L*log2(S)/m->fft_batch_rate;
+  b.fft_m_hat = 5*mu*L*log2(M_hat)/m->fft_rate;
+  b.demodulate = 3*c*L/m->mem_bandwidth;
+  b.ghost = m->net_latency + c*(B - d_mu)*S/m->net_bandwidth;
+  b.all_to_all = k*(P - 1)*(m->net_latency + c*l/m->net_bandwidth);
+  b.total = soi_pipelined_time(&b, k);
+  return b;
+}
+
+double soi_predict_cooley_tukey_time(const soi_machine_model_t *m, cfft_size_t N, int P)
+{
+  double L = (double)N/P, c = sizeof(cfft_complex_t);
+  double all_to_all = (P - 1)*(m->net_latency + c*L/P/m->net_bandwidth);
+  return
+    3*all_to_all + 5*L*log2((double)N)/m->fft_rate +
+    2*2*c*L/m->mem_bandwidth;
+}
@@ -3,14 +3,24 @@
 #include <limits.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <float.h>
 
 #include <omp.h>
 
+#ifdef SOI_USE_MKL
 #include <mkl.h>
+#endif
 
 #include "soi.h"
 #include "compress.h"
+#include "fft_builtin.h"
+#include "isa.h"
+
+// SNR (dB) we're willing to give up for halving the window table
+#define MAX_FLOAT_WINDOW_SNR_LOSS 0.5
+// 64 block rows of a cache line of S are a 4 KB page
+#define MAX_INPUT_TILE_ROWS 64
 
 /*
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
@@ -50,14 +60,7 @@ static cfft_complex_t w_f(cfft_size_t i, const soi_desc_t *desc)
   cfft_size_t j = i%(desc->B*S);
 
   double t = ((double)theta/M_hat - (double)j/desc->N + (double)kappa/(2*M))*M;
-  double y;
-
-  if (t == 0) {
-    y = 1;
-  }
-  else {
-    y = sinl(VERIFY_PI*desc->tau*t)/(PI*desc->tau*t)*exp(-PI*PI*t*t/desc->sigma);
-  }
+  double y = soi_window_envelope(t, desc);
 
   cfft_complex_t r = cosl(VERIFY_PI*t) + I*sinl(VERIFY_PI*t);
 
@@ -65,20 +68,101 @@ static cfft_complex_t w_f(cfft_size_t i, const soi_desc_t *desc)
   return r*y/mu;
 }
 
-static cfft_complex_t W_inv_f(cfft_size_t i, const soi_desc_t *desc)
+/**
+ * @param W W(i/M - 1/2) from soi_window_response_table
+ */
+static cfft_complex_t W_inv_f(cfft_size_t i, double W, const soi_desc_t *desc)
 {
   cfft_size_t S = desc->k*desc->P; // total number of segments
 	cfft_size_t M = desc->N/S;
 
-  double t = (double)i/M - 0.5;
-
-  double y = 1/(2*desc->tau)*(erfc(sqrt(desc->sigma)*(t - desc->tau/2)) - erfc(sqrt(desc->sigma)*(t + desc->tau/2)));
-
   cfft_size_t kappa = desc->B - desc->d_mu;
   double delta = (double)kappa / (2*M);
   cfft_complex_t r = cosl(2*VERIFY_PI*delta*i) - I*sinl(2*VERIFY_PI*delta*i);
 
-  return r/y;
+  return r/W;
+}
+
+/*
+ * Window parameters and the SNR (dB) they achieve, used to predict the
+ * accuracy in init_soi_descriptor. Besides the default parameters, the
+ * following parameters also can be used.
+ * Pareto optimal points are marked with *.
+ * Overall, given the same mu (oversampling factor), higher B gives higher
+ * accuracy and we should also increase tau and sigma together
+ * With higher mu, we can get a similar accuracy with smaller B. This basically
+ * trade-offs more communication for less computation
+ */
+static const struct
+{
+  double mu, tau, sigma;
+  int B;
+  double snr;
+} window_snr_table[] = {
+  // mu  | tau | sigma | B | SNR (dB)
+  { 1.25, 872/1024., 313.1715, 76, 289.2718 }, // *
+  { 1.25, 928/1024., 373.7314, 72, 288.1844 }, // *
+  { 1.25, 818/1024., 267.4513, 64, 284.7614 }, // *
+  { 1.25, 0.899, 352.7647081, 60, 282 }, // *
+  { 1.25, 764/1024., 213.2893, 60, 275.246 },
+  { 1.25, 709/1024., 201.8235, 56, 266.6957 }, // *
+  { 1.25, 0.782, 245.8927353, 54, 259 }, // *
+  { 1.25, 652/1024., 176.9743, 54, 258.2814 },
+  { 1.25, 591/1024., 154.7071, 50, 247.7459 },
+  { 1.25, 512/1024., 121.0936, 44, 241.8972 }, // *
+  { 1.25, 0.664, 182.5254421, 46, 239 },
+  { 1.25, 0.578, 155.3322, 44, 233 },
+  { 1.25, 0.531, 136.5983707, 41, 220 }, // *
+  { 1.25, 383/1024., 104.1262, 42, 219.777 },
+  { 1.25, 0.4476, 119.2272, 38, 213 }, // *
+  { 1.25, 299/1024., 90.5391, 38, 210.1298 },
+  { 1.25, 0.373, 102.1115361, 36, 200 }, // *
+  { 1.25, 0.2927, 90.7306, 32, 193 }, // *
+  { 1.25, 0.154, 73.2102363, 30, 179 }, // *
+
+  { 1.125, 0.7238, 476.8683, 76, 213 }, // *
+  { 1.125, 0.6476, 363.891, 66, 193 }, // *
+
+  { 1.5, 931/1024., 109.0712, 36, 289.6294 }, // *
+  { 1.5, 832/1024., 93.4329, 38, 289.4688 },
+  { 1.5, 0.0554, 36.6513, 22, 235 }, // *
+};
+
+/**
+ * @return the SNR (dB) in window_snr_table of d's window parameters, NAN if
+ *         they're not there
+ */
+static double window_truncation_snr(const soi_desc_t *d)
+{
+  if (SOI_WINDOW_GAUSSIAN_SINC != d->window_family) return NAN;
+  double mu = (double)d->n_mu/d->d_mu;
+  for (int i = 0; i < sizeof(window_snr_table)/sizeof(window_snr_table[0]); ++i) {
+    if (fabs(window_snr_table[i].mu - mu) < 1e-9 &&
+        window_snr_table[i].B == d->B &&
+        fabs(window_snr_table[i].tau - d->tau) < 1e-6 &&
+        fabs(window_snr_table[i].sigma - d->sigma) < 1e-6*d->sigma) {
+      return window_snr_table[i].snr;
+    }
+  }
+  return NAN;
+}
+
+/**
+ * @return the power of the error from rounding the window table to float,
+ *         relative to the power of the window
+ */
+static double float_window_noise(const soi_desc_t *d)
+{
+  cfft_size_t n = d->B*d->k*d->P*d->n_mu;
+  double err = 0, sig = 0;
+#pragma omp parallel for reduction(+:err,sig)
+  for (cfft_size_t i = 0; i < n; ++i) {
+    double re = __real__(d->w[i]), im = __imag__(d->w[i]);
+    double re_err = re - (float)re, im_err = im - (float)im;
+    err += re_err*re_err + im_err*im_err;
+    sig += re*re + im*im;
+  }
+  return err/sig;
 }
 
 void set_default_soi_descriptor(soi_desc_t *desc)
@@ -89,58 +173,172 @@ void set_default_soi_descriptor(soi_desc_t *desc)
   desc->tau = 928/1024.; // divide with a power of 2 to be exact in binary representation
   desc->sigma = 373.7314;
   desc->B = 72;
+  desc->window_family = SOI_WINDOW_GAUSSIAN_SINC;
+  desc->window_beta = 0;
+  // see window_snr_table for other parameters, or set target_snr to have
+  // soi_plan_window choose them
 
   desc->use_vlc = 0;
   desc->comm_to_comp_cost_ratio = 1;
+  desc->target_snr = 0;
+  desc->target_max_err = 0;
+  desc->fft_backend = SOI_FFT_DEFAULT_BACKEND;
+  desc->use_fft_codelet = -1;
+  desc->isa = SOI_ISA_AUTO;
+  desc->use_split_complex = 0;
+  desc->use_compensated_sum = 0;
+  desc->window_mode = SOI_WINDOW_AUTO;
+  desc->window_precision = SOI_WINDOW_PRECISION_AUTO;
+  desc->store_policy.conv = SOI_STORE_AUTO;
+  desc->store_policy.transpose = SOI_STORE_AUTO;
+  desc->store_policy.decompress = SOI_STORE_AUTO;
+  desc->store_policy.demodulate = SOI_STORE_AUTO;
+  desc->input_layout = SOI_INPUT_ROW_MAJOR;
+  desc->input_tile_rows = 0;
+  memset(&desc->conv_config, 0, sizeof(desc->conv_config));
+  desc->wisdom_file = NULL;
+  desc->quiet = 0;
+  desc->trace = NULL;
+  desc->counters = NULL;
+  desc->comm_profile = NULL;
+  desc->imbalance = NULL;
+  desc->thread_weights = NULL;
+  desc->energy = NULL;
+  desc->metrics = NULL;
+  memset(desc->stats, 0, sizeof(desc->stats));
 #ifdef SOI_USE_FFTW
-  desc->use_fftw = 0;
   desc->fftw_flags = FFTW_ESTIMATE;
 #endif
 
   desc->alpha_tilde = NULL;
   desc->beta_tilde = NULL;
   desc->gamma_tilde = NULL;
+}
+
+void soi_split_complex_lines(cfft_complex_t *out, const cfft_complex_t *in, cfft_size_t n)
+{
+#pragma omp parallel for
+  for (cfft_size_t i = 0; i < n; i += CACHE_LINE_LEN/2) {
+    VAL_TYPE line[CACHE_LINE_LEN];
+    for (int c = 0; c < CACHE_LINE_LEN/2; c++) {
+      line[c] = __real__(in[i + c]);
+      line[CACHE_LINE_LEN/2 + c] = __imag__(in[i + c]);
+    }
+    memcpy(out + i, line, sizeof(line));
+  }
+}
+
+void soi_tile_input(const soi_desc_t *d, cfft_complex_t *out, const cfft_complex_t *in)
+{
+  cfft_size_t S = d->k*d->P;
+  cfft_size_t rows = d->N/S/d->P;
+  // write out sequentially
+#pragma omp parallel for collapse(2)
+  for (cfft_size_t r0 = 0; r0 < rows; r0 += d->input_tile_rows) {
+    for (cfft_size_t i = 0; i < S; i += CACHE_LINE_LEN/2) {
+      for (cfft_size_t r = r0; r < r0 + d->input_tile_rows; ++r) {
+        memcpy(
+          out + soi_input_index(d, r, i), in + r*S + i,
+          sizeof(cfft_complex_t)*(CACHE_LINE_LEN/2));
+      }
+    }
+  }
+}
+
+/**
+ * Resolve input_tile_rows of SOI_INPUT_TILED and check it
+ */
+static void resolve_input_layout(soi_desc_t *d)
+{
+  if (SOI_INPUT_TILED != d->input_layout) {
+    d->input_tile_rows = 1;
+    return;
+  }
+  cfft_size_t rows = d->N/(d->k*d->P)/d->P;
+  int R = d->input_tile_rows;
+  if (0 == R) {
+    for (R = 1; R < MAX_INPUT_TILE_ROWS && rows%(2*R) == 0; R *= 2);
+  }
+  if (R <= 0 || (R & (R - 1)) || rows%R) {
+    if (0 == d->rank) {
+      fprintf(
+        stderr, "input_tile_rows=%d must be a power of 2 dividing M/P=%ld\n",
+        R, (long)rows);
+    }
+    exit(-1);
+  }
+  d->input_tile_rows = R;
+}
+
+/**
+ * Resolve SOI_STORE_AUTO: stream if the bytes written by a stage before
+ * they're read again don't fit in half of the last level cache (the other
+ * half is for what the stage reads)
+ */
+static void resolve_store(soi_store_t *store, size_t bytes)
+{
+  if (SOI_STORE_AUTO == *store) {
+    *store = bytes > get_llc_size()/2 ? SOI_STORE_STREAM : SOI_STORE_REGULAR;
+  }
+}
 
-// The following parameters also can be used.
-// Pareto optimal points are marked with *.
-// Overall, given the same mu (oversampling factor), higher B gives higher
-// accuracy and we should also increase tau and sigma together
-// With higher mu, we can get a similar accuracy with smaller B. This basically
-// trade-offs more communication for less computation
-
-// mu    | tau      | sigma       | B  | SNR (dB)
-// 1.25  | 872/1024 | 313.1715    | 76 | 289.2718 *
-// 1.25  | 928/1024 | 373.7314    | 72 | 288.1844 *
-// 1.25  | 818/1024 | 267.4513    | 64 | 284.7614 *
-// 1.25  | 0.899    | 352.7647081 | 60 | 282 *
-// 1.25  | 764/1024 | 213.2893    | 60 | 275.246
-// 1.25  | 709/1024 | 201.8235    | 56 | 266.6957 *
-// 1.25  | 0.782    | 245.8927353 | 54 | 259 *
-// 1.25  | 652/1024 | 176.9743    | 54 | 258.2814
-// 1.25  | 591/1024 | 154.7071    | 50 | 247.7459
-// 1.25  | 512/1024 | 121.0936    | 44 | 241.8972 *
-// 1.25  | 0.664    | 182.5254421 | 46 | 239
-// 1.25  | 0.578    | 155.3322    | 44 | 233
-// 1.25  | 0.531    | 136.5983707 | 41 | 220 *
-// 1.25  | 383/1024 | 104.1262    | 42 | 219.777
-// 1.25  | 0.4476   | 119.2272    | 38 | 213 *
-// 1.25  | 299/1024 |  90.5391    | 38 | 210.1298
-// 1.25  | 0.373    | 102.1115361 | 36 | 200 *
-// 1.25  | 0.2927   |  90.7306    | 32 | 193 *
-// 1.25  | 0.154    |  73.2102363 | 30 | 179 *
-
-// 1.125 | 0.7238   | 476.8683    | 76 | 213 *
-// 1.125 | 0.6476   | 363.891     | 66 | 193 *
-
-// 1.5   | 931/1024 | 109.0712    | 36 | 289.6294 *
-// 1.5   | 832/1024 |  93.4329    | 38 | 289.4688
-// 1.5   | 0.0554   |  36.6513    | 22 | 235 *
+static void resolve_store_policy(soi_desc_t *d)
+{
+  cfft_size_t S = d->k*d->P;
+  cfft_size_t M = d->N/S;
+  cfft_size_t M_hat = d->n_mu*M/d->d_mu;
+
+  // the whole gamma_tilde is computed before the S-point FFTs
+  resolve_store(&d->store_policy.conv, sizeof(cfft_complex_t)*M_hat*d->k);
+  resolve_store(&d->store_policy.transpose, sizeof(cfft_complex_t)*M_hat*d->k);
+  // one segment at a time
+  resolve_store(&d->store_policy.decompress, sizeof(cfft_complex_t)*M_hat);
+  // the output is read by the caller after compute_soi returns
+  resolve_store(&d->store_policy.demodulate, sizeof(cfft_complex_t)*M*d->k);
+}
+
+/**
+ * Time n_mu S-point FFTs of gamma_tilde rows written transposed into
+ * alpha_tilde as done by the filter stage.
+ * @return the minimum time in seconds over a few repetitions
+ */
+static double time_s_fft(soi_desc_t *d, soi_fft_plan_t *p)
+{
+  cfft_size_t S = d->k*d->P;
+  cfft_size_t l = d->n_mu*(d->N/S)/d->d_mu/d->P;
+  const int REPEAT = 8;
+
+  double best = DBL_MAX;
+  for (int iter = 0; iter < REPEAT; ++iter) {
+    double t = MPI_Wtime();
+    for (int theta = 0; theta < d->n_mu; ++theta) {
+      soi_fft_compute_strided(
+        p, d->gamma_tilde + theta*S, d->alpha_tilde + theta, l);
+    }
+    best = MIN(best, MPI_Wtime() - t);
+  }
+  return best;
 }
 
 void init_soi_descriptor(soi_desc_t *d, MPI_Comm comm, cfft_size_t k)
 {
 	d->comm = comm;
 	d->k = k;
+  d->predicted_snr = NAN;
+  d->predicted_times.total = NAN;
+  memset(d->buffer_bytes, 0, sizeof(d->buffer_bytes));
+  d->transient_bytes = 0;
+  // the window parameters don't depend on k much: the planner's cost of
+  // the FFTs only depends on S*M_hat
+  if (0 == k) d->k = 1;
+  soi_plan_window(d);
+  if (SOI_WINDOW_GAUSSIAN_SINC != d->window_family && d->window_beta <= 0) {
+    soi_optimize_window_shape(d);
+  }
+  if (0 == k) {
+    soi_plan_k(d);
+    k = d->k;
+  }
   d->segmentBoundaries = (int *)malloc(sizeof(int)*(d->P + 1));
   for (int p = 0; p <= d->P; ++p) {
     d->segmentBoundaries[p] = p*k;
@@ -148,11 +346,11 @@ void init_soi_descriptor(soi_desc_t *d, MPI_Comm comm, cfft_size_t k)
   cfft_size_t S = d->k*d->P; // total number of segments
 	cfft_size_t M = d->N/S;
 	cfft_size_t M_hat = d->n_mu*M/d->d_mu;
-  posix_memalign((void **)&d->w, 4096, sizeof(cfft_complex_t)*d->B*S*d->n_mu);
-  posix_memalign((void **)&d->w_dup, 4096, sizeof(SIMDFPTYPE)*d->B*S*d->n_mu);
-  posix_memalign((void **)&d->W_inv, 4096, sizeof(cfft_complex_t)*M);
+  d->buffer_bytes[SOI_BUFFER_W_INV] = sizeof(cfft_complex_t)*M;
+  posix_memalign((void **)&d->W_inv, 4096, d->buffer_bytes[SOI_BUFFER_W_INV]);
   if (NULL == d->gamma_tilde) {
-    posix_memalign((void **)&d->gamma_tilde, 4096, sizeof(cfft_complex_t)*M_hat*k*2);
+    d->buffer_bytes[SOI_BUFFER_GAMMA_TILDE] = sizeof(cfft_complex_t)*M_hat*k*2;
+    posix_memalign((void **)&d->gamma_tilde, 4096, d->buffer_bytes[SOI_BUFFER_GAMMA_TILDE]);
   }
   if (NULL == d->gamma_tilde) {
     fprintf(stderr, "Failed to allocate d->gamma_tilde\n");
@@ -160,7 +358,8 @@ void init_soi_descriptor(soi_desc_t *d, MPI_Comm comm, cfft_size_t k)
   }
 
   if (NULL == d->alpha_tilde) {
-    posix_memalign((void **)&d->alpha_tilde, 4096, sizeof(cfft_complex_t)*M_hat*k);
+    d->buffer_bytes[SOI_BUFFER_ALPHA_TILDE] = sizeof(cfft_complex_t)*M_hat*k;
+    posix_memalign((void **)&d->alpha_tilde, 4096, d->buffer_bytes[SOI_BUFFER_ALPHA_TILDE]);
   }
   if (NULL == d->alpha_tilde) {
     fprintf(stderr, "Failed to allocate d->alpha_tilde\n");
@@ -168,7 +367,8 @@ void init_soi_descriptor(soi_desc_t *d, MPI_Comm comm, cfft_size_t k)
   }
 
   if (NULL == d->beta_tilde) {
-    posix_memalign((void **)&d->beta_tilde, 4096, sizeof(cfft_complex_t)*M_hat*k);
+    d->buffer_bytes[SOI_BUFFER_BETA_TILDE] = sizeof(cfft_complex_t)*M_hat*k;
+    posix_memalign((void **)&d->beta_tilde, 4096, d->buffer_bytes[SOI_BUFFER_BETA_TILDE]);
   }
   if (NULL == d->beta_tilde) {
     fprintf(stderr, "Failed to allocate d->beta_tilde\n");
@@ -176,76 +376,205 @@ void init_soi_descriptor(soi_desc_t *d, MPI_Comm comm, cfft_size_t k)
   }
 
   //d->alpha_ghost = (cfft_complex_t *)_mm_malloc(sizeof(cfft_complex_t)*d->M*S, 4096);
-  posix_memalign((void **)&d->alpha_ghost, 4096, sizeof(cfft_complex_t)*2*d->B*S);
+  resolve_input_layout(d);
+  // with SOI_INPUT_TILED, the ghost rows sent to the left neighbor are
+  // gathered into the last B*S
+  d->buffer_bytes[SOI_BUFFER_ALPHA_GHOST] =
+    sizeof(cfft_complex_t)*(SOI_INPUT_TILED == d->input_layout ? 3 : 2)*d->B*S;
+  posix_memalign((void **)&d->alpha_ghost, 4096, d->buffer_bytes[SOI_BUFFER_ALPHA_GHOST]);
   if (NULL == d->alpha_ghost) {
     fprintf(stderr, "Failed to allocate d->alpha_ghost\n");
     exit(1);
   }
-  posix_memalign((void **)&d->delta, 4096, sizeof(int)*4*M_hat*k);
+  d->buffer_bytes[SOI_BUFFER_DELTA] = sizeof(int)*4*M_hat*k;
+  posix_memalign((void **)&d->delta, 4096, d->buffer_bytes[SOI_BUFFER_DELTA]);
   d->epsilon = NULL;
 
   d->sendRequests = (MPI_Request *)malloc(sizeof(MPI_Request)*d->P*d->k);
   d->recvRequests = (MPI_Request *)malloc(sizeof(MPI_Request)*d->P*S);
+  d->buffer_bytes[SOI_BUFFER_REQUESTS] = sizeof(MPI_Request)*(d->P*d->k + d->P*S);
 
-	for (int theta=0; theta<d->n_mu; theta++)
+  if (SOI_ISA_AUTO == d->isa) {
+    d->isa = soi_detect_isa();
+  }
+  if (d->use_vlc && !soi_isa_supported(SOI_ISA_AVX2)) {
+    fprintf(stderr, "Variable length compression requires AVX2\n");
+    exit(-1);
+  }
+  if (d->use_split_complex && !soi_get_kernels(d->isa)->split_complex) {
+    if (0 == d->rank) {
+      fprintf(
+        stderr, "Split complex layout is not supported with %s. Using interleaved layout\n",
+        soi_isa_name(d->isa));
+    }
+    d->use_split_complex = 0;
+  }
+
+  resolve_store_policy(d);
+
+  d->w_poly = NULL;
+  d->w_phase = NULL;
+  if (SOI_WINDOW_AUTO == d->window_mode) {
+    // w_dup is streamed once per block row, so generate the window instead
+    // when w_dup would be evicted between block rows
+    size_t w_dup_bytes = 2*sizeof(cfft_complex_t)*d->B*S*d->n_mu;
+    d->window_mode =
+      !d->use_split_complex && w_dup_bytes > get_llc_size() ?
+      SOI_WINDOW_OTF : SOI_WINDOW_TABLE;
+  }
+  else if (SOI_WINDOW_OTF == d->window_mode && d->use_split_complex) {
+    if (0 == d->rank) {
+      fprintf(stderr, "On-the-fly window doesn't use split complex layout. Using interleaved layout\n");
+    }
+    d->use_split_complex = 0;
+  }
+  if (SOI_WINDOW_OTF == d->window_mode && !soi_init_window_otf(d)) {
+    if (0 == d->rank) {
+      fprintf(stderr, "Failed to fit the window with polynomials. Using window tables\n");
+    }
+    free(d->w_poly); d->w_poly = NULL;
+    free(d->w_phase); d->w_phase = NULL;
+    d->buffer_bytes[SOI_BUFFER_W_OTF] = 0;
+    d->window_mode = SOI_WINDOW_TABLE;
+  }
+
+  d->w = NULL;
+  d->w_dup = NULL;
+  d->w_split = NULL;
+  if (SOI_WINDOW_TABLE == d->window_mode) {
+    d->buffer_bytes[SOI_BUFFER_W] = sizeof(cfft_complex_t)*d->B*S*d->n_mu;
+    posix_memalign((void **)&d->w, 4096, d->buffer_bytes[SOI_BUFFER_W]);
+    for (int theta=0; theta<d->n_mu; theta++)
 #pragma omp parallel for
-    for (cfft_size_t i = 0; i < S/(SIMD_WIDTH/2)*(SIMD_WIDTH/2); i += CACHE_LINE_LEN/2) {
-      for (cfft_size_t j = 0; j < d->B; j++)
-        for (cfft_size_t ii = i; ii < i + CACHE_LINE_LEN/2; ii++)
-          (d->w)[i*d->B*d->n_mu + (j*d->n_mu + theta)*(CACHE_LINE_LEN/2) + ii - i] =
-            w_f(theta*d->B*S + j*S + ii, d);
-
-      for (cfft_size_t j = 0; j < d->B; j++) {
-        for (cfft_size_t ii = 0; ii < 2; ii++) {
-          SIMDFPTYPE temp = _MM_LOADU((VAL_TYPE *)(d->w + i*d->B*d->n_mu + (j*d->n_mu + theta)*(CACHE_LINE_LEN/2)) + ii*SIMD_WIDTH);
-          _MM_STOREU(d->w_dup + i*d->B*d->n_mu + (j*d->n_mu + theta)*(CACHE_LINE_LEN/2) + 2*ii, _MM_MOVELDUP(temp));
-          _MM_STOREU(d->w_dup + i*d->B*d->n_mu + (j*d->n_mu + theta)*(CACHE_LINE_LEN/2) + 2*ii + 1, _MM_MOVEHDUP(temp));
-        }
+      for (cfft_size_t i = 0; i < S; i += CACHE_LINE_LEN/2) {
+        for (cfft_size_t j = 0; j < d->B; j++)
+          for (cfft_size_t ii = i; ii < i + CACHE_LINE_LEN/2; ii++)
+            (d->w)[i*d->B*d->n_mu + (j*d->n_mu + theta)*(CACHE_LINE_LEN/2) + ii - i] =
+              w_f(theta*d->B*S + j*S + ii, d);
       }
+    if (d->use_split_complex) {
+      d->buffer_bytes[SOI_BUFFER_W_SPLIT] = sizeof(cfft_complex_t)*d->B*S*d->n_mu;
+      posix_memalign((void **)&d->w_split, 4096, d->buffer_bytes[SOI_BUFFER_W_SPLIT]);
+      soi_split_complex_lines((cfft_complex_t *)d->w_split, d->w, d->B*S*d->n_mu);
+    }
+    else {
+      d->buffer_bytes[SOI_BUFFER_W_DUP] = 2*sizeof(cfft_complex_t)*d->B*S*d->n_mu;
+      posix_memalign((void **)&d->w_dup, 4096, d->buffer_bytes[SOI_BUFFER_W_DUP]);
+      soi_get_kernels(d->isa)->init_w_dup(d);
     }
+  }
 
+  // Predict the SNR from the truncation error of the window parameters and
+  // the rounding error of the window table, and store the table in float
+  // if that costs a negligible fraction of the accuracy
+  double truncation_snr = window_truncation_snr(d);
+  if (isnan(truncation_snr)) {
+    // from soi_plan_window or the error model
+    truncation_snr = isnan(d->predicted_snr) ? soi_window_model_snr(d) : d->predicted_snr;
+  }
+  d->predicted_snr = truncation_snr;
+  d->w_dup_float = NULL;
+  if (NULL == d->w_dup || PRECISION != 2) {
+    if (SOI_WINDOW_PRECISION_FLOAT == d->window_precision && 0 == d->rank) {
+      fprintf(stderr, "Only the interleaved window table of double precision builds can be stored in float\n");
+    }
+    d->window_precision = SOI_WINDOW_PRECISION_FULL;
+  }
+  else if (d->use_compensated_sum) {
+    if (SOI_WINDOW_PRECISION_FLOAT == d->window_precision && 0 == d->rank) {
+      fprintf(stderr, "Compensated summation keeps the window table in full precision\n");
+    }
+    d->window_precision = SOI_WINDOW_PRECISION_FULL;
+  }
+  else if (SOI_WINDOW_PRECISION_FULL != d->window_precision) {
+    double noise = float_window_noise(d);
+    double float_snr = -10*log10(pow(10, -truncation_snr/10) + noise);
+    if (SOI_WINDOW_PRECISION_AUTO == d->window_precision) {
+      d->window_precision =
+        truncation_snr - float_snr < MAX_FLOAT_WINDOW_SNR_LOSS ?
+        SOI_WINDOW_PRECISION_FLOAT : SOI_WINDOW_PRECISION_FULL;
+    }
+    if (SOI_WINDOW_PRECISION_FLOAT == d->window_precision) {
+      d->predicted_snr = float_snr;
+    }
+  }
+  if (SOI_WINDOW_PRECISION_FLOAT == d->window_precision) {
+    // same layout as w_dup
+    cfft_size_t n = 4*d->B*S*d->n_mu;
+    d->buffer_bytes[SOI_BUFFER_W_DUP_FLOAT] = sizeof(float)*n;
+    posix_memalign((void **)&d->w_dup_float, 4096, d->buffer_bytes[SOI_BUFFER_W_DUP_FLOAT]);
+#pragma omp parallel for
+    for (cfft_size_t i = 0; i < n; ++i) {
+      d->w_dup_float[i] = d->w_dup[i];
+    }
+    d->transient_bytes = MAX(d->transient_bytes, d->buffer_bytes[SOI_BUFFER_W_DUP]);
+    free(d->w_dup); d->w_dup = NULL;
+    d->buffer_bytes[SOI_BUFFER_W_DUP] = 0;
+  }
+
+  double *W = (double *)malloc(sizeof(double)*M);
+  d->transient_bytes = MAX(d->transient_bytes, sizeof(double)*M);
+  if (!soi_window_response_table(d, W, M)) {
+    if (0 == d->rank) {
+      fprintf(
+        stderr, "The frequency window with tau=%f beta=%f isn't positive over the segment\n",
+        d->tau, d->window_beta);
+    }
+    exit(-1);
+  }
 #pragma omp parallel for
 	for (cfft_size_t i=0; i < M; i++) {
-		(d->W_inv)[i] = W_inv_f(i, d);
+		(d->W_inv)[i] = W_inv_f(i, W[i], d);
   }
+  free(W);
 
-	// create DFT descriptors
+	// create DFT plans
+  unsigned fft_flags = 0;
 #ifdef SOI_USE_FFTW
-  if (d->use_fftw) {
-    FFTW_PLAN_WITH_NTHREADS(omp_get_max_threads());
-    d->fftw_plan_s = FFTW_PLAN_DFT_1D(
-      S, d->gamma_tilde, d->gamma_tilde, FFTW_FORWARD, fftw_flags);
-    d->fftw_plan_m_hat = FFTW_PLAN_DFT_1D(
-      M_hat, d->alpha_tilde, d->alpha_tilde, FFTW_FORWARD, fftw_flags);
-  }
-  else
+  fft_flags = d->fftw_flags;
 #endif
-  {
-    CHECK_DFTI( DftiCreateDescriptor(&(d->desc_dft_s), DFTI_TYPE, DFTI_COMPLEX, 1, (long)S) );
-    CHECK_DFTI( DftiSetValue(d->desc_dft_s, DFTI_NUMBER_OF_USER_THREADS, omp_get_max_threads()) );
-    CHECK_DFTI( DftiCommitDescriptor(d->desc_dft_s) );
-    CHECK_DFTI( DftiCreateDescriptor(&(d->desc_dft_m_hat), DFTI_TYPE, DFTI_COMPLEX, 1, (long)(M_hat)) );
-    CHECK_DFTI( DftiCommitDescriptor(d->desc_dft_m_hat) );
+  d->fft_s = soi_fft_create_plan(
+    d->fft_backend, d->isa, S, d->n_mu, S, omp_get_max_threads(), fft_flags,
+    d->gamma_tilde);
+  int has_codelet = NULL != soi_fft_get_codelet(d->isa, S);
+  if (SOI_FFT_BUILTIN == d->fft_backend || !has_codelet) {
+    // the builtin backend uses codelets whenever they exist
+    d->use_fft_codelet = SOI_FFT_BUILTIN == d->fft_backend && has_codelet;
   }
+  else if (d->use_fft_codelet) {
+    soi_fft_plan_t *codelet_plan = soi_fft_create_plan(
+      SOI_FFT_BUILTIN, d->isa, S, d->n_mu, S, omp_get_max_threads(), fft_flags,
+      d->gamma_tilde);
+
+    if (d->use_fft_codelet < 0) {
+      memset(d->gamma_tilde, 0, sizeof(cfft_complex_t)*S*d->n_mu);
+      time_s_fft(d, d->fft_s); // warm up
+      // times of the slowest rank, so that all ranks take the same path
+      double times[2] = { time_s_fft(d, codelet_plan), time_s_fft(d, d->fft_s) };
+      MPI_Allreduce(MPI_IN_PLACE, times, 2, MPI_DOUBLE, MPI_MAX, d->comm);
+      d->use_fft_codelet = times[0] < times[1];
+    }
+    if (d->use_fft_codelet) {
+      soi_fft_destroy_plan(d->fft_s);
+      d->fft_s = codelet_plan;
+    }
+    else {
+      soi_fft_destroy_plan(codelet_plan);
+    }
+  }
+  d->fft_m_hat = soi_fft_create_plan(
+    d->fft_backend, d->isa, M_hat, 1, M_hat, 1, fft_flags, d->gamma_tilde);
+
+  soi_tune_conv(d);
 
   get_cpu_freq();
 }
 
 void free_soi_descriptor(soi_desc_t * d)
 {
-	// free DFT descriptors
-#ifdef SOI_USE_FFTW
-  if (d->use_fftw) {
-    FFTW_DESTROY_PLAN(d->fftw_plan_s);
-    FFTW_DESTROY_PLAN(d->fftw_plan_m_hat);
-    FFTW_CLEANUP_THREADS();
-  }
-  else
-#endif
-  {
-    CHECK_DFTI( DftiFreeDescriptor(&(d->desc_dft_s)) );
-    CHECK_DFTI( DftiFreeDescriptor(&(d->desc_dft_m_hat)) );
-  }
+	// free DFT plans
+  soi_fft_destroy_plan(d->fft_s); d->fft_s = NULL;
+  soi_fft_destroy_plan(d->fft_m_hat); d->fft_m_hat = NULL;
 
   // free requests
   //CFFT_ASSERT_MPI(MPI_Waitall(d->P*d->k, d->sendRequests, MPI_STATUSES_IGNORE));
@@ -255,6 +584,10 @@ void free_soi_descriptor(soi_desc_t * d)
 	// free window functions tables
 	if (d->w) free(d->w);
 	if (d->w_dup) free(d->w_dup);
+	if (d->w_split) free(d->w_split);
+	if (d->w_dup_float) free(d->w_dup_float);
+	if (d->w_poly) free(d->w_poly);
+	if (d->w_phase) free(d->w_phase);
 	if (d->W_inv) free(d->W_inv);
 	if (d->alpha_ghost) free(d->alpha_ghost);
 	if (d->alpha_tilde) free(d->alpha_tilde); d->alpha_tilde = NULL;
@@ -276,6 +609,9 @@ double time_begin_fused[1024], time_end_fused[1024];
 void compute_soi(soi_desc_t * d, cfft_complex_t *alpha_dt)
 {
   double soiBeginTime = MPI_Wtime();
+  memset(d->stats, 0, sizeof(d->stats));
+  soi_comm_profile_begin(d->comm_profile, d->k);
+  if (d->energy) soi_energy_start(d->energy);
 
   cfft_size_t S = d->k*d->P; // total number of segments
   cfft_size_t M = d->N/S; // length of one segment, before oversampling
@@ -294,18 +630,21 @@ void compute_soi(soi_desc_t * d, cfft_complex_t *alpha_dt)
 */
 MPI_TIMED_SECTION_BEGIN();
 	parallel_filter_subsampling(d, alpha_dt);
+  if (d->energy) soi_energy_mark(d->energy, SOI_ENERGY_FILTER);
 #ifdef SOI_MEASURE_LOAD_IMBALANCE
-MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "time_fss_total");
-  if (0 == d->rank) {
-    double min = DBL_MAX, max = DBL_MIN;
-    for (int i = 0; i < omp_get_max_threads(); i++) {
-      double t = load_imbalance_times[i]/get_cpu_freq();
-      min = MIN(min, t); max = MAX(max, t);
-    }
+MPI_TIMED_SECTION_END_WO_NEWLINE(d->comm, "time_fss_total", SOI_STAT_FSS_TOTAL);
+  double min = DBL_MAX, max = DBL_MIN;
+  for (int i = 0; i < omp_get_max_threads(); i++) {
+    double t = load_imbalance_times[i]/get_cpu_freq();
+    min = MIN(min, t); max = MAX(max, t);
+  }
+  d->stats[SOI_STAT_FSS_IMBALANCE_MIN] = min;
+  d->stats[SOI_STAT_FSS_IMBALANCE_MAX] = max;
+  if (0 == d->rank && !d->quiet) {
     printf(" load_imbalance = %f~%f\n", min, max);
   }
 #else
-MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
+MPI_TIMED_SECTION_END(d->comm, "time_fss_total", SOI_STAT_FSS_TOTAL);
 #endif
 
   int sendLens[S];
@@ -321,7 +660,7 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
       maxExponent[s] = max_exponent((double *)(d->alpha_tilde + s*l), l*2);
     }
     ttt += MPI_Wtime();
-    if (0 == d->rank) {
+    if (0 == d->rank && !d->quiet) {
       printf("compute maximum exp takes %f\n", ttt);
     }
     time_compress += ttt;
@@ -332,7 +671,7 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
       maxExponent, globalMaxExponentReduced, S,
       MPI_INT, MPI_MAX, MPI_COMM_WORLD));
     ttt += MPI_Wtime();
-    if (0 == d->rank) {
+    if (0 == d->rank && !d->quiet) {
       printf("MPI_Allreduce takes %f\n", ttt);
     }
     time_compress += ttt;
@@ -342,7 +681,7 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
       totalMaxExponent = MAX(totalMaxExponent, globalMaxExponentReduced[s]);
     }
 
-    if (0 == d->rank) {
+    if (0 == d->rank && !d->quiet) {
       for (int s = 0; s < S; ++s) {
         printf("%d ", globalMaxExponentReduced[s]);
       }
@@ -428,7 +767,7 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
       }
     }
 
-    if (0 == d->rank) {
+    if (0 == d->rank && !d->quiet) {
       for (int p = 0; p < d->P; ++p) {
         printf(
           "%d: %g %d\n",
@@ -457,7 +796,23 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
 
   if (d->use_vlc) {
     if (d->epsilon) free(d->epsilon);
-    posix_memalign((void **)&d->epsilon, 4096, sizeof(int)*4*M_hat*numOfSegToReceive);
+    d->buffer_bytes[SOI_BUFFER_EPSILON] = sizeof(int)*4*M_hat*numOfSegToReceive;
+    posix_memalign((void **)&d->epsilon, 4096, d->buffer_bytes[SOI_BUFFER_EPSILON]);
+  }
+
+  // each segment is sent once, by parts of sCnts[segment] with use_vlc
+  d->uncompressed_bytes = sizeof(cfft_complex_t)*l*S;
+  if (d->use_vlc) {
+    d->sent_bytes = d->received_bytes = 0;
+    for (int s = 0; s < S; ++s) d->sent_bytes += sizeof(VAL_TYPE)*sCnts[s];
+    for (int ik = 0; ik < numOfSegToReceive; ++ik) {
+      d->received_bytes +=
+        sizeof(VAL_TYPE)*sCnts[d->segmentBoundaries[d->rank] + ik]*d->P;
+    }
+  }
+  else {
+    d->sent_bytes = d->uncompressed_bytes;
+    d->received_bytes = sizeof(cfft_complex_t)*l*numOfSegToReceive*d->P;
   }
 
   long compressedLen = 0;
@@ -474,6 +829,7 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
   // for each segment
   for (cfft_size_t ik = 0; ik < MAX(maxNSegment, numOfSegToReceive); ik++) {
     if (d->use_vlc) {
+      double trace_begin = soi_trace_begin(d->trace);
       time_mpi -= MPI_Wtime();
       // pairwise exchange algorithm
       if (ik < numOfSegToReceive) {
@@ -481,6 +837,9 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
           int src = (d->rank - i + d->P)%d->P;
           int segment = d->segmentBoundaries[d->rank] + ik;
 
+          soi_comm_profile_post(
+            d->comm_profile, SOI_COMM_RECV, ik*d->P + src, src, segment,
+            sCnts[segment]*sizeof(VAL_TYPE));
           CFFT_ASSERT_MPI(MPI_Irecv(
             d->epsilon + (ik*d->P + src)*l*4,
             sCnts[segment],
@@ -489,6 +848,7 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
         } // for each MPI rank
       }
       time_mpi += MPI_Wtime();
+      soi_trace_end(d->trace, SOI_TRACE_ALL_TO_ALL_POST, trace_begin, ik);
 
       if (ik < maxNSegment) {
         time_compress -= MPI_Wtime();
@@ -499,12 +859,14 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
             // FIXME: load balancing
 
           unsigned long long t = __rdtsc();
+          double trace_begin = soi_trace_begin(d->trace);
           sendLens[segment] = compress(
             d->delta + segment*l*4, (double *)(d->alpha_tilde + segment*l),
             l*2,
             totalMaxExponent, globalMaxExponentReduced[segment],
             0/*7 == d->rank && 3 == s*/);
 
+          soi_trace_end(d->trace, SOI_TRACE_COMPRESS, trace_begin, segment);
           compressedLen += sendLens[segment];
           assert(sCnts[segment] == (sendLens[segment] + 1)/2);
 
@@ -523,6 +885,7 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
 
         time_compress += MPI_Wtime();
 
+        trace_begin = soi_trace_begin(d->trace);
         time_mpi -= MPI_Wtime();
 
         // pairwise exchange algorithm
@@ -532,6 +895,9 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
           int segment = d->segmentBoundaries[dst + 1] - maxNSegment + ik;
           if (segment < d->segmentBoundaries[dst]) continue;
 
+          soi_comm_profile_post(
+            d->comm_profile, SOI_COMM_SEND, segment, dst, segment,
+            sCnts[segment]*sizeof(VAL_TYPE));
           CFFT_ASSERT_MPI(MPI_Isend(
             d->delta + segment*l*4, sCnts[segment],
             MPI_TYPE, dst, segment,
@@ -539,12 +905,20 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
         }
 
         time_mpi += MPI_Wtime();
+        soi_trace_end(d->trace, SOI_TRACE_ALL_TO_ALL_POST, trace_begin, ik);
       }
     } // d->use_vlc
     else {
+      double trace_begin = soi_trace_begin(d->trace);
       time_mpi -= MPI_Wtime();
 
 #ifdef SOI_USE_I_ALL_TO_ALL
+      // only the receives are profiled, completing together
+      for (int src = 0; src < d->P; ++src) {
+        soi_comm_profile_post(
+          d->comm_profile, SOI_COMM_RECV, ik*d->P + src, src,
+          d->segmentBoundaries[d->rank] + ik, sCnts[src]*sizeof(VAL_TYPE));
+      }
       CFFT_ASSERT_MPI(MPI_Ialltoallv(
         d->alpha_tilde + ik*l, sCnts, sDispls, MPI_TYPE,
         d->gamma_tilde + ik*d->P*l, sCnts, rDispls, MPI_TYPE,
@@ -556,6 +930,9 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
           int src = (d->rank - i + d->P)%d->P;
           int segment = d->segmentBoundaries[d->rank] + ik;
 
+          soi_comm_profile_post(
+            d->comm_profile, SOI_COMM_RECV, ik*d->P + src, src, segment,
+            l*sizeof(cfft_complex_t));
           CFFT_ASSERT_MPI(MPI_Irecv(
             d->gamma_tilde + (ik*d->P + src)*l, l*2,
             MPI_TYPE, src, segment,
@@ -570,6 +947,9 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
           int segment = d->segmentBoundaries[dst + 1] - maxNSegment + ik;
           if (segment < d->segmentBoundaries[dst]) continue;
 
+          soi_comm_profile_post(
+            d->comm_profile, SOI_COMM_SEND, segment, dst, segment,
+            l*sizeof(cfft_complex_t));
           CFFT_ASSERT_MPI(MPI_Isend(
             d->alpha_tilde + segment*l, l*2,
             MPI_TYPE, dst, segment,
@@ -579,9 +959,12 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
 #endif
 
       time_mpi += MPI_Wtime();
+      soi_trace_end(d->trace, SOI_TRACE_ALL_TO_ALL_POST, trace_begin, ik);
     } // !d->use_vlc
   }
-  if (0 == d->rank) {
+  d->stats[SOI_STAT_COMPRESS] = time_compress;
+  d->stats[SOI_STAT_MPI] = time_mpi;
+  if (0 == d->rank && !d->quiet) {
     if (d->use_vlc) {
       printf("compression rate = %g\n", (double)compressedLen/(l*S*4));
       printf("time_compress\t%f\n", time_compress);
@@ -589,6 +972,7 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
     printf("time_mpi\t%f\n", time_mpi);
   }
 
+  if (d->energy) soi_energy_mark(d->energy, SOI_ENERGY_ALL_TO_ALL);
   time_fused = MPI_Wtime();
   time_end_mpi = time_fused - soiBeginTime;
 
@@ -599,15 +983,19 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
 
 	for (cfft_size_t ik = 0; ik < numOfSegToReceive; ik++)
 	{
+    int segment = d->segmentBoundaries[d->rank] + ik;
+    double trace_begin = soi_trace_begin(d->trace);
     temp_time = MPI_Wtime();
 #ifdef SOI_USE_I_ALL_TO_ALL
     assert(!d->use_vlc); // i_all_to_all doesn't work with vlc
-    CFFT_ASSERT_MPI(MPI_Wait(d->recvRequests + ik, MPI_STATUS_IGNORE));
+    CFFT_ASSERT_MPI(soi_comm_wait_shared(
+      d->comm_profile, SOI_COMM_RECV, ik*d->P, d->P, d->recvRequests + ik));
 #else
-    CFFT_ASSERT_MPI(MPI_Waitall(
-      d->P, d->recvRequests + ik*d->P, MPI_STATUSES_IGNORE));
+    CFFT_ASSERT_MPI(soi_comm_waitall(
+      d->comm_profile, SOI_COMM_RECV, ik*d->P, d->P, d->recvRequests + ik*d->P));
 #endif
     temp_time = MPI_Wtime() - temp_time;
+    soi_trace_end(d->trace, SOI_TRACE_RECV_WAIT, trace_begin, segment);
     //if (0 == d->rank) printf("\ttime_fused_mpi = %f", temp_time);
     time_fused_mpi += temp_time;
     temp_time = MPI_Wtime();
@@ -617,6 +1005,7 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
 
     if (d->use_vlc) {
       double t_decompress = MPI_Wtime();
+      trace_begin = soi_trace_begin(d->trace);
 #pragma omp parallel for
       for (int p = 0; p < d->P; ++p) {
         int *srcBuffer = d->epsilon + (ik*M_hat + p*l)*4;
@@ -626,21 +1015,19 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
           l*2,
           totalMaxExponent,
           globalMaxExponentReduced[d->segmentBoundaries[d->rank] + ik],
-          NULL);
+          NULL, SOI_STORE_STREAM == d->store_policy.decompress);
       }
       time_decompress += MPI_Wtime() - t_decompress;
+      soi_trace_end(d->trace, SOI_TRACE_DECOMPRESS, trace_begin, segment);
     }
 
     temp_time = MPI_Wtime();
-#ifdef SOI_USE_FFTW
-    if (d->use_fftw)
-      FFTW_EXECUTE_DFT(
-        d->fftw_plan_m_hat, d->gamma_tilde + ik*M_hat, d->gamma_tilde + ik*M_hat);
-    else {
-#endif
-      {
-		    DftiComputeForward(d->desc_dft_m_hat, d->gamma_tilde + ik*M_hat);
-      }
+    trace_begin = soi_trace_begin(d->trace);
+    soi_counter_snapshot_t counts;
+    soi_counters_begin(d->counters, &counts);
+    soi_fft_compute(d->fft_m_hat, d->gamma_tilde + ik*M_hat);
+    soi_counters_end(d->counters, SOI_COUNTED_FFT_M_HAT, &counts);
+    soi_trace_end(d->trace, SOI_TRACE_FFT_M_HAT, trace_begin, segment);
 
     double t2 = MPI_Wtime();
     //if (0 == d->rank) printf("\ttime_fused_fft = %f\n", t2 - temp_time);
@@ -649,15 +1036,22 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
 #ifdef SOI_USE_INTRINSIC
 #pragma omp parallel
     {
-#pragma omp for
-    for (cfft_size_t i = 0; i < M/(SIMD_WIDTH/2)*(SIMD_WIDTH/2); i += SIMD_WIDTH/2) {
-      SIMDFPTYPE xtemp = _MM_LOAD((VAL_TYPE *)(d->W_inv + i));
-      SIMDFPTYPE xl = _MM_MOVELDUP(xtemp);
-      SIMDFPTYPE xh = _MM_MOVEHDUP(xtemp);
-      SIMDFPTYPE ytemp = _MM_LOAD((VAL_TYPE *)(d->gamma_tilde + ik*M_hat + i));
-      SIMDFPTYPE temp = _MM_FMADDSUB(xl, ytemp, _MM_SWAP_REAL_IMAG(_MM_MUL(xh, ytemp)));
-      _MM_STREAM((VAL_TYPE *)(alpha_dt + ik*M + i), temp);
-    }
+    // split by cache lines so that each thread's stores are aligned
+    int nthreads = omp_get_num_threads();
+    cfft_size_t i_per_thread = (M + nthreads - 1)/nthreads;
+    i_per_thread = (i_per_thread + CACHE_LINE_LEN/2 - 1)/(CACHE_LINE_LEN/2)*(CACHE_LINE_LEN/2);
+    cfft_size_t i_begin = MIN(i_per_thread*omp_get_thread_num(), M);
+    cfft_size_t i_end = MIN(i_begin + i_per_thread, M);
+
+    double trace_begin = soi_trace_begin(d->trace);
+    soi_counter_snapshot_t counts;
+    soi_counters_begin(d->counters, &counts);
+    soi_get_kernels(d->isa)->demodulate(
+      alpha_dt + ik*M + i_begin, d->gamma_tilde + ik*M_hat + i_begin,
+      d->W_inv + i_begin, i_end - i_begin,
+      SOI_STORE_STREAM == d->store_policy.demodulate);
+    soi_counters_end(d->counters, SOI_COUNTED_DEMODULATE, &counts);
+    soi_trace_end(d->trace, SOI_TRACE_DEMODULATE, trace_begin, segment);
 
 #ifdef SOI_MEASURE_LOAD_IMBALANCE
     unsigned long long t = __rdtsc();
@@ -665,17 +1059,6 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
     load_imbalance_times[omp_get_thread_num()] += __rdtsc() - t;
 #endif
     }
-    cfft_size_t i = M/(SIMD_WIDTH/2)*(SIMD_WIDTH/2);
-
-    if (i < M) {
-      SIMDFPTYPE xtemp = _MM_LOADU((VAL_TYPE *)(d->W_inv + i));
-      SIMDFPTYPE xl = _MM_MOVELDUP(xtemp);
-      SIMDFPTYPE xh = _MM_MOVEHDUP(xtemp);
-      SIMDFPTYPE ytemp = _MM_LOADU((VAL_TYPE *)(d->gamma_tilde + ik*M_hat + i));
-      __m256i mask = _mm256_load_si256((__m256i *)Remaining[M - i]);
-      SIMDFPTYPE temp = _MM_FMADDSUB(xl, ytemp, _MM_SWAP_REAL_IMAG(_MM_MUL(xh, ytemp)));
-      _MM_MASKSTORE((VAL_TYPE *)(alpha_dt + ik*M + i), mask, temp);
-    }
 #else
 #pragma omp parallel
     {
@@ -709,13 +1092,24 @@ MPI_TIMED_SECTION_END(d->comm, "time_fss_total");
 #else
 MPI_TIMED_SECTION_END(d->comm, "time_fused");
 #endif*/
-  if (0 == d->rank) {
-    printf("time_fused\t%f\n", MPI_Wtime() - time_fused);
+  d->stats[SOI_STAT_FUSED] = MPI_Wtime() - time_fused;
+  d->stats[SOI_STAT_FUSED_MPI] = time_fused_mpi;
+  d->stats[SOI_STAT_DECOMPRESS] = time_decompress;
+  d->stats[SOI_STAT_FUSED_FFT] = time_fused_fft;
+  d->stats[SOI_STAT_FUSED_VMUL] = time_fused_vmul;
+  if (0 == d->rank && !d->quiet) {
+    printf("time_fused\t%f\n", d->stats[SOI_STAT_FUSED]);
     printf(
       "\ttime_fused_mpi = %f\ttime_decompress = %f\ttime_fused_fft = %f\ttime_fused_vmul = %f\n",
       time_fused_mpi, time_decompress, time_fused_fft, time_fused_vmul);
   }
 #ifndef SOI_USE_I_ALL_TO_ALL
-  CFFT_ASSERT_MPI(MPI_Waitall(d->P*d->k, d->sendRequests, MPI_STATUSES_IGNORE));
+  double trace_begin = soi_trace_begin(d->trace);
+  CFFT_ASSERT_MPI(soi_comm_waitall(
+    d->comm_profile, SOI_COMM_SEND, 0, d->P*d->k, d->sendRequests));
+  soi_trace_end(d->trace, SOI_TRACE_SEND_WAIT, trace_begin, 0);
 #endif
+  if (d->energy) soi_energy_mark(d->energy, SOI_ENERGY_FUSED);
+  d->stats[SOI_STAT_TOTAL] = MPI_Wtime() - soiBeginTime;
+  if (d->metrics) soi_metrics_update(d->metrics, d);
 }
@@ -14,7 +14,10 @@
 #include "mpi.h"
 #include <stdio.h>
 #include <immintrin.h>
+#ifdef SOI_USE_MKL
 #include "mkl_dfti.h"
+#include "mkl_cdft.h"
+#endif
 
 #ifdef SOI_USE_FFTW
 #include <fftw3-mpi.h>
@@ -27,7 +30,9 @@
 
 #if PRECISION == 2
 #define VAL_TYPE double
+#ifdef SOI_USE_MKL
 #define DFTI_TYPE DFTI_DOUBLE
+#endif
 #define MPI_TYPE MPI_DOUBLE
 
 #ifdef SOI_USE_FFTW
@@ -36,15 +41,17 @@
 #define FFTW_PLAN fftw_plan
 
 #define FFTW_MPI_INIT() { fftw_init_threads(); fftw_mpi_init(); }
+#define FFTW_INIT_THREADS fftw_init_threads
 #define FFTW_MPI_LOCAL_SIZE_1D fftw_mpi_local_size_1d
 #define FFTW_MALLOC fftw_malloc
 #define FFTW_FREE fftw_free
 #define FFTW_MPI_PLAN_DFT_1D fftw_mpi_plan_dft_1d
 #define FFTW_MPI_EXECUTE_DFT fftw_mpi_execute_dft
 #define FFTW_PLAN_DFT_1D fftw_plan_dft_1d
+#define FFTW_PLAN_MANY_DFT fftw_plan_many_dft
 #define FFTW_EXECUTE fftw_execute
 #define FFTW_EXECUTE_DFT fftw_execute_dft
-#define FFTW_DESTROY_PLAN(a)
+#define FFTW_DESTROY_PLAN fftw_destroy_plan
 #define FFTW_CLEANUP_THREADS fftw_cleanup_threads
 #define FFTW_MPI_CLEANUP fftw_mpi_cleanup
 #endif
@@ -53,7 +60,9 @@
 // PRECISION == 1
 
 #define VAL_TYPE float
+#ifdef SOI_USE_MKL
 #define DFTI_TYPE DFTI_SINGLE
+#endif
 #define MPI_TYPE MPI_FLOAT
 
 #ifdef SOI_USE_FFTW
@@ -62,15 +71,17 @@
 #define FFTW_PLAN fftwf_plan
 
 #define FFTW_MPI_INIT() { fftwf_init_threads(); fftwf_mpi_init(); }
+#define FFTW_INIT_THREADS fftwf_init_threads
 #define FFTW_MPI_LOCAL_SIZE_1D fftwf_mpi_local_size_1d
 #define FFTW_MALLOC fftwf_malloc
 #define FFTW_FREE fftwf_free
 #define FFTW_MPI_PLAN_DFT_1D fftwf_mpi_plan_dft_1d
 #define FFTW_MPI_EXECUTE_DFT fftwf_mpi_execute_dft
 #define FFTW_PLAN_DFT_1D fftwf_plan_dft_1d
+#define FFTW_PLAN_MANY_DFT fftwf_plan_many_dft
 #define FFTW_EXECUTE fftwf_execute
 #define FFTW_EXECUTE_DFT fftwf_execute_dft
-#define FFTW_DESTROY_PLAN(a)
+#define FFTW_DESTROY_PLAN fftwf_destroy_plan
 #define FFTW_CLEANUP_THREADS fftwf_cleanup_threads
 #define FFTW_MPI_CLEANUP fftwf_mpi_cleanup
 #endif
@@ -179,6 +190,7 @@ if (MPI_SUCCESS != err) \
   printf("MPI error %lu in %s (%s, line %lu)\n", (unsigned long)err, __FUNCTION__, __FILE__, (unsigned long)__LINE__); \
 } while(0)
 
+#ifdef SOI_USE_MKL
 #define CHECK_DFTI(x) \
   { \
     MKL_LONG status = x; \
@@ -186,29 +198,33 @@ if (MPI_SUCCESS != err) \
       fprintf(stderr, "Dfti error while %s: %s\n", #x, DftiErrorMessage(status)); \
     } \
   }
+#endif
 
+// The sections record their time in d->stats[stat], and print it as x
+// from rank 0 unless d->quiet
 #define MPI_TIMED_SECTION_BEGIN() { double __timing = -MPI_Wtime();
-#define MPI_TIMED_SECTION_END(c, x)            \
+#define MPI_TIMED_SECTION_END(c, x, stat)            \
 	{                                          \
 		__timing += MPI_Wtime();               \
-		if (d->rank == 0)                         \
+		d->stats[stat] = __timing;             \
+		if (d->rank == 0 && !d->quiet)            \
 			printf("%s\t%f\n", x, __timing);   \
 	}                                          \
 }
-#define MPI_TIMED_SECTION_END_WO_NEWLINE(c, x)            \
+#define MPI_TIMED_SECTION_END_WO_NEWLINE(c, x, stat)            \
 	{                                          \
 		__timing += MPI_Wtime();               \
-		if (d->rank == 0)                         \
+		d->stats[stat] = __timing;             \
+		if (d->rank == 0 && !d->quiet)            \
 			printf("%s\t%f", x, __timing);   \
 	}                                          \
 }
-#define MPI_TIMED_SECTION_END_WITH_BARRIER(c, x)            \
+#define MPI_TIMED_SECTION_END_WITH_BARRIER(c, x, stat)            \
 	{                                          \
-		int rank;                              \
 		CFFT_ASSERT_MPI( MPI_Barrier(c) );          \
 		__timing += MPI_Wtime();               \
-		CFFT_ASSERT_MPI( MPI_Comm_rank(c, &rank) ); \
-		if (rank == 0)                         \
+		d->stats[stat] = __timing;             \
+		if (d->rank == 0 && !d->quiet)            \
 			printf("%s\t%f\n", x, __timing);   \
 	}                                          \
 }
@@ -233,6 +249,367 @@ do {                                                \
 		COMPLEX_PTR(x)[__i] = COMPLEX_PTR(y)[__i];  \
 } while (0);
 
+/**
+ * FFT libraries that can compute the S-point and M_hat-point local FFTs
+ */
+typedef enum
+{
+  SOI_FFT_MKL,
+  SOI_FFT_FFTW,
+  SOI_FFT_BUILTIN, // self-contained mixed-radix FFT (no external dependency)
+  SOI_FFT_NUM_BACKENDS,
+} soi_fft_backend_t;
+
+#ifdef SOI_USE_MKL
+#define SOI_FFT_DEFAULT_BACKEND SOI_FFT_MKL
+#else
+#define SOI_FFT_DEFAULT_BACKEND SOI_FFT_BUILTIN
+#endif
+
+typedef struct soi_fft_plan soi_fft_plan_t;
+
+/**
+ * Instruction sets the SIMD kernels (filter stage and demodulation) are
+ * compiled for
+ */
+typedef enum
+{
+  SOI_ISA_AUTO = -1, // the best one supported by CPU and OS
+  SOI_ISA_SSE42,
+  SOI_ISA_AVX2, // AVX2 + FMA
+  SOI_ISA_AVX512,
+  SOI_ISA_NUM,
+} soi_isa_t;
+
+/**
+ * Register blocking and cache tiling of the filter stage convolution
+ */
+typedef struct
+{
+  int theta_unroll; // filter rows (out of n_mu) computed together. 0: autotune
+  int j_unroll; // block rows computed together
+  int i_tile; // cache lines of S computed for each block of j_block rows
+  int j_block; // block rows computed for each tile of S. 0: all rows of a thread
+  int prefetch_rows;
+    // rows of alpha_dt prefetched ahead. 0: no prefetch. -1: from the
+    // measured memory latency (see soi_tune_conv)
+  int prefetch_window; // prefetch the window table of the next cache line of S
+} soi_conv_config_t;
+
+/**
+ * How the filter stage gets the time window coefficients
+ */
+typedef enum
+{
+  SOI_WINDOW_AUTO, // SOI_WINDOW_OTF if the w_dup table doesn't fit in the last level cache
+  SOI_WINDOW_TABLE, // load from w_dup (or w_split)
+  SOI_WINDOW_OTF, // evaluate piecewise polynomials of the envelope in registers
+} soi_window_mode_t;
+
+/**
+ * Storage precision of the w_dup table. The convolution always accumulates
+ * in VAL_TYPE.
+ */
+typedef enum
+{
+  SOI_WINDOW_PRECISION_AUTO,
+    // float if the predicted SNR loss is well below the truncation error of
+    // the window parameters, full otherwise
+  SOI_WINDOW_PRECISION_FULL, // VAL_TYPE
+  SOI_WINDOW_PRECISION_FLOAT, // float, halving the table (double precision builds only)
+} soi_window_precision_t;
+
+/**
+ * Shape of the window (see window_family.c). The time window is
+ * exp(i*pi*t)*y(t)/mu and W its Fourier transform. Each family is
+ * sinc(tau*t) = sin(pi*tau*t)/(pi*tau*t), which makes W flat over the
+ * middle of the segment, times a bell that decides how fast W decays
+ * beyond.
+ */
+typedef enum
+{
+  SOI_WINDOW_GAUSSIAN_SINC,
+    // bell exp(-pi^2*t^2/sigma), W in closed form with erfc. Truncated to
+    // the B block rows
+  SOI_WINDOW_KAISER_BESSEL_SINC,
+    // bell I0(beta*sqrt(1 - (t/h)^2))/I0(beta) for |t| <= h, 0 beyond, with
+    // h = (B - d_mu)/2 so that the B block rows hold the whole window
+  SOI_WINDOW_ES_SINC,
+    // bell exp(beta*(sqrt(1 - (t/h)^2) - 1)) (exponential of semicircle), h
+    // as SOI_WINDOW_KAISER_BESSEL_SINC
+} soi_window_family_t;
+
+/**
+ * Whether a stage writes its output with non-temporal stores, which save
+ * the read for ownership and don't pollute the cache but evict the output
+ * from the cache even when it's read back soon
+ */
+typedef enum
+{
+  SOI_STORE_AUTO = -1, // non-temporal if the output doesn't fit in the last level cache
+  SOI_STORE_REGULAR = 0,
+  SOI_STORE_STREAM = 1,
+} soi_store_t;
+
+typedef struct
+{
+  soi_store_t conv; // filter stage convolution into gamma_tilde, read by the S-point FFTs
+  // S-point FFT outputs into alpha_tilde, sent by all-to-all. Only the AVX
+  // transpose of n_mu = 8 without codelets uses it: the strided S-point
+  // FFTs of the other cases leave their stores to the FFT backend.
+  soi_store_t transpose;
+  soi_store_t decompress; // received data into gamma_tilde, read by the M_hat-point FFT (use_vlc)
+  soi_store_t demodulate; // the output
+} soi_store_policy_t;
+
+/**
+ * Layout of the local input of compute_soi: M/P block rows of S elements
+ */
+typedef enum
+{
+  SOI_INPUT_ROW_MAJOR, // one block row after another
+  SOI_INPUT_TILED,
+    // input_tile_rows block rows at a time, each cache line of S for all of
+    // them before the next cache line (see soi_input_index), so that the
+    // filter stage reads consecutive block rows from consecutive memory
+    // instead of at stride S
+} soi_input_layout_t;
+
+/**
+ * Seconds per stage of one transform. soi_plan_k predicts them from short
+ * trial runs for the k it picks, soi_predict_time from a
+ * soi_machine_model_t, and compute_soi measures them.
+ */
+typedef struct
+{
+  double ghost; // exchange of the B - d_mu block rows with the neighbors
+  double conv; // filter stage convolution
+  double fft_s; // S-point FFTs of the filter stage
+  double all_to_all; // all segments
+  double fft_m_hat; // M_hat-point FFTs of the k segments
+  double demodulate; // multiplications by W_inv of the k segments
+  double total;
+    // with the all-to-all and the segment FFTs and demodulations
+    // pipelined over the k segments (see k_planner.c)
+} soi_time_breakdown_t;
+
+/**
+ * Rates of the machine that soi_predict_time and
+ * soi_predict_cooley_tukey_time scale the work of each stage by (see
+ * perf_model.c). Per rank, with all its OpenMP threads.
+ */
+typedef struct
+{
+  double conv_rate; // complex multiply-adds per second of the filter stage
+  double fft_batch_rate; // flops (5*n*log2(n) per FFT) per second of the S-point FFTs
+  double fft_rate; // flops per second of the M_hat-point FFTs
+  double mem_bandwidth; // bytes per second
+  double net_latency; // seconds per message
+  double net_bandwidth; // bytes per second of one rank's messages
+  size_t llc_size;
+  int threads;
+} soi_machine_model_t;
+
+/**
+ * Stages whose seconds compute_soi records in soi_desc_t::stats
+ */
+typedef enum
+{
+  SOI_STAT_FSS_SPLIT, // conversion of the input to split complex
+  SOI_STAT_FSS_GHOST, // posting the exchange of the ghost rows
+  SOI_STAT_FSS_CONV, // convolution of the rows not needing the ghost rows (thread 0)
+  SOI_STAT_FSS_FFT, // their S-point FFTs (thread 0)
+  SOI_STAT_FSS_TRANS, // their transposes, if separate from the FFTs (thread 0)
+  SOI_STAT_FSS_MPI, // waiting for the ghost rows
+  SOI_STAT_FSS_LAST, // the rows needing the ghost rows
+  SOI_STAT_FSS_TOTAL, // the filter stage
+  SOI_STAT_FSS_IMBALANCE_MIN, // the shortest wait of a thread at the end of the filter stage
+  SOI_STAT_FSS_IMBALANCE_MAX, // the longest one
+  SOI_STAT_COMPRESS, // use_vlc: exponents and compression
+  SOI_STAT_MPI, // posting the all-to-all
+  SOI_STAT_FUSED, // the segment loop
+  SOI_STAT_FUSED_MPI, // waiting for the segments
+  SOI_STAT_DECOMPRESS,
+  SOI_STAT_FUSED_FFT, // M_hat-point FFTs
+  SOI_STAT_FUSED_VMUL, // demodulation
+  SOI_STAT_TOTAL,
+  SOI_NUM_STATS,
+} soi_stat_t;
+
+/**
+ * A stat across ranks
+ */
+typedef struct
+{
+  double min, avg, max, stddev;
+} soi_stat_summary_t;
+
+typedef enum
+{
+  SOI_STATS_JSON,
+  SOI_STATS_CSV,
+} soi_stats_format_t;
+
+/**
+ * Events of a soi_trace_t. The argument of each is in parentheses
+ */
+typedef enum
+{
+  SOI_TRACE_SPLIT, // conversion of the input to split complex
+  SOI_TRACE_GHOST_SEND, // copying and posting the ghost rows
+  SOI_TRACE_CONV_TILE, // a tile of the convolution (first block row)
+  SOI_TRACE_FFT_S, // S-point FFTs of n_mu block rows (block row / n_mu)
+  SOI_TRACE_TRANSPOSE, // their transposes, if separate (block row / n_mu)
+  SOI_TRACE_GHOST_WAIT, // waiting for the ghost rows
+  SOI_TRACE_CONV_LAST, // convolution and FFTs of n_mu rows needing the ghost rows
+  SOI_TRACE_COMPRESS, // use_vlc (segment)
+  SOI_TRACE_ALL_TO_ALL_POST, // posting the sends and receives of segment ik (ik)
+  SOI_TRACE_RECV_WAIT, // until all ranks' parts of a segment arrived (segment)
+  SOI_TRACE_DECOMPRESS, // (segment)
+  SOI_TRACE_FFT_M_HAT, // (segment)
+  SOI_TRACE_DEMODULATE, // each thread's part (segment)
+  SOI_TRACE_SEND_WAIT, // until all sends completed
+  SOI_TRACE_NUM_EVENT_TYPES,
+} soi_trace_event_type_t;
+
+typedef struct soi_trace soi_trace_t; // see trace.c
+
+/**
+ * Hardware performance counters of a soi_counters_t
+ */
+typedef enum
+{
+  SOI_COUNTER_CYCLES,
+  SOI_COUNTER_INSTRUCTIONS,
+  SOI_COUNTER_LLC_MISSES,
+  SOI_COUNTER_DTLB_MISSES, // loads
+  SOI_COUNTER_FLOPS,
+  SOI_COUNTER_MEM_BYTES, // read and written by the memory controllers
+  SOI_NUM_COUNTERS,
+} soi_counter_t;
+
+/**
+ * Stages of compute_soi that a soi_counters_t counts
+ */
+typedef enum
+{
+  SOI_COUNTED_CONV, // filter stage convolution
+  SOI_COUNTED_FFT_S,
+  SOI_COUNTED_TRANSPOSE, // if separate from the S-point FFTs
+  SOI_COUNTED_FFT_M_HAT,
+  SOI_COUNTED_DEMODULATE,
+  SOI_NUM_COUNTED_STAGES,
+} soi_counted_stage_t;
+
+typedef struct
+{
+  double v[SOI_NUM_COUNTERS];
+  double time;
+} soi_counter_snapshot_t;
+
+typedef struct soi_counters soi_counters_t; // see counters.c
+
+typedef enum
+{
+  SOI_COMM_SEND,
+  SOI_COMM_RECV,
+} soi_comm_kind_t;
+
+typedef struct soi_comm_profile soi_comm_profile_t; // see comm_profile.c
+
+/**
+ * Work of the filter stage that a soi_imbalance_t attributes to threads
+ */
+typedef enum
+{
+  SOI_IMBALANCE_CONV, // tiles of the first K_0/J_UNROLL_FACTOR*J_UNROLL_FACTOR block rows
+  SOI_IMBALANCE_CONV_WAIT, // at the barrier after them
+  SOI_IMBALANCE_FFT_S, // S-point FFTs and transposes of those rows
+  SOI_IMBALANCE_FFT_S_WAIT, // at the barrier after them
+  SOI_IMBALANCE_TAIL, // the remaining block rows before the ghost exchange
+  SOI_IMBALANCE_LAST, // block rows after it
+  SOI_IMBALANCE_NUM_STAGES,
+} soi_imbalance_stage_t;
+
+typedef struct soi_imbalance soi_imbalance_t; // see imbalance.c
+
+/**
+ * Stages of compute_soi that a soi_energy_t measures
+ */
+typedef enum
+{
+  SOI_ENERGY_FILTER, // filter stage, including the ghost exchange
+  SOI_ENERGY_ALL_TO_ALL, // posting the all-to-all, and compression with use_vlc
+  SOI_ENERGY_FUSED, // M_hat-point FFTs and demodulation as segments arrive
+  SOI_ENERGY_NUM_STAGES,
+} soi_energy_stage_t;
+
+typedef struct soi_energy soi_energy_t; // see energy.c
+
+/**
+ * Buffers of a SOI transform per rank (see memory.c)
+ */
+typedef enum
+{
+  SOI_BUFFER_INPUT, // allocated by the caller: M_hat*k elements, for the output
+  SOI_BUFFER_TILED_INPUT, // allocated by the caller with SOI_INPUT_TILED
+  SOI_BUFFER_W,
+  SOI_BUFFER_W_DUP,
+  SOI_BUFFER_W_SPLIT,
+  SOI_BUFFER_W_DUP_FLOAT,
+  SOI_BUFFER_W_OTF, // w_poly and w_phase
+  SOI_BUFFER_W_INV,
+  SOI_BUFFER_GAMMA_TILDE,
+  SOI_BUFFER_ALPHA_TILDE,
+  SOI_BUFFER_BETA_TILDE,
+  SOI_BUFFER_ALPHA_GHOST,
+  SOI_BUFFER_DELTA,
+  SOI_BUFFER_EPSILON, // use_vlc, allocated by compute_soi
+  SOI_BUFFER_REQUESTS,
+  SOI_NUM_BUFFERS,
+} soi_buffer_t;
+
+typedef struct
+{
+  size_t bytes[SOI_NUM_BUFFERS];
+  size_t total; // of all buffers
+  size_t peak; // with the temporary buffers of init_soi_descriptor
+} soi_memory_t;
+
+#define SOI_METRICS_MAGIC 0x4d494f53 // "SOIM"
+#define SOI_METRICS_VERSION 1
+#define SOI_METRICS_BUCKETS 32
+
+/**
+ * Layout of the shared memory file of a soi_metrics_t, for monitoring
+ * agents. All counters are cumulative since soi_metrics_create.
+ */
+typedef struct
+{
+  unsigned magic; // SOI_METRICS_MAGIC once initialized
+  unsigned version; // SOI_METRICS_VERSION
+  unsigned long long sequence;
+    // incremented before and after each update: odd while updating. Read
+    // the page again if it's odd or changed while copying it
+  int rank, P;
+  long long pid;
+  long long N, k; // of the last transform
+  unsigned long long transforms; // compute_soi calls completed
+  unsigned long long stage_histogram[SOI_NUM_STATS][SOI_METRICS_BUCKETS];
+    // transforms by the time of each soi_stat_t stage: bucket b counts
+    // [2^b, 2^(b + 1)) microseconds, with the first and last unbounded
+  double stage_seconds[SOI_NUM_STATS];
+  unsigned long long bytes_sent, bytes_received; // by the all-to-all
+  unsigned long long bytes_uncompressed; // what bytes_sent would be without use_vlc
+  double compression_ratio; // bytes_sent/bytes_uncompressed
+  double imbalance_last, imbalance_max, imbalance_sum;
+    // seconds between the first and the last thread at the end of the filter stage
+  unsigned long long snr_checks; // reported with soi_metrics_record_snr
+  double snr_last, snr_min;
+} soi_metrics_page_t;
+
+typedef struct soi_metrics soi_metrics_t; // see metrics.c
+
 typedef struct
 {
 	MPI_Comm comm;
@@ -242,7 +619,10 @@ typedef struct
 	cfft_size_t N;   // global vector length
 	cfft_complex_t *W_inv; // inverse frequency window function tabulated values
 	cfft_complex_t *w; // time window function tabulated values
-  SIMDFPTYPE *w_dup;
+  VAL_TYPE *w_dup;
+    // w with real and imaginary parts duplicated into separate SIMD vectors
+    // of the selected isa
+  VAL_TYPE *w_split; // w in split complex layout, used if use_split_complex
 	cfft_complex_t *gamma_tilde; // temp buf for sampled and filtered data of size M_hat*k
 	cfft_complex_t *alpha_tilde; // another temp buf for permuted data of size M_hat*k
 	cfft_complex_t *beta_tilde; // another temp buf for permuted data of size M_hat*k
@@ -254,19 +634,104 @@ typedef struct
 	cfft_size_t B;
   double tau; // a paramter controls the width of window function. The wider the width, the smaller truncation error becomes
   double sigma;
+  soi_window_family_t window_family; // sigma is only used by SOI_WINDOW_GAUSSIAN_SINC
+  double window_beta;
+    // bell of the other families, with tau.
+    // 0: tau and window_beta maximizing soi_window_model_snr, resolved in
+    // init_soi_descriptor
 
-	DFTI_DESCRIPTOR_HANDLE desc_dft_s;
-	DFTI_DESCRIPTOR_HANDLE desc_dft_m_hat;
+  soi_fft_backend_t fft_backend;
+  soi_fft_plan_t *fft_s; // S-point FFTs, batched over n_mu rows of gamma_tilde
+  soi_fft_plan_t *fft_m_hat; // M_hat-point FFT of each segment
+  int use_fft_codelet;
+    // 1: S-point FFTs use the builtin fixed-size codelets and write their
+    //    output directly transposed into alpha_tilde
+    // 0: S-point FFTs use fft_backend
+    // -1: time both in init_soi_descriptor and set to 0 or 1
 #ifdef SOI_USE_FFTW
-  int use_fftw;
   unsigned fftw_flags;
-  FFTW_PLAN fftw_plan_s, fftw_plan_m_hat;
 #endif
+  soi_isa_t isa; // resolved in init_soi_descriptor if SOI_ISA_AUTO
+  soi_conv_config_t conv_config;
+    // theta_unroll = 0: the fastest compiled-in variant is picked by timing
+    // in init_soi_descriptor (or read from wisdom_file)
+  const char *wisdom_file;
+    // text file where autotuned parameters are looked up and appended.
+    // NULL: always tune
+  int use_split_complex;
+    // Split each cache line of the input and the window into real and
+    // imaginary parts (see soi_split_complex_lines) so that the convolution
+    // is pure FMAs. The input is converted in place at the beginning of
+    // the filter stage; gamma_tilde and the output stay interleaved.
+    // Not supported with avx512 (init_soi_descriptor resets it to 0).
+  int use_compensated_sum;
+    // Accumulate the convolution with TwoSum error terms so that its
+    // rounding error doesn't grow with B, at about twice the additions.
+    // The window table is then kept in full precision
+  soi_window_mode_t window_mode; // resolved in init_soi_descriptor if SOI_WINDOW_AUTO
+  VAL_TYPE *w_poly;
+    // used if window_mode == SOI_WINDOW_OTF.
+    // Monomial coefficients of the real envelope (-1)^kkk*y(t)/mu for each
+    // of the w_poly_pieces pieces of S, then (kkk, theta) pair, in a variable
+    // mapping the piece to [-1, 1]
+  int w_poly_degree, w_poly_pieces;
+  cfft_complex_t *w_phase;
+    // w_phase[theta*S + s]: the rest of w, which doesn't depend on kkk
+  soi_window_precision_t window_precision;
+    // resolved in init_soi_descriptor if SOI_WINDOW_PRECISION_AUTO.
+    // Only the interleaved window table can be stored in float
+  float *w_dup_float; // w_dup in float, used if window_precision == SOI_WINDOW_PRECISION_FLOAT
+  double predicted_snr;
+    // SNR (dB) expected from the window parameters and the rounding of the
+    // window table, set by init_soi_descriptor: measured if the parameters
+    // are in window_snr_table of pfft.c, otherwise from soi_plan_window or
+    // soi_window_model_snr
+  soi_store_policy_t store_policy; // SOI_STORE_AUTO fields are resolved in init_soi_descriptor
+  soi_input_layout_t input_layout;
+  int input_tile_rows;
+    // block rows per tile of SOI_INPUT_TILED, a power of 2 dividing M/P.
+    // 0: the largest one up to 64, resolved in init_soi_descriptor
   MPI_Request *sendRequests, *recvRequests;
   int use_vlc; // use variable length compression
   int *segmentBoundaries;
     // segmentBoundaries[i]: the first segment ith rank will process
   double comm_to_comp_cost_ratio;
+  double target_snr, target_max_err;
+    // accuracy soi_plan_window chooses n_mu, d_mu, B, and the shape for in
+    // init_soi_descriptor. 0: use the given window parameters
+  soi_time_breakdown_t predicted_times;
+    // set by soi_plan_k when init_soi_descriptor is called with k = 0,
+    // total is NAN otherwise
+  double stats[SOI_NUM_STATS];
+    // seconds of each stage of the last compute_soi on this rank, 0 for
+    // stages it didn't run. See soi_reduce_stats and soi_write_stats
+  int quiet; // 1: compute_soi doesn't print anything
+  soi_trace_t *trace; // where compute_soi records its timeline. NULL: not traced
+  soi_counters_t *counters;
+    // where compute_soi accumulates the hardware counters of its stages.
+    // NULL: not counted
+  soi_comm_profile_t *comm_profile;
+    // where compute_soi records each message of its all-to-all. NULL: not
+    // profiled
+  soi_imbalance_t *imbalance;
+    // where the filter stage attributes its work to threads. NULL: not
+    // analyzed
+  const double *thread_weights;
+    // relative speed of each OpenMP thread, by which the filter stage
+    // partitions block rows among threads. NULL: evenly. See
+    // soi_imbalance_feedback
+  soi_energy_t *energy;
+    // where compute_soi accumulates the energy of its stages. NULL: not
+    // measured
+  soi_metrics_t *metrics; // where compute_soi exports its counters. NULL: not exported
+  size_t sent_bytes, received_bytes;
+    // by the all-to-all of the last compute_soi on this rank
+  size_t uncompressed_bytes; // what sent_bytes would be without use_vlc
+  size_t buffer_bytes[SOI_NUM_BUFFERS];
+    // allocated for each buffer by init_soi_descriptor and compute_soi on
+    // this rank, 0 for the buffers the caller allocated
+  size_t transient_bytes;
+    // the largest buffer that only lived during init_soi_descriptor
 } soi_desc_t;
 
 __declspec(noinline)
@@ -274,11 +739,525 @@ void parallel_filter_subsampling(soi_desc_t *desc, cfft_complex_t * alpha_dt);
 
 void set_default_soi_descriptor(soi_desc_t *desc);
 
+/**
+ * @param k segments per rank. 0: chosen by soi_plan_k
+ */
 void init_soi_descriptor(soi_desc_t *desc, MPI_Comm comm, cfft_size_t k);
 
 void compute_soi(soi_desc_t * d, cfft_complex_t *alpha_dt);
+/**
+ * Doesn't call fftw_cleanup_threads, which would invalidate the FFTW plans
+ * of other descriptors: call it once when the process is done with FFTW
+ */
 void free_soi_descriptor(soi_desc_t * d);
 
+/**
+ * @param isa the instruction set of the codelets of SOI_FFT_BUILTIN
+ * @param howmany, dist the batch computed by soi_fft_compute_batch:
+ *        howmany transforms with distance dist between their first elements
+ * @param user_threads the maximum number of threads that can call the plan
+ *        concurrently
+ * @param flags planner flags (FFTW only)
+ * @param buf a buffer used for planning (FFTW only). Its contents are
+ *        destroyed.
+ */
+soi_fft_plan_t *soi_fft_create_plan(
+  soi_fft_backend_t backend, soi_isa_t isa,
+  cfft_size_t n, cfft_size_t howmany, cfft_size_t dist,
+  int user_threads, unsigned flags, cfft_complex_t *buf);
+void soi_fft_compute(soi_fft_plan_t *p, cfft_complex_t *inout);
+void soi_fft_compute_batch(soi_fft_plan_t *p, cfft_complex_t *inout);
+/**
+ * Computes the FFT of inout (whose contents are destroyed) and writes it to
+ * out[k*ostride]
+ */
+void soi_fft_compute_strided(
+  soi_fft_plan_t *p, cfft_complex_t *inout,
+  cfft_complex_t *out, cfft_size_t ostride);
+void soi_fft_destroy_plan(soi_fft_plan_t *p);
+
+int soi_fft_backend_available(soi_fft_backend_t backend);
+const char *soi_fft_backend_name(soi_fft_backend_t backend);
+/**
+ * @ret the backend with the given name or -1 if there's no such backend
+ */
+int soi_fft_backend_from_name(const char *name);
+
+/**
+ * @return the best ISA supported by this CPU and OS. Environment variable
+ *         SOI_ISA (sse42, avx2, or avx512) overrides it.
+ */
+soi_isa_t soi_detect_isa();
+int soi_isa_supported(soi_isa_t isa);
+const char *soi_isa_name(soi_isa_t isa);
+/**
+ * @ret the ISA with the given name or -1 if there's no such ISA
+ */
+int soi_isa_from_name(const char *name);
+
+/**
+ * Resolve d->conv_config by timing the compiled-in variants on the actual
+ * problem size, or from d->wisdom_file. Collective over d->comm.
+ */
+void soi_tune_conv(soi_desc_t *d);
+
+/**
+ * Convert n complex numbers (a multiple of CACHE_LINE_LEN/2) from
+ * interleaved to split complex layout: each cache line holds
+ * CACHE_LINE_LEN/2 real parts followed by the imaginary parts.
+ * out can be the same as in.
+ */
+void soi_split_complex_lines(cfft_complex_t *out, const cfft_complex_t *in, cfft_size_t n);
+
+/**
+ * @return the index in the local input of compute_soi of element i of
+ *         local block row r in d->input_layout
+ */
+static inline cfft_size_t soi_input_index(const soi_desc_t *d, cfft_size_t r, cfft_size_t i)
+{
+  cfft_size_t S = d->k*d->P;
+  if (SOI_INPUT_ROW_MAJOR == d->input_layout) return r*S + i;
+  cfft_size_t R = d->input_tile_rows, L = CACHE_LINE_LEN/2;
+  return r/R*R*S + i/L*R*L + r%R*L + i%L;
+}
+
+/**
+ * Copy the row major local input in to out in d->input_layout, for callers
+ * that can't produce it in that layout directly. Call after
+ * init_soi_descriptor.
+ */
+void soi_tile_input(const soi_desc_t *d, cfft_complex_t *out, const cfft_complex_t *in);
+
+/**
+ * The real envelope y(t) of the time window (w without the phase exp(i*pi*t)
+ * and the 1/mu scaling)
+ */
+double soi_window_envelope(double t, const soi_desc_t *d);
+/**
+ * @return the frequency window W(u), the Fourier transform of the envelope,
+ *         in closed form for SOI_WINDOW_GAUSSIAN_SINC and by quadrature
+ *         otherwise. Meant for |u| up to a few mu.
+ */
+double soi_window_response(double u, const soi_desc_t *d);
+/**
+ * Set W[i] = W(i/M - 1/2) for i in [0, M), over the segment
+ * @return 0 if W isn't positive over the segment, 1 otherwise
+ */
+int soi_window_response_table(const soi_desc_t *d, double *W, cfft_size_t M);
+#define SOI_OTF_MIN_PIECES 16 // pieces of S fitted first, if its cache lines divide
+#define SOI_OTF_MAX_DEGREE 16 // the degree of w_poly is below this
+/**
+ * @return the number of pieces of S that soi_init_window_otf fits first.
+ *         It doubles them while the degree would reach SOI_OTF_MAX_DEGREE.
+ */
+cfft_size_t soi_window_otf_pieces(cfft_size_t S);
+/**
+ * Fit d->w_poly and fill d->w_phase for SOI_WINDOW_OTF.
+ * @return 1 on success, 0 if no polynomial degree up to the supported
+ *         maximum reproduces the window to working precision
+ */
+int soi_init_window_otf(soi_desc_t *d);
+
+/**
+ * @return the SNR (dB) predicted by the analytic error model of d's window
+ *         parameters (see window_planner.c)
+ */
+double soi_window_model_snr(const soi_desc_t *d);
+/**
+ * @return the SNR (dB) of d's window parameters from the response of the
+ *         truncated, sampled window at random output frequencies, the ones
+ *         a random input would see, and all their aliases
+ */
+double soi_window_check_snr(const soi_desc_t *d, unsigned seed);
+/**
+ * Set the shape parameters of d's window family (tau and sigma, or tau and
+ * window_beta) to maximize soi_window_model_snr for d's mu and B.
+ * @return the SNR
+ */
+double soi_optimize_window_shape(soi_desc_t *d);
+/**
+ * Set n_mu, d_mu, B, tau and sigma (window_beta for the other families),
+ * and predicted_snr of d to the parameters of d->window_family with the
+ * lowest modeled cost (filter stage, FFTs, and all-to-all weighted by
+ * comm_to_comp_cost_ratio) that reach d->target_snr and d->target_max_err
+ * with the error model and soi_window_check_snr. Only mu with compiled-in
+ * filter stage kernels and dividing the problem are considered. Does
+ * nothing if neither target is set. Collective over d->comm; d->k, d->N,
+ * and d->P must be set.
+ */
+void soi_plan_window(soi_desc_t *d);
+/**
+ * @return the SNR (dB) needed for d->target_snr and d->target_max_err, 0
+ *         if neither is set. The largest error of N outputs is about
+ *         sqrt(2*ln(N)) times the RMS error.
+ */
+double soi_required_snr(const soi_desc_t *d);
+/**
+ * Set d->k to the power of 2 with the smallest total time predicted from
+ * short trial runs of each stage with d's parameters, and
+ * d->predicted_times to its breakdown. Only k for which the filter stage
+ * can run with d's window parameters and the OpenMP threads are
+ * considered. Collective over d->comm; d->N, d->P, and the window
+ * parameters must be set.
+ */
+void soi_plan_k(soi_desc_t *d);
+/**
+ * Run each stage of a transform with d's parameters briefly on scratch
+ * buffers of the real sizes, as soi_plan_k does for each k.
+ * @return the times scaled to the whole transform (the maximum over
+ *         ranks), all NAN if the filter stage can't run with d's k.
+ *         Collective over d->comm.
+ */
+soi_time_breakdown_t soi_time_stages(const soi_desc_t *d);
+
+/**
+ * @return the time of the stages in b with the all-to-all and the segment
+ *         FFTs and demodulations pipelined over k segments
+ */
+double soi_pipelined_time(const soi_time_breakdown_t *b, cfft_size_t k);
+/**
+ * Measure the memory bandwidth and the network latency and bandwidth with
+ * micro-benchmarks, and fit the compute rates of m to soi_time_stages of d
+ * (which needs d->k, and otherwise only what soi_plan_k needs). Collective
+ * over d->comm.
+ */
+void soi_calibrate_machine_model(soi_machine_model_t *m, const soi_desc_t *d);
+/**
+ * Refit the compute rates of m to the times t of the stages of a transform
+ * with d's parameters, e.g. from soi_measured_times
+ */
+void soi_fit_machine_model(
+  soi_machine_model_t *m, const soi_desc_t *d, const soi_time_breakdown_t *t);
+/**
+ * @return the predicted time of each stage of SOI on machine m
+ */
+soi_time_breakdown_t soi_predict_time(
+  const soi_machine_model_t *m, cfft_size_t N, int P, cfft_size_t k,
+  int n_mu, int d_mu, cfft_size_t B);
+/**
+ * @return the predicted time of a distributed Cooley-Tukey FFT (MKL cluster
+ *         DFT or FFTW-MPI) with the output in order on machine m
+ */
+double soi_predict_cooley_tukey_time(const soi_machine_model_t *m, cfft_size_t N, int P);
+
+/**
+ * @return the name of stat in soi_write_stats
+ */
+const char *soi_stat_name(soi_stat_t stat);
+/**
+ * Reduce d->stats across d->comm. Collective over d->comm.
+ * @param summary SOI_NUM_STATS summaries, the same on every rank
+ */
+void soi_reduce_stats(const soi_desc_t *d, soi_stat_summary_t *summary);
+/**
+ * Sum d->stats of the last compute_soi on this rank into the stages of t.
+ * The compression of use_vlc is not counted, and the decompression is
+ * counted as demodulate.
+ */
+void soi_measured_times(const soi_desc_t *d, soi_time_breakdown_t *t);
+/**
+ * Write the soi_reduce_stats of d->stats from rank 0 to fp, with N, P,
+ * and k. JSON is an object with an object of min, avg, max, and stddev per
+ * stat, CSV a line per stat after a header. Collective over d->comm.
+ */
+void soi_write_stats(const soi_desc_t *d, FILE *fp, soi_stats_format_t format);
+
+/**
+ * @param events_per_thread the size of the ring buffer of each thread
+ * @return a trace to set soi_desc_t::trace to. Collective over comm
+ */
+soi_trace_t *soi_trace_create(MPI_Comm comm, size_t events_per_thread);
+/**
+ * Record an event of the calling OpenMP thread from begin to now
+ */
+void soi_trace_record(soi_trace_t *t, soi_trace_event_type_t type, double begin, long arg);
+/**
+ * Write the events of all ranks to file_name in the Chrome trace event
+ * format. Collective over comm.
+ */
+void soi_trace_write(soi_trace_t *t, MPI_Comm comm, const char *file_name);
+void soi_trace_free(soi_trace_t *t);
+
+/**
+ * @return the begin time of an event to pass to soi_trace_end
+ */
+static inline double soi_trace_begin(soi_trace_t *t)
+{
+  return t ? MPI_Wtime() : 0;
+}
+
+static inline void soi_trace_end(soi_trace_t *t, soi_trace_event_type_t type, double begin, long arg)
+{
+  if (t) soi_trace_record(t, type, begin, arg);
+}
+
+/**
+ * Open the hardware counters of every OpenMP thread. Counters that can't
+ * be opened are unavailable (see soi_counters_available).
+ */
+soi_counters_t *soi_counters_create();
+int soi_counters_available(const soi_counters_t *c, soi_counter_t counter);
+/**
+ * Read the counters of the calling thread in a parallel region, of all
+ * threads otherwise
+ */
+void soi_counters_read(soi_counters_t *c, soi_counter_snapshot_t *s);
+/**
+ * Add the counts of the calling thread since begin, read by it with
+ * soi_counters_read, to stage
+ */
+void soi_counters_add(
+  soi_counters_t *c, soi_counted_stage_t stage, const soi_counter_snapshot_t *begin);
+void soi_counters_reset(soi_counters_t *c);
+/**
+ * Write the counts of each stage summed over threads and ranks from rank 0
+ * to fp, with IPC, GFLOP/s, memory GB/s, and bytes per flop derived from
+ * the available ones. Collective over comm.
+ */
+void soi_write_counters(const soi_counters_t *c, MPI_Comm comm, FILE *fp);
+void soi_counters_free(soi_counters_t *c);
+
+static inline void soi_counters_begin(soi_counters_t *c, soi_counter_snapshot_t *s)
+{
+  if (c) soi_counters_read(c, s);
+}
+
+static inline void soi_counters_end(
+  soi_counters_t *c, soi_counted_stage_t stage, const soi_counter_snapshot_t *s)
+{
+  if (c) soi_counters_add(c, stage, s);
+}
+
+/**
+ * @return a communication profile to set soi_desc_t::comm_profile to
+ */
+soi_comm_profile_t *soi_comm_profile_create(MPI_Comm comm);
+/**
+ * Clear the records of the last transform. Called by compute_soi
+ */
+void soi_comm_profile_begin(soi_comm_profile_t *p, cfft_size_t k);
+/**
+ * Record that a message of bytes to or from peer is posted
+ *
+ * @param slot index of its request in soi_desc_t::sendRequests or
+ *             soi_desc_t::recvRequests
+ */
+void soi_comm_profile_record(
+  soi_comm_profile_t *p, soi_comm_kind_t kind, size_t slot, int peer, int segment, long bytes);
+/**
+ * MPI_Waitall that records when each of the requests, in slots
+ * [first_slot, first_slot + count), completes
+ */
+int soi_comm_waitall(
+  soi_comm_profile_t *p, soi_comm_kind_t kind, size_t first_slot, int count,
+  MPI_Request *requests);
+/**
+ * MPI_Wait of one request, such as of an MPI_Ialltoallv, that completes the
+ * count messages in slots [first_slot, first_slot + count)
+ */
+int soi_comm_wait_shared(
+  soi_comm_profile_t *p, soi_comm_kind_t kind, size_t first_slot, int count,
+  MPI_Request *request);
+/**
+ * Write every message of the last transform of all ranks to file_name as
+ * CSV, with times in seconds since its start. Collective over comm.
+ */
+void soi_comm_profile_write_records(soi_comm_profile_t *p, MPI_Comm comm, const char *file_name);
+/**
+ * Write the P x P matrices of bytes, average time from post to completion,
+ * and bandwidth of the messages received so far from rank 0 to fp, and the
+ * links and ranks that are much slower than the median. Collective over
+ * comm.
+ */
+void soi_comm_profile_write_matrix(soi_comm_profile_t *p, MPI_Comm comm, FILE *fp);
+void soi_comm_profile_free(soi_comm_profile_t *p);
+
+static inline void soi_comm_profile_post(
+  soi_comm_profile_t *p, soi_comm_kind_t kind, size_t slot, int peer, int segment, long bytes)
+{
+  if (p) soi_comm_profile_record(p, kind, slot, peer, segment, bytes);
+}
+
+soi_imbalance_t *soi_imbalance_create(MPI_Comm comm);
+/**
+ * Add the time since begin and the work of the block rows [j_begin, j_end)
+ * times the segments [i_begin, i_end) to stage of the calling thread
+ */
+void soi_imbalance_record(
+  soi_imbalance_t *a, soi_imbalance_stage_t stage,
+  long i_begin, long i_end, long j_begin, long j_end, double begin);
+void soi_imbalance_reset(soi_imbalance_t *a);
+/**
+ * Write, from rank 0 to fp, a histogram of the time of each stage across
+ * the threads of all ranks, the slowest pieces of work, and the systematic
+ * skews found. Collective over comm.
+ */
+void soi_imbalance_write(soi_imbalance_t *a, MPI_Comm comm, FILE *fp);
+/**
+ * Set d->thread_weights from the speed of each thread of this rank so far.
+ * The weights are owned by a.
+ */
+void soi_imbalance_feedback(soi_imbalance_t *a, soi_desc_t *d);
+void soi_imbalance_free(soi_imbalance_t *a);
+
+/**
+ * Open the RAPL package and DRAM counters of /sys/class/powercap on the
+ * first rank of each node. Without them, the energy isn't measured.
+ */
+soi_energy_t *soi_energy_create(MPI_Comm comm);
+/**
+ * @return whether any rank of comm reads RAPL counters. Collective over comm.
+ */
+int soi_energy_available(const soi_energy_t *e, MPI_Comm comm);
+/**
+ * Start measuring the first stage. Called by compute_soi
+ */
+void soi_energy_start(soi_energy_t *e);
+/**
+ * Add the energy since the last soi_energy_start or soi_energy_mark to
+ * stage. Called by compute_soi
+ */
+void soi_energy_mark(soi_energy_t *e, soi_energy_stage_t stage);
+void soi_energy_reset(soi_energy_t *e);
+/**
+ * Write, from rank 0 to fp, the joules per transform of each stage summed
+ * over nodes, the average watts, and GFLOP/J, if available. Collective over
+ * d->comm.
+ */
+void soi_write_energy(const soi_energy_t *e, const soi_desc_t *d, FILE *fp);
+void soi_energy_free(soi_energy_t *e);
+
+const char *soi_buffer_name(soi_buffer_t buffer);
+/**
+ * Predict the bytes per rank of the buffers of d, with d->N, d->P, d->k
+ * (not 0), and the window parameters set, without allocating anything.
+ * With target_snr, soi_plan_window may choose other window parameters.
+ */
+void soi_predict_memory(const soi_desc_t *d, soi_memory_t *m);
+/**
+ * The bytes of the buffers allocated by init_soi_descriptor and
+ * compute_soi for d (d->buffer_bytes), and of the input buffer(s) of the
+ * caller
+ */
+void soi_descriptor_memory(const soi_desc_t *d, soi_memory_t *m);
+/**
+ * Write predicted, and actual if not NULL, bytes per buffer, total, and
+ * peak from rank 0 to fp. The actual ones are of the rank with the most,
+ * with the peak resident set size of the process. Collective over comm.
+ */
+void soi_write_memory(
+  const soi_memory_t *predicted, const soi_memory_t *actual, MPI_Comm comm, FILE *fp);
+
+/**
+ * Create /dev/shm/<name>.<rank> with a soi_metrics_page_t, which stays
+ * after soi_metrics_free for a final read.
+ *
+ * @return metrics to set soi_desc_t::metrics to, NULL if the file can't
+ *         be created
+ */
+soi_metrics_t *soi_metrics_create(MPI_Comm comm, const char *name);
+/**
+ * Add the last transform of d. Called by compute_soi
+ */
+void soi_metrics_update(soi_metrics_t *m, const soi_desc_t *d);
+/**
+ * Add an SNR of a transform checked against a reference by the caller
+ */
+void soi_metrics_record_snr(soi_metrics_t *m, double snr);
+void soi_metrics_free(soi_metrics_t *m);
+
+static inline double soi_imbalance_begin(soi_imbalance_t *a)
+{
+  return a ? MPI_Wtime() : 0;
+}
+
+static inline void soi_imbalance_end(
+  soi_imbalance_t *a, soi_imbalance_stage_t stage,
+  long i_begin, long i_end, long j_begin, long j_end, double begin)
+{
+  if (a) soi_imbalance_record(a, stage, i_begin, i_end, j_begin, j_end, begin);
+}
+
+/**
+ * [*begin, *end) of [0, n) for thread first_thread + local_thread of
+ * num_threads, in multiples of unit (n is one too) proportional to weights
+ */
+static inline void soi_weighted_partition(
+  const double *weights, int first_thread, int num_threads, int local_thread,
+  size_t n, size_t unit, size_t *begin, size_t *end)
+{
+  double total = 0, before = 0;
+  for (int t = 0; t < num_threads; ++t) {
+    if (t == local_thread) before = total;
+    total += weights[first_thread + t];
+  }
+  double units = n/unit;
+  *begin = (size_t)floor(units*before/total + 0.5)*unit;
+  *end = (size_t)floor(units*(before + weights[first_thread + local_thread])/total + 0.5)*unit;
+  if (*begin > n) *begin = n;
+  if (*end > n) *end = n;
+}
+
+typedef enum
+{
+  SOI_DFT_AUTO = -1,
+  SOI_DFT_SOI,
+  SOI_DFT_MKL, // MKL cluster DFT
+  SOI_DFT_FFTW, // FFTW-MPI
+  SOI_DFT_NUM_METHODS,
+} soi_dft_method_t;
+
+/**
+ * A distributed FFT computed with the method that is expected to be the
+ * fastest for its shape and accuracy (see distributed_fft.c)
+ */
+typedef struct
+{
+  soi_dft_method_t method; // resolved in soi_dft_init if SOI_DFT_AUTO
+  int measure;
+    // 1: choose by timing a transform of each method
+    // 0: choose by the performance model
+  soi_desc_t soi;
+    // N, the accuracy (target_snr, target_max_err), wisdom_file, and the
+    // other SOI parameters. P, rank, and comm are set by soi_dft_init
+  int has_soi;
+  cfft_size_t local_len[SOI_DFT_NUM_METHODS];
+    // complex elements of the buffer passed to distributed_fft; the first
+    // N/P of them are the input and the output
+  double time[SOI_DFT_NUM_METHODS];
+    // predicted or measured seconds of each method, INFINITY if it's not
+    // available
+  double snr[SOI_DFT_NUM_METHODS]; // expected SNR (dB), NAN if not available
+#ifdef SOI_USE_MKL
+  DFTI_DESCRIPTOR_HANDLE mkl; // used if P == 1
+  DFTI_DESCRIPTOR_DM_HANDLE mkl_dm;
+#endif
+#ifdef SOI_USE_FFTW
+  int has_fftw;
+  FFTW_PLAN fftw;
+#endif
+} soi_dft_t;
+
+void set_default_soi_dft(soi_dft_t *p);
+/**
+ * Choose p->method if SOI_DFT_AUTO, unless it's cached for p's shape in this
+ * process or in p->soi.wisdom_file, and create its plan. Collective over
+ * comm.
+ * @param k segments per rank of SOI. 0: chosen by soi_plan_k
+ */
+void soi_dft_init(soi_dft_t *p, MPI_Comm comm, cfft_size_t k);
+/**
+ * @return complex elements of the buffer distributed_fft needs
+ */
+cfft_size_t soi_dft_local_len(const soi_dft_t *p);
+/**
+ * Compute the forward FFT of the N/P elements of inout of each rank in
+ * place, with the output in order
+ */
+void distributed_fft(soi_dft_t *p, cfft_complex_t *inout);
+void soi_dft_free(soi_dft_t *p);
+const char *soi_dft_method_name(soi_dft_method_t method);
+
 void populate_input(cfft_complex_t *input, size_t localLen, size_t offset, size_t globalLen, int kind);
 cfft_complex_t reference_output(size_t idx, size_t globalLen, int kind, size_t offset);
 double compute_snr(
@@ -303,7 +1282,41 @@ __declspec (align(64)) static unsigned long Remaining[5][4] = {
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
+typedef enum
+{
+  TSC_FREQ_CPUID,
+  TSC_FREQ_HYPERVISOR,
+  TSC_FREQ_KERNEL,
+  TSC_FREQ_CALIBRATED,
+} tsc_freq_source_t;
+
+/**
+ * @return the frequency of the TSC (__rdtsc ticks per second), from CPUID,
+ *         the hypervisor, or the kernel, calibrated against
+ *         CLOCK_MONOTONIC_RAW if none of them reports it (see cpu_freq.c)
+ */
 double get_cpu_freq();
+tsc_freq_source_t get_tsc_freq_source();
+const char *tsc_freq_source_name(tsc_freq_source_t source);
+/**
+ * @return 1 if the TSC ticks at a constant rate in all power states, so
+ *         that __rdtsc differences are times. 0 if not or unknown
+ */
+int tsc_is_invariant();
+/**
+ * @return the size in bytes of the largest cache of cpu0
+ */
+size_t get_llc_size();
+/**
+ * @return the measured latency in seconds of a load that misses the cache
+ */
+double get_memory_latency();
+/**
+ * @return the measured bandwidth in bytes per second of copying a buffer
+ *         that doesn't fit in the cache with all OpenMP threads (reads plus
+ *         writes)
+ */
+double get_memory_bandwidth();
 
 static const double PI=3.14159265358979323846;
 #define VERIFY_PI 3.141592653589793238462643383279502884197169399375105820974944592307816406286208998628034825342117067982148086q
@@ -0,0 +1,91 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "soi.h"
+
+static const char *stat_names[SOI_NUM_STATS] = {
+  "fss_split",
+  "fss_ghost",
+  "fss_conv",
+  "fss_fft",
+  "fss_trans",
+  "fss_mpi",
+  "fss_last",
+  "fss_total",
+  "fss_imbalance_min",
+  "fss_imbalance_max",
+  "compress",
+  "mpi",
+  "fused",
+  "fused_mpi",
+  "decompress",
+  "fused_fft",
+  "fused_vmul",
+  "total",
+};
+
+const char *soi_stat_name(soi_stat_t stat)
+{
+  return stat_names[stat];
+}
+
+void soi_measured_times(const soi_desc_t *d, soi_time_breakdown_t *t)
+{
+  const double *s = d->stats;
+  t->ghost = s[SOI_STAT_FSS_GHOST] + s[SOI_STAT_FSS_MPI];
+  // the last rows are mostly convolution
+  t->conv = s[SOI_STAT_FSS_CONV] + s[SOI_STAT_FSS_LAST];
+  t->fft_s = s[SOI_STAT_FSS_FFT] + s[SOI_STAT_FSS_TRANS];
+  t->all_to_all = s[SOI_STAT_MPI] + s[SOI_STAT_FUSED_MPI];
+  t->fft_m_hat = s[SOI_STAT_FUSED_FFT];
+  t->demodulate = s[SOI_STAT_FUSED_VMUL] + s[SOI_STAT_DECOMPRESS];
+  t->total = s[SOI_STAT_TOTAL];
+}
+
+void soi_reduce_stats(const soi_desc_t *d, soi_stat_summary_t *summary)
+{
+  double min[SOI_NUM_STATS], max[SOI_NUM_STATS], sum[2*SOI_NUM_STATS];
+  for (int i = 0; i < SOI_NUM_STATS; ++i) {
+    sum[i] = d->stats[i];
+    sum[SOI_NUM_STATS + i] = d->stats[i]*d->stats[i];
+  }
+  MPI_Allreduce(d->stats, min, SOI_NUM_STATS, MPI_DOUBLE, MPI_MIN, d->comm);
+  MPI_Allreduce(d->stats, max, SOI_NUM_STATS, MPI_DOUBLE, MPI_MAX, d->comm);
+  MPI_Allreduce(MPI_IN_PLACE, sum, 2*SOI_NUM_STATS, MPI_DOUBLE, MPI_SUM, d->comm);
+
+  for (int i = 0; i < SOI_NUM_STATS; ++i) {
+    summary[i].min = min[i];
+    summary[i].max = max[i];
+    summary[i].avg = sum[i]/d->P;
+    double var = sum[SOI_NUM_STATS + i]/d->P - summary[i].avg*summary[i].avg;
+    summary[i].stddev = sqrt(MAX(var, 0));
+  }
+}
+
+void soi_write_stats(const soi_desc_t *d, FILE *fp, soi_stats_format_t format)
+{
+  soi_stat_summary_t summary[SOI_NUM_STATS];
+  soi_reduce_stats(d, summary);
+  if (0 != d->rank) return;
+
+  if (SOI_STATS_JSON == format) {
+    fprintf(fp, "{\"N\": %ld, \"P\": %d, \"k\": %ld, \"stats\": {", (long)d->N, d->P, (long)d->k);
+    for (int i = 0; i < SOI_NUM_STATS; ++i) {
+      fprintf(
+        fp, "%s\n  \"%s\": {\"min\": %g, \"avg\": %g, \"max\": %g, \"stddev\": %g}",
+        i ? "," : "", stat_names[i],
+        summary[i].min, summary[i].avg, summary[i].max, summary[i].stddev);
+    }
+    fprintf(fp, "\n}}\n");
+  }
+  else {
+    fprintf(fp, "N,P,k,stat,min,avg,max,stddev\n");
+    for (int i = 0; i < SOI_NUM_STATS; ++i) {
+      fprintf(
+        fp, "%ld,%d,%ld,%s,%g,%g,%g,%g\n",
+        (long)d->N, d->P, (long)d->k, stat_names[i],
+        summary[i].min, summary[i].avg, summary[i].max, summary[i].stddev);
+    }
+  }
+  fflush(fp);
+}
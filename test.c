@@ -7,7 +7,9 @@
 
 #include <omp.h>
 
+#ifdef SOI_USE_MKL
 #include <mkl_cdft.h>
+#endif
 
 #include "soi.h"
 
@@ -16,6 +18,22 @@
  */
 typedef struct options {
   int k_min, k_max;
+  int auto_k; // let init_soi_descriptor choose k instead of sweeping
+  int perf_model; // print the predictions of the performance model
+  double net_latency, net_bandwidth; // of the performance model. 0: measured
+  int dispatch; // 0: off, 1: distributed_fft chosen by the model, 2: by measuring
+  int stats; // print the stage times across ranks. 0: off, 1: JSON, 2: CSV
+  char *trace_file_name; // Chrome trace of all SOI runs
+  int counters; // print the hardware counters of the stages of each SOI run
+  int comm_profile; // print the P x P matrices of the all-to-all of SOI
+  char *comm_records_file_name; // messages of the last SOI run, as CSV
+  int imbalance; // print the load imbalance of the filter stage of each SOI run
+  int imbalance_feedback; // partition the filter stage by the measured thread speeds
+  int energy; // print the RAPL energy of the stages of each SOI run
+  int memory; // print the predicted and actual bytes of the buffers of each SOI run
+  int estimate_only; // only print the predicted bytes of the buffers
+  int estimate_P; // ranks to predict for. 0: MPI_COMM_WORLD's
+  char *metrics_name; // export counters to /dev/shm/<metrics_name>.<rank>
   int input_min, input_max;
   int no_mkl, no_soi, no_snr;
   char *in_file_name;
@@ -25,7 +43,8 @@ typedef struct options {
   int no_fftw;
   char *fftw_out_file_name;
 #endif
-  int soi_with_fftw;
+  int fft_backends[SOI_FFT_NUM_BACKENDS]; // FFT backends used by SOI
+  int layouts[2]; // layouts[0]: interleaved, layouts[1]: split complex
   unsigned fftw_flags;
 } options;
 
@@ -33,13 +52,35 @@ static options parseArgs(int argc, char *argv[], soi_desc_t *desc)
 {
   options ret;
   ret.k_min = ret.k_max = 8;
+  ret.auto_k = 0;
+  ret.perf_model = 0;
+  ret.net_latency = ret.net_bandwidth = 0;
+  ret.dispatch = 0;
+  ret.stats = 0;
+  ret.trace_file_name = NULL;
+  ret.counters = 0;
+  ret.comm_profile = 0;
+  ret.comm_records_file_name = NULL;
+  ret.imbalance = ret.imbalance_feedback = 0;
+  ret.energy = 0;
+  ret.memory = 0;
+  ret.estimate_only = ret.estimate_P = 0;
+  ret.metrics_name = NULL;
   ret.input_min = 2;
   ret.input_max = 2;
   ret.no_mkl = ret.no_soi = ret.no_snr = 0;
   ret.in_file_name = NULL;
   ret.mkl_out_file_name = NULL;
   ret.soi_out_file_name = NULL;
-  ret.soi_with_fftw = 0;
+  for (int b = 0; b < SOI_FFT_NUM_BACKENDS; ++b) {
+    ret.fft_backends[b] = 0;
+  }
+  int backend_specified = 0;
+  ret.layouts[0] = 1;
+  ret.layouts[1] = 0;
+#ifndef SOI_USE_MKL
+  ret.no_mkl = 1;
+#endif
 #ifdef SOI_USE_FFTW
   ret.no_fftw = 0;
   ret.fftw_out_file_name = NULL;
@@ -50,6 +91,40 @@ static options parseArgs(int argc, char *argv[], soi_desc_t *desc)
     static struct option long_options[] = {
       { "k_min", required_argument, 0, 'k' },
       { "k_max", required_argument, 0, 'K' }, // sweep k over [k_min, k_max)
+      { "auto_k", no_argument, 0, 'A' },
+      { "perf_model", optional_argument, 0, 'M' },
+        // --perf_model[=latency,bandwidth]: predict with the measured
+        // network or the given one (seconds, bytes per second)
+      { "dispatch", optional_argument, 0, 'D' },
+        // --dispatch[=measure]: also run distributed_fft with the method chosen
+        // by the performance model or by timing each one
+      { "quiet", no_argument, 0, 'Q' }, // no prints from compute_soi
+      { "stats", required_argument, 0, 'S' },
+        // json or csv: print the stage times of each SOI run (min, avg, max, and
+        // stddev across ranks)
+      { "trace", required_argument, 0, 'G' },
+        // write the timeline of the last SOI runs (per rank and thread) to a
+        // Chrome trace file
+      { "counters", no_argument, 0, 'H' },
+        // hardware counters of the stages of SOI (perf_event_open). Unavailable
+        // ones are printed as n/a
+      { "comm_profile", optional_argument, 0, 'U' },
+        // print the bytes, time, and bandwidth between each pair of ranks in the
+        // all-to-all of SOI, and write each message of the last run to the file
+      { "memory", no_argument, 0, 'j' },
+        // predicted and actual bytes per buffer, total, and peak of each SOI run
+      { "estimate_only", optional_argument, 0, 'P' },
+        // print the predicted bytes of the buffers for each k, with the given
+        // number of ranks, and exit without allocating or running anything
+      { "metrics", required_argument, 0, 'z' },
+        // keep cumulative counters of the SOI runs in /dev/shm/<name>.<rank> for
+        // monitoring agents (soi_metrics_page_t)
+      { "energy", no_argument, 0, 'Y' },
+        // RAPL package and DRAM energy of the stages of SOI. Nothing is printed
+        // without readable /sys/class/powercap counters
+      { "imbalance", optional_argument, 0, 'V' },
+        // print the load imbalance of the filter stage of each SOI run. With
+        // =feedback, later runs partition the work by the measured thread speeds
       { "input_min", required_argument, 0, 'i' },
       { "input_max", required_argument, 0, 'I' }, // sweep input kind over [input_min, input_max)
       { "no_mkl", no_argument, 0, 'o' },
@@ -65,7 +140,35 @@ static options parseArgs(int argc, char *argv[], soi_desc_t *desc)
       { "mkl_out_file", required_argument, 0, 'm' },
       { "soi_out_file", required_argument, 0, 's' },
       { "vlc", no_argument, 0, 'v' },
+      { "compensated_sum", no_argument, 0, 'q' }, // TwoSum accumulation in the filter stage
       { "comm_to_comp_ratio", required_argument, 0, 'r' },
+      { "target_snr", required_argument, 0, 'N' },
+      { "target_max_err", required_argument, 0, 'E' },
+        // plan n_mu, d_mu, B, and the window shape for an SNR (dB) or a normalized max error
+      { "window_family", required_argument, 0, 'J' },
+        // gaussian (default), kaiser_bessel, or es[,beta] (times sinc). Default beta: the most accurate one with tau
+      { "fft_backend", required_argument, 0, 'b' },
+        // comma separated list of FFT backends used by SOI (mkl, fftw, builtin)
+      { "fft_codelet", required_argument, 0, 'e' },
+        // S-point FFTs with builtin codelets: 1 always, 0 never, -1 if faster (default)
+      { "isa", required_argument, 0, 'X' },
+        // SIMD kernels (sse42, avx2, avx512). Default: the best one supported by the CPU
+      { "layout", required_argument, 0, 'L' },
+        // comma separated list of complex data layouts (interleaved, split)
+      { "window", required_argument, 0, 'y' },
+        // time window coefficients: auto (default), table, or otf (generated on the fly)
+      { "window_precision", required_argument, 0, 'Z' },
+        // storage of the window table: auto (default), full, or float
+      { "store", required_argument, 0, 'T' },
+        // stores of all stages: auto (default, per stage from the output size), regular, or stream
+      { "conv_config", required_argument, 0, 'C' },
+        // theta_unroll,j_unroll,i_tile,j_block[,prefetch_rows,prefetch_window] of the
+        // filter stage convolution. Default: autotuned
+      { "input_layout", required_argument, 0, 'R' },
+        // layout of the input: row (default), or tiled[,tile_rows]. The tiling pre-pass
+        // is timed separately and included in time_soi
+      { "wisdom", required_argument, 0, 'W' },
+        // file where autotuned parameters are looked up and saved
 #ifdef SOI_USE_FFTW
       { "no_fftw", no_argument, 0, 'w' },
       { "fftw_out_file", required_argument, 0, 'f' },
@@ -82,6 +185,56 @@ static options parseArgs(int argc, char *argv[], soi_desc_t *desc)
     switch (c) {
     case 'k': ret.k_min = atoi(optarg); break;
     case 'K': ret.k_max = atoi(optarg); break;
+    case 'A': ret.auto_k = 1; break;
+    case 'M':
+      ret.perf_model = 1;
+      if (optarg && 2 != sscanf(optarg, "%lf,%lf", &ret.net_latency, &ret.net_bandwidth)) {
+        fprintf(stderr, "--perf_model takes latency,bandwidth\n");
+        exit(-1);
+      }
+      break;
+    case 'D':
+      ret.dispatch = 1;
+      if (optarg) {
+        if (strcmp(optarg, "measure")) {
+          fprintf(stderr, "--dispatch takes measure\n");
+          exit(-1);
+        }
+        ret.dispatch = 2;
+      }
+      break;
+    case 'Q': desc->quiet = 1; break;
+    case 'S':
+      if (!strcmp(optarg, "json")) ret.stats = 1;
+      else if (!strcmp(optarg, "csv")) ret.stats = 2;
+      else {
+        fprintf(stderr, "--stats takes json or csv\n");
+        exit(-1);
+      }
+      break;
+    case 'G': ret.trace_file_name = optarg; break;
+    case 'H': ret.counters = 1; break;
+    case 'Y': ret.energy = 1; break;
+    case 'j': ret.memory = 1; break;
+    case 'z': ret.metrics_name = optarg; break;
+    case 'P':
+      ret.estimate_only = 1;
+      if (optarg) ret.estimate_P = atoi(optarg);
+      break;
+    case 'V':
+      ret.imbalance = 1;
+      if (optarg && !strcmp(optarg, "feedback")) {
+        ret.imbalance_feedback = 1;
+      }
+      else if (optarg) {
+        fprintf(stderr, "unknown imbalance option %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'U':
+      ret.comm_profile = 1;
+      ret.comm_records_file_name = optarg;
+      break;
     case 'i': ret.input_min = atoi(optarg); break;
     case 'I': ret.input_max = atoi(optarg); break;
     case 'o': ret.no_mkl = 1; break;
@@ -98,11 +251,121 @@ static options parseArgs(int argc, char *argv[], soi_desc_t *desc)
     case 'm': ret.mkl_out_file_name = optarg; break;
     case 's': ret.soi_out_file_name = optarg; break;
     case 'v': desc->use_vlc = 1; break;
+    case 'q': desc->use_compensated_sum = 1; break;
     case 'r': desc->comm_to_comp_cost_ratio = atof(optarg); break;
+    case 'N': desc->target_snr = atof(optarg); break;
+    case 'E': desc->target_max_err = atof(optarg); break;
+    case 'b':
+    {
+      backend_specified = 1;
+      for (char *name = strtok(optarg, ","); name; name = strtok(NULL, ",")) {
+        int b = soi_fft_backend_from_name(name);
+        if (b < 0 || !soi_fft_backend_available(b)) {
+          fprintf(stderr, "FFT backend %s is not available\n", name);
+          exit(-1);
+        }
+        ret.fft_backends[b] = 1;
+      }
+      break;
+    }
+    case 'e': desc->use_fft_codelet = atoi(optarg); break;
+    case 'X':
+      desc->isa = soi_isa_from_name(optarg);
+      if (desc->isa < 0 || !soi_isa_supported(desc->isa)) {
+        fprintf(stderr, "ISA %s is not supported\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'L':
+      ret.layouts[0] = ret.layouts[1] = 0;
+      for (char *name = strtok(optarg, ","); name; name = strtok(NULL, ",")) {
+        if (0 == strcmp(name, "interleaved")) ret.layouts[0] = 1;
+        else if (0 == strcmp(name, "split")) ret.layouts[1] = 1;
+        else {
+          fprintf(stderr, "Unknown layout %s\n", name);
+          exit(-1);
+        }
+      }
+      break;
+    case 'J':
+    {
+      char *name = strtok(optarg, ","), *beta = strtok(NULL, ",");
+      if (0 == strcmp(name, "gaussian")) desc->window_family = SOI_WINDOW_GAUSSIAN_SINC;
+      else if (0 == strcmp(name, "kaiser_bessel")) desc->window_family = SOI_WINDOW_KAISER_BESSEL_SINC;
+      else if (0 == strcmp(name, "es")) desc->window_family = SOI_WINDOW_ES_SINC;
+      else {
+        fprintf(stderr, "Unknown window family %s\n", name);
+        exit(-1);
+      }
+      if (beta) desc->window_beta = atof(beta);
+      break;
+    }
+    case 'y':
+      if (0 == strcmp(optarg, "auto")) desc->window_mode = SOI_WINDOW_AUTO;
+      else if (0 == strcmp(optarg, "table")) desc->window_mode = SOI_WINDOW_TABLE;
+      else if (0 == strcmp(optarg, "otf")) desc->window_mode = SOI_WINDOW_OTF;
+      else {
+        fprintf(stderr, "Unknown window mode %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'Z':
+      if (0 == strcmp(optarg, "auto")) desc->window_precision = SOI_WINDOW_PRECISION_AUTO;
+      else if (0 == strcmp(optarg, "full")) desc->window_precision = SOI_WINDOW_PRECISION_FULL;
+      else if (0 == strcmp(optarg, "float")) desc->window_precision = SOI_WINDOW_PRECISION_FLOAT;
+      else {
+        fprintf(stderr, "Unknown window precision %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'T':
+    {
+      soi_store_t store;
+      if (0 == strcmp(optarg, "auto")) store = SOI_STORE_AUTO;
+      else if (0 == strcmp(optarg, "regular")) store = SOI_STORE_REGULAR;
+      else if (0 == strcmp(optarg, "stream")) store = SOI_STORE_STREAM;
+      else {
+        fprintf(stderr, "Unknown store policy %s\n", optarg);
+        exit(-1);
+      }
+      desc->store_policy.conv = desc->store_policy.transpose = store;
+      desc->store_policy.decompress = desc->store_policy.demodulate = store;
+      break;
+    }
+    case 'C':
+    {
+      int n = sscanf(
+        optarg, "%d,%d,%d,%d,%d,%d",
+        &desc->conv_config.theta_unroll, &desc->conv_config.j_unroll,
+        &desc->conv_config.i_tile, &desc->conv_config.j_block,
+        &desc->conv_config.prefetch_rows, &desc->conv_config.prefetch_window);
+      if (4 == n) {
+        // prefetch distance from the memory latency
+        desc->conv_config.prefetch_rows = -1;
+        desc->conv_config.prefetch_window = 1;
+      }
+      else if (6 != n) {
+        fprintf(stderr, "conv_config should be theta_unroll,j_unroll,i_tile,j_block[,prefetch_rows,prefetch_window]\n");
+        exit(-1);
+      }
+      break;
+    }
+    case 'R':
+      if (0 == strcmp(optarg, "row")) desc->input_layout = SOI_INPUT_ROW_MAJOR;
+      else if (0 == strncmp(optarg, "tiled", 5) &&
+               ('\0' == optarg[5] || 1 == sscanf(optarg + 5, ",%d", &desc->input_tile_rows))) {
+        desc->input_layout = SOI_INPUT_TILED;
+      }
+      else {
+        fprintf(stderr, "Unknown input layout %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'W': desc->wisdom_file = optarg; break;
 #ifdef SOI_USE_FFTW
     case 'w': ret.no_fftw = 1; break;
     case 'f': ret.fftw_out_file_name = optarg; break;
-    case 'F': desc->use_fftw = 1; break;
+    case 'F': ret.fft_backends[SOI_FFT_FFTW] = 1; break;
     case 't': desc->fftw_flags = FFTW_MEASURE; break;
 #endif
     case '?': break;
@@ -110,8 +373,12 @@ static options parseArgs(int argc, char *argv[], soi_desc_t *desc)
     }
   }
 
+  if (!backend_specified) {
+    ret.fft_backends[SOI_FFT_DEFAULT_BACKEND] = 1;
+  }
+
   if (optind >= argc) {
-    fprintf(stderr, "usage: %s [k_min=k_min] [k_max=k_max] [n_mu=n_mu] [d_mu=d_mu] [B=B] [mkl_out_file=mkl_out_file] [soi_out_file=soi_out_file] [fftw_out_file=fftw_out_file] [vlc] N\n", argv[0]);
+    fprintf(stderr, "usage: %s [k_min=k_min] [k_max=k_max] [auto_k] [perf_model[=latency,bandwidth]] [dispatch[=measure]] [quiet] [stats=json|csv] [trace=trace_file] [counters] [comm_profile[=records_file]] [imbalance[=feedback]] [energy] [memory] [estimate_only[=P]] [metrics=name] [n_mu=n_mu] [d_mu=d_mu] [B=B] [mkl_out_file=mkl_out_file] [soi_out_file=soi_out_file] [fftw_out_file=fftw_out_file] [fft_backend=mkl,fftw,builtin] [fft_codelet=-1|0|1] [isa=sse42|avx2|avx512] [layout=interleaved,split] [window=auto|table|otf] [window_precision=auto|full|float] [store=auto|regular|stream] [input_layout=row|tiled[,tile_rows]] [target_snr=dB] [target_max_err=err] [window_family=gaussian|kaiser_bessel|es[,beta]] [conv_config=theta_unroll,j_unroll,i_tile,j_block[,prefetch_rows,prefetch_window]] [wisdom=wisdom_file] [vlc] [compensated_sum] N\n", argv[0]);
     exit(-1);
   }
 
@@ -127,7 +394,10 @@ static options parseArgs(int argc, char *argv[], soi_desc_t *desc)
   MPI_Comm_size(MPI_COMM_WORLD, &desc->P);
 	MPI_Comm_rank(MPI_COMM_WORLD, &desc->rank);
 
-  if (desc->N%(desc->d_mu*ret.k_max*desc->P*16) != 0) {
+  if (ret.auto_k) {
+    ret.k_min = ret.k_max = 1; // one run with the k init_soi_descriptor chooses
+  }
+  else if (desc->N%(desc->d_mu*ret.k_max*desc->P*16) != 0) {
     if (0 == desc->rank) {
       fprintf(stderr, "(d_mu=%d)*(P=%d)*(k=%d)*64 must divide N\n", desc->d_mu, desc->P, ret.k_max);
     }
@@ -200,24 +470,71 @@ int main(int argc, char *argv[])
   set_default_soi_descriptor(&d);
 
 	cfft_complex_t *in_buf = NULL;
-	double time_mkl, time_soi, max_err, g_max_err;
-	DFTI_DESCRIPTOR_DM_HANDLE desc;
+	cfft_complex_t *tiled_buf = NULL; // SOI_INPUT_TILED input, swapped with in_buf
+  size_t in_buf_len = 0, tiled_buf_len = 0; // elements allocated
+	double time_soi;
+#ifdef SOI_USE_MKL
+	double time_mkl;
+#endif
 
   initMPI(argc, argv);
   options options = parseArgs(argc, argv, &d);
+  soi_desc_t params = d; // as parsed, for distributed_fft, without instrumentation
+  if (options.trace_file_name) {
+    d.trace = soi_trace_create(MPI_COMM_WORLD, 1 << 16);
+  }
+  if (options.counters) {
+    d.counters = soi_counters_create();
+  }
+  if (options.energy) {
+    d.energy = soi_energy_create(MPI_COMM_WORLD);
+  }
+  if (options.metrics_name) {
+    d.metrics = soi_metrics_create(MPI_COMM_WORLD, options.metrics_name);
+  }
+  if (options.imbalance) {
+    d.imbalance = soi_imbalance_create(MPI_COMM_WORLD);
+  }
+  if (options.comm_profile) {
+    d.comm_profile = soi_comm_profile_create(MPI_COMM_WORLD);
+  }
+
+  if (options.estimate_only) {
+    soi_desc_t plan = d;
+    if (options.estimate_P > 0) plan.P = options.estimate_P;
+    for (int k = options.k_min; k <= options.k_max; k *= 2) {
+      plan.k = k;
+      soi_memory_t predicted;
+      soi_predict_memory(&plan, &predicted);
+      if (0 == d.rank) printf("estimate\tP=%d,N=%ld,k=%d\n", plan.P, (long)plan.N, k);
+      soi_write_memory(&predicted, NULL, MPI_COMM_WORLD, stdout);
+    }
+    MPI_Finalize();
+    return 0;
+  }
 
   if (0 == d.rank) {
     printf(
-      "P = %d, N = %ld, n_mu = %d, d_mu = %d, B = %ld, sigma = %f\n",
-      d.P, d.N, d.n_mu, d.d_mu, d.B, d.sigma);
+      "P = %d, N = %ld, n_mu = %d, d_mu = %d, B = %ld, sigma = %f, isa = %s\n",
+      d.P, d.N, d.n_mu, d.d_mu, d.B, d.sigma,
+      soi_isa_name(SOI_ISA_AUTO == d.isa ? soi_detect_isa() : d.isa));
+    printf(
+      "tsc_freq\t%f,source=%s,invariant=%d\n", get_cpu_freq()/1e9,
+      tsc_freq_source_name(get_tsc_freq_source()), tsc_is_invariant());
+    if (!tsc_is_invariant()) {
+      fprintf(stderr, "The TSC isn't invariant. Cycle counts of the stages may not convert to seconds\n");
+    }
   }
 
   double flop = 5.*d.N*log2(d.N);
+  soi_machine_model_t machine;
+  int machine_calibrated = 0;
 
   const int REPEAT = 4;
   for (int iter = 0; iter < REPEAT; iter++) {
     /* for each input type */
     for (int input = options.input_min; input <= options.input_max; input++) {
+#ifdef SOI_USE_MKL
       if (!options.no_mkl) {
         if (1 == d.P) { // 1 mpi rank : use local FFT
           DFTI_DESCRIPTOR_HANDLE desc;
@@ -230,6 +547,7 @@ int main(int argc, char *argv[])
               fprintf(stderr, "Failed to allocate in_buf (in_buf_size requested = %ld)\n", in_buf_size);
               return -1;
             }
+            in_buf_len = in_buf_size/sizeof(cfft_complex_t);
           }
           populate_input(in_buf, d.N, 0, d.N, input);
 
@@ -243,6 +561,7 @@ int main(int argc, char *argv[])
           CHECK_DFTI( DftiFreeDescriptor(&desc) );
         }
         else {
+          DFTI_DESCRIPTOR_DM_HANDLE desc;
           MKL_LONG status, size;
           CHECK_DFTI( DftiCreateDescriptorDM(MPI_COMM_WORLD, &desc, DFTI_TYPE, DFTI_COMPLEX, 1, d.N) );
           CHECK_DFTI( DftiGetValueDM(desc, CDFT_LOCAL_SIZE, &size) );
@@ -254,6 +573,7 @@ int main(int argc, char *argv[])
               fprintf(stderr, "Failed to allocate in_buf (in_buf_size requested = %ld)\n", in_buf_size);
               return -1;
             }
+            in_buf_len = in_buf_size/sizeof(cfft_complex_t);
           }
           CHECK_DFTI( DftiCommitDescriptorDM(desc) );
           populate_input(in_buf, d.N/d.P, d.rank*d.N/d.P, d.N, input);
@@ -292,29 +612,33 @@ int main(int argc, char *argv[])
           }
         }
       }
+#endif // SOI_USE_MKL
 
 #ifdef SOI_USE_FFTW
       if (!options.no_fftw) {
         // FFTW
         
         double time_fftw;
-        ptrdiff_t local_ni = N, local_i_start = 0, local_no = N, local_o_start = 0;
+        ptrdiff_t local_ni = d.N, local_i_start = 0, local_no = d.N, local_o_start = 0;
         FFTW_PLAN fftw_plan;
 
         if (1 == d.P) {
           FFTW_PLAN_WITH_NTHREADS(omp_get_max_threads());
 
           if (in_buf == NULL) {
-            in_buf = (FFTW_COMPLEX *)FFTW_MALLOC(N*sizeof(FFTW_COMPLEX)*n_mu/d_mu);
+            // aligned enough for FFTW, and freed with free when SOI needs
+            // a larger one
+            in_buf_len = d.N*d.n_mu/d.d_mu;
+            posix_memalign((void **)&in_buf, 4096, sizeof(FFTW_COMPLEX)*in_buf_len);
             if (NULL == in_buf) {
               fprintf(stderr, "Failed to allocated local data\n");
               return -1;
             }
           }
           fftw_plan = FFTW_PLAN_DFT_1D(
-            N, in_buf, in_buf, FFTW_FORWARD, options.fftw_flags);
+            d.N, (FFTW_COMPLEX *)in_buf, (FFTW_COMPLEX *)in_buf, FFTW_FORWARD, options.fftw_flags);
 
-          populate_input(in_buf, N, 0, N, input);
+          populate_input(in_buf, d.N, 0, d.N, input);
 
           time_fftw = -MPI_Wtime();
           FFTW_EXECUTE(fftw_plan);
@@ -324,11 +648,12 @@ int main(int argc, char *argv[])
           FFTW_MPI_INIT();
           FFTW_PLAN_WITH_NTHREADS(omp_get_max_threads());
           ptrdiff_t total_local_size = FFTW_MPI_LOCAL_SIZE_1D(
-            N, MPI_COMM_WORLD, FFTW_FORWARD, FFTW_MEASURE,
+            d.N, MPI_COMM_WORLD, FFTW_FORWARD, FFTW_MEASURE,
             &local_ni, &local_i_start, &local_no, &local_o_start);
 
           if (in_buf == NULL) {
-            in_buf = (FFTW_COMPLEX *)FFTW_MALLOC(total_local_size*sizeof(FFTW_COMPLEX)*n_mu/d_mu);
+            in_buf_len = total_local_size*d.n_mu/d.d_mu;
+            posix_memalign((void **)&in_buf, 4096, sizeof(FFTW_COMPLEX)*in_buf_len);
             if (NULL == in_buf) {
               fprintf(stderr, "Failed to allocated local data\n");
               return -1;
@@ -336,12 +661,12 @@ int main(int argc, char *argv[])
           }
 
           fftw_plan = FFTW_MPI_PLAN_DFT_1D(
-            N, in_buf, in_buf, MPI_COMM_WORLD, FFTW_FORWARD, options.fftw_flags);
+            d.N, (FFTW_COMPLEX *)in_buf, (FFTW_COMPLEX *)in_buf, MPI_COMM_WORLD, FFTW_FORWARD, options.fftw_flags);
 
-          populate_input(in_buf, local_ni, local_i_start, N, input);
+          populate_input(in_buf, local_ni, local_i_start, d.N, input);
 
           time_fftw = -MPI_Wtime();
-          FFTW_MPI_EXECUTE_DFT(fftw_plan, in_buf, in_buf);
+          FFTW_MPI_EXECUTE_DFT(fftw_plan, (FFTW_COMPLEX *)in_buf, (FFTW_COMPLEX *)in_buf);
           //FFTW_EXECUTE(fftw_plan);
           time_fftw += MPI_Wtime();
         }
@@ -354,8 +679,8 @@ int main(int argc, char *argv[])
         mpiWriteFileSequentially(options.fftw_out_file_name, in_buf, local_no);
 
         if (!options.no_snr) {
-          double fftw_snr = compute_snr(in_buf, local_ni, local_i_start, N, input, NULL);
-          double fftw_max_err = compute_normalized_inf_norm(in_buf, local_ni, local_i_start, N, input);
+          double fftw_snr = compute_snr(in_buf, local_ni, local_i_start, d.N, input, NULL);
+          double fftw_max_err = compute_normalized_inf_norm(in_buf, local_ni, local_i_start, d.N, input);
           if (0 == d.rank) {
             printf("snr_fftw%d\t%f\n", input, fftw_snr);
             printf("max_err_fftw%d\t%e\n", input, fftw_max_err);
@@ -368,39 +693,207 @@ int main(int argc, char *argv[])
 #endif
 
       //////////////////////////////
-      for (int soi_with_fftw = 0; soi_with_fftw <= options.soi_with_fftw; ++soi_with_fftw) {
-        for (int k = options.k_min; k <= options.k_max && !options.no_soi; k *= 2) {
-          init_soi_descriptor(&d, MPI_COMM_WORLD, k);
+      // resolved by init_soi_descriptor
+      int use_fft_codelet = d.use_fft_codelet;
+      soi_conv_config_t conv_config = d.conv_config;
+      soi_window_mode_t window_mode = d.window_mode;
+      soi_window_precision_t window_precision = d.window_precision;
+      soi_store_policy_t store_policy = d.store_policy;
+      int input_tile_rows = d.input_tile_rows;
+      int n_mu = d.n_mu, d_mu = d.d_mu;
+      cfft_size_t B = d.B;
+      double tau = d.tau, sigma = d.sigma, window_beta = d.window_beta;
+      for (int run = 0; run < 2*SOI_FFT_NUM_BACKENDS; ++run) {
+        int backend = run/2, split = run%2;
+        if (!options.fft_backends[backend] || !options.layouts[split]) continue;
+        d.fft_backend = backend;
+        d.use_split_complex = split;
+        // results with the default backend and interleaved layout are
+        // printed without backend and layout names
+        char backend_name[64] = "";
+        if (SOI_FFT_DEFAULT_BACKEND != backend) {
+          strcat(backend_name, soi_fft_backend_name(backend));
+        }
+        if (split) {
+          strcat(backend_name, backend_name[0] ? "_split" : "split");
+        }
+        const char *sep = backend_name[0] ? "_" : "";
+
+        for (int k_sweep = options.k_min; k_sweep <= options.k_max && !options.no_soi; k_sweep *= 2) {
+          d.use_fft_codelet = use_fft_codelet;
+          d.conv_config = conv_config;
+          d.window_mode = window_mode;
+          d.window_precision = window_precision;
+          d.store_policy = store_policy;
+          d.input_tile_rows = input_tile_rows;
+          d.n_mu = n_mu; d.d_mu = d_mu; d.B = B; d.tau = tau; d.sigma = sigma;
+          d.window_beta = window_beta;
+          soi_desc_t plan = d; // before init_soi_descriptor resolves anything
+          init_soi_descriptor(&d, MPI_COMM_WORLD, options.auto_k ? 0 : k_sweep);
+          int k = d.k;
+          if (0 == d.rank) {
+            printf("fft_codelet_%s%s%d\t%d\n", backend_name, sep, k, d.use_fft_codelet);
+            printf(
+              "conv_config_%s%s%d\t%d,%d,%d,%d,%d,%d\n", backend_name, sep, k,
+              d.conv_config.theta_unroll, d.conv_config.j_unroll,
+              d.conv_config.i_tile, d.conv_config.j_block,
+              d.conv_config.prefetch_rows, d.conv_config.prefetch_window);
+            if (SOI_WINDOW_OTF == d.window_mode) {
+              printf(
+                "window_%s%s%d\totf,degree=%d,pieces=%d\n", backend_name, sep, k,
+                d.w_poly_degree, d.w_poly_pieces);
+            }
+            else {
+              printf(
+                "window_%s%s%d\ttable,%s\n", backend_name, sep, k,
+                SOI_WINDOW_PRECISION_FLOAT == d.window_precision ? "float" : "full");
+            }
+            if (SOI_WINDOW_GAUSSIAN_SINC != d.window_family) {
+              printf(
+                "window_params_%s%s%d\t%s,n_mu=%d,d_mu=%d,B=%ld,tau=%f,beta=%f\n",
+                backend_name, sep, k,
+                SOI_WINDOW_KAISER_BESSEL_SINC == d.window_family ? "kaiser_bessel" : "es",
+                d.n_mu, d.d_mu, (long)d.B, d.tau, d.window_beta);
+            }
+            else if (d.target_snr > 0 || d.target_max_err > 0) {
+              printf(
+                "window_params_%s%s%d\tn_mu=%d,d_mu=%d,B=%ld,tau=%f,sigma=%f\n",
+                backend_name, sep, k, d.n_mu, d.d_mu, (long)d.B, d.tau, d.sigma);
+            }
+            printf("predicted_snr_%s%s%d\t%f\n", backend_name, sep, k, d.predicted_snr);
+            // 1: non-temporal stores
+            printf(
+              "store_policy_%s%s%d\tconv=%d,transpose=%d,decompress=%d,demodulate=%d\n",
+              backend_name, sep, k,
+              d.store_policy.conv, d.store_policy.transpose,
+              d.store_policy.decompress, d.store_policy.demodulate);
+            if (SOI_INPUT_TILED == d.input_layout) {
+              printf("input_layout_%s%s%d\ttiled,%d\n", backend_name, sep, k, d.input_tile_rows);
+            }
+            if (options.auto_k) {
+              printf(
+                "predicted_time_%s%s%d\tghost=%f,conv=%f,fft_s=%f,all_to_all=%f,fft_m_hat=%f,demodulate=%f,total=%f\n",
+                backend_name, sep, k,
+                d.predicted_times.ghost, d.predicted_times.conv, d.predicted_times.fft_s,
+                d.predicted_times.all_to_all, d.predicted_times.fft_m_hat,
+                d.predicted_times.demodulate, d.predicted_times.total);
+            }
+          }
+          if (options.perf_model && !machine_calibrated) {
+            soi_calibrate_machine_model(&machine, &d);
+            if (options.net_bandwidth > 0) {
+              machine.net_latency = options.net_latency;
+              machine.net_bandwidth = options.net_bandwidth;
+            }
+            machine_calibrated = 1;
+            if (0 == d.rank) {
+              printf(
+                "machine_model\tconv_rate=%g,fft_batch_rate=%g,fft_rate=%g,mem_bandwidth=%g,net_latency=%g,net_bandwidth=%g\n",
+                machine.conv_rate, machine.fft_batch_rate, machine.fft_rate,
+                machine.mem_bandwidth, machine.net_latency, machine.net_bandwidth);
+              printf("model_time_cooley_tukey\t%f\n", soi_predict_cooley_tukey_time(&machine, d.N, d.P));
+            }
+          }
+          if (options.perf_model && 0 == d.rank) {
+            soi_time_breakdown_t b = soi_predict_time(&machine, d.N, d.P, d.k, d.n_mu, d.d_mu, d.B);
+            printf(
+              "model_time_%s%s%d\tghost=%f,conv=%f,fft_s=%f,all_to_all=%f,fft_m_hat=%f,demodulate=%f,total=%f\n",
+              backend_name, sep, k,
+              b.ghost, b.conv, b.fft_s, b.all_to_all, b.fft_m_hat, b.demodulate, b.total);
+          }
 
           cfft_size_t S = d.k*d.P; // total number of segments
           cfft_size_t M = d.N/S; // length of one segment, before oversampling
           cfft_size_t M_hat = d.n_mu*M/d.d_mu; // length of one segment, after oversampling
 
-          if (in_buf == NULL) {
+          // n_mu and d_mu, and so M_hat, can be chosen by init_soi_descriptor,
+          // so in_buf allocated earlier from the parsed ones can be too small
+          if (in_buf_len < M_hat*d.k) {
+            free(in_buf);
+            in_buf = NULL;
             size_t in_buf_size = sizeof(cfft_complex_t)*M_hat*d.k;
             posix_memalign((void **)&in_buf, 4096, in_buf_size);
             if (NULL == in_buf) {
               fprintf(stderr, "Failed to allocate in_buf (in_buf_size requested = %ld)\n", in_buf_size);
               return -1;
             }
+            in_buf_len = M_hat*d.k;
           }
 
           populate_input(in_buf, d.N/d.P, d.rank*d.N/d.P, d.N, input);
           MPI_Barrier(MPI_COMM_WORLD);
+          double time_tile_input = 0;
+          if (SOI_INPUT_TILED == d.input_layout) {
+            if (tiled_buf_len < M_hat*d.k) {
+              free(tiled_buf);
+              tiled_buf = NULL;
+              posix_memalign((void **)&tiled_buf, 4096, sizeof(cfft_complex_t)*M_hat*d.k);
+              if (NULL == tiled_buf) {
+                fprintf(stderr, "Failed to allocate tiled_buf\n");
+                return -1;
+              }
+              tiled_buf_len = M_hat*d.k;
+            }
+            time_tile_input = -MPI_Wtime();
+            soi_tile_input(&d, tiled_buf, in_buf);
+            MPI_Barrier(MPI_COMM_WORLD);
+            time_tile_input += MPI_Wtime();
+            // the output is written to the input buffer
+            cfft_complex_t *temp = in_buf;
+            in_buf = tiled_buf;
+            tiled_buf = temp;
+            size_t temp_len = in_buf_len;
+            in_buf_len = tiled_buf_len;
+            tiled_buf_len = temp_len;
+          }
+          if (d.counters) soi_counters_reset(d.counters);
+          if (d.imbalance) soi_imbalance_reset(d.imbalance);
+          if (d.energy) soi_energy_reset(d.energy);
           time_soi = -MPI_Wtime();
           compute_soi(&d, in_buf);
 
           MPI_Barrier(MPI_COMM_WORLD);
-          time_soi += MPI_Wtime();
+          time_soi += MPI_Wtime() + time_tile_input;
           if (0 == d.rank) {
-            if (soi_with_fftw) {
-              printf("time_soi_fftw_%d\t%f\n", k, time_soi);
-            }
-            else {
-              printf("time_soi_%d\t%f\n", k, time_soi);
+            if (SOI_INPUT_TILED == d.input_layout) {
+              printf("time_tile_input_%s%s%d\t%f\n", backend_name, sep, k, time_tile_input);
             }
+            printf("time_soi_%s%s%d\t%f\n", backend_name, sep, k, time_soi);
             double gflops = flop/time_soi/1e9;
-            printf("flops_soi_%d\t%f\n", k, gflops);
+            printf("flops_soi_%s%s%d\t%f\n", backend_name, sep, k, gflops);
+          }
+          if (d.counters) {
+            soi_write_counters(d.counters, MPI_COMM_WORLD, stdout);
+          }
+          if (d.energy) {
+            soi_write_energy(d.energy, &d, stdout);
+          }
+          if (options.memory) {
+            soi_memory_t predicted, actual;
+            plan.k = d.k;
+            soi_predict_memory(&plan, &predicted);
+            soi_descriptor_memory(&d, &actual);
+            soi_write_memory(&predicted, &actual, MPI_COMM_WORLD, stdout);
+          }
+          if (d.imbalance) {
+            soi_imbalance_write(d.imbalance, MPI_COMM_WORLD, stdout);
+            if (options.imbalance_feedback) soi_imbalance_feedback(d.imbalance, &d);
+          }
+          if (options.stats) {
+            soi_write_stats(&d, stdout, 1 == options.stats ? SOI_STATS_JSON : SOI_STATS_CSV);
+          }
+          if (options.perf_model) {
+            // refit the compute rates to the slowest rank
+            soi_time_breakdown_t t;
+            soi_measured_times(&d, &t);
+            MPI_Allreduce(MPI_IN_PLACE, &t, sizeof(t)/sizeof(double), MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+            soi_fit_machine_model(&machine, &d, &t);
+            if (0 == d.rank) {
+              printf(
+                "measured_time_%s%s%d\tghost=%f,conv=%f,fft_s=%f,all_to_all=%f,fft_m_hat=%f,demodulate=%f,total=%f\n",
+                backend_name, sep, k,
+                t.ghost, t.conv, t.fft_s, t.all_to_all, t.fft_m_hat, t.demodulate, t.total);
+            }
           }
 
           // even though these buffers will be deallocated in free_soi_descriptor,
@@ -408,6 +901,10 @@ int main(int argc, char *argv[])
           // required to compute SNR
           free(d.w); d.w = NULL;
           free(d.w_dup); d.w_dup = NULL;
+          free(d.w_split); d.w_split = NULL;
+          free(d.w_dup_float); d.w_dup_float = NULL;
+          free(d.w_poly); d.w_poly = NULL;
+          free(d.w_phase); d.w_phase = NULL;
           free(d.W_inv); d.W_inv = NULL;
           free(d.alpha_ghost); d.alpha_ghost = NULL;
           if (d.use_vlc && d.epsilon) {
@@ -427,15 +924,12 @@ int main(int argc, char *argv[])
               in_buf, M*nSegments, M*firstSegment, d.N, input, &d);
             double soi_max_err = compute_normalized_inf_norm(
               in_buf, M*nSegments, M*firstSegment, d.N, input);
+            if (d.metrics && 0 == d.rank) {
+              soi_metrics_record_snr(d.metrics, soi_snr); // reduced to rank 0
+            }
             if (0 == d.rank) {
-              if (soi_with_fftw) {
-                printf("snr_soi_fftw%d_%d\t%f\n", input, k, soi_snr);
-                printf("max_err_soi_fftw%d_%d\t%e\n", input, k, soi_max_err);
-              }
-              else {
-                printf("snr_soi%d_%d\t%f\n", input, k, soi_snr);
-                printf("max_err_soi%d_%d\t%e\n", input, k, soi_max_err);
-              }
+              printf("snr_soi%s%s%d_%d\t%f\n", sep, backend_name, input, k, soi_snr);
+              printf("max_err_soi%s%s%d_%d\t%e\n", sep, backend_name, input, k, soi_max_err);
             }
           }
 
@@ -461,11 +955,77 @@ int main(int argc, char *argv[])
 
           // Write output to file.
           mpiWriteFileSequentially(options.soi_out_file_name, in_buf, d.N/d.P);
-        } // for (int k = kmin; k <= kmax; k *= 2)
+        } // for (int k_sweep = kmin; k_sweep <= kmax; k_sweep *= 2)
+      }
+
+      if (options.dispatch) {
+        soi_dft_t p;
+        set_default_soi_dft(&p);
+        p.soi = params;
+        p.measure = 2 == options.dispatch;
+        double time_init = -MPI_Wtime();
+        soi_dft_init(&p, MPI_COMM_WORLD, options.auto_k ? 0 : options.k_min);
+        time_init += MPI_Wtime();
+        if (0 == d.rank) {
+          printf("dispatch_method\t%s\n", soi_dft_method_name(p.method));
+          printf("dispatch_init_time\t%f\n", time_init);
+          for (int m = 0; m < SOI_DFT_NUM_METHODS; ++m) {
+            if (!isinf(p.time[m])) {
+              printf(
+                "dispatch_%s\ttime=%f,snr=%f\n", soi_dft_method_name(m), p.time[m], p.snr[m]);
+            }
+          }
+        }
+
+        cfft_complex_t *buf = NULL;
+        posix_memalign((void **)&buf, 4096, sizeof(cfft_complex_t)*soi_dft_local_len(&p));
+        if (NULL == buf) {
+          fprintf(stderr, "Failed to allocate the buffer of distributed_fft\n");
+          return -1;
+        }
+        populate_input(buf, d.N/d.P, d.rank*d.N/d.P, d.N, input);
+        MPI_Barrier(MPI_COMM_WORLD);
+        double time_dispatch = -MPI_Wtime();
+        distributed_fft(&p, buf);
+        MPI_Barrier(MPI_COMM_WORLD);
+        time_dispatch += MPI_Wtime();
+        if (0 == d.rank) {
+          printf("time_dispatch\t%f\n", time_dispatch);
+        }
+        if (!options.no_snr) {
+          // d was freed after the SOI runs, if there were any
+          double dispatch_snr = compute_snr(
+            buf, d.N/d.P, d.rank*d.N/d.P, d.N, input, NULL);
+          if (0 == d.rank) {
+            printf("snr_dispatch%d\t%f\n", input, dispatch_snr);
+          }
+        }
+        free(buf);
+        soi_dft_free(&p);
       }
     } // for (int input = 0; input < 2; input++)
   }
 
+  soi_counters_free(d.counters);
+  soi_imbalance_free(d.imbalance);
+  soi_energy_free(d.energy);
+  soi_metrics_free(d.metrics);
+  if (d.comm_profile) {
+    soi_comm_profile_write_matrix(d.comm_profile, MPI_COMM_WORLD, stdout);
+    if (options.comm_records_file_name) {
+      soi_comm_profile_write_records(
+        d.comm_profile, MPI_COMM_WORLD, options.comm_records_file_name);
+    }
+    soi_comm_profile_free(d.comm_profile);
+  }
+  if (d.trace) {
+    soi_trace_write(d.trace, MPI_COMM_WORLD, options.trace_file_name);
+    soi_trace_free(d.trace);
+  }
+#ifdef SOI_USE_FFTW
+  FFTW_CLEANUP_THREADS();
+#endif
+
 	MPI_Finalize();	
 
   return 0;
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+
+#include "soi.h"
+
+/*
+ * Timeline of the stages of compute_soi for the Chrome trace viewer
+ * (chrome://tracing) and Perfetto.
+ *
+ * Each OpenMP thread appends its events to its own ring buffer, so
+ * recording is a clock read and a few stores without synchronization. When
+ * a buffer is full, the oldest events are overwritten. soi_trace_write
+ * gathers the buffers of all ranks to rank 0, which writes them as
+ * complete ("X") events with pid = rank and tid = thread. Times are
+ * relative to the barrier in soi_trace_create.
+ */
+
+typedef struct
+{
+  double begin, end; // seconds since soi_trace::origin
+  int type; // soi_trace_event_type_t
+  int thread;
+  long arg;
+} trace_event_t;
+
+typedef struct
+{
+  trace_event_t *events;
+  size_t count; // events recorded, including the overwritten ones
+  char pad[64 - sizeof(trace_event_t *) - sizeof(size_t)];
+    // keep the counts of threads in separate cache lines
+} trace_buffer_t;
+
+struct soi_trace
+{
+  double origin;
+  size_t capacity; // events per thread
+  trace_buffer_t buffers[MAX_THREADS];
+};
+
+static const char *event_names[SOI_TRACE_NUM_EVENT_TYPES] = {
+  "split",
+  "ghost_send",
+  "conv_tile",
+  "fft_s",
+  "transpose",
+  "ghost_wait",
+  "conv_last",
+  "compress",
+  "all_to_all_post",
+  "recv_wait",
+  "decompress",
+  "fft_m_hat",
+  "demodulate",
+  "send_wait",
+};
+
+soi_trace_t *soi_trace_create(MPI_Comm comm, size_t events_per_thread)
+{
+  soi_trace_t *t = (soi_trace_t *)malloc(sizeof(soi_trace_t));
+  if (NULL == t) {
+    fprintf(stderr, "Failed to allocate the trace\n");
+    exit(1);
+  }
+  memset(t, 0, sizeof(*t));
+  t->capacity = events_per_thread;
+  MPI_Barrier(comm);
+  t->origin = MPI_Wtime();
+  return t;
+}
+
+void soi_trace_record(soi_trace_t *t, soi_trace_event_type_t type, double begin, long arg)
+{
+  int thread = omp_get_thread_num();
+  trace_buffer_t *b = t->buffers + thread;
+  if (NULL == b->events) {
+    // on first use so that threads touch only their own buffers
+    b->events = (trace_event_t *)malloc(sizeof(trace_event_t)*t->capacity);
+    if (NULL == b->events) return;
+  }
+  trace_event_t *e = b->events + b->count%t->capacity;
+  e->begin = begin - t->origin;
+  e->end = MPI_Wtime() - t->origin;
+  e->type = type;
+  e->thread = thread;
+  e->arg = arg;
+  ++b->count;
+}
+
+void soi_trace_write(soi_trace_t *t, MPI_Comm comm, const char *file_name)
+{
+  int rank, P;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &P);
+
+  // this rank's events of all threads, oldest first per thread
+  size_t n = 0;
+  long dropped = 0;
+  for (int i = 0; i < MAX_THREADS; ++i) {
+    n += MIN(t->buffers[i].count, t->capacity);
+    if (t->buffers[i].count > t->capacity) dropped += t->buffers[i].count - t->capacity;
+  }
+  trace_event_t *events = (trace_event_t *)malloc(sizeof(trace_event_t)*MAX(n, 1));
+  n = 0;
+  for (int i = 0; i < MAX_THREADS; ++i) {
+    trace_buffer_t *b = t->buffers + i;
+    size_t first = b->count > t->capacity ? b->count - t->capacity : 0;
+    for (size_t j = first; j < b->count; ++j) {
+      events[n++] = b->events[j%t->capacity];
+    }
+  }
+
+  int bytes = sizeof(trace_event_t)*n;
+  int *counts = NULL, *displs = NULL;
+  long *dropped_all = NULL;
+  trace_event_t *all = NULL;
+  if (0 == rank) {
+    counts = (int *)malloc(sizeof(int)*P);
+    displs = (int *)malloc(sizeof(int)*P);
+    dropped_all = (long *)malloc(sizeof(long)*P);
+  }
+  MPI_Gather(&bytes, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+  MPI_Gather(&dropped, 1, MPI_LONG, dropped_all, 1, MPI_LONG, 0, comm);
+  if (0 == rank) {
+    size_t total = 0;
+    for (int p = 0; p < P; ++p) {
+      displs[p] = total;
+      total += counts[p];
+    }
+    all = (trace_event_t *)malloc(MAX(total, 1));
+    if (NULL == all) {
+      fprintf(stderr, "Failed to allocate the events of all ranks\n");
+      exit(1);
+    }
+  }
+  MPI_Gatherv(events, bytes, MPI_BYTE, all, counts, displs, MPI_BYTE, 0, comm);
+  free(events);
+  if (0 != rank) return;
+
+  FILE *fp = fopen(file_name, "w");
+  if (NULL == fp) {
+    fprintf(stderr, "Failed to open trace file %s\n", file_name);
+  }
+  else {
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (int p = 0; p < P; ++p) {
+      fprintf(
+        fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}},\n",
+        p, p);
+      if (dropped_all[p] > 0) {
+        fprintf(stderr, "rank %d: %ld oldest trace events were overwritten\n", p, dropped_all[p]);
+      }
+      trace_event_t *e = (trace_event_t *)((char *)all + displs[p]);
+      for (int i = 0; i < counts[p]/(int)sizeof(trace_event_t); ++i) {
+        fprintf(
+          fp, "{\"name\": \"%s\", \"cat\": \"soi\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+          "\"pid\": %d, \"tid\": %d, \"args\": {\"arg\": %ld}},\n",
+          event_names[e[i].type], e[i].begin*1e6, (e[i].end - e[i].begin)*1e6,
+          p, e[i].thread, e[i].arg);
+      }
+    }
+    // JSON doesn't allow a trailing comma
+    fprintf(fp, "{\"name\": \"end\", \"ph\": \"i\", \"s\": \"g\", \"ts\": %.3f, \"pid\": 0, \"tid\": 0}\n]}\n",
+      (MPI_Wtime() - t->origin)*1e6);
+    fclose(fp);
+  }
+  free(all);
+  free(counts);
+  free(displs);
+  free(dropped_all);
+}
+
+void soi_trace_free(soi_trace_t *t)
+{
+  if (NULL == t) return;
+  for (int i = 0; i < MAX_THREADS; ++i) {
+    free(t->buffers[i].events);
+  }
+  free(t);
+}
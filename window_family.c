@@ -0,0 +1,170 @@
+#include <math.h>
+#include <stdlib.h>
+#include <float.h>
+
+#include <omp.h>
+
+#include "soi.h"
+
+/*
+ * Window families (soi_window_family_t).
+ *
+ * The Gaussian-sinc window has a closed form W but is never zero in time,
+ * so it's truncated to B block rows, and its tails are a large part of the
+ * error. The Kaiser-Bessel and exponential of semicircle (ES) bells fit in
+ * the B block rows, with half width h = (B - d_mu)/2 (the largest one all
+ * theta cover), and beta trades the decay of W against its width like
+ * sigma does.
+ *
+ * Their W is the integral of y(h*x)*cos(2*pi*u*h*x) over x in [-1, 1],
+ * whose derivative is singular at x = +-1, so we use tanh-sinh quadrature,
+ * which is exponentially accurate for that. For the M points of W_inv, we
+ * interpolate log(W) from Chebyshev points of the segment instead: W is
+ * positive and smooth there, so at most a few hundred points reproduce it
+ * to working precision.
+ */
+
+#define TANH_SINH_T_MAX 3.5 // 1 - tanh(pi/2*sinh(t)) underflows beyond
+#define RESPONSE_MIN_DEGREE 32
+#define RESPONSE_MAX_DEGREE 1024
+#define RESPONSE_TOLERANCE (16*DBL_EPSILON) // of log(W)
+
+static double bessel_i0(double x)
+{
+  // power series, fine for the beta we use (well below 700)
+  double term = 1, sum = 1, q = x*x/4;
+  for (int k = 1; k < 1000 && term > DBL_EPSILON*sum; ++k) {
+    term *= q/((double)k*k);
+    sum += term;
+  }
+  return sum;
+}
+
+static double window_half_width(const soi_desc_t *d)
+{
+  return (d->B - d->d_mu)/2.0;
+}
+
+double soi_window_envelope(double t, const soi_desc_t *desc)
+{
+  double bell;
+  if (SOI_WINDOW_GAUSSIAN_SINC == desc->window_family) {
+    bell = exp(-PI*PI*t*t/desc->sigma);
+  }
+  else {
+    double x = t/window_half_width(desc);
+    if (fabs(x) > 1) return 0;
+    double z = sqrt(1 - x*x);
+    bell = SOI_WINDOW_KAISER_BESSEL_SINC == desc->window_family ?
+      bessel_i0(desc->window_beta*z)/bessel_i0(desc->window_beta) :
+      exp(desc->window_beta*(z - 1));
+  }
+  if (t == 0) {
+    return bell;
+  }
+  else {
+    return sinl(VERIFY_PI*desc->tau*t)/(PI*desc->tau*t)*bell;
+  }
+}
+
+double soi_window_response(double u, const soi_desc_t *d)
+{
+  if (SOI_WINDOW_GAUSSIAN_SINC == d->window_family) {
+    return 1/(2*d->tau)*(erfc(sqrt(d->sigma)*(u - d->tau/2)) - erfc(sqrt(d->sigma)*(u + d->tau/2)));
+  }
+
+  // tanh-sinh: x = tanh(pi/2*sinh(t)), with the step resolving both the
+  // oscillation of the cosine and the sinc, and the width of the bell
+  // around x = 0
+  double h = window_half_width(d);
+  double omega = 2*PI*fabs(u)*h;
+  double step = 1/(16 + omega + PI*d->tau*h + d->window_beta);
+  int n = (int)ceil(TANH_SINH_T_MAX/step);
+  long double sum = 0;
+  for (int k = n; k >= 1; --k) { // smallest terms first
+    double t = k*step;
+    double s = PI/2*sinh(t), c = cosh(s);
+    double x = tanh(s);
+    double weight = PI/2*cosh(t)/(c*c);
+    sum += 2*weight*soi_window_envelope(h*x, d)*cos(omega*x);
+  }
+  sum += PI/2*soi_window_envelope(0, d);
+  return h*step*sum;
+}
+
+/**
+ * @return the polynomial through f at the Chebyshev points of the second
+ *         kind x_j = cos(j*pi/n)/2, evaluated at x (barycentric formula)
+ */
+static double cheb_interpolate(double x, const double *nodes, const double *f, int n)
+{
+  double num = 0, den = 0;
+  for (int j = 0; j <= n; ++j) {
+    if (x == nodes[j]) return f[j];
+    double c = (j%2 ? -1.0 : 1.0)/(x - nodes[j]);
+    if (0 == j || n == j) c /= 2;
+    num += c*f[j];
+    den += c;
+  }
+  return num/den;
+}
+
+int soi_window_response_table(const soi_desc_t *d, double *W, cfft_size_t M)
+{
+  if (SOI_WINDOW_GAUSSIAN_SINC == d->window_family) {
+#pragma omp parallel for
+    for (cfft_size_t i = 0; i < M; ++i) {
+      W[i] = soi_window_response((double)i/M - 0.5, d);
+    }
+    return 1;
+  }
+
+  // log(W) at Chebyshev points of the second kind u_j = cos(j*pi/n)/2,
+  // doubling n, which keeps the points, until the new points are
+  // interpolated to working precision
+  double *nodes = (double *)malloc(sizeof(double)*(RESPONSE_MAX_DEGREE + 1));
+  double *log_w = (double *)malloc(sizeof(double)*(RESPONSE_MAX_DEGREE + 1));
+  double *new_log_w = (double *)malloc(sizeof(double)*RESPONSE_MAX_DEGREE);
+  int n = RESPONSE_MIN_DEGREE;
+  for (int j = 0; j <= n; ++j) {
+    nodes[j] = cos(j*PI/n)/2;
+    log_w[j] = log(soi_window_response(nodes[j], d));
+  }
+  int positive = 1;
+  while (1) {
+    for (int j = 0; j <= n; ++j) {
+      positive = positive && log_w[j] > -INFINITY; // NaN if W < 0
+    }
+    if (!positive || RESPONSE_MAX_DEGREE == n) break;
+
+    double err = 0;
+#pragma omp parallel for reduction(max:err)
+    for (int j = 0; j < n; ++j) {
+      double u = cos((2*j + 1)*PI/(2*n))/2;
+      new_log_w[j] = log(soi_window_response(u, d));
+      err = MAX(err, fabs(new_log_w[j] - cheb_interpolate(u, nodes, log_w, n)));
+    }
+    for (int j = n; j >= 0; --j) {
+      log_w[2*j] = log_w[j];
+    }
+    for (int j = 0; j < n; ++j) {
+      log_w[2*j + 1] = new_log_w[j];
+    }
+    n *= 2;
+    for (int j = 0; j <= n; ++j) {
+      nodes[j] = cos(j*PI/n)/2;
+    }
+    if (!(err > RESPONSE_TOLERANCE)) break;
+  }
+
+  if (positive) {
+#pragma omp parallel for
+    for (cfft_size_t i = 0; i < M; ++i) {
+      W[i] = exp(cheb_interpolate((double)i/M - 0.5, nodes, log_w, n));
+    }
+  }
+  free(nodes);
+  free(log_w);
+  free(new_log_w);
+  return positive;
+}
@@ -0,0 +1,200 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include <omp.h>
+
+#include "soi.h"
+
+/*
+ * Piecewise polynomial approximation of the time window for
+ * SOI_WINDOW_OTF.
+ *
+ * w(theta, kkk, s) = exp(i*pi*t)*y(t)/mu with
+ * t = theta*d_mu/n_mu + kappa/2 - kkk - s/S, which factors into
+ *   (-1)^kkk*y(t)/mu                       (real, smooth in s)
+ *   exp(i*pi*(theta*d_mu/n_mu + kappa/2 - s/S)) (w_phase, independent of kkk)
+ * The filter stage accumulates the real part over kkk with polynomials
+ * evaluated in registers and multiplies the phase once per output.
+ *
+ * S is cut into pieces of whole cache lines. For each piece and (kkk, theta),
+ * we interpolate at Chebyshev nodes, pick the degree from the decay of the
+ * Chebyshev coefficients, and store the monomial coefficients in a variable
+ * mapping the piece to [-1, 1]. More pieces are used when the degree would
+ * be too high. The result is checked against every s the filter stage will
+ * evaluate.
+ */
+
+#if PRECISION == 1
+#define VAL_EPSILON FLT_EPSILON
+#else
+#define VAL_EPSILON DBL_EPSILON
+#endif
+
+/**
+ * Interpolate f(x) = (-1)^kkk*y(t)/mu at SOI_OTF_MAX_DEGREE + 1 Chebyshev nodes of
+ * the piece [s_begin, s_begin + L - 1] and write the Chebyshev coefficients
+ * to cheb.
+ */
+static void fit_chebyshev(
+  const soi_desc_t *d, int theta, cfft_size_t kkk, cfft_size_t s_begin, cfft_size_t L,
+  long double *cheb)
+{
+  const int n = SOI_OTF_MAX_DEGREE + 1;
+  cfft_size_t S = d->k*d->P;
+  long double mu = (long double)d->n_mu/d->d_mu;
+  long double center = s_begin + (L - 1)/2.0L, half = (L - 1)/2.0L;
+  long double t0 = (long double)theta*d->d_mu/d->n_mu + (d->B - d->d_mu)/2.0L - kkk;
+  long double sign = kkk%2 ? -1 : 1;
+
+  long double f[SOI_OTF_MAX_DEGREE + 1];
+  for (int m = 0; m < n; ++m) {
+    long double x = cosl(VERIFY_PI*(m + 0.5L)/n);
+    f[m] = sign*soi_window_envelope(t0 - (center + x*half)/S, d)/mu;
+  }
+  for (int j = 0; j < n; ++j) {
+    long double sum = 0;
+    for (int m = 0; m < n; ++m) {
+      sum += f[m]*cosl(VERIFY_PI*j*(m + 0.5L)/n);
+    }
+    cheb[j] = (j ? 2.0L : 1.0L)*sum/n;
+  }
+}
+
+/**
+ * @return the lowest degree whose truncation error bound is below tol
+ */
+static int chebyshev_degree(const long double *cheb, long double tol)
+{
+  long double tail = 0;
+  for (int j = SOI_OTF_MAX_DEGREE; j > 0; --j) {
+    tail += fabsl(cheb[j]);
+    if (tail > tol) return j;
+  }
+  return 0;
+}
+
+/**
+ * Convert the Chebyshev series cheb truncated at degree to monomial
+ * coefficients
+ */
+static void chebyshev_to_monomial(const long double *cheb, int degree, VAL_TYPE *poly)
+{
+  long double a[SOI_OTF_MAX_DEGREE + 1] = { 0 };
+  long double t_prev[SOI_OTF_MAX_DEGREE + 1] = { 0 }, t_cur[SOI_OTF_MAX_DEGREE + 1] = { 0 };
+  t_prev[0] = 1; // T_0
+  t_cur[1] = 1; // T_1
+  a[0] = cheb[0];
+  for (int j = 1; j <= degree; ++j) {
+    for (int n = 0; n <= j; ++n) a[n] += cheb[j]*t_cur[n];
+    // T_{j+1} = 2*x*T_j - T_{j-1}
+    long double t_next[SOI_OTF_MAX_DEGREE + 2] = { 0 };
+    t_next[0] = -t_prev[0];
+    for (int n = 1; n <= j + 1; ++n) {
+      t_next[n] = 2*t_cur[n - 1] - (n <= SOI_OTF_MAX_DEGREE ? t_prev[n] : 0);
+    }
+    memcpy(t_prev, t_cur, sizeof(t_prev));
+    memcpy(t_cur, t_next, sizeof(t_cur));
+  }
+  for (int n = 0; n <= degree; ++n) poly[n] = a[n];
+}
+
+/**
+ * Fit with the given number of pieces.
+ * @return 1 if every window coefficient is reproduced within tol
+ */
+static int fit_pieces(soi_desc_t *d, int pieces, long double tol)
+{
+  cfft_size_t S = d->k*d->P;
+  cfft_size_t L = S/pieces;
+  cfft_size_t num_fits = pieces*d->B*d->n_mu;
+
+  size_t cheb_bytes = sizeof(long double)*(SOI_OTF_MAX_DEGREE + 1)*num_fits;
+  long double *cheb = (long double *)malloc(cheb_bytes);
+  if (NULL == cheb) return 0;
+  d->transient_bytes = MAX(d->transient_bytes, cheb_bytes);
+
+  int degree = 0;
+#pragma omp parallel for reduction(max:degree)
+  for (cfft_size_t f = 0; f < num_fits; ++f) {
+    cfft_size_t piece = f/(d->B*d->n_mu), j = f%(d->B*d->n_mu);
+    long double *c = cheb + f*(SOI_OTF_MAX_DEGREE + 1);
+    fit_chebyshev(d, j%d->n_mu, j/d->n_mu, piece*L, L, c);
+    degree = MAX(degree, chebyshev_degree(c, tol/2));
+  }
+  if (degree >= SOI_OTF_MAX_DEGREE) {
+    free(cheb);
+    return 0;
+  }
+
+  free(d->w_poly);
+  d->w_poly_degree = degree;
+  d->w_poly_pieces = pieces;
+  d->buffer_bytes[SOI_BUFFER_W_OTF] = sizeof(VAL_TYPE)*(degree + 1)*num_fits;
+  posix_memalign((void **)&d->w_poly, 4096, d->buffer_bytes[SOI_BUFFER_W_OTF]);
+
+  int ok = 1;
+  long double mu = (long double)d->n_mu/d->d_mu;
+#pragma omp parallel for reduction(&&:ok)
+  for (cfft_size_t f = 0; f < num_fits; ++f) {
+    cfft_size_t piece = f/(d->B*d->n_mu), j = f%(d->B*d->n_mu);
+    int theta = j%d->n_mu;
+    cfft_size_t kkk = j/d->n_mu;
+    VAL_TYPE *poly = d->w_poly + f*(degree + 1);
+    chebyshev_to_monomial(cheb + f*(SOI_OTF_MAX_DEGREE + 1), degree, poly);
+
+    // evaluate as otf_window in parallel_filter_subsampling.cpp does
+    VAL_TYPE center = piece*L + (L - 1)/(VAL_TYPE)2, inv_half = 2/(VAL_TYPE)(L - 1);
+    long double t0 = (long double)theta*d->d_mu/d->n_mu + (d->B - d->d_mu)/2.0L - kkk;
+    long double sign = kkk%2 ? -1 : 1;
+    for (cfft_size_t s = piece*L; s < (piece + 1)*L; ++s) {
+      VAL_TYPE x = (s - center)*inv_half;
+      VAL_TYPE r = poly[degree];
+      for (int n = degree - 1; n >= 0; --n) r = r*x + poly[n];
+      long double ref = sign*soi_window_envelope(t0 - (long double)s/S, d)/mu;
+      ok = ok && fabsl(r - ref) <= tol;
+    }
+  }
+  free(cheb);
+  return ok;
+}
+
+cfft_size_t soi_window_otf_pieces(cfft_size_t S)
+{
+  // pieces must divide the cache lines of S
+  cfft_size_t lines = S/(CACHE_LINE_LEN/2);
+  cfft_size_t pieces = 1;
+  while (pieces < SOI_OTF_MIN_PIECES && lines%(2*pieces) == 0) pieces *= 2;
+  return pieces;
+}
+
+int soi_init_window_otf(soi_desc_t *d)
+{
+  cfft_size_t S = d->k*d->P;
+  cfft_size_t lines = S/(CACHE_LINE_LEN/2);
+
+  // a few times the rounding error of the tabulated window
+  long double tol = 4*VAL_EPSILON*d->d_mu/d->n_mu;
+
+  cfft_size_t pieces = soi_window_otf_pieces(S);
+
+  int ok = 0;
+  for ( ; lines%pieces == 0 && !ok; pieces *= 2) {
+    ok = fit_pieces(d, pieces, tol);
+  }
+  if (!ok) return 0;
+
+  size_t phase_bytes = sizeof(cfft_complex_t)*d->n_mu*S;
+  posix_memalign((void **)&d->w_phase, 4096, phase_bytes);
+  d->buffer_bytes[SOI_BUFFER_W_OTF] += phase_bytes;
+  for (int theta = 0; theta < d->n_mu; ++theta) {
+#pragma omp parallel for
+    for (cfft_size_t s = 0; s < S; ++s) {
+      long double t = fmodl(
+        (long double)theta*d->d_mu/d->n_mu + (d->B - d->d_mu)/2.0L - (long double)s/S, 2);
+      d->w_phase[theta*S + s] = cosl(VERIFY_PI*t) + I*sinl(VERIFY_PI*t);
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,389 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "soi.h"
+#include "isa.h"
+
+/*
+ * Plan-time choice of the window parameters (n_mu/d_mu, B, and the shape:
+ * tau and sigma, or beta) for a required accuracy (see soi_plan_window).
+ *
+ * Error model. With the Gaussian-sinc frequency window
+ *   W(u) = (erfc(sqrt(sigma)*(u - tau/2)) - erfc(sqrt(sigma)*(u + tau/2)))/(2*tau)
+ * over the segment u in [-1/2, 1/2), an output at u gets, relative to
+ * W(u) times the exact result:
+ *   - aliases W(u + l*mu), l != 0, from subsampling by mu
+ *   - the spectrum of the window tails beyond the B block rows. For each
+ *     theta, the tail beyond T block rows is approximately
+ *     sin(pi*tau*t)*h(T)*exp(-lambda*(t - T)) with h(T) = y(T)/sin(pi*tau*T)
+ *     and lambda the log derivative of the Gaussian at T, whose spectrum is
+ *     a pair of Lorentzians at +-tau/2, aliased by mu as well
+ *   - rounding errors, about VAL_EPSILON^2*ROUNDOFF_FACTOR*(B + log2(N))
+ *     in power. ROUNDOFF_FACTOR is fitted to the SNR measured with the
+ *     default parameters.
+ * all divided by W(u)^2 and averaged over u.
+ * The model is only a guide for the search: it can be off by 10-30 dB
+ * from soi_window_check_snr, which sums the response of the actual
+ * truncated window over aliases at random frequencies and is within about
+ * 5 dB of the SNR measured with random inputs (input kind 2 of test.exe).
+ * The windows of the other families fit in the B block rows, so their
+ * model only has the aliases of the window sampled at CHECK_S per block
+ * row and the rounding errors.
+ * The search bisects B on the model, optimizing the shape for each B, and
+ * shifts the model by the difference each time the check fails.
+ */
+
+#define MODEL_SAMPLES 32 // u sampled by soi_window_model_snr
+#define MODEL_TAIL_ALIASES 8
+#define CHECK_SAMPLES 512 // strata of u sampled at random by soi_window_check_snr
+#define CHECK_S 8 // samples per block row of the window in the check
+#define ROUNDOFF_FACTOR 8
+#define MIN_PLANNED_B 8
+#define MAX_PLANNED_B 96
+  // bounds the search of plan_b, which moves on to the next B after each
+  // failed check. Larger B only costs convolution work: B = 72 with
+  // n_mu/d_mu = 5/4 already reaches the rounding error of double precision
+
+#if PRECISION == 1
+#define VAL_EPSILON FLT_EPSILON
+#else
+#define VAL_EPSILON DBL_EPSILON
+#endif
+
+// oversampling factors tried, kept if the filter stage has kernels for them
+static const int mu_candidates[][2] = {
+  { 5, 4 }, { 8, 7 }, { 9, 8 }, { 4, 3 }, { 3, 2 },
+};
+
+/**
+ * @return the power of the rounding errors relative to the input, which is
+ *         divided by W(u)^2 at u
+ */
+static double roundoff_noise(const soi_desc_t *d)
+{
+  double noise = VAL_EPSILON*VAL_EPSILON*ROUNDOFF_FACTOR*(d->B + log2((double)d->N));
+  if (SOI_WINDOW_GAUSSIAN_SINC != d->window_family) {
+    // W(0) of the Gaussian-sinc window is about 1, the others are scaled
+    // by their width
+    double w0 = soi_window_response(0, d);
+    noise *= w0*w0;
+  }
+  return noise;
+}
+
+/**
+ * Model of the windows that fit in the B block rows: no truncation, the
+ * aliases of the sampled window and rounding errors
+ */
+static double compact_model_snr(const soi_desc_t *d)
+{
+  double mu = (double)d->n_mu/d->d_mu;
+  double h = (d->B - d->d_mu)/2.0;
+  int taps = (int)floor(h*CHECK_S);
+  double y[taps + 1];
+  for (int m = 0; m <= taps; ++m) {
+    y[m] = soi_window_envelope((double)m/CHECK_S, d);
+  }
+
+  // trapezoidal rule including the ends of the segment, where W is the
+  // smallest and 1/W^2 can grow fast with a sharp W
+  double noise = 0, w_sum = 0;
+  for (int q = 0; q <= MODEL_SAMPLES; ++q) {
+    double u = -0.5 + (double)q/MODEL_SAMPLES;
+    double weight = 0 == q || MODEL_SAMPLES == q ? 0.5 : 1;
+    double err = 0;
+    for (int l = -3; l <= 3; ++l) {
+      if (0 == l) continue;
+      double v = u + l*mu;
+      // the window is even, cos(2*pi*v*m/CHECK_S) by recurrence
+      double c = 1, s = 0, dc = cos(2*PI*v/CHECK_S), ds = sin(2*PI*v/CHECK_S);
+      double sum = y[0]/2;
+      for (int m = 1; m <= taps; ++m) {
+        double c_next = c*dc - s*ds;
+        s = s*dc + c*ds;
+        c = c_next;
+        sum += y[m]*c;
+      }
+      double a = 2*sum/CHECK_S;
+      err += a*a;
+    }
+    double w = soi_window_response(u, d);
+    noise += weight*err/(w*w);
+    w_sum += weight/(w*w);
+  }
+  noise = (noise + roundoff_noise(d)*w_sum)/MODEL_SAMPLES;
+  return -10*log10(noise);
+}
+
+double soi_window_model_snr(const soi_desc_t *d)
+{
+  if (SOI_WINDOW_GAUSSIAN_SINC != d->window_family) return compact_model_snr(d);
+
+  double mu = (double)d->n_mu/d->d_mu;
+  double tau = d->tau, sigma = d->sigma;
+
+  // tails of each theta: beyond T_lo above and T_hi below
+  double h2[2*d->n_mu], lambda[2*d->n_mu];
+  int n_tails = 0;
+  for (int theta = 0; theta < d->n_mu; ++theta) {
+    double shift = (double)theta*d->d_mu/d->n_mu;
+    double T[2] = { (d->B - d->d_mu)/2.0 + shift, (d->B + d->d_mu)/2.0 - shift };
+    for (int s = 0; s < 2; ++s) {
+      double h = exp(-PI*PI*T[s]*T[s]/sigma)/(PI*tau*T[s]);
+      h2[n_tails] = h*h;
+      lambda[n_tails] = 2*PI*PI*T[s]/sigma + 1/T[s];
+      ++n_tails;
+    }
+  }
+
+  double noise = 0;
+  for (int q = 0; q < MODEL_SAMPLES; ++q) {
+    double u = -0.5 + (q + 0.5)/MODEL_SAMPLES;
+    double err = 0;
+    for (int l = 1; l <= 3; ++l) {
+      double a = soi_window_response(u + l*mu, d), b = soi_window_response(u - l*mu, d);
+      err += a*a + b*b;
+    }
+    double tail = 0;
+    for (int i = 0; i < n_tails; ++i) {
+      for (int l = -MODEL_TAIL_ALIASES; l <= MODEL_TAIL_ALIASES; ++l) {
+        for (int sign = -1; sign <= 1; sign += 2) {
+          double v = u + l*mu - sign*tau/2;
+          tail += h2[i]/4/(lambda[i]*lambda[i] + 4*PI*PI*v*v);
+        }
+      }
+    }
+    err += tail/d->n_mu;
+    double w = soi_window_response(u, d);
+    noise += err/(w*w);
+  }
+  noise /= MODEL_SAMPLES;
+
+  double w_sum = 0;
+  for (int q = 0; q < MODEL_SAMPLES; ++q) {
+    double w = soi_window_response(-0.5 + (q + 0.5)/MODEL_SAMPLES, d);
+    w_sum += 1/(w*w);
+  }
+  noise += roundoff_noise(d)*w_sum/MODEL_SAMPLES;
+  return -10*log10(noise);
+}
+
+double soi_window_check_snr(const soi_desc_t *d, unsigned seed)
+{
+  double mu = (double)d->n_mu/d->d_mu;
+  double kappa = d->B - d->d_mu;
+  int L = (int)floor(CHECK_S/2/mu);
+  cfft_size_t taps = d->B*CHECK_S;
+
+  double *y = (double *)malloc(sizeof(double)*d->n_mu*taps);
+  double *t = (double *)malloc(sizeof(double)*d->n_mu*taps);
+  for (int theta = 0; theta < d->n_mu; ++theta) {
+    for (cfft_size_t j = 0; j < taps; ++j) {
+      // as w_f
+      t[theta*taps + j] = (double)theta*d->d_mu/d->n_mu + kappa/2 - (double)j/CHECK_S;
+      y[theta*taps + j] = soi_window_envelope(t[theta*taps + j], d);
+    }
+  }
+
+  // one in each of CHECK_SAMPLES strata of the segment
+  double u[CHECK_SAMPLES];
+  for (int q = 0; q < CHECK_SAMPLES; ++q) {
+    seed = seed*1103515245 + 12345;
+    u[q] = -0.5 + (q + (seed >> 8)/(double)(1 << 24))/CHECK_SAMPLES;
+  }
+
+  double noise = 0, w_sum = 0;
+#pragma omp parallel for reduction(+:noise,w_sum)
+  for (int q = 0; q < CHECK_SAMPLES; ++q) {
+    double w = soi_window_response(u[q], d);
+    long double err = 0;
+    for (int theta = 0; theta < d->n_mu; ++theta) {
+      for (int l = -L; l <= L; ++l) {
+        long double v = u[q] + l*mu;
+        // exp(-2*pi*i*v*t) with t decreasing by 1/CHECK_S per tap
+        long double phase = -2*VERIFY_PI*v*t[theta*taps];
+        long double c = cosl(phase), s = sinl(phase);
+        long double dc = cosl(2*VERIFY_PI*v/CHECK_S), ds = sinl(2*VERIFY_PI*v/CHECK_S);
+        long double re = 0, im = 0;
+        for (cfft_size_t j = 0; j < taps; ++j) {
+          re += y[theta*taps + j]*c;
+          im += y[theta*taps + j]*s;
+          long double c_next = c*dc - s*ds;
+          s = s*dc + c*ds;
+          c = c_next;
+        }
+        re /= CHECK_S;
+        im /= CHECK_S;
+        if (0 == l) re -= w;
+        err += re*re + im*im;
+      }
+    }
+    noise += err/d->n_mu/(w*w);
+    w_sum += 1/(w*w);
+  }
+  free(y);
+  free(t);
+
+  noise = (noise + roundoff_noise(d)*w_sum)/CHECK_SAMPLES;
+  return -10*log10(noise);
+}
+
+double soi_optimize_window_shape(soi_desc_t *d)
+{
+  // tau and sigma, or tau and beta: a coarse grid search followed by
+  // pattern search
+  const int GRID = 12;
+  double *width = &d->sigma, LOG_WIDTH_MIN = log(10.0), LOG_WIDTH_MAX = log(2000.0);
+  if (SOI_WINDOW_GAUSSIAN_SINC != d->window_family) {
+    width = &d->window_beta;
+    LOG_WIDTH_MIN = 0;
+    LOG_WIDTH_MAX = log(4*PI*MAX(d->B - d->d_mu, 2));
+  }
+  if (*width <= 0) *width = exp((LOG_WIDTH_MIN + LOG_WIDTH_MAX)/2);
+  double best = -INFINITY, best_tau = d->tau, best_log_width = log(*width);
+  for (int i = 1; i < GRID; ++i) {
+    for (int j = 0; j < GRID; ++j) {
+      d->tau = (double)i/GRID;
+      *width = exp(LOG_WIDTH_MIN + j*(LOG_WIDTH_MAX - LOG_WIDTH_MIN)/(GRID - 1));
+      double snr = soi_window_model_snr(d);
+      if (snr > best) {
+        best = snr;
+        best_tau = d->tau;
+        best_log_width = log(*width);
+      }
+    }
+  }
+  double step_tau = 0.5/GRID, step_log_width = 0.5*(LOG_WIDTH_MAX - LOG_WIDTH_MIN)/(GRID - 1);
+  while (step_tau > 5e-4) {
+    int improved = 0;
+    for (int dir = 0; dir < 4; ++dir) {
+      double tau = best_tau + (0 == dir ? step_tau : 1 == dir ? -step_tau : 0);
+      double log_width = best_log_width + (2 == dir ? step_log_width : 3 == dir ? -step_log_width : 0);
+      if (tau <= 0 || tau >= 1) continue;
+      d->tau = tau;
+      *width = exp(log_width);
+      double snr = soi_window_model_snr(d);
+      if (snr > best) {
+        best = snr;
+        best_tau = tau;
+        best_log_width = log_width;
+        improved = 1;
+      }
+    }
+    if (!improved) {
+      step_tau /= 2;
+      step_log_width /= 2;
+    }
+  }
+  d->tau = best_tau;
+  *width = exp(best_log_width);
+  return best;
+}
+
+/**
+ * @return the relative time of a transform with d's window parameters:
+ *         flops of the filter stage (a complex multiply-add per tap) and
+ *         the FFTs, plus the all-to-all, which takes comm_to_comp_cost_ratio
+ *         times the computation of the parameters the planner started from
+ */
+static double relative_cost(const soi_desc_t *d, double comm_cost_per_mu)
+{
+  double mu = (double)d->n_mu/d->d_mu;
+  double S = d->k*d->P, M_hat = mu*d->N/S;
+  return mu*(8*d->B + 5*(log2(S) + log2(M_hat))) + comm_cost_per_mu*mu;
+}
+
+double soi_required_snr(const soi_desc_t *d)
+{
+  double snr = d->target_snr;
+  if (d->target_max_err > 0) {
+    snr = MAX(snr, -20*log10(d->target_max_err/sqrt(2*log((double)d->N))));
+  }
+  return snr;
+}
+
+/**
+ * Set d->B and the shape parameters to the smallest B in [lo, hi] whose
+ * soi_window_check_snr reaches target. The B is found by bisection on the
+ * model, shifted by the difference between the check and the model each
+ * time the check fails.
+ * @return the checked SNR, less than target if no B reaches it (then d has
+ *         the parameters of hi)
+ */
+static double plan_b(soi_desc_t *d, cfft_size_t lo, cfft_size_t hi, double target, unsigned seed)
+{
+  double offset = 0, snr = -INFINITY;
+  while (lo <= hi) {
+    cfft_size_t b_lo = lo, b_hi = hi;
+    while (b_lo < b_hi) {
+      d->B = (b_lo + b_hi)/2;
+      if (soi_optimize_window_shape(d) + offset >= target) b_hi = d->B;
+      else b_lo = d->B + 1;
+    }
+    d->B = b_lo;
+    double model = soi_optimize_window_shape(d);
+    snr = soi_window_check_snr(d, seed);
+    if (snr >= target || d->B == hi) break;
+    offset = MIN(offset, snr - model);
+    lo = d->B + 1;
+  }
+  return snr;
+}
+
+void soi_plan_window(soi_desc_t *d)
+{
+  double target = soi_required_snr(d);
+  if (target <= 0) return;
+
+  soi_desc_t t = *d;
+  cfft_size_t S = d->k*d->P;
+  cfft_size_t M = d->N/S;
+  soi_isa_t isa = SOI_ISA_AUTO == d->isa ? soi_detect_isa() : d->isa;
+  const soi_kernels_t *kernels = soi_get_kernels(isa);
+
+  double comm_cost_per_mu =
+    d->comm_to_comp_cost_ratio*relative_cost(d, 0)/((double)d->n_mu/d->d_mu);
+
+  // the cheapest parameters reaching target, or the most accurate ones
+  struct { int n_mu, d_mu; cfft_size_t B; double tau, sigma, beta, snr, cost; } best = { 0 };
+  best.snr = -INFINITY;
+  best.cost = INFINITY;
+
+  if (0 == d->rank) {
+    for (int c = 0; c < sizeof(mu_candidates)/sizeof(mu_candidates[0]); ++c) {
+      t.n_mu = mu_candidates[c][0];
+      t.d_mu = mu_candidates[c][1];
+      soi_conv_config_t configs[1];
+      if (M%(t.d_mu*d->P) || 0 == kernels->conv_variants(&t, configs, 1)) continue;
+
+      cfft_size_t lo = MAX(MIN_PLANNED_B, t.d_mu + 1), hi = MIN(MAX_PLANNED_B, M/d->P);
+      if (lo > hi) continue;
+      double snr = plan_b(&t, lo, hi, target, 1 + c);
+      double cost = snr >= target ? relative_cost(&t, comm_cost_per_mu) : INFINITY;
+      if (cost < best.cost || (isinf(best.cost) && snr > best.snr)) {
+        best.n_mu = t.n_mu; best.d_mu = t.d_mu; best.B = t.B;
+        best.tau = t.tau; best.sigma = t.sigma; best.beta = t.window_beta; best.snr = snr; best.cost = cost;
+      }
+    }
+    if (0 == best.n_mu) {
+      fprintf(stderr, "No oversampling factor is supported for this problem size. Keeping the window parameters\n");
+    }
+    else if (isinf(best.cost)) {
+      fprintf(
+        stderr, "No window parameters reach SNR %f dB. Using the most accurate ones found (%f dB)\n",
+        target, best.snr);
+    }
+  }
+  MPI_Bcast(&best, sizeof(best), MPI_BYTE, 0, d->comm);
+  if (0 == best.n_mu) return;
+
+  d->n_mu = best.n_mu;
+  d->d_mu = best.d_mu;
+  d->B = best.B;
+  d->tau = best.tau;
+  d->sigma = best.sigma;
+  d->window_beta = best.beta;
+  d->predicted_snr = best.snr;
+}